@@ -0,0 +1,570 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL_mixer.h>
+#include "library.h"
+#include "audio_engine.h"
+#include "track_decoder.h"
+#include "trace.h"
+
+// Runs inside SDL_mixer's audio callback: apply any pending flush, copy what
+// the ring holds, and pad with silence. No locks and no allocation.
+static void engine_callback(void *data, Uint8 *stream, int len) {
+    AudioEngine *engine = data;
+    Uint64 trace_start_time = trace_begin();
+
+    int sequence = SDL_AtomicGet(&engine->flush_sequence);
+    if (sequence != engine->seen_flush_sequence) {
+        engine->seen_flush_sequence = sequence;
+        ring_buffer_skip_to(&engine->ring, (Uint32)SDL_AtomicGet(&engine->flush_index));
+    }
+
+    Uint32 frames = (Uint32)len / engine->frame_bytes;
+    Uint32 copied = ring_buffer_read(&engine->ring, (Sint16 *)stream, frames);
+    if (copied < frames) {
+        memset(stream + copied * engine->frame_bytes, 0, (frames - copied) * engine->frame_bytes);
+        if (SDL_AtomicGet(&engine->playing)) {
+            SDL_AtomicAdd(&engine->underruns, 1);
+            trace_instant("underrun");
+        }
+    }
+    trace_end("audio_callback", trace_start_time);
+}
+
+static void post_event(AudioEngine *engine, EngineEventCode code, int generation, int position) {
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = engine->event_type;
+    event.user.code = code;
+    event.user.data1 = (void *)(intptr_t)generation;
+    event.user.data2 = (void *)(intptr_t)position;
+    SDL_PushEvent(&event);
+}
+
+// Called with the lock held.
+static void clear_track(AudioEngine *engine, EngineTrack *track) {
+    music_cache_release(engine->cache, track->handle);
+    free(track->location);
+    memset(track, 0, sizeof(*track));
+}
+
+static void drop_current(AudioEngine *engine) {
+    clear_track(engine, &engine->tracks[0]);
+    memmove(&engine->tracks[0], &engine->tracks[1], (engine->track_count - 1) * sizeof(EngineTrack));
+    engine->track_count--;
+    memset(&engine->tracks[engine->track_count], 0, sizeof(EngineTrack));
+}
+
+static bool set_track(EngineTrack *track, const char *location, int position) {
+    track->location = malloc(strlen(location) + 1);
+    if (!track->location) {
+        printf("Memory allocation failed for engine track\n");
+        return false;
+    }
+    strcpy(track->location, location);
+    track->position = position;
+    track->gain = LOUDNESS_UNITY_GAIN;
+    return true;
+}
+
+// Decodes the first queued track that has no PCM yet, current track first.
+static int loader_thread(void *data) {
+    AudioEngine *engine = data;
+    trace_name_thread("audio_loader");
+
+    SDL_LockMutex(engine->lock);
+    while (!engine->quit) {
+        int index = -1;
+        for (int i = 0; i < engine->track_count; i++) {
+            if (!engine->tracks[i].handle && !engine->tracks[i].failed) {
+                index = i;
+                break;
+            }
+        }
+        if (index < 0) {
+            SDL_CondWait(engine->loader_wake, engine->lock);
+            continue;
+        }
+
+        char location[MAX_PATH_LENGTH];
+        snprintf(location, sizeof(location), "%s", engine->tracks[index].location);
+
+        // Looking up the loudness gain stats the file, so do it unlocked
+        int gain = LOUDNESS_UNITY_GAIN;
+        if (engine->loudness) {
+            Loudness *loudness = engine->loudness;
+            SDL_UnlockMutex(engine->lock);
+            gain = loudness_gain(loudness, location);
+            SDL_LockMutex(engine->lock);
+        }
+
+        MusicHandle *handle = music_cache_lookup(engine->cache, location);
+        bool failed = false;
+        if (!handle) {
+            SDL_UnlockMutex(engine->lock);
+            printf("Loading music: %s\n", location);
+            Uint64 trace_start_time = trace_begin();
+            Mix_Chunk *chunk = decode_track(location, engine->frequency, engine->channels, engine->resample_quality);
+            trace_end("decode_track", trace_start_time);
+            SDL_LockMutex(engine->lock);
+            if (chunk) {
+                handle = music_cache_insert(engine->cache, location, chunk);
+            } else {
+                printf("Error loading music: %s - %s\n", location, Mix_GetError());
+            }
+            failed = !handle;
+        }
+
+        // The queue may have changed while decoding; hand the result to every
+        // slot still waiting for this file
+        for (int i = 0; i < engine->track_count; i++) {
+            EngineTrack *track = &engine->tracks[i];
+            if (track->handle || track->failed || strcmp(track->location, location) != 0) {
+                continue;
+            }
+            track->gain = gain;
+            if (failed) {
+                track->failed = true;
+            } else if (handle) {
+                track->handle = handle;
+                handle = NULL;
+            } else {
+                track->handle = music_cache_lookup(engine->cache, location);
+            }
+        }
+        music_cache_release(engine->cache, handle);
+        SDL_CondSignal(engine->feeder_wake);
+    }
+    SDL_UnlockMutex(engine->lock);
+    return 0;
+}
+
+// A track the feeder reads from, with its own reference so it outlives the
+// queue entry.
+typedef struct stream {
+    MusicHandle *handle;
+    Uint32 offset;
+    int gain;
+} Stream;
+
+static Uint32 frames_left(const AudioEngine *engine, const Stream *stream) {
+    return (stream->handle->chunk->alen - stream->offset) / engine->frame_bytes;
+}
+
+static const Sint16 *stream_pcm(const Stream *stream) {
+    return (const Sint16 *)(stream->handle->chunk->abuf + stream->offset);
+}
+
+// Called with the lock held.
+static void release_stream(AudioEngine *engine, Stream *stream) {
+    music_cache_release(engine->cache, stream->handle);
+    memset(stream, 0, sizeof(*stream));
+}
+
+// A fade curve with the stream's loudness gain folded in.
+static MixGain with_gain(MixGain fade, int gain) {
+    float scale = (float)gain / LOUDNESS_UNITY_GAIN;
+    fade.start *= scale;
+    fade.step *= scale;
+    return fade;
+}
+
+// Streams tracks[0] into the ring. When it runs out the next track is
+// already decoded, so its first frame lands right after the last frame of
+// the previous one.
+//
+// With a crossfade, the last crossfade_frames of a track are mixed with the
+// start of the next, which is then `current` while the old one is
+// `outgoing`. A track started by audio_engine_play() fades in over the one
+// that was playing, right after the audio already buffered, or once it is
+// decoded if that takes longer.
+static int feeder_thread(void *data) {
+    AudioEngine *engine = data;
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_HIGH);
+    trace_name_thread("audio_feeder");
+
+    Stream current;
+    Stream outgoing;
+    memset(&current, 0, sizeof(current));
+    memset(&outgoing, 0, sizeof(outgoing));
+    Uint32 fade_position = 0;
+    Uint32 fade_length = 0;
+    int generation = engine->generation;
+    bool in_transition = false;
+    Uint64 ended_at = 0;
+    Uint32 buffered_at_end = 0;
+    Uint32 full_wait_ms = engine->ring.capacity * 1000 / engine->frequency / 4;
+    if (full_wait_ms < 1) {
+        full_wait_ms = 1;
+    }
+
+    SDL_LockMutex(engine->lock);
+    while (!engine->quit) {
+        if (generation != engine->generation) {
+            // Play or stop. With a crossfade the audio already buffered plays
+            // out and the stream it came from continues as `outgoing`;
+            // otherwise it belongs to the old queue and is dropped.
+            Stream *heard = current.handle ? &current : &outgoing;
+            Stream kept = {NULL, 0, 0};
+            if (engine->crossfade_frames > 0 && engine->track_count > 0 && heard->handle) {
+                kept = *heard;
+                heard->handle = NULL;
+            } else {
+                SDL_AtomicSet(&engine->flush_index, SDL_AtomicGet(&engine->ring.write_index));
+                SDL_AtomicAdd(&engine->flush_sequence, 1);
+            }
+            release_stream(engine, &current);
+            release_stream(engine, &outgoing);
+            outgoing = kept;
+            fade_length = 0;
+            in_transition = false;
+            generation = engine->generation;
+        }
+
+        if (engine->seek_pending) {
+            // Drop what is buffered and carry on from the new frame. The
+            // callback applies the flush on its next period, so the jump is
+            // heard one device buffer later however long the track is. A
+            // crossfade in progress is cut short.
+            engine->seek_pending = false;
+            if (current.handle) {
+                SDL_AtomicSet(&engine->flush_index, SDL_AtomicGet(&engine->ring.write_index));
+                SDL_AtomicAdd(&engine->flush_sequence, 1);
+                Uint32 seek_bytes = engine->seek_frame * (Uint32)engine->frame_bytes;
+                current.offset = seek_bytes < current.handle->chunk->alen ? seek_bytes : current.handle->chunk->alen;
+                release_stream(engine, &outgoing);
+                fade_length = 0;
+                SDL_AtomicSet(&engine->track_start_frame, (int)(current.offset / engine->frame_bytes));
+                SDL_AtomicSet(&engine->track_origin, SDL_AtomicGet(&engine->ring.write_index));
+                trace_instant("seek");
+            }
+        }
+
+        if (current.handle && current.offset >= current.handle->chunk->alen) {
+            release_stream(engine, &current);
+            drop_current(engine);
+            in_transition = true;
+            ended_at = SDL_GetPerformanceCounter();
+            buffered_at_end = ring_buffer_readable(&engine->ring);
+            if (engine->track_count == 0) {
+                SDL_AtomicSet(&engine->playing, 0);
+                post_event(engine, ENGINE_OUT_OF_TRACKS, generation, -1);
+            }
+        }
+
+        if (!current.handle && engine->track_count > 0 && engine->tracks[0].failed) {
+            drop_current(engine);
+            if (engine->track_count == 0) {
+                release_stream(engine, &outgoing);
+                SDL_AtomicSet(&engine->playing, 0);
+                post_event(engine, ENGINE_OUT_OF_TRACKS, generation, -1);
+            }
+            continue;
+        }
+
+        if (!current.handle && engine->track_count > 0 && engine->tracks[0].handle) {
+            current.handle = engine->tracks[0].handle;
+            current.handle->refs++;
+            Uint32 start_bytes = engine->tracks[0].start_frame * (Uint32)engine->frame_bytes;
+            current.offset = start_bytes < current.handle->chunk->alen ? start_bytes : current.handle->chunk->alen;
+            current.gain = engine->tracks[0].gain;
+            SDL_AtomicSet(&engine->track_start_frame, (int)(current.offset / engine->frame_bytes));
+            SDL_AtomicSet(&engine->track_frames, (int)(current.handle->chunk->alen / engine->frame_bytes));
+            SDL_AtomicSet(&engine->track_origin, SDL_AtomicGet(&engine->ring.write_index));
+            SDL_AtomicSet(&engine->playing, 1);
+            post_event(engine, ENGINE_TRACK_STARTED, generation, engine->tracks[0].position);
+            trace_instant("track_started");
+
+            if (outgoing.handle) {
+                fade_position = 0;
+                fade_length = engine->crossfade_frames;
+                Uint32 outgoing_left = frames_left(engine, &outgoing);
+                Uint32 current_left = frames_left(engine, &current);
+                fade_length = outgoing_left < fade_length ? outgoing_left : fade_length;
+                fade_length = current_left < fade_length ? current_left : fade_length;
+            }
+
+            if (in_transition) {
+                // Silence is only heard if decoding the next track took longer
+                // than the audio still buffered when the last one ended
+                double waited_ms = (double)(SDL_GetPerformanceCounter() - ended_at) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+                double buffered_ms = buffered_at_end * 1000.0 / engine->frequency;
+                printf("Track transition gap: %.2f ms\n", waited_ms > buffered_ms ? waited_ms - buffered_ms : 0.0);
+                in_transition = false;
+            }
+        }
+
+        // The fade is over, or the track heard while the next one decodes
+        // has ended
+        if (outgoing.handle && (current.handle ? fade_position >= fade_length : outgoing.offset >= outgoing.handle->chunk->alen)) {
+            release_stream(engine, &outgoing);
+        }
+
+        bool next_ready = engine->track_count > 1 && engine->tracks[1].handle;
+        if (engine->crossfade_frames > 0 && current.handle && !outgoing.handle && next_ready &&
+            frames_left(engine, &current) <= engine->crossfade_frames) {
+            outgoing = current;
+            memset(&current, 0, sizeof(current));
+            drop_current(engine);
+            continue;
+        }
+
+        if (!current.handle && !outgoing.handle) {
+            SDL_CondWait(engine->feeder_wake, engine->lock);
+            continue;
+        }
+
+        Uint32 writable = ring_buffer_writable(&engine->ring);
+        if (writable == 0) {
+            SDL_CondWaitTimeout(engine->feeder_wake, engine->lock, full_wait_ms);
+            continue;
+        }
+
+        bool fading = current.handle && outgoing.handle;
+        Stream *stream = current.handle ? &current : &outgoing;
+        Uint32 frames = fading ? fade_length - fade_position : frames_left(engine, stream);
+        if (!fading && stream == &current && engine->crossfade_frames > 0 && next_ready && frames > engine->crossfade_frames) {
+            // Stop where the crossfade into the next track begins
+            frames -= engine->crossfade_frames;
+        }
+        if (frames > writable) {
+            frames = writable;
+        }
+
+        SDL_UnlockMutex(engine->lock);
+        if (fading) {
+            frames = frames < MIX_BLOCK_FRAMES ? frames : MIX_BLOCK_FRAMES;
+            MixGain fade_out, fade_in;
+            mix_equal_power(fade_position, fade_length, frames, &fade_out, &fade_in);
+            mix_s16(engine->mix_kernel, engine->mix_block, stream_pcm(&outgoing), stream_pcm(&current), (int)frames, engine->channels,
+                    with_gain(fade_out, outgoing.gain), with_gain(fade_in, current.gain));
+            ring_buffer_write(&engine->ring, engine->mix_block, frames);
+            outgoing.offset += frames * engine->frame_bytes;
+            current.offset += frames * engine->frame_bytes;
+            fade_position += frames;
+        } else {
+            if (stream->gain == LOUDNESS_UNITY_GAIN) {
+                ring_buffer_write(&engine->ring, stream_pcm(stream), frames);
+            } else {
+                ring_buffer_write_scaled(&engine->ring, stream_pcm(stream), frames, stream->gain, LOUDNESS_GAIN_SHIFT);
+            }
+            stream->offset += frames * engine->frame_bytes;
+            if (frames == 0) {
+                stream->offset = stream->handle->chunk->alen;
+            }
+        }
+        SDL_LockMutex(engine->lock);
+    }
+    release_stream(engine, &current);
+    release_stream(engine, &outgoing);
+    SDL_UnlockMutex(engine->lock);
+    return 0;
+}
+
+// Call after Mix_OpenAudio. Takes over the mixer's music stream. On failure
+// the engine stays usable but silent.
+bool audio_engine_start(AudioEngine *engine, MusicCache *cache, Uint32 event_type, Uint32 ring_frames, ResampleQuality resample_quality) {
+    memset(engine, 0, sizeof(*engine));
+    engine->cache = cache;
+    engine->event_type = event_type;
+    engine->resample_quality = resample_quality;
+
+    Uint16 format;
+    if (!Mix_QuerySpec(&engine->frequency, &format, &engine->channels)) {
+        printf("Audio engine: mixer is not open - %s\n", Mix_GetError());
+        return false;
+    }
+    if (format != AUDIO_S16SYS) {
+        printf("Audio engine: unsupported output format 0x%x\n", format);
+        return false;
+    }
+    engine->frame_bytes = engine->channels * (int)sizeof(Sint16);
+    engine->mix_kernel = mix_best_kernel();
+    engine->mix_block = malloc((size_t)MIX_BLOCK_FRAMES * engine->frame_bytes);
+
+    engine->lock = SDL_CreateMutex();
+    engine->feeder_wake = SDL_CreateCond();
+    engine->loader_wake = SDL_CreateCond();
+    if (!engine->mix_block || !engine->lock || !engine->feeder_wake || !engine->loader_wake || !ring_buffer_init(&engine->ring, ring_frames, engine->channels)) {
+        printf("Audio engine initialization failed: %s\n", SDL_GetError());
+        audio_engine_shutdown(engine);
+        return false;
+    }
+
+    engine->loader = SDL_CreateThread(loader_thread, "audio_loader", engine);
+    engine->feeder = SDL_CreateThread(feeder_thread, "audio_feeder", engine);
+    if (!engine->loader || !engine->feeder) {
+        printf("Audio engine thread creation failed: %s\n", SDL_GetError());
+        audio_engine_shutdown(engine);
+        return false;
+    }
+
+    Mix_HookMusic(engine_callback, engine);
+    return true;
+}
+
+// Replaces everything with `locations` (the track to play now, then the ones
+// to follow it) and drops the audio already buffered. The first track starts
+// `start_ms` in. Returns the generation that events for this queue will
+// carry.
+int audio_engine_play(AudioEngine *engine, const char **locations, const int *positions, int count, Uint32 start_ms) {
+    SDL_LockMutex(engine->lock);
+    while (engine->track_count > 0) {
+        drop_current(engine);
+    }
+    if (count > 1 + ENGINE_MAX_UPCOMING) {
+        count = 1 + ENGINE_MAX_UPCOMING;
+    }
+    for (int i = 0; i < count; i++) {
+        if (set_track(&engine->tracks[engine->track_count], locations[i], positions[i])) {
+            engine->track_count++;
+        }
+    }
+    if (engine->track_count > 0) {
+        engine->tracks[0].start_frame = (Uint32)((Uint64)start_ms * engine->frequency / 1000);
+    }
+    int generation = ++engine->generation;
+    SDL_CondSignal(engine->loader_wake);
+    SDL_CondSignal(engine->feeder_wake);
+    SDL_UnlockMutex(engine->lock);
+    return generation;
+}
+
+// Replaces the tracks queued after the current one, without interrupting it.
+// Entries at or before the current position are skipped, since the feeder
+// may already have moved on to them.
+void audio_engine_set_upcoming(AudioEngine *engine, const char **locations, const int *positions, int count) {
+    SDL_LockMutex(engine->lock);
+    while (engine->track_count > 1) {
+        clear_track(engine, &engine->tracks[--engine->track_count]);
+    }
+    int current = engine->track_count > 0 ? engine->tracks[0].position : -1;
+    for (int i = 0; i < count && engine->track_count < 1 + ENGINE_MAX_UPCOMING; i++) {
+        if (positions[i] > current && set_track(&engine->tracks[engine->track_count], locations[i], positions[i])) {
+            engine->track_count++;
+        }
+    }
+    SDL_CondSignal(engine->loader_wake);
+    SDL_CondSignal(engine->feeder_wake);
+    SDL_UnlockMutex(engine->lock);
+}
+
+// Tracks loaded from now on are played at the gain `loudness` has for them;
+// NULL plays everything as mastered.
+void audio_engine_set_loudness(AudioEngine *engine, Loudness *loudness) {
+    SDL_LockMutex(engine->lock);
+    engine->loudness = loudness;
+    SDL_UnlockMutex(engine->lock);
+}
+
+// Crossfades over `milliseconds` between consecutive tracks and into a
+// track started by audio_engine_play(); 0 cuts straight over.
+void audio_engine_set_crossfade(AudioEngine *engine, int milliseconds) {
+    SDL_LockMutex(engine->lock);
+    engine->crossfade_frames = milliseconds > 0 ? (Uint32)((Sint64)milliseconds * engine->frequency / 1000) : 0;
+    SDL_CondSignal(engine->feeder_wake);
+    SDL_UnlockMutex(engine->lock);
+    if (milliseconds > 0) {
+        printf("Crossfade: %d ms, %s mixing\n", milliseconds, mix_kernel_name(engine->mix_kernel));
+    }
+}
+
+// Moves the current track to `ms`. Seeking is in the decoded PCM, so it is
+// exact to the sample and costs the same anywhere in the track. A track
+// that is still decoding starts there instead.
+void audio_engine_seek(AudioEngine *engine, Uint32 ms) {
+    SDL_LockMutex(engine->lock);
+    if (engine->track_count > 0) {
+        engine->seek_frame = (Uint32)((Uint64)ms * engine->frequency / 1000);
+        engine->tracks[0].start_frame = engine->seek_frame;
+        engine->seek_pending = true;
+        SDL_CondSignal(engine->feeder_wake);
+    }
+    SDL_UnlockMutex(engine->lock);
+}
+
+// Forgets the decoded PCM of a file that changed on disk. A track already
+// streaming keeps playing what it has; the next play decodes the file anew.
+void audio_engine_evict(AudioEngine *engine, const char *location) {
+    if (!engine->lock) {
+        return;
+    }
+    SDL_LockMutex(engine->lock);
+    music_cache_evict(engine->cache, location);
+    SDL_UnlockMutex(engine->lock);
+}
+
+void audio_engine_stop(AudioEngine *engine) {
+    SDL_LockMutex(engine->lock);
+    while (engine->track_count > 0) {
+        drop_current(engine);
+    }
+    engine->generation++;
+    SDL_AtomicSet(&engine->playing, 0);
+    SDL_CondSignal(engine->feeder_wake);
+    SDL_UnlockMutex(engine->lock);
+}
+
+bool audio_engine_is_playing(AudioEngine *engine) {
+    return SDL_AtomicGet(&engine->playing) != 0;
+}
+
+// How far into the current track the listener is: frames the callback has
+// read since the track's first frame was written, plus where it started.
+// Until the audio still buffered from the previous track has played out this
+// is the start position.
+Uint32 audio_engine_position_ms(AudioEngine *engine) {
+    if (!audio_engine_is_playing(engine)) {
+        return 0;
+    }
+    Sint32 heard = (Sint32)((Uint32)SDL_AtomicGet(&engine->ring.read_index) - (Uint32)SDL_AtomicGet(&engine->track_origin));
+    Uint32 frames = (Uint32)SDL_AtomicGet(&engine->track_start_frame) + (heard > 0 ? (Uint32)heard : 0);
+    return (Uint32)((Uint64)frames * 1000 / engine->frequency);
+}
+
+// Length of the current track, 0 when nothing is playing.
+Uint32 audio_engine_duration_ms(AudioEngine *engine) {
+    if (!audio_engine_is_playing(engine)) {
+        return 0;
+    }
+    return (Uint32)((Uint64)(Uint32)SDL_AtomicGet(&engine->track_frames) * 1000 / engine->frequency);
+}
+
+int audio_engine_underruns(AudioEngine *engine) {
+    return SDL_AtomicGet(&engine->underruns);
+}
+
+// Detaches from the mixer, joins the threads and releases every track.
+void audio_engine_shutdown(AudioEngine *engine) {
+    Mix_HookMusic(NULL, NULL);
+    if (engine->lock) {
+        SDL_LockMutex(engine->lock);
+        engine->quit = true;
+        SDL_CondSignal(engine->feeder_wake);
+        SDL_CondSignal(engine->loader_wake);
+        SDL_UnlockMutex(engine->lock);
+    }
+    SDL_WaitThread(engine->feeder, NULL);
+    SDL_WaitThread(engine->loader, NULL);
+    engine->feeder = NULL;
+    engine->loader = NULL;
+
+    while (engine->track_count > 0) {
+        drop_current(engine);
+    }
+    ring_buffer_free(&engine->ring);
+    free(engine->mix_block);
+    engine->mix_block = NULL;
+    if (engine->feeder_wake) {
+        SDL_DestroyCond(engine->feeder_wake);
+        engine->feeder_wake = NULL;
+    }
+    if (engine->loader_wake) {
+        SDL_DestroyCond(engine->loader_wake);
+        engine->loader_wake = NULL;
+    }
+    if (engine->lock) {
+        SDL_DestroyMutex(engine->lock);
+        engine->lock = NULL;
+    }
+}
@@ -0,0 +1,92 @@
+#ifndef AUDIO_ENGINE_H
+#define AUDIO_ENGINE_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "loudness.h"
+#include "mix.h"
+#include "music_cache.h"
+#include "resampler.h"
+#include "ring_buffer.h"
+
+#define ENGINE_MAX_UPCOMING 8
+#define ENGINE_RING_FRAMES 8192
+
+typedef enum engine_event_code {
+    ENGINE_TRACK_STARTED,
+    ENGINE_OUT_OF_TRACKS
+} EngineEventCode;
+
+// A track the engine has been asked to play. `position` is the caller's
+// queue index, echoed back in events. `gain` is the Q12 loudness gain
+// looked up when the track was loaded. Playback begins `start_frame` frames
+// in.
+typedef struct engine_track {
+    char *location;
+    int position;
+    Uint32 start_frame;
+    MusicHandle *handle;
+    int gain;
+    bool failed;
+} EngineTrack;
+
+// Playback pipeline. A loader thread decodes tracks into the MusicCache; a
+// feeder thread streams the decoded PCM of the current track, then each
+// upcoming one back to back, into a lock-free ring; the mixer's music hook
+// only copies out of the ring. The render thread never touches audio data.
+// With a crossfade set, the feeder mixes the end of one track into the start
+// of the next before it reaches the ring.
+//
+// Fields above `lock` are fixed after start. `tracks` and the cache are
+// shared between the threads under `lock`. The atomics are shared with the
+// audio callback, which never locks.
+typedef struct audio_engine {
+    RingBuffer ring;
+    int frequency;
+    int channels;
+    int frame_bytes;
+    ResampleQuality resample_quality;
+    MixKernel mix_kernel;
+    Sint16 *mix_block;
+    MusicCache *cache;
+    Uint32 event_type;
+
+    SDL_mutex *lock;
+    SDL_cond *feeder_wake;
+    SDL_cond *loader_wake;
+    SDL_Thread *feeder;
+    SDL_Thread *loader;
+    Loudness *loudness;
+    Uint32 crossfade_frames;
+    bool quit;
+    int generation;
+    EngineTrack tracks[1 + ENGINE_MAX_UPCOMING];
+    int track_count;
+    bool seek_pending;
+    Uint32 seek_frame;
+
+    SDL_atomic_t flush_index;
+    SDL_atomic_t flush_sequence;
+    SDL_atomic_t playing;
+    SDL_atomic_t underruns;
+    SDL_atomic_t track_origin;
+    SDL_atomic_t track_start_frame;
+    SDL_atomic_t track_frames;
+    int seen_flush_sequence;
+} AudioEngine;
+
+bool audio_engine_start(AudioEngine *engine, MusicCache *cache, Uint32 event_type, Uint32 ring_frames, ResampleQuality resample_quality);
+int audio_engine_play(AudioEngine *engine, const char **locations, const int *positions, int count, Uint32 start_ms);
+void audio_engine_set_upcoming(AudioEngine *engine, const char **locations, const int *positions, int count);
+void audio_engine_set_loudness(AudioEngine *engine, Loudness *loudness);
+void audio_engine_set_crossfade(AudioEngine *engine, int milliseconds);
+void audio_engine_seek(AudioEngine *engine, Uint32 ms);
+void audio_engine_evict(AudioEngine *engine, const char *location);
+void audio_engine_stop(AudioEngine *engine);
+bool audio_engine_is_playing(AudioEngine *engine);
+Uint32 audio_engine_position_ms(AudioEngine *engine);
+Uint32 audio_engine_duration_ms(AudioEngine *engine);
+int audio_engine_underruns(AudioEngine *engine);
+void audio_engine_shutdown(AudioEngine *engine);
+
+#endif
@@ -0,0 +1,629 @@
+// Headless benchmark of the player's load, render and click paths. Built in
+// place of music.c, whose functions it drives directly:
+//
+//   gcc bench.c <every other .c except music.c> -o bench -lSDL2 ...
+//
+// Runs on SDL's dummy video and audio drivers with the software renderer
+// against a synthetic library written to BENCH_DATA_DIR, and writes its
+// results as JSON.
+#define MUSIC_PLAYER_NO_MAIN
+#include "music.c"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+#define BENCH_DATA_DIR "bench_data"
+#define BENCH_COVER_FILES 8
+#define BENCH_TRACK_MS 500
+#define BENCH_GRID_COVERS 200
+#define BENCH_GRID_COLUMNS 20
+
+typedef struct bench_options {
+    int albums;
+    int tracks;
+    int cover_size;
+    int frames;
+    int warmup;
+    int clicks;
+    bool eager;
+    const char *output;
+} BenchOptions;
+
+typedef struct percentiles {
+    double p50;
+    double p90;
+    double p99;
+    double max;
+    double mean;
+} Percentiles;
+
+// On glibc every allocation in the process, SDL's included, goes through
+// these, so allocations per frame can be counted without touching the
+// player's code.
+#if defined(__GLIBC__)
+#define BENCH_COUNTS_ALLOCATIONS 1
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t count, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+
+static SDL_atomic_t allocations;
+
+void *malloc(size_t size) {
+    SDL_AtomicAdd(&allocations, 1);
+    return __libc_malloc(size);
+}
+
+void *calloc(size_t count, size_t size) {
+    SDL_AtomicAdd(&allocations, 1);
+    return __libc_calloc(count, size);
+}
+
+void *realloc(void *ptr, size_t size) {
+    SDL_AtomicAdd(&allocations, 1);
+    return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr) {
+    __libc_free(ptr);
+}
+
+static int allocation_count(void) {
+    return SDL_AtomicGet(&allocations);
+}
+#else
+#define BENCH_COUNTS_ALLOCATIONS 0
+
+static int allocation_count(void) {
+    return 0;
+}
+#endif
+
+static bool parse_bench_options(int argc, char **argv, BenchOptions *options) {
+    options->albums = 1000;
+    options->tracks = 10;
+    options->cover_size = 500;
+    options->frames = 600;
+    options->warmup = 60;
+    options->clicks = 2000;
+    options->eager = false;
+    options->output = "bench_results.json";
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--albums") == 0 && has_value) {
+            options->albums = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--tracks") == 0 && has_value) {
+            options->tracks = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cover-size") == 0 && has_value) {
+            options->cover_size = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--frames") == 0 && has_value) {
+            options->frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--warmup") == 0 && has_value) {
+            options->warmup = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--clicks") == 0 && has_value) {
+            options->clicks = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--eager") == 0) {
+            options->eager = true;
+        } else if (strcmp(argv[i], "--output") == 0 && has_value) {
+            options->output = argv[++i];
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            return false;
+        }
+    }
+    if (options->albums < 1 || options->tracks < 1 || options->cover_size < 1 || options->frames < 1 || options->warmup < 0 || options->clicks < 0) {
+        printf("Sizes and counts must be positive\n");
+        return false;
+    }
+    return true;
+}
+
+static double elapsed_ms(Uint64 start) {
+    return (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+}
+
+static void make_directory(const char *path) {
+#ifdef _WIN32
+    _mkdir(path);
+#else
+    mkdir(path, 0755);
+#endif
+}
+
+// A short silent 16-bit stereo WAV, so clicked tracks have something to
+// decode.
+static bool write_track(const char *path) {
+    Uint32 frames = AUDIO_FREQUENCY * BENCH_TRACK_MS / 1000;
+    Uint32 data_size = frames * 4;
+    Uint8 header[44] = {'R', 'I', 'F', 'F', 0, 0, 0, 0, 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ', 16, 0, 0, 0, 1, 0, 2, 0};
+    Uint32 fields[] = {36 + data_size, AUDIO_FREQUENCY, AUDIO_FREQUENCY * 4};
+    for (int i = 0; i < 4; i++) {
+        header[4 + i] = (Uint8)(fields[0] >> (8 * i));
+        header[24 + i] = (Uint8)(fields[1] >> (8 * i));
+        header[28 + i] = (Uint8)(fields[2] >> (8 * i));
+        header[40 + i] = (Uint8)(data_size >> (8 * i));
+    }
+    header[32] = 4;
+    header[34] = 16;
+    memcpy(header + 36, "data", 4);
+
+    FILE *fptr = fopen(path, "wb");
+    if (!fptr) {
+        return false;
+    }
+    bool ok = fwrite(header, 1, sizeof(header), fptr) == sizeof(header);
+    Uint8 silence[4096] = {0};
+    for (Uint32 left = data_size; ok && left > 0;) {
+        size_t chunk = left < sizeof(silence) ? left : sizeof(silence);
+        ok = fwrite(silence, 1, chunk, fptr) == chunk;
+        left -= (Uint32)chunk;
+    }
+    return fclose(fptr) == 0 && ok;
+}
+
+// Writes the covers, the track and an albums.txt describing the library.
+static bool write_library(const BenchOptions *options, char *albums_path, size_t size) {
+    make_directory(BENCH_DATA_DIR);
+    for (int c = 0; c < BENCH_COVER_FILES; c++) {
+        SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, options->cover_size, options->cover_size, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (!surface) {
+            printf("Cover creation failed: %s\n", SDL_GetError());
+            return false;
+        }
+        Uint32 *pixels = surface->pixels;
+        for (int y = 0; y < surface->h; y++) {
+            for (int x = 0; x < surface->w; x++) {
+                pixels[y * (surface->pitch / 4) + x] = 0xFF000000u | (Uint32)((x * 255 / surface->w) << 16) | (Uint32)((y * 255 / surface->h) << 8) | (Uint32)(c * 32);
+            }
+        }
+        char path[MAX_PATH_LENGTH];
+        snprintf(path, sizeof(path), BENCH_DATA_DIR "/cover_%d.bmp", c);
+        bool saved = SDL_SaveBMP(surface, path) == 0;
+        SDL_FreeSurface(surface);
+        if (!saved) {
+            printf("Error writing %s: %s\n", path, SDL_GetError());
+            return false;
+        }
+    }
+    if (!write_track(BENCH_DATA_DIR "/track.wav")) {
+        printf("Error writing " BENCH_DATA_DIR "/track.wav\n");
+        return false;
+    }
+
+    snprintf(albums_path, size, BENCH_DATA_DIR "/albums.txt");
+    FILE *fptr = fopen(albums_path, "w");
+    if (!fptr) {
+        printf("Error writing %s\n", albums_path);
+        return false;
+    }
+    fprintf(fptr, "%d\n", options->albums);
+    for (int a = 0; a < options->albums; a++) {
+        fprintf(fptr, "Album %d\nArtist %d\n" BENCH_DATA_DIR "/cover_%d.bmp\n%d\n%d\n", a + 1, a % 97 + 1, a % BENCH_COVER_FILES, a % 4 + 1, options->tracks);
+        for (int t = 0; t < options->tracks; t++) {
+            fprintf(fptr, "Track %d of album %d\n" BENCH_DATA_DIR "/track.wav\n", t + 1, a + 1);
+        }
+    }
+    return fclose(fptr) == 0;
+}
+
+// Requests the covers the view needs and waits until they are uploaded,
+// so every timed frame draws the same thing whatever the disk is doing.
+static void settle_covers(View *view, Library *library, CoverLoader *loader, CoverAtlas *atlas, Uint32 ready_event) {
+    update_resident_covers(view, library, loader, atlas);
+    for (;;) {
+        int album_index;
+        SDL_Surface *surface;
+        while (cover_loader_collect(loader, &album_index, &surface)) {
+            Album *album = &library->albums[album_index];
+            if (album->cover_state == COVER_PENDING && surface) {
+                cover_atlas_release(atlas, album->cover);
+                album->cover = cover_atlas_insert(atlas, surface, album_index);
+                album->cover_state = cover_atlas_contains(atlas, album->cover) ? COVER_READY : COVER_FAILED;
+            } else if (album->cover_state == COVER_PENDING) {
+                album->cover_state = COVER_FAILED;
+            }
+            SDL_FreeSurface(surface);
+        }
+        if (cover_loader_outstanding(loader) == 0) {
+            break;
+        }
+        SDL_Delay(1);
+    }
+    SDL_FlushEvent(ready_event);
+}
+
+static int compare_doubles(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// Nearest-rank percentiles; sorts `samples`.
+static Percentiles percentiles(double *samples, int count) {
+    Percentiles result = {0};
+    if (count == 0) {
+        return result;
+    }
+    qsort(samples, (size_t)count, sizeof(double), compare_doubles);
+    double sum = 0.0;
+    for (int i = 0; i < count; i++) {
+        sum += samples[i];
+    }
+    result.p50 = samples[(count - 1) * 50 / 100];
+    result.p90 = samples[(count - 1) * 90 / 100];
+    result.p99 = samples[(count - 1) * 99 / 100];
+    result.max = samples[count - 1];
+    result.mean = sum / count;
+    return result;
+}
+
+static void write_percentiles(FILE *fptr, const char *name, Percentiles p, const char *suffix) {
+    fprintf(fptr, "    \"%s\": {\"p50\": %.4f, \"p90\": %.4f, \"p99\": %.4f, \"max\": %.4f, \"mean\": %.4f}%s\n", name, p.p50, p.p90, p.p99, p.max, p.mean, suffix);
+}
+
+// Frame time of a grid of BENCH_GRID_COVERS distinct covers drawn into the
+// canvas, once as one texture and one SDL_RenderCopy per cover, once from
+// the atlas.
+typedef struct cover_grid {
+    Percentiles textures;
+    Percentiles atlas;
+    int texture_draw_calls;
+    int atlas_draw_calls;
+    int atlas_pages;
+} CoverGrid;
+
+static void finish_frame(SDL_Renderer *renderer) {
+#if SDL_VERSION_ATLEAST(2, 0, 10)
+    SDL_RenderFlush(renderer);
+#else
+    (void)renderer;
+#endif
+}
+
+static bool bench_cover_grid(SDL_Renderer *renderer, SDL_Texture *canvas, int frames, CoverGrid *grid) {
+    SDL_Texture *textures[BENCH_GRID_COVERS] = {0};
+    CoverSlot slots[BENCH_GRID_COVERS];
+    memset(grid, 0, sizeof(*grid));
+    CoverAtlas atlas;
+    cover_atlas_init(&atlas, renderer, COVER_SIZE, ATLAS_MAX_PAGES);
+    double *texture_ms = malloc((size_t)frames * sizeof(double));
+    double *atlas_ms = malloc((size_t)frames * sizeof(double));
+    bool ok = texture_ms && atlas_ms;
+    for (int i = 0; ok && i < BENCH_GRID_COVERS; i++) {
+        SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormat(0, COVER_SIZE, COVER_SIZE, 32, SDL_PIXELFORMAT_ARGB8888);
+        if (!surface) {
+            printf("Cover creation failed: %s\n", SDL_GetError());
+            ok = false;
+            break;
+        }
+        SDL_FillRect(surface, NULL, 0xFF000000u | (Uint32)(i * 0x010305));
+        textures[i] = SDL_CreateTextureFromSurface(renderer, surface);
+        slots[i] = cover_atlas_insert(&atlas, surface, i);
+        SDL_FreeSurface(surface);
+        if (!textures[i] || !cover_atlas_contains(&atlas, slots[i])) {
+            printf("Cover grid does not fit: %s\n", SDL_GetError());
+            ok = false;
+        }
+    }
+
+    int cell = WINDOW_WIDTH / BENCH_GRID_COLUMNS;
+    SDL_SetRenderTarget(renderer, canvas);
+    for (int f = 0; ok && f < frames; f++) {
+        int draw_calls = 0;
+        Uint64 phase = SDL_GetPerformanceCounter();
+        SDL_RenderClear(renderer);
+        for (int i = 0; i < BENCH_GRID_COVERS; i++) {
+            SDL_Rect destination = {i % BENCH_GRID_COLUMNS * cell, i / BENCH_GRID_COLUMNS * cell, cell, cell};
+            draw_calls += SDL_RenderCopy(renderer, textures[i], NULL, &destination) == 0;
+        }
+        finish_frame(renderer);
+        texture_ms[f] = elapsed_ms(phase);
+        grid->texture_draw_calls = draw_calls;
+
+        draw_calls = atlas.draw_calls;
+        phase = SDL_GetPerformanceCounter();
+        SDL_RenderClear(renderer);
+        for (int i = 0; i < BENCH_GRID_COVERS; i++) {
+            SDL_Rect destination = {i % BENCH_GRID_COLUMNS * cell, i / BENCH_GRID_COLUMNS * cell, cell, cell};
+            cover_atlas_draw(&atlas, slots[i], &destination);
+        }
+        cover_atlas_flush(&atlas);
+        finish_frame(renderer);
+        atlas_ms[f] = elapsed_ms(phase);
+        grid->atlas_draw_calls = atlas.draw_calls - draw_calls;
+    }
+    SDL_SetRenderTarget(renderer, NULL);
+
+    if (ok) {
+        grid->textures = percentiles(texture_ms, frames);
+        grid->atlas = percentiles(atlas_ms, frames);
+        grid->atlas_pages = atlas.page_count;
+    }
+    for (int i = 0; i < BENCH_GRID_COVERS; i++) {
+        SDL_DestroyTexture(textures[i]);
+    }
+    cover_atlas_free(&atlas);
+    free(texture_ms);
+    free(atlas_ms);
+    return ok;
+}
+
+static long long peak_rss_bytes(void) {
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS counters;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) {
+        return (long long)counters.PeakWorkingSetSize;
+    }
+    return -1;
+#else
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0) {
+        return -1;
+    }
+    return (long long)usage.ru_maxrss * 1024;
+#endif
+}
+
+int main(int argc, char **argv) {
+    BenchOptions options;
+    if (!parse_bench_options(argc, argv, &options)) {
+        return 1;
+    }
+
+    // Headless unless the caller asked for real drivers
+    SDL_setenv("SDL_VIDEODRIVER", "dummy", 0);
+    SDL_setenv("SDL_AUDIODRIVER", "dummy", 0);
+    SDL_SetHint(SDL_HINT_RENDER_DRIVER, "software");
+
+    Uint64 start = SDL_GetPerformanceCounter();
+    SDL_Window *window = NULL;
+    SDL_Renderer *renderer = NULL;
+    TTF_Font *font = NULL;
+    if (!initialize_sdl(&window, &renderer, &font, false, AUDIO_CHUNK_SIZE, AUDIO_FREQUENCY)) {
+        return 1;
+    }
+    double sdl_init_ms = elapsed_ms(start);
+
+    char albums_path[MAX_PATH_LENGTH];
+    if (!write_library(&options, albums_path, sizeof(albums_path))) {
+        return 1;
+    }
+
+    // Startup, as main() does it: parse, index, lay out, load the visible
+    // covers and draw the first frame
+    Uint64 phase = SDL_GetPerformanceCounter();
+    Library library;
+    if (!library_load(&library, albums_path, NULL)) {
+        return 1;
+    }
+    double read_albums_ms = elapsed_ms(phase);
+
+    // With --eager every track is opened with Mix_LoadMUS up front, as the
+    // player did before tracks were loaded on demand, to compare startup
+    // time and peak RSS against the default
+    phase = SDL_GetPerformanceCounter();
+    Mix_Music **eager_tracks = NULL;
+    int eager_failures = 0;
+    if (options.eager) {
+        eager_tracks = calloc((size_t)library.number_of_tracks, sizeof(Mix_Music *));
+        if (!eager_tracks) {
+            printf("Memory allocation failed for eager tracks\n");
+            return 1;
+        }
+        for (int a = 0; a < library.number_of_albums; a++) {
+            for (int t = 0; t < library.albums[a].number_of_tracks; t++) {
+                char location[MAX_PATH_LENGTH];
+                library_track_location(&library, a, t, location, sizeof(location));
+                Mix_Music *music = Mix_LoadMUS(location);
+                eager_tracks[library.albums[a].first_track + t] = music;
+                eager_failures += music == NULL;
+            }
+        }
+    }
+    double load_tracks_ms = elapsed_ms(phase);
+
+    phase = SDL_GetPerformanceCounter();
+    SearchIndex search_index;
+    search_index_build(&search_index, &library);
+    double search_index_ms = elapsed_ms(phase);
+
+    MusicCache music_cache;
+    TextCache text_cache;
+    music_cache_init(&music_cache, MUSIC_CACHE_HANDLES, (size_t)MUSIC_CACHE_MEGABYTES * 1024 * 1024);
+    text_cache_init(&text_cache);
+    AudioEngine audio_engine;
+    Uint32 engine_event = SDL_RegisterEvents(1);
+    audio_engine_start(&audio_engine, &music_cache, engine_event, ENGINE_RING_FRAMES, RESAMPLE_MEDIUM);
+    PlayQueue play_queue;
+    play_queue_init(&play_queue, &audio_engine, PREFETCH_TRACKS);
+
+    int current_album = 0;
+    int current_track = -1;
+    Layout layout;
+    layout_init(&layout);
+    layout_build(&layout, &library, current_album, font);
+    View view;
+    view_init(&view, library.number_of_albums);
+    Damage damage;
+    damage_clear(&damage);
+    Search search;
+    memset(&search, 0, sizeof(search));
+    SDL_Texture *canvas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, WINDOW_WIDTH, WINDOW_HEIGHT);
+
+    phase = SDL_GetPerformanceCounter();
+    CoverAtlas cover_atlas;
+    cover_atlas_init(&cover_atlas, renderer, COVER_SIZE, ATLAS_MAX_PAGES);
+    CoverLoader cover_loader;
+    Uint32 cover_ready_event = SDL_RegisterEvents(1);
+    if (!cover_loader_start(&cover_loader, cover_ready_event, COVER_SIZE)) {
+        return 1;
+    }
+    settle_covers(&view, &library, &cover_loader, &cover_atlas, cover_ready_event);
+    double visible_covers_ms = elapsed_ms(phase);
+
+    phase = SDL_GetPerformanceCounter();
+    damage_all(&damage);
+    draw_albums(renderer, canvas, &library, font, &text_cache, &cover_atlas, &layout, NULL, NULL, &damage, &view, &search, current_album, current_track);
+    double first_frame_ms = elapsed_ms(phase);
+    double startup_ms = elapsed_ms(start);
+
+    // Scroll frames: the view moves one step and everything is redrawn.
+    // Tick frames: only the current album is redrawn, as on a position tick.
+    int total = options.warmup + options.frames;
+    double *scroll_ms = malloc((size_t)options.frames * sizeof(double));
+    double *tick_ms = malloc((size_t)options.frames * sizeof(double));
+    double *click_us = malloc((size_t)(options.clicks > 0 ? options.clicks : 1) * sizeof(double));
+    if (!scroll_ms || !tick_ms || !click_us) {
+        printf("Memory allocation failed for benchmark samples\n");
+        return 1;
+    }
+    long long scroll_allocations = 0;
+    long long tick_allocations = 0;
+    long long scroll_cover_draw_calls = 0;
+    double cover_wait_ms = 0.0;
+    for (int f = 0; f < total; f++) {
+        if (view.scroll_y >= view.max_scroll_y) {
+            view.target_scroll_y = 0;
+        } else {
+            view_scroll_by(&view, SCROLL_STEP);
+        }
+        view.scroll_y = view.target_scroll_y;
+        phase = SDL_GetPerformanceCounter();
+        settle_covers(&view, &library, &cover_loader, &cover_atlas, cover_ready_event);
+        cover_wait_ms += elapsed_ms(phase);
+
+        damage_all(&damage);
+        int before = allocation_count();
+        int cover_draw_calls = cover_atlas.draw_calls;
+        phase = SDL_GetPerformanceCounter();
+        draw_albums(renderer, canvas, &library, font, &text_cache, &cover_atlas, &layout, NULL, NULL, &damage, &view, &search, current_album, current_track);
+        double scroll_frame = elapsed_ms(phase);
+        int scroll_allocated = allocation_count() - before;
+        cover_draw_calls = cover_atlas.draw_calls - cover_draw_calls;
+
+        int first, last;
+        view_visible_range(&view, library.number_of_albums, &first, &last);
+        damage_album(&damage, first);
+        before = allocation_count();
+        phase = SDL_GetPerformanceCounter();
+        draw_albums(renderer, canvas, &library, font, &text_cache, &cover_atlas, &layout, NULL, NULL, &damage, &view, &search, current_album, current_track);
+        double tick_frame = elapsed_ms(phase);
+        int tick_allocated = allocation_count() - before;
+
+        if (f >= options.warmup) {
+            scroll_ms[f - options.warmup] = scroll_frame;
+            tick_ms[f - options.warmup] = tick_frame;
+            scroll_allocations += scroll_allocated;
+            scroll_cover_draw_calls += cover_draw_calls;
+            tick_allocations += tick_allocated;
+        }
+    }
+
+    // Clicks at pseudo-random points over the content, handled as the main
+    // loop handles them, including the relayout when the album changes
+    Uint32 seed = 12345;
+    for (int i = 0; i < options.clicks; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        int x = (int)((seed >> 8) % WINDOW_WIDTH);
+        seed = seed * 1664525u + 1013904223u;
+        int y = (int)((seed >> 8) % (Uint32)layout.content_height);
+        int previous_album = current_album;
+        phase = SDL_GetPerformanceCounter();
+        Hit hit = layout_hit_test(&layout, x, y);
+        handle_click(hit, SDL_BUTTON_LEFT, &library, &play_queue, &current_album, &current_track);
+        if (hit.kind == HIT_TRACK) {
+            follow_queue(&play_queue, &current_album, &current_track);
+        }
+        if (current_album != previous_album) {
+            layout_build(&layout, &library, current_album, font);
+        }
+        click_us[i] = elapsed_ms(phase) * 1000.0;
+    }
+
+    CoverGrid grid;
+    if (!bench_cover_grid(renderer, canvas, options.frames, &grid)) {
+        return 1;
+    }
+
+    Percentiles scroll = percentiles(scroll_ms, options.frames);
+    Percentiles tick = percentiles(tick_ms, options.frames);
+    Percentiles click = percentiles(click_us, options.clicks);
+    long long rss = peak_rss_bytes();
+
+    FILE *fptr = strcmp(options.output, "-") == 0 ? stdout : fopen(options.output, "w");
+    if (!fptr) {
+        printf("Error writing %s\n", options.output);
+        return 1;
+    }
+    fprintf(fptr, "{\n");
+    fprintf(fptr, "  \"config\": {\"albums\": %d, \"tracks_per_album\": %d, \"cover_size\": %d, \"frames\": %d, \"warmup\": %d, \"clicks\": %d, \"renderer\": \"software\", \"thumbnails\": true, \"eager\": %s},\n",
+            options.albums, options.tracks, options.cover_size, options.frames, options.warmup, options.clicks, options.eager ? "true" : "false");
+    fprintf(fptr, "  \"startup_ms\": {\"sdl_init\": %.3f, \"read_albums\": %.3f, \"load_tracks\": %.3f, \"search_index\": %.3f, \"visible_covers\": %.3f, \"first_frame\": %.3f, \"total\": %.3f},\n",
+            sdl_init_ms, read_albums_ms, load_tracks_ms, search_index_ms, visible_covers_ms, first_frame_ms, startup_ms);
+    if (options.eager) {
+        fprintf(fptr, "  \"eager_load_failures\": %d,\n", eager_failures);
+    }
+    fprintf(fptr, "  \"frame_ms\": {\n");
+    write_percentiles(fptr, "scroll", scroll, ",");
+    write_percentiles(fptr, "tick", tick, "");
+    fprintf(fptr, "  },\n");
+    if (BENCH_COUNTS_ALLOCATIONS) {
+        fprintf(fptr, "  \"allocations_per_frame\": {\"scroll\": %.2f, \"tick\": %.2f},\n",
+                (double)scroll_allocations / options.frames, (double)tick_allocations / options.frames);
+    } else {
+        fprintf(fptr, "  \"allocations_per_frame\": null,\n");
+    }
+    fprintf(fptr, "  \"click_us\": {\"p50\": %.3f, \"p90\": %.3f, \"p99\": %.3f, \"max\": %.3f, \"mean\": %.3f},\n",
+            click.p50, click.p90, click.p99, click.max, click.mean);
+    fprintf(fptr, "  \"cover_wait_ms\": %.3f,\n", cover_wait_ms);
+    fprintf(fptr, "  \"cover_draw_calls_per_frame\": %.2f,\n", (double)scroll_cover_draw_calls / options.frames);
+    fprintf(fptr, "  \"cover_grid\": {\n");
+    fprintf(fptr, "    \"covers\": %d,\n", BENCH_GRID_COVERS);
+    fprintf(fptr, "    \"draw_calls\": {\"textures\": %d, \"atlas\": %d},\n", grid.texture_draw_calls, grid.atlas_draw_calls);
+    fprintf(fptr, "    \"atlas_pages\": %d,\n", grid.atlas_pages);
+    write_percentiles(fptr, "textures", grid.textures, ",");
+    write_percentiles(fptr, "atlas", grid.atlas, "");
+    fprintf(fptr, "  },\n");
+    fprintf(fptr, "  \"peak_rss_bytes\": %lld\n", rss);
+    fprintf(fptr, "}\n");
+    if (fptr != stdout) {
+        fclose(fptr);
+        printf("Wrote %s\n", options.output);
+    }
+
+    free(scroll_ms);
+    free(tick_ms);
+    free(click_us);
+    cover_loader_stop(&cover_loader);
+    cover_atlas_free(&cover_atlas);
+    SDL_DestroyTexture(canvas);
+    layout_free(&layout);
+    play_queue_free(&play_queue);
+    audio_engine_shutdown(&audio_engine);
+    music_cache_clear(&music_cache);
+    text_cache_invalidate(&text_cache);
+    search_index_free(&search_index);
+    for (int i = 0; eager_tracks && i < library.number_of_tracks; i++) {
+        Mix_FreeMusic(eager_tracks[i]);
+    }
+    free(eager_tracks);
+    library_free(&library);
+    SDL_DestroyRenderer(renderer);
+    SDL_DestroyWindow(window);
+    TTF_CloseFont(font);
+    TTF_Quit();
+    IMG_Quit();
+    Mix_CloseAudio();
+    Mix_Quit();
+    SDL_Quit();
+    return 0;
+}
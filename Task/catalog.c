@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+#include "catalog.h"
+
+static void source_stamp(const char *source_path, int64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (source_path && stat(source_path, &st) == 0) {
+        *size = (int64_t)st.st_size;
+        *mtime = (int64_t)st.st_mtime;
+    } else {
+        *size = -1;
+        *mtime = -1;
+    }
+}
+
+// Maps a whole file read-only. NULL when it is missing or empty.
+void *catalog_map_file(const char *path, size_t *size) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE) {
+        return NULL;
+    }
+    LARGE_INTEGER file_size;
+    if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+        CloseHandle(file);
+        return NULL;
+    }
+    HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+    CloseHandle(file);
+    if (!mapping) {
+        return NULL;
+    }
+    void *data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    *size = (size_t)file_size.QuadPart;
+    return data;
+#else
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return NULL;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *data = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+    *size = (size_t)st.st_size;
+    return data;
+#endif
+}
+
+void catalog_unmap_file(void *data, size_t size) {
+#ifdef _WIN32
+    (void)size;
+    UnmapViewOfFile(data);
+#else
+    munmap(data, size);
+#endif
+}
+
+// Writes the library as a catalog stamped with `source_path`'s size and
+// mtime. Removes the file on failure.
+bool catalog_write(const Library *library, const char *path, const char *source_path) {
+    CatalogHeader header = {0};
+    header.magic = CATALOG_MAGIC;
+    header.version = CATALOG_VERSION;
+    header.album_count = (uint32_t)library->number_of_albums;
+    header.track_count = (uint32_t)library->number_of_tracks;
+    header.albums_offset = sizeof(CatalogHeader);
+    header.tracks_offset = header.albums_offset + header.album_count * sizeof(CatalogAlbum);
+    header.strings_offset = header.tracks_offset + 3 * (uint64_t)header.track_count * sizeof(StringId);
+    header.strings_size = library->strings.size;
+    source_stamp(source_path, &header.source_size, &header.source_mtime);
+
+    CatalogAlbum *albums = calloc(header.album_count + 1, sizeof(CatalogAlbum));
+    bool ok = albums != NULL;
+    for (uint32_t i = 0; ok && i < header.album_count; i++) {
+        const Album *album = &library->albums[i];
+        albums[i].title = album->title;
+        albums[i].artist = album->artist;
+        albums[i].photo_location = album->photo_location;
+        albums[i].genre = album->genre;
+        albums[i].first_track = (uint32_t)album->first_track;
+        albums[i].number_of_tracks = (uint32_t)album->number_of_tracks;
+    }
+
+    FILE *fptr = ok ? fopen(path, "wb") : NULL;
+    if (fptr) {
+        ok = fwrite(&header, sizeof(header), 1, fptr) == 1 &&
+             fwrite(albums, sizeof(CatalogAlbum), header.album_count, fptr) == header.album_count &&
+             fwrite(library->track_titles, sizeof(StringId), header.track_count, fptr) == header.track_count &&
+             fwrite(library->track_folders, sizeof(StringId), header.track_count, fptr) == header.track_count &&
+             fwrite(library->track_files, sizeof(StringId), header.track_count, fptr) == header.track_count &&
+             fwrite(library->strings.data, 1, library->strings.size, fptr) == library->strings.size;
+        ok = fclose(fptr) == 0 && ok;
+    } else {
+        ok = false;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error writing catalog: %s\n", path);
+        remove(path);
+    }
+
+    free(albums);
+    return ok;
+}
+
+static bool valid_string(const CatalogHeader *header, uint32_t offset) {
+    return offset < header->strings_size;
+}
+
+// Maps the catalog and points the library at it. Fails quietly when there is
+// no catalog, and with a message when it is corrupt or older than its source.
+bool catalog_open(Library *library, const char *path, const char *source_path) {
+    size_t size;
+    void *data = catalog_map_file(path, &size);
+    if (!data) {
+        return false;
+    }
+
+    const CatalogHeader *header = data;
+    const char *base = data;
+    bool valid = size >= sizeof(CatalogHeader) &&
+                 header->magic == CATALOG_MAGIC &&
+                 header->version == CATALOG_VERSION &&
+                 header->albums_offset == sizeof(CatalogHeader) &&
+                 header->tracks_offset == header->albums_offset + (uint64_t)header->album_count * sizeof(CatalogAlbum) &&
+                 header->strings_offset == header->tracks_offset + 3 * (uint64_t)header->track_count * sizeof(StringId) &&
+                 header->strings_offset + header->strings_size == size &&
+                 header->strings_size > 0 && header->strings_size <= UINT32_MAX &&
+                 base[header->strings_offset] == '\0' && base[size - 1] == '\0';
+    if (!valid) {
+        fprintf(stderr, "Ignoring invalid catalog: %s\n", path);
+        catalog_unmap_file(data, size);
+        return false;
+    }
+
+    int64_t source_size;
+    int64_t source_mtime;
+    source_stamp(source_path, &source_size, &source_mtime);
+    if (source_size >= 0 && (source_size != header->source_size || source_mtime != header->source_mtime)) {
+        fprintf(stderr, "Ignoring stale catalog: %s (rebuild with --build-catalog)\n", path);
+        catalog_unmap_file(data, size);
+        return false;
+    }
+
+    const CatalogAlbum *catalog_albums = (const CatalogAlbum *)(base + header->albums_offset);
+    StringId *track_ids = (StringId *)(base + header->tracks_offset);
+    for (uint64_t i = 0; i < 3 * (uint64_t)header->track_count && valid; i++) {
+        valid = valid_string(header, track_ids[i]);
+    }
+
+    library->albums = malloc((header->album_count + 1) * sizeof(Album));
+    if (!library->albums) {
+        fprintf(stderr, "Memory allocation failed for catalog\n");
+        catalog_unmap_file(data, size);
+        return false;
+    }
+
+    // Strings and track arrays stay in the mapping; only the album records,
+    // which also hold cover slots, are copied
+    for (uint32_t i = 0; i < header->album_count && valid; i++) {
+        const CatalogAlbum *record = &catalog_albums[i];
+        valid = valid_string(header, record->title) && valid_string(header, record->artist) &&
+                valid_string(header, record->photo_location) &&
+                record->first_track <= header->track_count &&
+                record->number_of_tracks <= header->track_count - record->first_track;
+        Album *album = &library->albums[i];
+        memset(album, 0, sizeof(*album));
+        album->title = record->title;
+        album->artist = record->artist;
+        album->photo_location = record->photo_location;
+        album->genre = (Genre)record->genre;
+        album->first_track = (int)record->first_track;
+        album->number_of_tracks = (int)record->number_of_tracks;
+    }
+    if (!valid) {
+        fprintf(stderr, "Ignoring invalid catalog: %s\n", path);
+        free(library->albums);
+        library->albums = NULL;
+        catalog_unmap_file(data, size);
+        return false;
+    }
+
+    library->number_of_albums = (int)header->album_count;
+    library->number_of_tracks = (int)header->track_count;
+    library->track_titles = track_ids;
+    library->track_folders = track_ids + header->track_count;
+    library->track_files = track_ids + 2 * (uint64_t)header->track_count;
+    library->tracks_capacity = 0;
+    string_arena_attach(&library->strings, base + header->strings_offset, (uint32_t)header->strings_size);
+    library->mapping = data;
+    library->mapping_size = size;
+    return true;
+}
+
+void catalog_close(Library *library) {
+    if (library->mapping) {
+        catalog_unmap_file(library->mapping, library->mapping_size);
+        library->mapping = NULL;
+        library->mapping_size = 0;
+    }
+}
+
+// Parses the text library and writes it out as a catalog.
+bool catalog_convert(const char *text_path, const char *catalog_path) {
+    Library library;
+    if (!library_load(&library, text_path, NULL)) {
+        return false;
+    }
+    bool ok = catalog_write(&library, catalog_path, text_path);
+    if (ok) {
+        printf("Wrote %s: %d albums, %d tracks\n", catalog_path, library.number_of_albums, library.number_of_tracks);
+    }
+    library_free(&library);
+    return ok;
+}
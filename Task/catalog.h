@@ -0,0 +1,56 @@
+#ifndef CATALOG_H
+#define CATALOG_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "library.h"
+
+// Binary library catalog, used in place through a read-only memory mapping.
+//
+//   CatalogHeader
+//   CatalogAlbum[album_count]
+//   uint32_t track titles[track_count]
+//   uint32_t track folders[track_count]
+//   uint32_t track file names[track_count]
+//   string table: the library's StringArena, strings referenced by offset
+//
+// This is the in-memory Library layout, so writing is a straight dump and
+// opening only copies the album records.
+//
+// All fields are in host byte order; `magic` doubles as the byte order check.
+// `source_size` and `source_mtime` identify the albums.txt the catalog was
+// built from, so a stale catalog is ignored.
+
+#define CATALOG_MAGIC 0x5441434Cu // "LCAT"
+#define CATALOG_VERSION 2
+
+typedef struct catalog_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t album_count;
+    uint32_t track_count;
+    uint64_t albums_offset;
+    uint64_t tracks_offset;
+    uint64_t strings_offset;
+    uint64_t strings_size;
+    int64_t source_size;
+    int64_t source_mtime;
+} CatalogHeader;
+
+typedef struct catalog_album {
+    uint32_t title;
+    uint32_t artist;
+    uint32_t photo_location;
+    int32_t genre;
+    uint32_t first_track;
+    uint32_t number_of_tracks;
+} CatalogAlbum;
+
+bool catalog_write(const Library *library, const char *path, const char *source_path);
+bool catalog_open(Library *library, const char *path, const char *source_path);
+void catalog_close(Library *library);
+void *catalog_map_file(const char *path, size_t *size);
+void catalog_unmap_file(void *data, size_t size);
+bool catalog_convert(const char *text_path, const char *catalog_path);
+
+#endif
@@ -0,0 +1,356 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "cover_atlas.h"
+#include "thumbnail_cache.h"
+#include "trace.h"
+
+void cover_atlas_init(CoverAtlas *atlas, SDL_Renderer *renderer, int cover_size, int max_pages) {
+    memset(atlas, 0, sizeof(*atlas));
+    atlas->renderer = renderer;
+    atlas->cover_size = cover_size;
+    atlas->max_pages = max_pages;
+    atlas->page_size = ATLAS_PAGE_SIZE;
+    atlas->next_stamp = 1;
+    SDL_RendererInfo info;
+    if (renderer && SDL_GetRendererInfo(renderer, &info) == 0) {
+        if (info.max_texture_width > 0 && info.max_texture_width < atlas->page_size) {
+            atlas->page_size = info.max_texture_width;
+        }
+        if (info.max_texture_height > 0 && info.max_texture_height < atlas->page_size) {
+            atlas->page_size = info.max_texture_height;
+        }
+    }
+}
+
+static AtlasEntry *slot_entry(const CoverAtlas *atlas, CoverSlot slot) {
+    if (slot.entry < 0 || slot.entry >= atlas->entry_count) {
+        return NULL;
+    }
+    AtlasEntry *entry = &atlas->entries[slot.entry];
+    return entry->live && entry->stamp == slot.stamp ? entry : NULL;
+}
+
+bool cover_atlas_contains(const CoverAtlas *atlas, CoverSlot slot) {
+    return slot_entry(atlas, slot) != NULL;
+}
+
+// Hands `index` to a new cover, invalidating any slot still pointing at it.
+static int claim(CoverAtlas *atlas, int index, int w, int h, int owner) {
+    AtlasEntry *entry = &atlas->entries[index];
+    entry->w = w;
+    entry->h = h;
+    entry->owner = owner;
+    entry->stamp = atlas->next_stamp++;
+    if (atlas->next_stamp == 0) {
+        atlas->next_stamp = 1;
+    }
+    entry->last_used = atlas->frame;
+    entry->live = true;
+    return index;
+}
+
+static int add_entry(CoverAtlas *atlas, int page, int x, int y, int w, int h) {
+    if (atlas->entry_count == atlas->entry_capacity) {
+        int capacity = atlas->entry_capacity ? atlas->entry_capacity * 2 : 256;
+        AtlasEntry *entries = realloc(atlas->entries, capacity * sizeof(AtlasEntry));
+        if (!entries) {
+            printf("Memory allocation failed for cover atlas\n");
+            return -1;
+        }
+        atlas->entries = entries;
+        atlas->entry_capacity = capacity;
+    }
+    AtlasEntry *entry = &atlas->entries[atlas->entry_count];
+    memset(entry, 0, sizeof(*entry));
+    entry->page = page;
+    entry->space.x = x;
+    entry->space.y = y;
+    entry->space.w = w;
+    entry->space.h = h;
+    return atlas->entry_count++;
+}
+
+// Places a w x h rectangle at the end of `shelf`.
+static int shelf_place(CoverAtlas *atlas, int page, AtlasShelf *shelf, int w) {
+    int index = add_entry(atlas, page, shelf->x, shelf->y, w, shelf->height);
+    if (index >= 0) {
+        shelf->x += w;
+    }
+    return index;
+}
+
+static bool add_page(CoverAtlas *atlas) {
+    if (atlas->page_count == atlas->page_capacity) {
+        int capacity = atlas->page_capacity ? atlas->page_capacity * 2 : ATLAS_MAX_PAGES;
+        AtlasPage *pages = realloc(atlas->pages, capacity * sizeof(AtlasPage));
+        if (!pages) {
+            printf("Memory allocation failed for cover atlas\n");
+            return false;
+        }
+        atlas->pages = pages;
+        atlas->page_capacity = capacity;
+    }
+    AtlasPage *page = &atlas->pages[atlas->page_count];
+    memset(page, 0, sizeof(*page));
+    page->texture = SDL_CreateTexture(atlas->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STATIC, atlas->page_size, atlas->page_size);
+    if (!page->texture) {
+        printf("Cover atlas page creation failed: %s\n", SDL_GetError());
+        return false;
+    }
+    SDL_SetTextureBlendMode(page->texture, SDL_BLENDMODE_BLEND);
+    atlas->page_count++;
+    return true;
+}
+
+// Finds room for a w x h cover, padded so neighbours never bleed into each
+// other when filtered: freed space first, then the shortest shelf it fits
+// on, a new shelf, a new page, and as a last resort the space of the least
+// recently drawn cover that is not pinned. Returns the entry, or -1 if
+// every cover it could go in is pinned.
+static int allocate(CoverAtlas *atlas, int w, int h, int owner) {
+    int padded_w = w + ATLAS_PADDING;
+    int padded_h = h + ATLAS_PADDING;
+    if (padded_w > atlas->page_size || padded_h > atlas->page_size) {
+        return -1;
+    }
+
+    int best = -1;
+    for (int i = 0; i < atlas->entry_count; i++) {
+        const AtlasEntry *entry = &atlas->entries[i];
+        if (!entry->live && entry->space.w >= padded_w && entry->space.h >= padded_h &&
+            (best < 0 || entry->space.w * entry->space.h < atlas->entries[best].space.w * atlas->entries[best].space.h)) {
+            best = i;
+        }
+    }
+    if (best >= 0) {
+        return claim(atlas, best, w, h, owner);
+    }
+
+    AtlasShelf *shortest = NULL;
+    int shortest_page = -1;
+    for (int p = 0; p < atlas->page_count; p++) {
+        for (int s = 0; s < atlas->pages[p].shelf_count; s++) {
+            AtlasShelf *shelf = &atlas->pages[p].shelves[s];
+            if (shelf->height >= padded_h && shelf->x + padded_w <= atlas->page_size && (!shortest || shelf->height < shortest->height)) {
+                shortest = shelf;
+                shortest_page = p;
+            }
+        }
+    }
+    if (shortest) {
+        int index = shelf_place(atlas, shortest_page, shortest, padded_w);
+        return index >= 0 ? claim(atlas, index, w, h, owner) : -1;
+    }
+
+    for (int p = 0; p <= atlas->page_count && (atlas->max_pages == 0 || p < atlas->max_pages); p++) {
+        if (p == atlas->page_count && !add_page(atlas)) {
+            break;
+        }
+        AtlasPage *page = &atlas->pages[p];
+        if (page->shelf_count < ATLAS_MAX_SHELVES && page->next_y + padded_h <= atlas->page_size) {
+            AtlasShelf *shelf = &page->shelves[page->shelf_count++];
+            shelf->y = page->next_y;
+            shelf->height = padded_h;
+            shelf->x = 0;
+            page->next_y += padded_h;
+            int index = shelf_place(atlas, p, shelf, padded_w);
+            return index >= 0 ? claim(atlas, index, w, h, owner) : -1;
+        }
+    }
+
+    int oldest = -1;
+    for (int i = 0; i < atlas->entry_count; i++) {
+        const AtlasEntry *entry = &atlas->entries[i];
+        bool pinned = entry->owner >= atlas->pinned_first && entry->owner < atlas->pinned_last;
+        if (entry->live && !pinned && entry->space.w >= padded_w && entry->space.h >= padded_h &&
+            (oldest < 0 || entry->last_used < atlas->entries[oldest].last_used)) {
+            oldest = i;
+        }
+    }
+    if (oldest < 0) {
+        return -1;
+    }
+    atlas->evictions++;
+    return claim(atlas, oldest, w, h, owner);
+}
+
+// Hands the cover to the album now at index `owner`, as when the library is
+// reloaded. A stale slot is ignored.
+void cover_atlas_set_owner(CoverAtlas *atlas, CoverSlot slot, int owner) {
+    AtlasEntry *entry = slot_entry(atlas, slot);
+    if (entry) {
+        entry->owner = owner;
+    }
+}
+
+// Keeps the covers of albums [first, last) from being evicted, whenever
+// they were last drawn. Called with the resident range as it moves.
+void cover_atlas_pin(CoverAtlas *atlas, int first, int last) {
+    atlas->pinned_first = first;
+    atlas->pinned_last = last;
+}
+
+// Uploads `surface` into the atlas as the cover of album `owner`. Returns a
+// zeroed slot if it cannot be converted or there is no room for it.
+CoverSlot cover_atlas_insert(CoverAtlas *atlas, SDL_Surface *surface, int owner) {
+    CoverSlot slot = {0, 0};
+    SDL_Surface *converted = NULL;
+    if (surface->w > atlas->cover_size || surface->h > atlas->cover_size) {
+        converted = scale_surface(surface, atlas->cover_size, atlas->cover_size);
+    } else if (surface->format->format != SDL_PIXELFORMAT_ARGB8888) {
+        converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+    }
+    SDL_Surface *source = converted ? converted : surface;
+    if (source->format->format != SDL_PIXELFORMAT_ARGB8888) {
+        printf("Cover conversion failed: %s\n", SDL_GetError());
+        SDL_FreeSurface(converted);
+        return slot;
+    }
+
+    int index = allocate(atlas, source->w, source->h, owner);
+    if (index >= 0) {
+        AtlasEntry *entry = &atlas->entries[index];
+        SDL_Rect rect = {entry->space.x, entry->space.y, source->w, source->h};
+        if (SDL_UpdateTexture(atlas->pages[entry->page].texture, &rect, source->pixels, source->pitch) == 0) {
+            slot.entry = index;
+            slot.stamp = entry->stamp;
+        } else {
+            printf("Cover atlas upload failed: %s\n", SDL_GetError());
+            entry->live = false;
+        }
+    } else {
+        printf("Cover atlas full: %d pages, %d covers\n", atlas->page_count, atlas->entry_count);
+    }
+    SDL_FreeSurface(converted);
+    return slot;
+}
+
+// Frees the cover's space for the next one that fits. A stale slot is
+// ignored.
+void cover_atlas_release(CoverAtlas *atlas, CoverSlot slot) {
+    AtlasEntry *entry = slot_entry(atlas, slot);
+    if (entry) {
+        entry->live = false;
+    }
+}
+
+// Queues the cover for the next cover_atlas_flush(). Returns false if the
+// slot holds no cover, so the caller can draw a placeholder instead.
+bool cover_atlas_draw(CoverAtlas *atlas, CoverSlot slot, const SDL_Rect *destination) {
+    AtlasEntry *entry = slot_entry(atlas, slot);
+    if (!entry) {
+        return false;
+    }
+    AtlasPage *page = &atlas->pages[entry->page];
+    if (page->quad_count == page->quad_capacity) {
+        int capacity = page->quad_capacity ? page->quad_capacity * 2 : 64;
+        AtlasQuad *quads = realloc(page->quads, capacity * sizeof(AtlasQuad));
+        if (!quads) {
+            printf("Memory allocation failed for cover atlas\n");
+            return false;
+        }
+        page->quads = quads;
+        page->quad_capacity = capacity;
+    }
+    AtlasQuad *quad = &page->quads[page->quad_count++];
+    quad->source.x = entry->space.x;
+    quad->source.y = entry->space.y;
+    quad->source.w = entry->w;
+    quad->source.h = entry->h;
+    quad->destination = *destination;
+    entry->last_used = atlas->frame;
+    return true;
+}
+
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+static bool reserve_vertices(CoverAtlas *atlas, int quads) {
+    if (quads * 4 <= atlas->vertex_capacity) {
+        return true;
+    }
+    int capacity = atlas->vertex_capacity ? atlas->vertex_capacity : 256;
+    while (capacity < quads * 4) {
+        capacity *= 2;
+    }
+    SDL_Vertex *vertices = realloc(atlas->vertices, capacity * sizeof(SDL_Vertex));
+    if (vertices) {
+        atlas->vertices = vertices;
+    }
+    int *indices = vertices ? realloc(atlas->indices, capacity / 4 * 6 * sizeof(int)) : NULL;
+    if (!indices) {
+        printf("Memory allocation failed for cover atlas\n");
+        return false;
+    }
+    atlas->indices = indices;
+    atlas->vertex_capacity = capacity;
+    return true;
+}
+#endif
+
+// Draws every queued cover, one SDL_RenderGeometry call per page (one copy
+// per cover on SDL before 2.0.18), and starts the next frame. Returns the
+// number of draw calls.
+int cover_atlas_flush(CoverAtlas *atlas) {
+    Uint64 trace_start_time = trace_begin();
+    int calls = 0;
+    float scale = 1.0f / atlas->page_size;
+    for (int p = 0; p < atlas->page_count; p++) {
+        AtlasPage *page = &atlas->pages[p];
+        if (page->quad_count == 0) {
+            continue;
+        }
+#if SDL_VERSION_ATLEAST(2, 0, 18)
+        if (reserve_vertices(atlas, page->quad_count)) {
+            SDL_Color white = {255, 255, 255, 255};
+            for (int q = 0; q < page->quad_count; q++) {
+                const SDL_Rect *source = &page->quads[q].source;
+                const SDL_Rect *destination = &page->quads[q].destination;
+                float u0 = source->x * scale;
+                float v0 = source->y * scale;
+                float u1 = (source->x + source->w) * scale;
+                float v1 = (source->y + source->h) * scale;
+                float x0 = (float)destination->x;
+                float y0 = (float)destination->y;
+                float x1 = (float)(destination->x + destination->w);
+                float y1 = (float)(destination->y + destination->h);
+                SDL_Vertex *vertex = &atlas->vertices[q * 4];
+                vertex[0] = (SDL_Vertex){{x0, y0}, white, {u0, v0}};
+                vertex[1] = (SDL_Vertex){{x1, y0}, white, {u1, v0}};
+                vertex[2] = (SDL_Vertex){{x1, y1}, white, {u1, v1}};
+                vertex[3] = (SDL_Vertex){{x0, y1}, white, {u0, v1}};
+                int *index = &atlas->indices[q * 6];
+                index[0] = q * 4;
+                index[1] = q * 4 + 1;
+                index[2] = q * 4 + 2;
+                index[3] = q * 4;
+                index[4] = q * 4 + 2;
+                index[5] = q * 4 + 3;
+            }
+            SDL_RenderGeometry(atlas->renderer, page->texture, atlas->vertices, page->quad_count * 4, atlas->indices, page->quad_count * 6);
+            calls++;
+        }
+#else
+        for (int q = 0; q < page->quad_count; q++) {
+            SDL_RenderCopy(atlas->renderer, page->texture, &page->quads[q].source, &page->quads[q].destination);
+            calls++;
+        }
+#endif
+        page->quad_count = 0;
+    }
+    atlas->frame++;
+    atlas->draw_calls += calls;
+    trace_end("cover_atlas_flush", trace_start_time);
+    return calls;
+}
+
+void cover_atlas_free(CoverAtlas *atlas) {
+    for (int p = 0; p < atlas->page_count; p++) {
+        SDL_DestroyTexture(atlas->pages[p].texture);
+        free(atlas->pages[p].quads);
+    }
+    free(atlas->pages);
+    free(atlas->entries);
+    free(atlas->vertices);
+    free(atlas->indices);
+    memset(atlas, 0, sizeof(*atlas));
+}
@@ -0,0 +1,101 @@
+#ifndef COVER_ATLAS_H
+#define COVER_ATLAS_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#define ATLAS_PAGE_SIZE 2048
+#define ATLAS_MAX_PAGES 4
+#define ATLAS_MAX_SHELVES 64
+#define ATLAS_PADDING 1
+
+// Where a cover sits in the atlas. The stamp tells a slot that has since
+// been evicted and given to another cover apart from the one it was handed
+// out for. A zeroed slot holds no cover.
+typedef struct cover_slot {
+    int entry;
+    Uint32 stamp;
+} CoverSlot;
+
+// A rectangle of a page. `space` is what the packer gave out and keeps for
+// reuse; the cover itself fills the top-left `w` x `h` of it. `owner` is
+// the album the cover was inserted for.
+typedef struct atlas_entry {
+    int page;
+    SDL_Rect space;
+    int w;
+    int h;
+    int owner;
+    Uint32 stamp;
+    Uint32 last_used;
+    bool live;
+} AtlasEntry;
+
+// A row of the page as tall as the first cover placed in it, filled left
+// to right.
+typedef struct atlas_shelf {
+    int y;
+    int height;
+    int x;
+} AtlasShelf;
+
+// A quad queued for the next flush.
+typedef struct atlas_quad {
+    SDL_Rect source;
+    SDL_Rect destination;
+} AtlasQuad;
+
+typedef struct atlas_page {
+    SDL_Texture *texture;
+    AtlasShelf shelves[ATLAS_MAX_SHELVES];
+    int shelf_count;
+    int next_y;
+    AtlasQuad *quads;
+    int quad_count;
+    int quad_capacity;
+} AtlasPage;
+
+// Cover thumbnails packed into a few large textures by a shelf packer, so
+// every cover on screen is drawn with one SDL_RenderGeometry call per page
+// instead of one SDL_RenderCopy, and one texture bind, per album. Covers
+// larger than `cover_size` are scaled down to it before packing.
+//
+// Space freed by a released cover is reused by the next cover that fits in
+// it. Pages are added up to `max_pages`, or without limit when it is 0.
+// When none has room, the least recently drawn cover whose owner is outside
+// the pinned range [pinned_first, pinned_last) is evicted; its owner finds
+// its slot gone and loads the cover again. Render thread only.
+typedef struct cover_atlas {
+    SDL_Renderer *renderer;
+    int cover_size;
+    int page_size;
+    AtlasPage *pages;
+    int page_count;
+    int page_capacity;
+    int max_pages;
+    int pinned_first;
+    int pinned_last;
+    AtlasEntry *entries;
+    int entry_count;
+    int entry_capacity;
+    Uint32 frame;
+    Uint32 next_stamp;
+    SDL_Vertex *vertices;
+    int *indices;
+    int vertex_capacity;
+
+    int draw_calls;
+    int evictions;
+} CoverAtlas;
+
+void cover_atlas_init(CoverAtlas *atlas, SDL_Renderer *renderer, int cover_size, int max_pages);
+CoverSlot cover_atlas_insert(CoverAtlas *atlas, SDL_Surface *surface, int owner);
+void cover_atlas_set_owner(CoverAtlas *atlas, CoverSlot slot, int owner);
+void cover_atlas_pin(CoverAtlas *atlas, int first, int last);
+bool cover_atlas_contains(const CoverAtlas *atlas, CoverSlot slot);
+void cover_atlas_release(CoverAtlas *atlas, CoverSlot slot);
+bool cover_atlas_draw(CoverAtlas *atlas, CoverSlot slot, const SDL_Rect *destination);
+int cover_atlas_flush(CoverAtlas *atlas);
+void cover_atlas_free(CoverAtlas *atlas);
+
+#endif
@@ -0,0 +1,231 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL_image.h>
+#include "cover_loader.h"
+#include "thumbnail_cache.h"
+#include "trace.h"
+
+static int cover_worker(void *data) {
+    CoverLoader *loader = data;
+    trace_name_thread("cover_worker");
+
+    SDL_LockMutex(loader->lock);
+    while (true) {
+        while (!loader->quit && !loader->pending_head) {
+            SDL_CondWait(loader->wake, loader->lock);
+        }
+        if (loader->quit) {
+            break;
+        }
+        CoverJob *job = loader->pending_head;
+        loader->pending_head = job->next;
+        if (!loader->pending_head) {
+            loader->pending_tail = NULL;
+        }
+        SDL_UnlockMutex(loader->lock);
+
+        // Decode and convert to the texture format off the render thread, so
+        // the upload is a plain copy
+        Uint64 trace_start_time = trace_begin();
+        SDL_Surface *surface;
+        if (loader->thumbnail_size > 0) {
+            surface = thumbnail_load(job->path, loader->thumbnail_size);
+        } else if (!(surface = IMG_Load(job->path))) {
+            printf("Error loading image: %s - %s\n", job->path, IMG_GetError());
+        } else if (surface->format->format != SDL_PIXELFORMAT_ARGB8888) {
+            SDL_Surface *converted = SDL_ConvertSurfaceFormat(surface, SDL_PIXELFORMAT_ARGB8888, 0);
+            if (converted) {
+                SDL_FreeSurface(surface);
+                surface = converted;
+            }
+        }
+        trace_end("cover_decode", trace_start_time);
+        job->surface = surface;
+        job->next = NULL;
+
+        SDL_LockMutex(loader->lock);
+        if (loader->done_tail) {
+            loader->done_tail->next = job;
+        } else {
+            loader->done_head = job;
+        }
+        loader->done_tail = job;
+
+        SDL_Event event;
+        SDL_zero(event);
+        event.type = loader->ready_event;
+        SDL_PushEvent(&event);
+    }
+    SDL_UnlockMutex(loader->lock);
+    return 0;
+}
+
+bool cover_loader_start(CoverLoader *loader, Uint32 ready_event, int thumbnail_size) {
+    memset(loader, 0, sizeof(*loader));
+    loader->ready_event = ready_event;
+    loader->thumbnail_size = thumbnail_size;
+    loader->lock = SDL_CreateMutex();
+    loader->wake = SDL_CreateCond();
+    if (!loader->lock || !loader->wake) {
+        printf("Cover loader initialization failed: %s\n", SDL_GetError());
+        cover_loader_stop(loader);
+        return false;
+    }
+
+    // Leave a core for the render thread
+    int thread_count = SDL_GetCPUCount() - 1;
+    if (thread_count < 1) {
+        thread_count = 1;
+    } else if (thread_count > COVER_LOADER_MAX_THREADS) {
+        thread_count = COVER_LOADER_MAX_THREADS;
+    }
+    for (int i = 0; i < thread_count; i++) {
+        loader->threads[i] = SDL_CreateThread(cover_worker, "cover_worker", loader);
+        if (!loader->threads[i]) {
+            printf("Cover worker creation failed: %s\n", SDL_GetError());
+            break;
+        }
+        loader->thread_count++;
+    }
+    if (loader->thread_count == 0) {
+        cover_loader_stop(loader);
+        return false;
+    }
+    return true;
+}
+
+bool cover_loader_request(CoverLoader *loader, int album_index, const char *path) {
+    CoverJob *job = calloc(1, sizeof(CoverJob));
+    char *path_copy = malloc(strlen(path) + 1);
+    if (!job || !path_copy) {
+        printf("Memory allocation failed for cover job\n");
+        free(job);
+        free(path_copy);
+        return false;
+    }
+    strcpy(path_copy, path);
+    job->album_index = album_index;
+    job->path = path_copy;
+
+    SDL_LockMutex(loader->lock);
+    job->generation = loader->generation;
+    if (loader->pending_tail) {
+        loader->pending_tail->next = job;
+    } else {
+        loader->pending_head = job;
+    }
+    loader->pending_tail = job;
+    loader->outstanding++;
+    SDL_CondSignal(loader->wake);
+    SDL_UnlockMutex(loader->lock);
+    return true;
+}
+
+// Pops one decoded cover. `surface` is NULL if decoding failed; otherwise the
+// caller owns it. Covers requested before cover_loader_cancel_all() are
+// dropped here.
+bool cover_loader_collect(CoverLoader *loader, int *album_index, SDL_Surface **surface) {
+    SDL_LockMutex(loader->lock);
+    CoverJob *job;
+    while ((job = loader->done_head) != NULL) {
+        loader->done_head = job->next;
+        if (!loader->done_head) {
+            loader->done_tail = NULL;
+        }
+        loader->outstanding--;
+        if (job->generation == loader->generation) {
+            break;
+        }
+        SDL_FreeSurface(job->surface);
+        free(job->path);
+        free(job);
+    }
+    SDL_UnlockMutex(loader->lock);
+
+    if (!job) {
+        return false;
+    }
+    *album_index = job->album_index;
+    *surface = job->surface;
+    free(job->path);
+    free(job);
+    return true;
+}
+
+int cover_loader_outstanding(CoverLoader *loader) {
+    SDL_LockMutex(loader->lock);
+    int outstanding = loader->outstanding;
+    SDL_UnlockMutex(loader->lock);
+    return outstanding;
+}
+
+// Drops queued jobs for albums outside [first, last), e.g. ones that were
+// scrolled past before a worker got to them. Covers already being decoded
+// still arrive through cover_loader_collect.
+void cover_loader_cancel_outside(CoverLoader *loader, int first, int last) {
+    SDL_LockMutex(loader->lock);
+    CoverJob **link = &loader->pending_head;
+    loader->pending_tail = NULL;
+    while (*link) {
+        CoverJob *job = *link;
+        if (job->album_index < first || job->album_index >= last) {
+            *link = job->next;
+            loader->outstanding--;
+            free(job->path);
+            free(job);
+        } else {
+            loader->pending_tail = job;
+            link = &job->next;
+        }
+    }
+    SDL_UnlockMutex(loader->lock);
+}
+
+// Drops every request, including covers already being decoded, for when
+// the album indices they were made for no longer hold.
+void cover_loader_cancel_all(CoverLoader *loader) {
+    SDL_LockMutex(loader->lock);
+    loader->generation++;
+    SDL_UnlockMutex(loader->lock);
+    cover_loader_cancel_outside(loader, 0, 0);
+}
+
+static void free_jobs(CoverJob *job) {
+    while (job) {
+        CoverJob *next = job->next;
+        SDL_FreeSurface(job->surface);
+        free(job->path);
+        free(job);
+        job = next;
+    }
+}
+
+// Joins the workers and drops any covers that were never collected.
+void cover_loader_stop(CoverLoader *loader) {
+    if (loader->lock) {
+        SDL_LockMutex(loader->lock);
+        loader->quit = true;
+        SDL_CondBroadcast(loader->wake);
+        SDL_UnlockMutex(loader->lock);
+    }
+    for (int i = 0; i < loader->thread_count; i++) {
+        SDL_WaitThread(loader->threads[i], NULL);
+    }
+    loader->thread_count = 0;
+
+    free_jobs(loader->pending_head);
+    free_jobs(loader->done_head);
+    loader->pending_head = loader->pending_tail = NULL;
+    loader->done_head = loader->done_tail = NULL;
+    loader->outstanding = 0;
+
+    if (loader->wake) {
+        SDL_DestroyCond(loader->wake);
+        loader->wake = NULL;
+    }
+    if (loader->lock) {
+        SDL_DestroyMutex(loader->lock);
+        loader->lock = NULL;
+    }
+}
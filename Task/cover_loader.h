@@ -0,0 +1,45 @@
+#ifndef COVER_LOADER_H
+#define COVER_LOADER_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#define COVER_LOADER_MAX_THREADS 8
+
+typedef struct cover_job {
+    int album_index;
+    int generation;
+    char *path;
+    SDL_Surface *surface;
+    struct cover_job *next;
+} CoverJob;
+
+// Decodes cover images on a pool of worker threads. Decoded surfaces are
+// queued for the render thread, which turns them into textures; an SDL event
+// of type `ready_event` is pushed whenever one is ready. With a non-zero
+// `thumbnail_size` covers come from the on-disk thumbnail cache at that size.
+typedef struct cover_loader {
+    SDL_Thread *threads[COVER_LOADER_MAX_THREADS];
+    int thread_count;
+    SDL_mutex *lock;
+    SDL_cond *wake;
+    CoverJob *pending_head;
+    CoverJob *pending_tail;
+    CoverJob *done_head;
+    CoverJob *done_tail;
+    int outstanding;
+    int generation;
+    bool quit;
+    Uint32 ready_event;
+    int thumbnail_size;
+} CoverLoader;
+
+bool cover_loader_start(CoverLoader *loader, Uint32 ready_event, int thumbnail_size);
+bool cover_loader_request(CoverLoader *loader, int album_index, const char *path);
+bool cover_loader_collect(CoverLoader *loader, int *album_index, SDL_Surface **surface);
+int cover_loader_outstanding(CoverLoader *loader);
+void cover_loader_cancel_outside(CoverLoader *loader, int first, int last);
+void cover_loader_cancel_all(CoverLoader *loader);
+void cover_loader_stop(CoverLoader *loader);
+
+#endif
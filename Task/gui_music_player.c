@@ -1,271 +1,1450 @@
 #include <stdio.h>
 #include <stdbool.h>
+#include <math.h>
 #include <SDL2/SDL.h>
 #include <SDL2/SDL_image.h>
 #include <SDL2/SDL_mixer.h>
 #include <SDL2/SDL_ttf.h>
 #include "input_functions.h"
+#include "library.h"
+#include "catalog.h"
+#include "cover_atlas.h"
+#include "cover_loader.h"
+#include "thumbnail_cache.h"
+#include "layout.h"
+#include "audio_engine.h"
+#include "play_queue.h"
+#include "music_cache.h"
+#include "text_cache.h"
+#include "search_index.h"
+#include "library_scanner.h"
+#include "library_watch.h"
+#include "spectrum.h"
+#include "mix.h"
+#include "resampler.h"
+#include "track_decoder.h"
+#include "loudness.h"
+#include "seek_index.h"
+#include "session.h"
+#include "headless.h"
+#include "trace.h"
 
 #define WINDOW_WIDTH 600
 #define WINDOW_HEIGHT 700
-#define FONT_SIZE 25
-
-#define MARGIN_LEFT 50
-#define ALBUM_SPACE 300
-#define TRACK_SPACING 50
-#define COVER_SIZE 200
-#define TRACK_LIST_X 300
-#define COVER_Y_OFFSET 50
 
 #define AUDIO_FREQUENCY 44100
-#define AUDIO_CHUNK_SIZE 2048
-
-#define MAX_PATH_LENGTH 256
+#define AUDIO_CHUNK_SIZE 256
+
+#define ALBUMS_PATH "albums.txt"
+#define CATALOG_PATH "albums.cat"
+
+#define MUSIC_CACHE_HANDLES 8
+#define MUSIC_CACHE_MEGABYTES 256
+#define PREFETCH_TRACKS 1
+
+#define POSITION_TICK_MS 1000
+#define IDLE_WAIT_MS 5000
+#define SESSION_SAVE_MS 60000
+
+#define SCROLL_STEP 100
+#define SCROLL_FRAME_MS 16
+#define SPECTRUM_FRAME_MS 33
+#define PREFETCH_ALBUMS 2
+#define MAX_DAMAGED_ALBUMS 16
+
+#define SEARCH_RESULTS 8
+#define SEARCH_BAR_HEIGHT 35
+
+#define BENCH_ALBUMS 5000
+#define BENCH_TRACKS_PER_ALBUM 10
+#define BENCH_LOOKUPS 1000000
+#define BENCH_SPECTRUM_BLOCKS 20000
+#define BENCH_MIX_BLOCKS 200000
+#define BENCH_RESAMPLE_SECONDS 10
+#define BENCH_SEARCH_ALBUMS 100000
+#define BENCH_SEARCH_WORDS 20000
+#define BENCH_SEARCH_QUERIES 10000
+#define BENCH_INPUT_RECORDS 100000
+#define BENCH_INPUT_TRACKS 10
+#define BENCH_INPUT_PATH "bench_input.txt"
 
 const SDL_Color COLOR_WHITE = {255, 255, 255};
 const SDL_Color COLOR_RED = {255, 0, 0};
 
-typedef enum genre {
-    POP = 1,
-    CLASSIC = 2,
-    JAZZ = 3,
-    ROCK = 4
-} Genre;
+typedef struct player_options {
+    int cache_handles;
+    int cache_megabytes;
+    int prefetch_tracks;
+    int audio_buffer;
+    int audio_rate;
+    ResampleQuality resample_quality;
+    int ring_frames;
+    bool vsync;
+    int frame_cap;
+    bool build_catalog;
+    bool serial_covers;
+    bool thumbnails;
+    bool spectrum;
+    bool loudness;
+    bool seek_index;
+    bool session;
+    bool watch;
+    int crossfade_ms;
+    bool bench_hit_test;
+    bool bench_spectrum;
+    bool bench_mix;
+    bool bench_resample;
+    bool bench_seek;
+    bool bench_search;
+    bool bench_input;
+    HeadlessCommand headless;
+    const char *headless_argument;
+    const char *scan_root;
+    const char *trace_path;
+} PlayerOptions;
+
+// Which album panels need re-rendering into the canvas on the next frame.
+// Damaging more panels than fit in the list falls back to a full redraw.
+typedef struct damage {
+    bool full;
+    bool any;
+    int albums[MAX_DAMAGED_ALBUMS];
+    int count;
+} Damage;
+
+// Scroll position of the album list, and the range of albums whose covers
+// are kept resident: the visible ones plus PREFETCH_ALBUMS on either side.
+typedef struct view {
+    int scroll_y;
+    int target_scroll_y;
+    int max_scroll_y;
+    int first_resident;
+    int last_resident;
+} View;
+
+// Type-ahead search, opened with Ctrl+F. The selected result is shown by
+// scrolling to its album and expanding it, so it is drawn like any other.
+typedef struct search {
+    bool active;
+    char query[SEARCH_MAX_QUERY];
+    SearchResult results[SEARCH_RESULTS];
+    int count;
+    int selected;
+} Search;
+
+// The current track's place in its progress bar, which is only drawn once
+// the length is known.
+typedef struct progress {
+    Uint32 position_ms;
+    Uint32 duration_ms;
+} Progress;
+
+// Length of the current track from the seek index, asked for again only
+// when the track changes or, while it is unknown, when the index has been
+// through more files.
+typedef struct track_length {
+    int album;
+    int track;
+    int checked;
+    Uint32 duration_ms;
+} TrackLength;
+
+bool parse_options(int argc, char **argv, PlayerOptions *options) {
+    options->cache_handles = MUSIC_CACHE_HANDLES;
+    options->cache_megabytes = MUSIC_CACHE_MEGABYTES;
+    options->prefetch_tracks = PREFETCH_TRACKS;
+    options->audio_buffer = AUDIO_CHUNK_SIZE;
+    options->audio_rate = 0;
+    options->resample_quality = RESAMPLE_MEDIUM;
+    options->ring_frames = ENGINE_RING_FRAMES;
+    options->vsync = false;
+    options->frame_cap = 0;
+    options->build_catalog = false;
+    options->serial_covers = false;
+    options->thumbnails = true;
+    options->spectrum = true;
+    options->loudness = true;
+    options->seek_index = true;
+    options->session = true;
+    options->watch = true;
+    options->crossfade_ms = 0;
+    options->bench_hit_test = false;
+    options->bench_spectrum = false;
+    options->bench_mix = false;
+    options->bench_resample = false;
+    options->bench_seek = false;
+    options->bench_search = false;
+    options->bench_input = false;
+    options->headless = HEADLESS_NONE;
+    options->headless_argument = NULL;
+    options->scan_root = NULL;
+    options->trace_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        bool has_value = i + 1 < argc;
+        if (strcmp(argv[i], "--cache-tracks") == 0 && has_value) {
+            options->cache_handles = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--cache-mb") == 0 && has_value) {
+            options->cache_megabytes = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--prefetch") == 0 && has_value) {
+            options->prefetch_tracks = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--audio-buffer") == 0 && has_value) {
+            options->audio_buffer = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--audio-rate") == 0 && has_value) {
+            options->audio_rate = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--resample") == 0 && has_value) {
+            i++;
+            if (strcmp(argv[i], "low") == 0) {
+                options->resample_quality = RESAMPLE_LOW;
+            } else if (strcmp(argv[i], "medium") == 0) {
+                options->resample_quality = RESAMPLE_MEDIUM;
+            } else if (strcmp(argv[i], "high") == 0) {
+                options->resample_quality = RESAMPLE_HIGH;
+            } else {
+                printf("Unknown resample quality: %s\n", argv[i]);
+                return false;
+            }
+        } else if (strcmp(argv[i], "--ring-frames") == 0 && has_value) {
+            options->ring_frames = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--vsync") == 0) {
+            options->vsync = true;
+        } else if (strcmp(argv[i], "--fps") == 0 && has_value) {
+            options->frame_cap = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--build-catalog") == 0) {
+            options->build_catalog = true;
+        } else if (strcmp(argv[i], "--serial-covers") == 0) {
+            options->serial_covers = true;
+        } else if (strcmp(argv[i], "--no-thumbnails") == 0) {
+            options->thumbnails = false;
+        } else if (strcmp(argv[i], "--no-spectrum") == 0) {
+            options->spectrum = false;
+        } else if (strcmp(argv[i], "--no-loudness") == 0) {
+            options->loudness = false;
+        } else if (strcmp(argv[i], "--no-seek-index") == 0) {
+            options->seek_index = false;
+        } else if (strcmp(argv[i], "--no-session") == 0) {
+            options->session = false;
+        } else if (strcmp(argv[i], "--no-watch") == 0) {
+            options->watch = false;
+        } else if (strcmp(argv[i], "--crossfade") == 0 && has_value) {
+            options->crossfade_ms = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--bench-hit-test") == 0) {
+            options->bench_hit_test = true;
+        } else if (strcmp(argv[i], "--bench-spectrum") == 0) {
+            options->bench_spectrum = true;
+        } else if (strcmp(argv[i], "--bench-mix") == 0) {
+            options->bench_mix = true;
+        } else if (strcmp(argv[i], "--bench-resample") == 0) {
+            options->bench_resample = true;
+        } else if (strcmp(argv[i], "--bench-seek") == 0) {
+            options->bench_seek = true;
+        } else if (strcmp(argv[i], "--bench-search") == 0) {
+            options->bench_search = true;
+        } else if (strcmp(argv[i], "--bench-input") == 0) {
+            options->bench_input = true;
+        } else if (strcmp(argv[i], "--headless") == 0 && has_value) {
+            const char *name = argv[++i];
+            options->headless = headless_parse_command(name, i + 1 < argc ? argv[i + 1] : NULL);
+            if (options->headless == HEADLESS_NONE) {
+                printf("Unknown headless command: %s (expected list, search QUERY, validate, export json or export csv)\n", name);
+                return false;
+            }
+            if (headless_takes_argument(options->headless)) {
+                options->headless_argument = argv[++i];
+            }
+        } else if (strcmp(argv[i], "--scan") == 0 && has_value) {
+            options->scan_root = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && has_value) {
+            options->trace_path = argv[++i];
+        } else {
+            printf("Unknown option: %s\n", argv[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+void damage_album(Damage *damage, int album_index) {
+    if (damage->full) {
+        return;
+    }
+    for (int i = 0; i < damage->count; i++) {
+        if (damage->albums[i] == album_index) {
+            return;
+        }
+    }
+    if (damage->count == MAX_DAMAGED_ALBUMS) {
+        damage->full = true;
+    } else {
+        damage->albums[damage->count++] = album_index;
+    }
+    damage->any = true;
+}
+
+void damage_all(Damage *damage) {
+    damage->full = true;
+    damage->any = true;
+}
+
+void damage_clear(Damage *damage) {
+    damage->count = 0;
+    damage->full = false;
+    damage->any = false;
+}
 
-typedef struct track {
-    Mix_Music *music;
-    char title[256];
-    char location[MAX_PATH_LENGTH];
-} Track;
+// The search bar is drawn over the canvas on every frame, so changing it
+// only needs a frame, not a repainted panel.
+void damage_overlay(Damage *damage) {
+    damage->any = true;
+}
 
-void trim_newline(char *str) {
-    char *newline = strpbrk(str, "\r\n");
-    if (newline) {
-        *newline = '\0';
+bool is_damaged(const Damage *damage, int album_index) {
+    for (int i = 0; i < damage->count; i++) {
+        if (damage->albums[i] == album_index) {
+            return true;
+        }
     }
+    return false;
 }
 
-typedef struct album {
-    SDL_Texture *cover;
-    char title[MAX_PATH_LENGTH];
-    char artist[MAX_PATH_LENGTH];
-    char photo_location[MAX_PATH_LENGTH];
-    Genre genre;
-    int number_of_tracks;
-    Track *tracks;
-} Album;
+void view_init(View *view, int number_of_albums) {
+    memset(view, 0, sizeof(*view));
+    view->max_scroll_y = number_of_albums * ALBUM_SPACE - WINDOW_HEIGHT;
+    if (view->max_scroll_y < 0) {
+        view->max_scroll_y = 0;
+    }
+}
 
-Track read_track(FILE *fptr) {
-    Track track = {0};
-    if (!fgets(track.title, sizeof(track.title), fptr) || !fgets(track.location, sizeof(track.location), fptr)) {
-        printf("Error reading track information\n");
-        return track;
+// Follows a library that gained or lost albums, keeping the scroll position
+// where it still fits.
+void view_resize(View *view, int number_of_albums) {
+    view->max_scroll_y = number_of_albums * ALBUM_SPACE - WINDOW_HEIGHT;
+    if (view->max_scroll_y < 0) {
+        view->max_scroll_y = 0;
+    }
+    if (view->scroll_y > view->max_scroll_y) {
+        view->scroll_y = view->max_scroll_y;
+    }
+    if (view->target_scroll_y > view->max_scroll_y) {
+        view->target_scroll_y = view->max_scroll_y;
     }
-    trim_newline(track.title);
-    trim_newline(track.location);
+}
 
-    printf("Loading music: %s\n", track.location);
-    track.music = Mix_LoadMUS(track.location);
-    if (!track.music) {
-        printf("Error loading music: %s - %s\n", track.location, Mix_GetError());
+void view_scroll_by(View *view, int delta) {
+    view->target_scroll_y += delta;
+    if (view->target_scroll_y < 0) {
+        view->target_scroll_y = 0;
+    } else if (view->target_scroll_y > view->max_scroll_y) {
+        view->target_scroll_y = view->max_scroll_y;
     }
+}
 
-    return track;
+void view_scroll_to(View *view, int y) {
+    view_scroll_by(view, y - view->target_scroll_y);
 }
 
-Track *read_tracks(FILE *fptr, int number_of_tracks) {
-    Track *tracks = malloc(number_of_tracks * sizeof(Track));
-    if (!tracks) {
-        printf("Memory allocation failed for tracks\n");
-        return NULL;
+// Eases the scroll position a quarter of the way towards its target. Returns
+// true if it moved.
+bool view_animate(View *view) {
+    int distance = view->target_scroll_y - view->scroll_y;
+    if (distance == 0) {
+        return false;
     }
+    int step = distance / 4;
+    if (step == 0) {
+        step = distance > 0 ? 1 : -1;
+    }
+    view->scroll_y += step;
+    return true;
+}
 
-    for (int i = 0; i < number_of_tracks; i++) {
-        tracks[i] = read_track(fptr);
+// Albums in [*first, *last) intersect the window.
+void view_visible_range(const View *view, int number_of_albums, int *first, int *last) {
+    *first = view->scroll_y / ALBUM_SPACE;
+    *last = (view->scroll_y + WINDOW_HEIGHT + ALBUM_SPACE - 1) / ALBUM_SPACE;
+    if (*last > number_of_albums) {
+        *last = number_of_albums;
     }
+}
 
-    return tracks;
+// The visible albums plus PREFETCH_ALBUMS on either side, whose covers and
+// text stay cached.
+void view_resident_range(const View *view, int number_of_albums, int *first, int *last) {
+    view_visible_range(view, number_of_albums, first, last);
+    *first = *first > PREFETCH_ALBUMS ? *first - PREFETCH_ALBUMS : 0;
+    *last = *last + PREFETCH_ALBUMS < number_of_albums ? *last + PREFETCH_ALBUMS : number_of_albums;
 }
 
-Album read_album(FILE *fptr, SDL_Renderer *renderer) {
-    Album album = {0};
+// Keeps covers in the atlas only for albums near the viewport. Covers
+// entering the range, marked COVER_NONE inside it because their image
+// changed, or evicted from the atlas are requested from the loader; covers
+// leaving it give up their atlas space, and queued requests for them are
+// cancelled. Covers inside it are pinned, so a cover arriving for one album
+// never evicts another that is about to be drawn.
+void update_resident_covers(View *view, Library *library, CoverLoader *loader, CoverAtlas *atlas) {
+    Album *albums = library->albums;
+    int number_of_albums = library->number_of_albums;
+    int first, last;
+    view_resident_range(view, number_of_albums, &first, &last);
+    if (first != view->first_resident || last != view->last_resident) {
+        for (int i = view->first_resident; i < view->last_resident; i++) {
+            if (i >= first && i < last) {
+                continue;
+            }
+            cover_atlas_release(atlas, albums[i].cover);
+            albums[i].cover_state = COVER_NONE;
+        }
+        cover_loader_cancel_outside(loader, first, last);
+    }
+    cover_atlas_pin(atlas, first, last);
 
-    if (!fgets(album.title, sizeof(album.title), fptr) ||
-        !fgets(album.artist, sizeof(album.artist), fptr) ||
-        !fgets(album.photo_location, sizeof(album.photo_location), fptr)) {
-        printf("Error reading album information\n");
-        return album;
+    for (int i = first; i < last; i++) {
+        if (albums[i].cover_state == COVER_READY && !cover_atlas_contains(atlas, albums[i].cover)) {
+            albums[i].cover_state = COVER_NONE;
+        }
+        if (albums[i].cover_state == COVER_NONE && cover_loader_request(loader, i, library_string(library, albums[i].photo_location))) {
+            albums[i].cover_state = COVER_PENDING;
+        }
     }
-    trim_newline(album.title);
-    trim_newline(album.artist);
-    trim_newline(album.photo_location);
+    view->first_resident = first;
+    view->last_resident = last;
+}
 
-    SDL_Surface *surface = IMG_Load(album.photo_location);
-    if (!surface) {
-        printf("Error loading image: %s\n", album.photo_location, IMG_GetError());
-    } else {
-        album.cover = SDL_CreateTextureFromSurface(renderer, surface);
+// Decodes every cover on the calling thread. Kept for --serial-covers, to
+// compare against the CoverLoader. Every cover stays resident, so the atlas
+// gets as many pages as they need.
+void load_covers(Library *library, CoverAtlas *atlas, int thumbnail_size) {
+    atlas->max_pages = 0;
+    for (int i = 0; i < library->number_of_albums; i++) {
+        Album *album = &library->albums[i];
+        const char *photo_location = library_string(library, album->photo_location);
+        SDL_Surface *surface;
+        if (thumbnail_size > 0) {
+            surface = thumbnail_load(photo_location, thumbnail_size);
+        } else {
+            Uint64 trace_start_time = trace_begin();
+            surface = IMG_Load(photo_location);
+            trace_end("IMG_Load", trace_start_time);
+            if (!surface) {
+                printf("Error loading image: %s - %s\n", photo_location, IMG_GetError());
+            }
+        }
+        if (!surface) {
+            printf("Error loading album cover for album %d\n", i + 1);
+            album->cover_state = COVER_FAILED;
+            continue;
+        }
+        album->cover = cover_atlas_insert(atlas, surface, i);
+        album->cover_state = cover_atlas_contains(atlas, album->cover) ? COVER_READY : COVER_FAILED;
         SDL_FreeSurface(surface);
     }
+}
+
+bool is_point_in_rect(int x, int y, SDL_Rect rect) {
+    return (x >= rect.x && x <= rect.x + rect.w && y >= rect.y && y <= rect.y + rect.h);
+}
+
+// Left-clicking an album selects it and stops playback; left-clicking a
+// track plays the album from there; right-clicking a track queues it.
+void handle_click(Hit hit, int button, const Library *library, PlayQueue *queue, int *current_album, int *current_track) {
+    int a = hit.album;
+    int t = hit.track;
+
+    if (hit.kind == HIT_ALBUM && button == SDL_BUTTON_LEFT) {
+        printf("Album %d clicked\n", a + 1);
+
+        // Update current album and reset current track
+        *current_album = a;
+        *current_track = -1;
 
-    int genre_code;
-    if (fscanf(fptr, "%d\n", &genre_code) != 1) {
-        printf("Error reading genre information\n");
-        return album;
+        // Stop any currently playing music and hand it back to the cache
+        play_queue_stop(queue);
+    } else if (hit.kind == HIT_TRACK && button == SDL_BUTTON_LEFT) {
+        printf("Track %d in Album %d clicked\n", t + 1, a + 1);
+
+        // Play the rest of the album from the selected track
+        play_queue_play_album(queue, library, a, t);
+    } else if (hit.kind == HIT_TRACK && button == SDL_BUTTON_RIGHT) {
+        play_queue_append(queue, library, a, t);
     }
-    album.genre = (Genre)genre_code;
+}
+
+// Points the selection at whatever the queue is playing.
+void follow_queue(const PlayQueue *queue, int *current_album, int *current_track) {
+    if (!play_queue_current(queue, current_album, current_track)) {
+        *current_track = -1;
+    }
+}
 
-    if (fscanf(fptr, "%d\n", &album.number_of_tracks) != 1) {
-        printf("Error reading number of tracks\n");
-        return album;
+// Where a file kept about the library goes: in the --scan folder, or beside
+// albums.txt.
+void library_file_path(char *path, size_t size, const char *scan_root, const char *name) {
+    if (scan_root) {
+        snprintf(path, size, "%s/%s", scan_root, name);
+        return;
     }
+    const char *slash = strrchr(ALBUMS_PATH, '/');
+    int folder_length = slash ? (int)(slash - ALBUMS_PATH + 1) : 0;
+    snprintf(path, size, "%.*s%s", folder_length, ALBUMS_PATH, name);
+}
 
-    album.tracks = read_tracks(fptr, album.number_of_tracks);
+// Where the current track is. Until it is decoded and playing, its length
+// comes from the seek index, so the bar appears as soon as it is chosen.
+Progress track_progress(AudioEngine *engine, SeekIndex *seek_index, TrackLength *length, const Library *library, int current_album, int current_track) {
+    Progress progress = {0, 0};
+    if (current_track < 0) {
+        return progress;
+    }
+    if (audio_engine_is_playing(engine)) {
+        progress.position_ms = audio_engine_position_ms(engine);
+        progress.duration_ms = audio_engine_duration_ms(engine);
+    } else if (seek_index) {
+        int checked = SDL_AtomicGet(&seek_index->checked);
+        if (length->album != current_album || length->track != current_track || (length->duration_ms == 0 && length->checked != checked)) {
+            char location[MAX_PATH_LENGTH];
+            library_track_location(library, current_album, current_track, location, sizeof(location));
+            length->album = current_album;
+            length->track = current_track;
+            length->checked = checked;
+            length->duration_ms = 0;
+            seek_index_duration_ms(seek_index, location, &length->duration_ms);
+        }
+        progress.duration_ms = length->duration_ms;
+    }
+    return progress;
+}
 
-    return album;
+// Seeks the playing track to `fraction` of its length and returns where it
+// went, or false if nothing is playing.
+bool scrub(AudioEngine *engine, float fraction, Uint32 *position_ms) {
+    Uint32 duration = audio_engine_duration_ms(engine);
+    if (duration == 0) {
+        return false;
+    }
+    *position_ms = (Uint32)(fraction * duration);
+    audio_engine_seek(engine, *position_ms);
+    return true;
 }
 
-Album *read_albums(FILE *fptr, int *number_of_albums, SDL_Renderer *renderer) {
-    if (fscanf(fptr, "%d\n", number_of_albums) != 1) {
-        printf("Error reading number of albums\n");
-        return NULL;
+// Applies files that changed under the library without reloading it. Covers
+// whose image changed go back to COVER_NONE, keeping the old texture until
+// the loader delivers the new one; changed tracks lose their decoded PCM.
+// The changes are sorted once, so each cover and track is two binary
+// searches on its interned folder and name, and a location is only put
+// together for a track that is evicted. Returns true if any track was
+// affected.
+bool refresh_media(Library *library, char **changes, int count, bool everything, AudioEngine *engine, Damage *damage) {
+    library_watch_sort(changes, count);
+    bool tracks_changed = false;
+    for (int a = 0; a < library->number_of_albums; a++) {
+        Album *album = &library->albums[a];
+        const char *photo_location = library_string(library, album->photo_location);
+        const char *slash = strrchr(photo_location, '/');
+        size_t photo_folder = slash ? (size_t)(slash - photo_location) + 1 : 0;
+        if (everything || library_watch_affects_sorted(changes, count, photo_location, photo_folder, photo_location + photo_folder)) {
+            if (album->cover_state != COVER_PENDING) {
+                album->cover_state = COVER_NONE;
+            }
+            damage_album(damage, a);
+        }
+        for (int t = album->first_track; t < album->first_track + album->number_of_tracks; t++) {
+            const char *folder = library_string(library, library->track_folders[t]);
+            if (everything || library_watch_affects_sorted(changes, count, folder, strlen(folder), library_string(library, library->track_files[t]))) {
+                char location[MAX_PATH_LENGTH];
+                library_track_location(library, a, t - album->first_track, location, sizeof(location));
+                audio_engine_evict(engine, location);
+                tracks_changed = true;
+            }
+        }
     }
+    return tracks_changed;
+}
 
-    Album *albums = malloc(*number_of_albums * sizeof(Album));
-    if (!albums) {
-        printf("Memory allocation failed for albums\n");
-        return NULL;
+// Moves the search index from `old` over to `library`. `kept_map` gives
+// each old album's index in `library`, or -1 if it was removed or changed:
+// those albums are dropped, the others keep their entries, and the albums
+// nothing maps to are indexed. Falls back to a full build when search was
+// disabled, `kept_map` is NULL or an update fails.
+static void update_search_index(SearchIndex *index, const Library *old, const Library *library, const int *kept_map) {
+    bool *kept = calloc((size_t)(library->number_of_albums > 0 ? library->number_of_albums : 1), sizeof(bool));
+    bool updated = index->strings && kept_map && kept;
+    for (int i = 0; updated && i < old->number_of_albums; i++) {
+        if (kept_map[i] < 0) {
+            search_index_remove_album(index, i);
+        } else {
+            kept[kept_map[i]] = true;
+        }
+    }
+    updated = updated && search_index_remap(index, old, library, kept_map);
+    for (int j = 0; updated && j < library->number_of_albums; j++) {
+        if (!kept[j]) {
+            updated = search_index_add_album(index, library, j);
+        }
     }
+    free(kept);
+    if (!updated) {
+        search_index_free(index);
+        if (!search_index_build(index, library)) {
+            printf("Search disabled\n");
+        }
+    }
+}
 
-    for (int i = 0; i < *number_of_albums; i++) {
-        albums[i] = read_album(fptr, renderer);
-        if (!albums[i].cover) {
-            printf("Error loading album cover for album %d\n", i + 1);
+// Re-reads albums.txt, or rescans the --scan folder, and swaps the result in
+// with only the albums that changed losing anything: matched albums keep
+// their covers unless the cover path moved, cached PCM is dropped
+// only for tracks that left their album, and the play queue and selection
+// follow their tracks to the new indices. The track playing is never
+// interrupted, since the engine holds its own copy of it. The search index
+// and the text cache drop the albums that were removed or changed, and the
+// new and changed albums are indexed. The caller stops anything else that
+// reads the library (the loudness scan) first and rebuilds the layout
+// afterwards.
+bool reload_library(Library *library, const char *scan_root, PlayQueue *queue, CoverLoader *loader, CoverAtlas *atlas, View *view, SearchIndex *search_index, TextCache *text_cache, int *current_album, int *current_track) {
+    Uint64 started = SDL_GetPerformanceCounter();
+    Uint64 trace_start_time = trace_begin();
+    Library fresh;
+    bool loaded = scan_root ? library_scan(&fresh, scan_root, SCAN_CACHE_PATH) : library_load(&fresh, ALBUMS_PATH, NULL);
+    LibraryDiff diff;
+    if (!loaded || !library_diff(library, &fresh, &diff)) {
+        printf("Library reload failed, keeping the current library\n");
+        if (loaded) {
+            library_free(&fresh);
         }
+        trace_end("library_reload", trace_start_time);
+        return false;
     }
 
-    return albums;
+    // Album indices change, so nothing the loader has in flight still fits
+    if (loader) {
+        cover_loader_cancel_all(loader);
+    }
+    // Where each old album went, or -1 unless it is still the same
+    int *kept_map = malloc((size_t)(library->number_of_albums > 0 ? library->number_of_albums : 1) * sizeof(int));
+    for (int i = 0; i < library->number_of_albums; i++) {
+        Album *album = &library->albums[i];
+        int j = diff.album_map[i];
+        bool same_cover = j >= 0 && strcmp(library_string(library, album->photo_location), library_string(&fresh, fresh.albums[j].photo_location)) == 0;
+        if (same_cover && cover_atlas_contains(atlas, album->cover)) {
+            fresh.albums[j].cover = album->cover;
+            cover_atlas_set_owner(atlas, album->cover, j);
+            fresh.albums[j].cover_state = album->cover_state == COVER_READY ? COVER_READY : COVER_NONE;
+        } else {
+            cover_atlas_release(atlas, album->cover);
+        }
+        bool same_album = j >= 0 && library_album_equal(library, i, &fresh, j);
+        if (kept_map) {
+            kept_map[i] = same_album ? j : -1;
+        }
+        if (same_album) {
+            continue;
+        }
+
+        // A track no longer in its album may have been replaced on disk
+        for (int t = 0; t < album->number_of_tracks; t++) {
+            char location[MAX_PATH_LENGTH];
+            library_track_location(library, i, t, location, sizeof(location));
+            bool kept = false;
+            for (int u = 0; j >= 0 && u < fresh.albums[j].number_of_tracks && !kept; u++) {
+                char candidate[MAX_PATH_LENGTH];
+                library_track_location(&fresh, j, u, candidate, sizeof(candidate));
+                kept = strcmp(candidate, location) == 0;
+            }
+            if (!kept) {
+                audio_engine_evict(queue->engine, location);
+            }
+        }
+    }
+
+    play_queue_remap(queue, library, &fresh, diff.album_map);
+    int album = *current_album < library->number_of_albums ? diff.album_map[*current_album] : -1;
+    *current_album = album >= 0 ? album : 0;
+    *current_track = -1;
+    follow_queue(queue, current_album, current_track);
+
+    // The old library is kept until the search index has moved over to the
+    // new one, since its entries point into the old arena
+    Library old = *library;
+    *library = fresh;
+    update_search_index(search_index, &old, library, kept_map);
+    if (kept_map) {
+        text_cache_remap(text_cache, kept_map, old.number_of_albums);
+    } else {
+        text_cache_invalidate(text_cache);
+    }
+    free(kept_map);
+    library_free(&old);
+
+    printf("Library reloaded in %.1f ms: %d albums added, %d removed, %d modified\n",
+           (double)(SDL_GetPerformanceCounter() - started) * 1000.0 / (double)SDL_GetPerformanceFrequency(), diff.added, diff.removed, diff.modified);
+    library_diff_free(&diff);
+
+    // Claim every album is resident so the next update destroys the textures
+    // carried over outside the visible range
+    view_resize(view, library->number_of_albums);
+    view->first_resident = 0;
+    view->last_resident = library->number_of_albums;
+    trace_end("library_reload", trace_start_time);
+    return true;
 }
 
-bool is_point_in_rect(int x, int y, SDL_Rect rect) {
-    return (x >= rect.x && x <= rect.x + rect.w && y >= rect.y && y <= rect.y + rect.h);
+// Snapshots what is on screen and playing, for the next launch to start
+// from, and hands it to the writer thread. Unless `force` is set nothing is
+// written when the screen is the same as at the last save. Only the
+// albums.txt library is snapshotted; a --scan library would need the whole
+// tree walked to validate it.
+void save_session(SessionWriter *writer, const Library *library, const Layout *layout, const View *view, AudioEngine *engine, int current_album, int current_track, int cover_size, bool force) {
+    SessionSnapshot *snapshot = session_snapshot_take(library, layout, current_album, view->first_resident, view->last_resident, cover_size);
+    if (snapshot) {
+        snapshot->current_track = current_track;
+        snapshot->scroll_y = view->target_scroll_y;
+        snapshot->playing = audio_engine_is_playing(engine);
+        snapshot->position_ms = audio_engine_position_ms(engine);
+        session_writer_submit(writer, snapshot, force);
+    }
 }
 
-void handle_click(int mouse_x, int mouse_y, Album *albums, int number_of_albums, Mix_Music **current_music, int *current_album, int *current_track) {
-    for (int a = 0; a < number_of_albums; a++) {
-        SDL_Rect album_rect = {MARGIN_LEFT, COVER_Y_OFFSET + a * ALBUM_SPACE, COVER_SIZE, COVER_SIZE};
+void search_open(Search *search) {
+    memset(search, 0, sizeof(*search));
+    search->active = true;
+    SDL_StartTextInput();
+}
+
+void search_close(Search *search) {
+    search->active = false;
+    SDL_StopTextInput();
+}
+
+// Re-runs the query after every keystroke; the index answers in well under
+// a frame, so there is no need to debounce.
+void search_update(Search *search, const SearchIndex *index) {
+    Uint64 started = SDL_GetPerformanceCounter();
+    search->count = search_index_query(index, search->query, search->results, SEARCH_RESULTS);
+    search->selected = 0;
+    Uint64 finished = SDL_GetPerformanceCounter();
+    if (trace_enabled) {
+        trace_record("search_query", started, finished);
+    }
+    double ms = (double)(finished - started) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    printf("Search \"%s\": %d results in %.3f ms\n", search->query, search->count, ms);
+}
+
+void search_append(Search *search, const SearchIndex *index, const char *text) {
+    size_t length = strlen(search->query);
+    if (length + strlen(text) >= sizeof(search->query)) {
+        return;
+    }
+    strcpy(search->query + length, text);
+    search_update(search, index);
+}
 
-        if (mouse_x >= album_rect.x && mouse_x <= album_rect.x + album_rect.w &&
-            mouse_y >= album_rect.y && mouse_y <= album_rect.y + album_rect.h) {
-            printf("Album %d clicked\n", a + 1);
-            
-            // Update current album and reset current track
-            *current_album = a;
-            *current_track = -1;
+// Removes the last character, including all bytes of a UTF-8 sequence.
+void search_backspace(Search *search, const SearchIndex *index) {
+    size_t length = strlen(search->query);
+    while (length > 0 && (search->query[--length] & 0xC0) == 0x80) {
+    }
+    search->query[length] = '\0';
+    search_update(search, index);
+}
+
+void search_select(Search *search, int delta) {
+    if (search->count > 0) {
+        search->selected = (search->selected + delta + search->count) % search->count;
+    }
+}
 
-            // Stop any currently playing music
-            if (*current_music) {
-                Mix_FreeMusic(*current_music);
-                *current_music = NULL;
+// Scrolls to the selected result. Its album is expanded by shown_album()
+// and its track outlined, without touching what is playing.
+void search_show(const Search *search, View *view) {
+    if (search->count == 0) {
+        return;
+    }
+    view_scroll_to(view, search->results[search->selected].album * ALBUM_SPACE - SEARCH_BAR_HEIGHT);
+}
+
+// The expanded album: the selected search result's while a search shows
+// one, otherwise the current album.
+int shown_album(const Search *search, int current_album) {
+    return search->active && search->count > 0 ? search->results[search->selected].album : current_album;
+}
+
+// The selected search result's track, or -1 for none or an album result.
+int shown_track(const Search *search) {
+    return search->active && search->count > 0 ? search->results[search->selected].track : -1;
+}
+
+// The nested scan handle_click() used before the layout cache, kept as the
+// baseline for --bench-hit-test.
+static Hit linear_hit_test(const Library *library, int mouse_x, int mouse_y) {
+    Hit hit = {HIT_NONE, -1, -1, 0.0f};
+    for (int a = 0; a < library->number_of_albums; a++) {
+        SDL_Rect album_rect = {MARGIN_LEFT, COVER_Y_OFFSET + a * ALBUM_SPACE, COVER_SIZE, COVER_SIZE};
+        if (is_point_in_rect(mouse_x, mouse_y, album_rect)) {
+            hit.kind = HIT_ALBUM;
+            hit.album = a;
+            return hit;
+        }
+        for (int t = 0; t < library->albums[a].number_of_tracks; t++) {
+            SDL_Rect track_rect = {TRACK_LIST_X, COVER_Y_OFFSET + t * TRACK_SPACING + a * ALBUM_SPACE, TRACK_ROW_WIDTH, FONT_SIZE};
+            if (is_point_in_rect(mouse_x, mouse_y, track_rect)) {
+                hit.kind = HIT_TRACK;
+                hit.album = a;
+                hit.track = t;
+                return hit;
             }
+        }
+    }
+    return hit;
+}
 
-            return;
+// Times layout_hit_test() against the old nested scan on a synthetic
+// library of BENCH_ALBUMS x BENCH_TRACKS_PER_ALBUM tracks, at uniformly
+// random points across the whole content area.
+int bench_hit_test(void) {
+    Library library;
+    memset(&library, 0, sizeof(library));
+    library.albums = calloc(BENCH_ALBUMS, sizeof(Album));
+    if (!library.albums) {
+        printf("Memory allocation failed for benchmark library\n");
+        return 1;
+    }
+    StringId title = library_intern(&library, "Benchmark Track");
+    for (int a = 0; a < BENCH_ALBUMS; a++) {
+        Album *album = &library.albums[a];
+        album->title = album->artist = album->photo_location = title;
+        album->first_track = library.number_of_tracks;
+        album->number_of_tracks = BENCH_TRACKS_PER_ALBUM;
+        for (int t = 0; t < BENCH_TRACKS_PER_ALBUM; t++) {
+            if (!library_add_track(&library, "Benchmark Track", "bench/track.mp3")) {
+                library_free(&library);
+                return 1;
+            }
         }
+    }
+    library.number_of_albums = BENCH_ALBUMS;
+
+    Layout layout;
+    layout_init(&layout);
+    layout_build(&layout, &library, BENCH_ALBUMS / 2, NULL);
+
+    // Linear congruential points, so both runs test the same sequence
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    double nanoseconds[2];
+    volatile long checksum = 0;
+    int lookups[2] = {BENCH_LOOKUPS, BENCH_LOOKUPS / 1000};
+    for (int run = 0; run < 2; run++) {
+        Uint32 seed = 12345;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int i = 0; i < lookups[run]; i++) {
+            seed = seed * 1664525u + 1013904223u;
+            int x = (int)((seed >> 8) % WINDOW_WIDTH);
+            seed = seed * 1664525u + 1013904223u;
+            int y = (int)((seed >> 8) % (Uint32)layout.content_height);
+            Hit hit = run == 0 ? layout_hit_test(&layout, x, y) : linear_hit_test(&library, x, y);
+            checksum += hit.kind + hit.album + hit.track;
+        }
+        Uint64 elapsed = SDL_GetPerformanceCounter() - start;
+        nanoseconds[run] = (double)elapsed * 1e9 / (double)frequency / lookups[run];
+    }
 
-        // Check track clicks within the album
-        for (int t = 0; t < albums[a].number_of_tracks; t++) {
-            SDL_Rect track_rect = {TRACK_LIST_X, COVER_Y_OFFSET + t * TRACK_SPACING + a * ALBUM_SPACE, 240, FONT_SIZE};
+    printf("Hit test, %d tracks: layout %.1f ns/lookup (%d lookups), linear scan %.1f ns/lookup (%d lookups)\n",
+           library.number_of_tracks, nanoseconds[0], lookups[0], nanoseconds[1], lookups[1]);
+    layout_free(&layout);
+    library_free(&library);
+    return 0;
+}
 
-            if (mouse_x >= track_rect.x && mouse_x <= track_rect.x + track_rect.w &&
-                mouse_y >= track_rect.y && mouse_y <= track_rect.y + track_rect.h) {
-                printf("Track %d in Album %d clicked\n", t + 1, a + 1);
+// Times one analysis pass of each kernel the CPU supports on a synthetic
+// signal, against the SPECTRUM_SIZE / AUDIO_FREQUENCY seconds of audio a
+// window covers, and checks the kernels agree with the scalar one.
+int bench_spectrum(void) {
+    Spectrum spectrum;
+    if (!spectrum_init(&spectrum, AUDIO_FREQUENCY, 2)) {
+        return 1;
+    }
+
+    // Two tones over low-level noise
+    Sint16 samples[SPECTRUM_SIZE];
+    Uint32 seed = 12345;
+    for (int i = 0; i < SPECTRUM_SIZE; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        double noise = (double)((seed >> 16) & 0xFF) - 128.0;
+        double tone = 12000.0 * sin(2.0 * M_PI * 440.0 * i / AUDIO_FREQUENCY) + 4000.0 * sin(2.0 * M_PI * 5000.0 * i / AUDIO_FREQUENCY);
+        samples[i] = (Sint16)(tone + noise);
+    }
 
-                // Update current track
-                *current_album = a;
-                *current_track = t;
+    float reference[SPECTRUM_BANDS];
+    float bands[SPECTRUM_BANDS];
+    float level;
+    double block_us = SPECTRUM_SIZE * 1e6 / AUDIO_FREQUENCY;
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    SpectrumKernel kernels[] = {SPECTRUM_SCALAR, SPECTRUM_SSE2, SPECTRUM_AVX2};
+    for (int k = 0; k < 3; k++) {
+        if (!spectrum_set_kernel(&spectrum, kernels[k])) {
+            printf("Spectrum %s: not available\n", spectrum_kernel_name(kernels[k]));
+            continue;
+        }
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int i = 0; i < BENCH_SPECTRUM_BLOCKS; i++) {
+            spectrum_analyze(&spectrum, samples, bands, &level);
+        }
+        double us = (double)(SDL_GetPerformanceCounter() - start) * 1e6 / (double)frequency / BENCH_SPECTRUM_BLOCKS;
 
-                // Stop any currently playing music
-                if (Mix_PlayingMusic()) {
-                    Mix_HaltMusic();
+        float difference = 0.0f;
+        for (int b = 0; b < SPECTRUM_BANDS; b++) {
+            if (k == 0) {
+                reference[b] = bands[b];
+            }
+            float d = fabsf(bands[b] - reference[b]);
+            difference = d > difference ? d : difference;
+        }
+        printf("Spectrum %s: %.2f us per %d-sample block, %.3f%% of the %.1f ms it covers at %d Hz (max band difference %.4f)\n",
+               spectrum_kernel_name(kernels[k]), us, SPECTRUM_SIZE, us * 100.0 / block_us, block_us / 1000.0, AUDIO_FREQUENCY, difference);
+    }
+    spectrum_free(&spectrum);
+    return 0;
+}
+
+// Times the crossfade kernels on two synthetic stereo streams, one
+// MIX_BLOCK_FRAMES block at a time as the feeder mixes them, against the
+// audio a block holds, and checks each kernel against the scalar one.
+int bench_mix(void) {
+    enum { SAMPLES = MIX_BLOCK_FRAMES * 2 };
+    static Sint16 a[SAMPLES], b[SAMPLES], out[SAMPLES], reference[SAMPLES];
+    static float a_float[SAMPLES], b_float[SAMPLES], out_float[SAMPLES], reference_float[SAMPLES];
+    Uint32 seed = 12345;
+    for (int i = 0; i < SAMPLES; i++) {
+        seed = seed * 1664525u + 1013904223u;
+        a[i] = (Sint16)(20000.0 * sin(2.0 * M_PI * 440.0 * (i / 2) / AUDIO_FREQUENCY));
+        b[i] = (Sint16)((Sint32)(seed >> 16) - 32768);
+        a_float[i] = a[i] / 32768.0f;
+        b_float[i] = b[i] / 32768.0f;
+    }
+
+    // Gains from across a two second fade
+    Uint32 fade_length = 2 * AUDIO_FREQUENCY;
+    Uint32 positions = fade_length / MIX_BLOCK_FRAMES;
+    double block_us = MIX_BLOCK_FRAMES * 1e6 / AUDIO_FREQUENCY;
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    MixKernel kernels[] = {MIX_SCALAR, MIX_SSE2, MIX_AVX2};
+    for (int k = 0; k < 3; k++) {
+        if (!mix_kernel_supported(kernels[k])) {
+            printf("Mix %s: not available\n", mix_kernel_name(kernels[k]));
+            continue;
+        }
+        MixGain fade_out, fade_in;
+        Uint64 start = SDL_GetPerformanceCounter();
+        for (int i = 0; i < BENCH_MIX_BLOCKS; i++) {
+            mix_equal_power((Uint32)(i % positions) * MIX_BLOCK_FRAMES, fade_length, MIX_BLOCK_FRAMES, &fade_out, &fade_in);
+            mix_s16(kernels[k], out, a, b, MIX_BLOCK_FRAMES, 2, fade_out, fade_in);
+        }
+        double s16_us = (double)(SDL_GetPerformanceCounter() - start) * 1e6 / (double)frequency / BENCH_MIX_BLOCKS;
+        start = SDL_GetPerformanceCounter();
+        for (int i = 0; i < BENCH_MIX_BLOCKS; i++) {
+            mix_equal_power((Uint32)(i % positions) * MIX_BLOCK_FRAMES, fade_length, MIX_BLOCK_FRAMES, &fade_out, &fade_in);
+            mix_f32(kernels[k], out_float, a_float, b_float, MIX_BLOCK_FRAMES, 2, fade_out, fade_in);
+        }
+        double f32_us = (double)(SDL_GetPerformanceCounter() - start) * 1e6 / (double)frequency / BENCH_MIX_BLOCKS;
+
+        // Compare a block from the middle of the fade, where both gains are large
+        mix_equal_power(fade_length / 2, fade_length, MIX_BLOCK_FRAMES, &fade_out, &fade_in);
+        mix_s16(kernels[k], out, a, b, MIX_BLOCK_FRAMES, 2, fade_out, fade_in);
+        mix_f32(kernels[k], out_float, a_float, b_float, MIX_BLOCK_FRAMES, 2, fade_out, fade_in);
+        int difference = 0;
+        float difference_float = 0.0f;
+        for (int i = 0; i < SAMPLES; i++) {
+            if (k == 0) {
+                reference[i] = out[i];
+                reference_float[i] = out_float[i];
+            }
+            int d = abs(out[i] - reference[i]);
+            float d_float = fabsf(out_float[i] - reference_float[i]);
+            difference = d > difference ? d : difference;
+            difference_float = d_float > difference_float ? d_float : difference_float;
+        }
+        printf("Mix %s: int16 %.3f us, float32 %.3f us per %d-frame stereo block, %.4f%% and %.4f%% of the %.1f ms it covers (max difference %d, %g)\n",
+               mix_kernel_name(kernels[k]), s16_us, f32_us, MIX_BLOCK_FRAMES, s16_us * 100.0 / block_us, f32_us * 100.0 / block_us,
+               block_us / 1000.0, difference, difference_float);
+    }
+    return 0;
+}
+
+// Times each resampler tier with each kernel the CPU supports, converting
+// BENCH_RESAMPLE_SECONDS of synthetic stereo on one thread, and checks the
+// kernels agree with the scalar one.
+int bench_resample(void) {
+    int conversions[][2] = {{48000, 44100}, {96000, 44100}, {44100, 48000}};
+    ResampleQuality qualities[] = {RESAMPLE_LOW, RESAMPLE_MEDIUM, RESAMPLE_HIGH};
+    MixKernel kernels[] = {MIX_SCALAR, MIX_SSE2, MIX_AVX2};
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    for (int r = 0; r < 3; r++) {
+        int input_rate = conversions[r][0];
+        int output_rate = conversions[r][1];
+        Uint32 input_frames = (Uint32)input_rate * BENCH_RESAMPLE_SECONDS;
+        Sint16 *input = malloc((size_t)input_frames * 2 * sizeof(Sint16));
+        if (!input) {
+            printf("Memory allocation failed for resampler benchmark\n");
+            return 1;
+        }
+        Uint32 seed = 12345;
+        for (Uint32 i = 0; i < input_frames; i++) {
+            seed = seed * 1664525u + 1013904223u;
+            double noise = (double)((seed >> 16) & 0xFF) - 128.0;
+            input[2 * i] = (Sint16)(12000.0 * sin(2.0 * M_PI * 440.0 * i / input_rate) + noise);
+            input[2 * i + 1] = (Sint16)(8000.0 * sin(2.0 * M_PI * 5000.0 * i / input_rate) + noise);
+        }
+
+        for (int q = 0; q < 3; q++) {
+            Resampler resampler;
+            if (!resampler_init(&resampler, input_rate, output_rate, 2, qualities[q])) {
+                continue;
+            }
+            Uint32 output_frames = resampler_output_frames(&resampler, input_frames);
+            Sint16 *output = malloc((size_t)output_frames * 2 * sizeof(Sint16));
+            Sint16 *reference = malloc((size_t)output_frames * 2 * sizeof(Sint16));
+            for (int k = 0; k < 3 && output && reference; k++) {
+                if (!resampler_set_kernel(&resampler, kernels[k])) {
+                    printf("Resample %s: not available\n", mix_kernel_name(kernels[k]));
+                    continue;
+                }
+                Uint64 start = SDL_GetPerformanceCounter();
+                resampler_process(&resampler, input, input_frames, output, output_frames);
+                double seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)frequency;
+
+                int difference = 0;
+                for (Uint32 i = 0; i < output_frames * 2; i++) {
+                    if (k == 0) {
+                        reference[i] = output[i];
+                    }
+                    int d = abs(output[i] - reference[i]);
+                    difference = d > difference ? d : difference;
                 }
+                printf("Resample %d to %d Hz, %s quality (%d taps), %s: %.2f M frames/s per core, %.0fx real time (max difference %d)\n",
+                       input_rate, output_rate, resample_quality_name(qualities[q]), resampler.taps, mix_kernel_name(kernels[k]),
+                       output_frames / seconds / 1e6, BENCH_RESAMPLE_SECONDS / seconds, difference);
+            }
+            free(output);
+            free(reference);
+            resampler_free(&resampler);
+        }
+        free(input);
+    }
+    return 0;
+}
+
+static int compare_latencies(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return (x > y) - (x < y);
+}
 
-                // Play the selected track
-                *current_music = albums[a].tracks[t].music;
-                Mix_PlayMusic(*current_music, -1);
-                return;
+// Builds the search index over a synthetic library of BENCH_SEARCH_ALBUMS
+// albums of BENCH_TRACKS_PER_ALBUM tracks, titled from a vocabulary of
+// BENCH_SEARCH_WORDS made-up words, and times type-ahead queries: prefixes
+// of one to four letters of random words, answered as search_update() does.
+int bench_search(void) {
+    static const char *syllables[] = {"ka", "lo", "mi", "ra", "ne", "to", "su", "vi", "de", "ba", "zo", "fe", "gu", "hi", "po", "we"};
+    char (*words)[16] = malloc(BENCH_SEARCH_WORDS * sizeof(*words));
+    double *latencies = malloc(BENCH_SEARCH_QUERIES * sizeof(double));
+    Library library;
+    memset(&library, 0, sizeof(library));
+    library.albums = calloc(BENCH_SEARCH_ALBUMS, sizeof(Album));
+    if (!words || !latencies || !library.albums) {
+        printf("Memory allocation failed for benchmark library\n");
+        free(words);
+        free(latencies);
+        free(library.albums);
+        return 1;
+    }
+    Uint32 seed = 12345;
+    for (int w = 0; w < BENCH_SEARCH_WORDS; w++) {
+        words[w][0] = '\0';
+        int count = 2 + w % 3;
+        for (int i = 0; i < count; i++) {
+            seed = seed * 1664525u + 1013904223u;
+            strcat(words[w], syllables[(seed >> 8) % 16]);
+        }
+    }
+
+    char text[64];
+    for (int a = 0; a < BENCH_SEARCH_ALBUMS; a++) {
+        Album *album = &library.albums[a];
+        seed = seed * 1664525u + 1013904223u;
+        snprintf(text, sizeof(text), "%s %s", words[(seed >> 8) % BENCH_SEARCH_WORDS], words[(seed >> 16) % BENCH_SEARCH_WORDS]);
+        album->title = library_intern(&library, text);
+        album->artist = library_intern(&library, words[a % BENCH_SEARCH_WORDS]);
+        album->photo_location = album->artist;
+        album->first_track = library.number_of_tracks;
+        album->number_of_tracks = BENCH_TRACKS_PER_ALBUM;
+        for (int t = 0; t < BENCH_TRACKS_PER_ALBUM; t++) {
+            seed = seed * 1664525u + 1013904223u;
+            snprintf(text, sizeof(text), "%s %s %s", words[(seed >> 4) % BENCH_SEARCH_WORDS], words[(seed >> 12) % BENCH_SEARCH_WORDS], words[(seed >> 20) % BENCH_SEARCH_WORDS]);
+            if (!library_add_track(&library, text, "bench/track.mp3")) {
+                library_free(&library);
+                free(words);
+                free(latencies);
+                return 1;
             }
         }
     }
+    library.number_of_albums = BENCH_SEARCH_ALBUMS;
+
+    SearchIndex index;
+    if (!search_index_build(&index, &library)) {
+        library_free(&library);
+        free(words);
+        free(latencies);
+        return 1;
+    }
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    SearchResult results[SEARCH_RESULTS];
+    volatile long checksum = 0;
+    for (int q = 0; q < BENCH_SEARCH_QUERIES; q++) {
+        seed = seed * 1664525u + 1013904223u;
+        const char *word = words[(seed >> 8) % BENCH_SEARCH_WORDS];
+        size_t length = 1 + (seed >> 28) % 4;
+        char query[8];
+        snprintf(query, sizeof(query), "%.*s", (int)length, word);
+        Uint64 start = SDL_GetPerformanceCounter();
+        checksum += search_index_query(&index, query, results, SEARCH_RESULTS);
+        latencies[q] = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)frequency;
+    }
+    qsort(latencies, BENCH_SEARCH_QUERIES, sizeof(double), compare_latencies);
+    printf("Search, %d tracks: p50 %.4f ms, p99 %.4f ms, max %.4f ms over %d queries\n", library.number_of_tracks,
+           latencies[BENCH_SEARCH_QUERIES / 2], latencies[BENCH_SEARCH_QUERIES * 99 / 100], latencies[BENCH_SEARCH_QUERIES - 1], BENCH_SEARCH_QUERIES);
+
+    search_index_free(&index);
+    library_free(&library);
+    free(words);
+    free(latencies);
+    return 0;
+}
+
+// Writes BENCH_INPUT_RECORDS album records of 5 + 2 * BENCH_INPUT_TRACKS
+// lines each (2.5M lines), then reads them back through stdin with the
+// console input functions in batch mode, as a script piping them in would.
+int bench_input(void) {
+    FILE *fptr = fopen(BENCH_INPUT_PATH, "wb");
+    if (!fptr) {
+        printf("Error writing %s\n", BENCH_INPUT_PATH);
+        return 1;
+    }
+    for (int a = 0; a < BENCH_INPUT_RECORDS; a++) {
+        fprintf(fptr, "Album %d\nArtist %d\n%d\n%s\n%d\n", a + 1, a % 97 + 1, a % 4 + 1, a % 2 ? "yes" : "no", BENCH_INPUT_TRACKS);
+        for (int t = 0; t < BENCH_INPUT_TRACKS; t++) {
+            fprintf(fptr, "Track %d of album %d\n%d.%02d\n", t + 1, a + 1, 120 + (a + t) % 300, (a * 7 + t) % 100);
+        }
+    }
+    if (fclose(fptr) != 0 || !freopen(BENCH_INPUT_PATH, "rb", stdin)) {
+        printf("Error reading %s\n", BENCH_INPUT_PATH);
+        remove(BENCH_INPUT_PATH);
+        return 1;
+    }
+
+    input_set_batch(true);
+    char text[MAX_PATH_LENGTH];
+    int genre, tracks;
+    bool favourite;
+    float length;
+    double total_length = 0.0;
+    int records = 0;
+    Uint64 start = SDL_GetPerformanceCounter();
+    while (records < BENCH_INPUT_RECORDS && read_string("", text, sizeof(text)) && read_string("", text, sizeof(text)) &&
+           read_integer_in_range("", 1, 4, &genre) && read_boolean("", &favourite) && read_integer("", &tracks)) {
+        bool ok = true;
+        for (int t = 0; ok && t < tracks; t++) {
+            ok = read_string("", text, sizeof(text)) && read_float("", &length);
+            total_length += ok ? length : 0.0f;
+        }
+        if (!ok) {
+            break;
+        }
+        records++;
+    }
+    double seconds = (double)(SDL_GetPerformanceCounter() - start) / (double)SDL_GetPerformanceFrequency();
+    remove(BENCH_INPUT_PATH);
+    if (records != BENCH_INPUT_RECORDS) {
+        printf("Input: stopped at line %d after %d records\n", input_line_number(), records);
+        return 1;
+    }
+    printf("Input, %d records: %d lines in %.3f s (%.1f M lines/s), %.0f s of tracks\n", records, input_line_number(),
+           seconds, seconds > 0.0 ? input_line_number() / seconds / 1e6 : 0.0, total_length);
+    return 0;
 }
 
+// Answers a --headless query from the library alone, without initializing
+// SDL or loading any cover or track.
+int run_headless(const PlayerOptions *options) {
+    Library library;
+    bool loaded = options->scan_root ? library_scan(&library, options->scan_root, SCAN_CACHE_PATH) : library_load(&library, ALBUMS_PATH, CATALOG_PATH);
+    if (!loaded) {
+        return 1;
+    }
+    int status = headless_run(&library, options->headless, options->headless_argument);
+    library_free(&library);
+    return status;
+}
 
+// Indexes each MP3 in the library, timing the frame scan that gives its
+// length.
+int bench_seek(void) {
+    Library library;
+    if (!library_load(&library, ALBUMS_PATH, CATALOG_PATH)) {
+        return 1;
+    }
+    Uint64 frequency = SDL_GetPerformanceFrequency();
+    for (int a = 0; a < library.number_of_albums; a++) {
+        for (int t = 0; t < library.albums[a].number_of_tracks; t++) {
+            char path[MAX_PATH_LENGTH];
+            library_track_location(&library, a, t, path, sizeof(path));
+            FILE *fptr = fopen(path, "rb");
+            if (!fptr) {
+                printf("Seek %s: cannot open\n", path);
+                continue;
+            }
+            fseek(fptr, 0, SEEK_END);
+            long size = ftell(fptr);
+            fseek(fptr, 0, SEEK_SET);
+            Uint8 *data = size > 0 ? malloc((size_t)size) : NULL;
+            bool loaded = data && fread(data, 1, (size_t)size, fptr) == (size_t)size;
+            fclose(fptr);
+
+            SeekTable table;
+            memset(&table, 0, sizeof(table));
+            Uint64 start = SDL_GetPerformanceCounter();
+            bool indexed = loaded && seek_table_scan(&table, data, (size_t)size);
+            double scan_ms = (double)(SDL_GetPerformanceCounter() - start) * 1000.0 / (double)frequency;
+            if (!indexed) {
+                printf("Seek %s: no MP3 frames\n", path);
+                free(data);
+                continue;
+            }
 
-void draw_single_album(Album *album, SDL_Renderer *renderer, TTF_Font *font, int y_offset, int album_index, int current_album, int current_track) {
-    SDL_Color title_color = (album_index == current_album) ? COLOR_RED : COLOR_WHITE;
-    SDL_Surface *title_surface = TTF_RenderText_Blended(font, album->title, title_color);
-    if (title_surface) {
-        SDL_Texture *title_texture = SDL_CreateTextureFromSurface(renderer, title_surface);
-        SDL_Rect title_rect = {MARGIN_LEFT, y_offset, title_surface->w, title_surface->h};
+            Uint32 duration = seek_table_duration_ms(&table);
+            printf("Seek %s: %u frames, %u:%02u at %u Hz; scan %.2f ms (%.0f MB/s)\n",
+                   path, table.frame_count, duration / 60000, duration / 1000 % 60, table.sample_rate,
+                   scan_ms, scan_ms > 0.0 ? size / 1048576.0 / (scan_ms / 1000.0) : 0.0);
+            free(data);
+        }
+    }
+    library_free(&library);
+    return 0;
+}
 
-        SDL_RenderCopy(renderer, title_texture, NULL, &title_rect);
-        SDL_FreeSurface(title_surface);
-        SDL_DestroyTexture(title_texture);
+// Bars for each band over a VU meter of the RMS level.
+void draw_spectrum(SDL_Renderer *renderer, const Spectrum *spectrum, SDL_Rect area) {
+    SDL_Rect bars[SPECTRUM_BANDS];
+    int bar_width = area.w / SPECTRUM_BANDS;
+    int bar_space = area.h - VU_HEIGHT - 2;
+    for (int b = 0; b < SPECTRUM_BANDS; b++) {
+        int height = (int)(spectrum->bands[b] * bar_space);
+        bars[b].x = area.x + b * bar_width;
+        bars[b].y = area.y + bar_space - height;
+        bars[b].w = bar_width - 1;
+        bars[b].h = height;
     }
+    SDL_SetRenderDrawColor(renderer, 0, 220, 120, 255);
+    SDL_RenderFillRects(renderer, bars, SPECTRUM_BANDS);
 
-    SDL_Surface *artist_surface = TTF_RenderText_Blended(font, album->artist, COLOR_WHITE);
-    if (artist_surface) {
-        SDL_Texture *artist_texture = SDL_CreateTextureFromSurface(renderer, artist_surface);
-        SDL_Rect artist_rect = {MARGIN_LEFT, y_offset + FONT_SIZE, artist_surface->w, artist_surface->h};
+    SDL_Rect meter = {area.x, area.y + area.h - VU_HEIGHT, (int)(spectrum->level * area.w), VU_HEIGHT};
+    SDL_SetRenderDrawColor(renderer, 255, 200, 0, 255);
+    SDL_RenderFillRect(renderer, &meter);
+}
+
+// A bar in the gap under the current track's row, filled up to its
+// position.
+void draw_progress(SDL_Renderer *renderer, const Layout *layout, const Progress *progress, int row_y) {
+    SDL_Rect bar = {layout->progress.x, row_y + layout->progress.y + (layout->progress.h - PROGRESS_HEIGHT) / 2, layout->progress.w, PROGRESS_HEIGHT};
+    SDL_SetRenderDrawColor(renderer, 60, 60, 60, 255);
+    SDL_RenderFillRect(renderer, &bar);
+    Uint32 position = progress->position_ms < progress->duration_ms ? progress->position_ms : progress->duration_ms;
+    bar.w = (int)((Uint64)bar.w * position / progress->duration_ms);
+    SDL_SetRenderDrawColor(renderer, 255, 0, 0, 255);
+    SDL_RenderFillRect(renderer, &bar);
+}
 
+// Where the shown rows sit among all of the album's tracks, beside the
+// track list.
+void draw_row_scrollbar(SDL_Renderer *renderer, const Layout *layout, int y_offset) {
+    int height = layout->visible_rows * TRACK_SPACING - (TRACK_SPACING - FONT_SIZE);
+    SDL_Rect track = {ROW_SCROLLBAR_X, y_offset + COVER_Y_OFFSET, ROW_SCROLLBAR_WIDTH, height};
+    SDL_Rect thumb = {ROW_SCROLLBAR_X, y_offset + COVER_Y_OFFSET + height * layout->first_row / layout->number_of_rows,
+                      ROW_SCROLLBAR_WIDTH, height * layout->visible_rows / layout->number_of_rows};
+    SDL_SetRenderDrawColor(renderer, 60, 60, 60, 255);
+    SDL_RenderFillRect(renderer, &track);
+    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+    SDL_RenderFillRect(renderer, &thumb);
+}
+
+void draw_single_album(const Library *library, SDL_Renderer *renderer, TTF_Font *font, TextCache *text_cache, CoverAtlas *atlas, const Layout *layout, const Spectrum *spectrum, const Progress *progress, int y_offset, int album_index, int current_album, int current_track, int selected_track) {
+    const Album *album = &library->albums[album_index];
+    int text_w, text_h;
+
+    SDL_Color title_color = (album_index == current_album) ? COLOR_RED : COLOR_WHITE;
+    SDL_Texture *title_texture = text_cache_get(text_cache, renderer, font, library_string(library, album->title), title_color, album_index, &text_w, &text_h);
+    if (title_texture) {
+        SDL_Rect title_rect = {layout->title.x, y_offset + layout->title.y, text_w, text_h};
+        SDL_RenderCopy(renderer, title_texture, NULL, &title_rect);
+    }
+
+    SDL_Texture *artist_texture = text_cache_get(text_cache, renderer, font, library_string(library, album->artist), COLOR_WHITE, album_index, &text_w, &text_h);
+    if (artist_texture) {
+        SDL_Rect artist_rect = {layout->artist.x, y_offset + layout->artist.y, text_w, text_h};
         SDL_RenderCopy(renderer, artist_texture, NULL, &artist_rect);
-        SDL_FreeSurface(artist_surface);
-        SDL_DestroyTexture(artist_texture);
     }
 
-    if (album->cover) {
-        SDL_Rect cover_rect = {MARGIN_LEFT, y_offset + COVER_Y_OFFSET, COVER_SIZE, COVER_SIZE};
-        SDL_RenderCopy(renderer, album->cover, NULL, &cover_rect);
+    // Covers are queued and drawn together once every panel is done
+    SDL_Rect cover_rect = {layout->cover.x, y_offset + layout->cover.y, layout->cover.w, layout->cover.h};
+    if (!cover_atlas_draw(atlas, album->cover, &cover_rect)) {
+        // Placeholder until the cover has been decoded
+        SDL_SetRenderDrawColor(renderer, 60, 60, 60, 255);
+        SDL_RenderFillRect(renderer, &cover_rect);
+        SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+        SDL_RenderDrawRect(renderer, &cover_rect);
     }
 
-    if (album_index == current_album) {
-        for (int i = 0; i < album->number_of_tracks; i++) {
+    if (album_index == layout->expanded_album) {
+        int scroll = layout->first_row * TRACK_SPACING;
+        for (int i = layout->first_row; i < layout->first_row + layout->visible_rows; i++) {
             SDL_Color track_color = (i == current_track) ? COLOR_RED : COLOR_WHITE;
-            char track_text[300];
-            sprintf(track_text, "%d. %s", i + 1, album->tracks[i].title);
-            SDL_Surface *track_surface = TTF_RenderText_Blended(font, track_text, track_color);
-            if (track_surface) {
-                SDL_Texture *track_texture = SDL_CreateTextureFromSurface(renderer, track_surface);
-                SDL_Rect track_rect = {TRACK_LIST_X, y_offset + COVER_Y_OFFSET + i * TRACK_SPACING, track_surface->w, FONT_SIZE};
-
-                // Draw the border around the track title
+            char track_text[MAX_PATH_LENGTH + 16];
+            format_track_row(track_text, sizeof(track_text), i, library_track_title(library, album_index, i));
+            SDL_Texture *track_texture = text_cache_get(text_cache, renderer, font, track_text, track_color, album_index, &text_w, &text_h);
+            if (track_texture) {
+                const SDL_Rect *row = &layout->rows[i];
+                SDL_Rect track_rect = {row->x, y_offset + row->y - scroll, row->w, row->h};
+
+                // Draw the border around the track title, yellow for the
+                // selected search result
                 SDL_Rect border_rect = {track_rect.x - 5, track_rect.y - 5, track_rect.w + 10, track_rect.h + 10};
-                SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255); // White border
+                if (i == selected_track) {
+                    SDL_SetRenderDrawColor(renderer, 255, 255, 0, 255);
+                } else {
+                    SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
+                }
                 SDL_RenderDrawRect(renderer, &border_rect);
+                SDL_SetRenderDrawColor(renderer, 255, 255, 255, 255);
 
                 SDL_RenderCopy(renderer, track_texture, NULL, &track_rect);
-                SDL_FreeSurface(track_surface);
-                SDL_DestroyTexture(track_texture);
+            }
+            if (progress && progress->duration_ms > 0 && album_index == current_album && i == current_track) {
+                draw_progress(renderer, layout, progress, y_offset + layout->rows[i].y - scroll);
             }
         }
+        if (layout->number_of_rows > layout->visible_rows) {
+            draw_row_scrollbar(renderer, layout, y_offset);
+        }
+    }
+
+    // The playing album shows its spectrum under the cover, beside the tracks
+    if (spectrum && spectrum->active && album_index == current_album) {
+        SDL_Rect area = {layout->spectrum.x, y_offset + layout->spectrum.y, layout->spectrum.w, layout->spectrum.h};
+        draw_spectrum(renderer, spectrum, area);
     }
 }
 
 
+void draw_search_bar(SDL_Renderer *renderer, TTF_Font *font, TextCache *text_cache, const Search *search) {
+    SDL_Rect bar = {0, 0, WINDOW_WIDTH, SEARCH_BAR_HEIGHT};
+    SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+    SDL_RenderFillRect(renderer, &bar);
+
+    char text[SEARCH_MAX_QUERY + 48];
+    if (search->count > 0) {
+        snprintf(text, sizeof(text), "Search: %s (%d/%d)", search->query, search->selected + 1, search->count);
+    } else {
+        snprintf(text, sizeof(text), "Search: %s", search->query);
+    }
+    int text_w, text_h;
+    SDL_Texture *texture = text_cache_get(text_cache, renderer, font, text, COLOR_WHITE, -1, &text_w, &text_h);
+    if (texture) {
+        SDL_Rect text_rect = {10, (SEARCH_BAR_HEIGHT - text_h) / 2, text_w, text_h};
+        SDL_RenderCopy(renderer, texture, NULL, &text_rect);
+    }
+}
 
-void draw_albums(SDL_Renderer *renderer, Album *albums, int number_of_albums, TTF_Font *font, int current_album, int current_track) {
-    SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
-    SDL_RenderClear(renderer);
+// Re-renders the damaged album panels into `canvas` and presents it. Only
+// albums that intersect the window are visited, so the cost of a frame does
+// not depend on the size of the library. Panels that are not damaged keep
+// their pixels from the previous frame. Without a canvas every frame is a
+// full redraw straight to the window.
+void draw_albums(SDL_Renderer *renderer, SDL_Texture *canvas, const Library *library, TTF_Font *font, TextCache *text_cache, CoverAtlas *atlas, const Layout *layout, const Spectrum *spectrum, const Progress *progress, Damage *damage, const View *view, const Search *search, int current_album, int current_track) {
+    Uint64 trace_start_time = trace_begin();
+    int first, last;
+    view_resident_range(view, library->number_of_albums, &first, &last);
+    text_cache_retain(text_cache, first, last);
+    text_cache_begin_frame(text_cache);
+    bool full = damage->full || !canvas;
+    SDL_SetRenderTarget(renderer, canvas);
+
+    if (full) {
+        SDL_RenderSetClipRect(renderer, NULL);
+        SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
+        SDL_RenderClear(renderer);
+    }
 
-    int y_offset = 0;
-    for (int i = 0; i < number_of_albums; i++) {
-        draw_single_album(&albums[i], renderer, font, y_offset, i, current_album, current_track);
-        y_offset += ALBUM_SPACE;
+    int selected_track = shown_track(search);
+    view_visible_range(view, library->number_of_albums, &first, &last);
+    for (int i = first; i < last; i++) {
+        if (full || is_damaged(damage, i)) {
+            int y_offset = i * ALBUM_SPACE - view->scroll_y;
+            SDL_Rect panel = {0, y_offset, WINDOW_WIDTH, ALBUM_SPACE};
+            SDL_RenderSetClipRect(renderer, &panel);
+            if (!full) {
+                SDL_SetRenderDrawColor(renderer, 0, 0, 255, 255);
+                SDL_RenderFillRect(renderer, &panel);
+            }
+            draw_single_album(library, renderer, font, text_cache, atlas, layout, spectrum, progress, y_offset, i, current_album, current_track, selected_track);
+        }
     }
+    SDL_RenderSetClipRect(renderer, NULL);
+    cover_atlas_flush(atlas);
 
+    if (canvas) {
+        SDL_SetRenderTarget(renderer, NULL);
+        SDL_RenderCopy(renderer, canvas, NULL, NULL);
+    }
+    if (search->active) {
+        draw_search_bar(renderer, font, text_cache, search);
+    }
+    Uint64 present_start = trace_begin();
     SDL_RenderPresent(renderer);
+    trace_end("SDL_RenderPresent", present_start);
+    text_cache_end_frame(text_cache);
+    damage_clear(damage);
+    trace_end("draw_albums", trace_start_time);
+}
+
+// True when decode_track() brings every track to the device rate with the
+// polyphase resampler. Stops at the first track that would not be, so for
+// a library with MP3s this is usually one lookup.
+bool library_resampled(const Library *library) {
+    for (int a = 0; a < library->number_of_albums; a++) {
+        for (int t = 0; t < library->albums[a].number_of_tracks; t++) {
+            char path[MAX_PATH_LENGTH];
+            library_track_location(library, a, t, path, sizeof(path));
+            if (!decode_track_resamples(path)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// The default output device's own rate, so nothing between the mixer and
+// the hardware resamples again. AUDIO_FREQUENCY when SDL cannot tell.
+int native_audio_rate(void) {
+#if SDL_VERSION_ATLEAST(2, 24, 0)
+    SDL_AudioSpec spec;
+    if (SDL_GetDefaultAudioInfo(NULL, &spec, 0) == 0 && spec.freq > 0) {
+        return spec.freq;
+    }
+#endif
+    return AUDIO_FREQUENCY;
 }
 
-bool initialize_sdl(SDL_Window **window, SDL_Renderer **renderer, TTF_Font **font) {
+// Opens the audio device at `audio_rate`, or at its native rate when 0.
+bool initialize_sdl(SDL_Window **window, SDL_Renderer **renderer, TTF_Font **font, bool vsync, int audio_buffer, int audio_rate) {
     if (SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO) < 0) {
         printf("SDL Initialization Failed: %s\n", SDL_GetError());
         return false;
@@ -277,7 +1456,11 @@ bool initialize_sdl(SDL_Window **window, SDL_Renderer **renderer, TTF_Font **fon
         return false;
     }
 
-    if (Mix_OpenAudio(AUDIO_FREQUENCY, MIX_DEFAULT_FORMAT, 2, AUDIO_CHUNK_SIZE) < 0) {
+    // Tracks are decoded to PCM up front by the audio engine, so the device
+    // buffer only has to cover callback jitter and can stay small
+    Mix_Init(MIX_INIT_MP3);
+    int frequency = audio_rate > 0 ? audio_rate : native_audio_rate();
+    if (Mix_OpenAudio(frequency, AUDIO_S16SYS, 2, audio_buffer) < 0) {
         printf("SDL_Mixer Initialization Failed: %s\n", Mix_GetError());
         IMG_Quit();
         SDL_Quit();
@@ -302,7 +1485,11 @@ bool initialize_sdl(SDL_Window **window, SDL_Renderer **renderer, TTF_Font **fon
         return false;
     }
 
-    *renderer = SDL_CreateRenderer(*window, -1, SDL_RENDERER_ACCELERATED);
+    Uint32 renderer_flags = SDL_RENDERER_ACCELERATED | SDL_RENDERER_TARGETTEXTURE;
+    if (vsync) {
+        renderer_flags |= SDL_RENDERER_PRESENTVSYNC;
+    }
+    *renderer = SDL_CreateRenderer(*window, -1, renderer_flags);
     if (!*renderer) {
         printf("Renderer Creation Failed: %s\n", SDL_GetError());
         SDL_DestroyWindow(*window);
@@ -328,85 +1515,583 @@ bool initialize_sdl(SDL_Window **window, SDL_Renderer **renderer, TTF_Font **fon
     return true;
 }
 
+#ifndef MUSIC_PLAYER_NO_MAIN
 int main(int argc, char **argv) {
     bool quit = false;
     SDL_Event event;
     int current_album = 0;
     int current_track = -1;
+    PlayerOptions options;
 
     SDL_Window *window = NULL;
     SDL_Renderer *renderer = NULL;
     TTF_Font *font = NULL;
-    Mix_Music *current_music = NULL;
+    MusicCache music_cache;
+    TextCache text_cache;
+    PlayQueue play_queue;
 
-    // Initialize SDL and its components
-    if (!initialize_sdl(&window, &renderer, &font)) {
+    if (!parse_options(argc, argv, &options)) {
+        return 1;
+    }
+    const char *trace_path = options.trace_path ? options.trace_path : getenv(TRACE_ENV);
+    if (trace_path && *trace_path) {
+        trace_start(trace_path);
+    }
+    if (options.build_catalog) {
+        return catalog_convert(ALBUMS_PATH, CATALOG_PATH) ? 0 : 1;
+    }
+    if (options.bench_hit_test) {
+        return bench_hit_test();
+    }
+    if (options.bench_spectrum) {
+        return bench_spectrum();
+    }
+    if (options.bench_mix) {
+        return bench_mix();
+    }
+    if (options.bench_resample) {
+        return bench_resample();
+    }
+    if (options.bench_seek) {
+        return bench_seek();
+    }
+    if (options.bench_search) {
+        return bench_search();
+    }
+    if (options.bench_input) {
+        return bench_input();
+    }
+    if (options.headless != HEADLESS_NONE) {
+        return run_headless(&options);
+    }
+    music_cache_init(&music_cache, options.cache_handles, (size_t)options.cache_megabytes * 1024 * 1024);
+    text_cache_init(&text_cache);
+    Uint32 start_ticks = SDL_GetTicks();
+
+    // Load the album data from a scan of --scan DIR, or else from the binary
+    // catalog when it is current, then the last session's snapshot of it
+    Library library;
+    Session session;
+    memset(&session, 0, sizeof(session));
+    bool session_enabled = options.session && !options.scan_root;
+    Uint64 trace_start_time = trace_begin();
+    bool library_loaded = options.scan_root ? library_scan(&library, options.scan_root, SCAN_CACHE_PATH) : library_load(&library, ALBUMS_PATH, CATALOG_PATH);
+    bool session_restored = library_loaded && session_enabled && session_open(&session, &library, SESSION_PATH, ALBUMS_PATH);
+    trace_end("library_load", trace_start_time);
+    if (!library_loaded) {
+        printf("Error reading albums\n");
         return 1;
     }
 
-    // Open the file containing album data
-    FILE *fptr = fopen("albums.txt", "r");
-    if (!fptr) {
-        printf("Error opening albums.txt\n");
-        TTF_CloseFont(font);
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
-        TTF_Quit();
-        IMG_Quit();
-        Mix_CloseAudio();
-        Mix_Quit();
-        SDL_Quit();
+    // Initialize SDL and its components. The device runs at the hardware's
+    // own rate only when every track goes through our resampler; otherwise
+    // SDL_mixer would resample the rest again with its own converter
+    int audio_rate = options.audio_rate;
+    if (audio_rate == 0 && !library_resampled(&library)) {
+        audio_rate = AUDIO_FREQUENCY;
+    }
+    if (!initialize_sdl(&window, &renderer, &font, options.vsync, options.audio_buffer, audio_rate)) {
+        session_close(&session);
+        library_free(&library);
         return 1;
     }
+    Album *albums = library.albums;
+    int number_of_albums = library.number_of_albums;
+    if (session_restored) {
+        current_album = session.current_album;
+        current_track = session.current_track;
+    }
+    SearchIndex search_index;
+    trace_start_time = trace_begin();
+    if (!search_index_build(&search_index, &library)) {
+        printf("Search disabled\n");
+    }
+    trace_end("search_index_build", trace_start_time);
+    Search search;
+    memset(&search, 0, sizeof(search));
+    SDL_StopTextInput();
+
+    // Covers stream in from the worker pool while the UI is already up,
+    // pre-scaled to COVER_SIZE through the thumbnail cache
+    int thumbnail_size = options.thumbnails ? COVER_SIZE : 0;
+    CoverAtlas cover_atlas;
+    cover_atlas_init(&cover_atlas, renderer, COVER_SIZE, ATLAS_MAX_PAGES);
+    CoverLoader cover_loader;
+    bool covers_streaming = false;
+    Uint32 cover_ready_event = SDL_RegisterEvents(1);
+    if (!options.serial_covers && cover_ready_event != (Uint32)-1 && cover_loader_start(&cover_loader, cover_ready_event, thumbnail_size)) {
+        covers_streaming = true;
+        // The snapshot's covers are shown until the loader has checked them
+        // against their sources
+        if (session_restored) {
+            int restored = session_restore_covers(&session, &library, &cover_atlas);
+            printf("Session restored after %u ms: %d covers\n", SDL_GetTicks() - start_ticks, restored);
+        }
+    } else {
+        load_covers(&library, &cover_atlas, thumbnail_size);
+        printf("All covers ready after %u ms\n", SDL_GetTicks() - start_ticks);
+    }
+    printf("Library loaded in %u ms: %d albums, %d tracks, %.1f MB\n", SDL_GetTicks() - start_ticks,
+           library.number_of_albums, library.number_of_tracks, library_memory_usage(&library) / (1024.0 * 1024.0));
 
-    int number_of_albums = 0;
-    Album *albums = read_albums(fptr, &number_of_albums, renderer);
-    fclose(fptr);
 
-    if (!albums) {
-        printf("Error reading albums\n");
-        TTF_CloseFont(font);
-        SDL_DestroyRenderer(renderer);
-        SDL_DestroyWindow(window);
-        TTF_Quit();
-        IMG_Quit();
-        Mix_CloseAudio();
-        Mix_Quit();
-        SDL_Quit();
-        return 1;
+    // Albums are drawn into a persistent canvas so only damaged panels need
+    // re-rendering
+    SDL_Texture *canvas = SDL_CreateTexture(renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_TARGET, WINDOW_WIDTH, WINDOW_HEIGHT);
+    if (!canvas) {
+        printf("Canvas creation failed, redrawing every frame: %s\n", SDL_GetError());
+    }
+    Damage damage;
+    damage_clear(&damage);
+    damage_all(&damage);
+    View view;
+    view_init(&view, number_of_albums);
+    Layout layout;
+    layout_init(&layout);
+    if (session_restored && session.row_count > 0) {
+        layout_build(&layout, &library, current_album, NULL);
+        session_restore_layout(&session, &layout);
+    } else {
+        layout_build(&layout, &library, current_album, font);
+    }
+    layout_show_row(&layout, current_track);
+    if (session_restored) {
+        view_scroll_to(&view, session.scroll_y);
+        view.scroll_y = view.target_scroll_y;
+    }
+    bool visible_covers_logged = false;
+    AudioEngine audio_engine;
+    Uint32 engine_event = SDL_RegisterEvents(1);
+    bool playback = audio_engine_start(&audio_engine, &music_cache, engine_event, (Uint32)options.ring_frames, options.resample_quality);
+    if (!playback) {
+        printf("Playback disabled\n");
+    }
+    if (playback) {
+        printf("Audio: %d Hz, %s quality resampling\n", audio_engine.frequency, resample_quality_name(options.resample_quality));
+        audio_engine_set_crossfade(&audio_engine, options.crossfade_ms);
+    }
+    play_queue_init(&play_queue, &audio_engine, options.prefetch_tracks);
+    if (playback && session_restored && session.playing) {
+        printf("Resuming track %d of album %d at %u ms\n", current_track + 1, current_album + 1, session.position_ms);
+        play_queue_resume(&play_queue, &library, current_album, current_track, session.position_ms);
+    }
+    session_close(&session);
+    Spectrum spectrum;
+    bool spectrum_running = playback && options.spectrum && spectrum_init(&spectrum, audio_engine.frequency, audio_engine.channels);
+    if (spectrum_running) {
+        spectrum_attach(&spectrum);
+    }
+    Uint32 last_spectrum = 0;
+
+    // Loudness is analysed in the background; tracks played before theirs
+    // is known play as mastered
+    Loudness *loudness = playback && options.loudness ? loudness_start(&library, LOUDNESS_CACHE_PATH, audio_engine.frequency, audio_engine.channels, options.resample_quality) : NULL;
+    if (loudness) {
+        audio_engine_set_loudness(&audio_engine, loudness);
     }
 
+    // MP3 frame counts give track lengths before anything is decoded. The
+    // cache goes beside the library it indexes.
+    char seek_cache_path[MAX_PATH_LENGTH];
+    library_file_path(seek_cache_path, sizeof(seek_cache_path), options.scan_root, SEEK_CACHE_PATH);
+    TrackLength track_length = {-1, -1, 0, 0};
+    SeekIndex *seek_index = playback && options.seek_index ? seek_index_start(&library, seek_cache_path) : NULL;
+    bool scrubbing = false;
+    bool scrub_moved = false;
+    float scrub_fraction = 0.0f;
+    Uint32 scrub_ms = 0;
+
+    // Edits to albums.txt, or files added under --scan, are picked up live
+    LibraryWatch library_watch;
+    const char *watched_path = options.scan_root ? options.scan_root : ALBUMS_PATH;
+    Uint32 watch_event = SDL_RegisterEvents(1);
+    const char *player_files[] = {CATALOG_PATH, SESSION_PATH, LOUDNESS_CACHE_PATH, seek_cache_path, SCAN_CACHE_PATH, THUMBNAIL_DIR, trace_path ? trace_path : ""};
+    int player_file_count = (int)(sizeof(player_files) / sizeof(player_files[0]));
+    bool watching = options.watch && watch_event != (Uint32)-1 && library_watch_start(&library_watch, &library, watched_path, player_files, player_file_count, watch_event);
+    bool library_changed = false;
+
+    Uint32 frame_interval = options.frame_cap > 0 ? 1000 / options.frame_cap : 0;
+    Uint32 last_frame = 0;
+    Uint32 last_tick = SDL_GetTicks();
+    Uint32 last_session_save = last_tick;
+    SessionWriter session_writer;
+    session_enabled = session_enabled && session_writer_start(&session_writer, SESSION_PATH, ALBUMS_PATH);
+    unsigned long frames_drawn = 0;
+    unsigned long frames_skipped = 0;
+
     while (!quit) {
-        while (SDL_PollEvent(&event)) {
-            switch (event.type) {
-                case SDL_QUIT:
-                    quit = true;
-                    break;
-                case SDL_MOUSEBUTTONDOWN:
-                    if (event.button.button == SDL_BUTTON_LEFT) {
-                        int mouse_x = event.button.x;
-                        int mouse_y = event.button.y;                       
-                        handle_click(mouse_x, mouse_y, albums, number_of_albums, &current_music, &current_album, &current_track);
+        // Sleep until an event arrives, the next position tick is due, or a
+        // capped frame may be drawn
+        Uint32 now = SDL_GetTicks();
+        Uint32 timeout = IDLE_WAIT_MS;
+        if (audio_engine_is_playing(&audio_engine)) {
+            Uint32 since_tick = now - last_tick;
+            timeout = since_tick < POSITION_TICK_MS ? POSITION_TICK_MS - since_tick : 0;
+        }
+        bool spectrum_due = spectrum_running && (audio_engine_is_playing(&audio_engine) || spectrum.active);
+        if (spectrum_due) {
+            Uint32 since_spectrum = now - last_spectrum;
+            Uint32 until_spectrum = since_spectrum < SPECTRUM_FRAME_MS ? SPECTRUM_FRAME_MS - since_spectrum : 0;
+            timeout = until_spectrum < timeout ? until_spectrum : timeout;
+        }
+        bool scrolling = view.scroll_y != view.target_scroll_y;
+        Uint32 interval = frame_interval == 0 && scrolling ? SCROLL_FRAME_MS : frame_interval;
+        if ((damage.any || scrolling) && interval > 0 && now - last_frame < interval) {
+            Uint32 until_frame = interval - (now - last_frame);
+            timeout = until_frame < timeout ? until_frame : timeout;
+        } else if (damage.any || scrolling) {
+            timeout = 0;
+        }
 
+        int previous_album = current_album;
+        int previous_track = current_track;
+        int previous_shown = shown_album(&search, current_album);
+        int previous_selected = shown_track(&search);
+        if (SDL_WaitEventTimeout(&event, (int)timeout)) {
+            do {
+                if (event.type == engine_event) {
+                    play_queue_handle_event(&play_queue, &library, &event);
+                    follow_queue(&play_queue, &current_album, &current_track);
+                } else if (watching && event.type == watch_event) {
+                    library_changed = true;
+                }
+                switch (event.type) {
+                    case SDL_QUIT:
+                        quit = true;
+                        break;
+                    case SDL_MOUSEBUTTONDOWN: {
+                        Uint64 click_start = trace_begin();
+                        Hit hit = layout_hit_test(&layout, event.button.x, event.button.y + view.scroll_y);
+                        if (hit.kind == HIT_PROGRESS && event.button.button == SDL_BUTTON_LEFT && hit.album == current_album && hit.track == current_track) {
+                            scrubbing = true;
+                            scrub_moved = true;
+                            scrub_fraction = hit.fraction;
+                        }
+                        handle_click(hit, event.button.button, &library, &play_queue, &current_album, &current_track);
+                        if (hit.kind == HIT_TRACK) {
+                            follow_queue(&play_queue, &current_album, &current_track);
+                        }
+                        trace_end("handle_click", click_start);
+                        break;
                     }
-                    break;
+                    case SDL_MOUSEMOTION:
+                        if (scrubbing) {
+                            scrub_fraction = layout_progress_fraction(&layout, event.motion.x);
+                            scrub_moved = true;
+                        }
+                        break;
+                    case SDL_MOUSEBUTTONUP:
+                        if (scrubbing && event.button.button == SDL_BUTTON_LEFT) {
+                            scrubbing = false;
+                            damage_album(&damage, current_album);
+                        }
+                        break;
+                    case SDL_MOUSEWHEEL: {
+                        // Over a long track list the wheel scrolls its rows
+                        // until they reach either end, then the view
+                        int mouse_x, mouse_y;
+                        SDL_GetMouseState(&mouse_x, &mouse_y);
+                        if (layout_in_track_list(&layout, mouse_x, mouse_y + view.scroll_y) && layout_scroll_rows(&layout, -event.wheel.y)) {
+                            damage_album(&damage, layout.expanded_album);
+                        } else {
+                            view_scroll_by(&view, -event.wheel.y * SCROLL_STEP);
+                        }
+                        break;
+                    }
+                    case SDL_TEXTINPUT:
+                        if (search.active) {
+                            search_append(&search, &search_index, event.text.text);
+                            search_show(&search, &view);
+                            damage_overlay(&damage);
+                        }
+                        break;
+                    case SDL_KEYDOWN:
+                        if (search.active) {
+                            switch (event.key.keysym.sym) {
+                                case SDLK_ESCAPE:
+                                    search_close(&search);
+                                    damage_all(&damage);
+                                    break;
+                                case SDLK_BACKSPACE:
+                                    search_backspace(&search, &search_index);
+                                    search_show(&search, &view);
+                                    break;
+                                case SDLK_UP:
+                                case SDLK_DOWN:
+                                    search_select(&search, event.key.keysym.sym == SDLK_UP ? -1 : 1);
+                                    search_show(&search, &view);
+                                    break;
+                                case SDLK_RETURN:
+                                    if (search.count > 0) {
+                                        // Same as clicking the result: play a track, select an album
+                                        SearchResult result = search.results[search.selected];
+                                        Hit hit = {result.track >= 0 ? HIT_TRACK : HIT_ALBUM, result.album, result.track, 0.0f};
+                                        handle_click(hit, SDL_BUTTON_LEFT, &library, &play_queue, &current_album, &current_track);
+                                        if (hit.kind == HIT_TRACK) {
+                                            follow_queue(&play_queue, &current_album, &current_track);
+                                        }
+                                    }
+                                    search_close(&search);
+                                    damage_all(&damage);
+                                    break;
+                            }
+                            damage_overlay(&damage);
+                            break;
+                        }
+                        if (event.key.keysym.sym == SDLK_f && (event.key.keysym.mod & KMOD_CTRL)) {
+                            search_open(&search);
+                            damage_overlay(&damage);
+                            break;
+                        }
+                        switch (event.key.keysym.sym) {
+                            case SDLK_UP:
+                                view_scroll_by(&view, -SCROLL_STEP);
+                                break;
+                            case SDLK_DOWN:
+                                view_scroll_by(&view, SCROLL_STEP);
+                                break;
+                            case SDLK_PAGEUP:
+                                view_scroll_by(&view, -WINDOW_HEIGHT);
+                                break;
+                            case SDLK_PAGEDOWN:
+                                view_scroll_by(&view, WINDOW_HEIGHT);
+                                break;
+                            case SDLK_n:
+                                play_queue_advance(&play_queue, &library);
+                                follow_queue(&play_queue, &current_album, &current_track);
+                                break;
+                        }
+                        break;
+                    case SDL_WINDOWEVENT:
+                        if (event.window.event == SDL_WINDOWEVENT_EXPOSED) {
+                            damage_all(&damage);
+                        }
+                        break;
+                    case SDL_RENDER_TARGETS_RESET:
+                    case SDL_RENDER_DEVICE_RESET:
+                        damage_all(&damage);
+                        break;
+                }
+            } while (SDL_PollEvent(&event));
+        }
+
+        if (library_changed) {
+            char *changes[WATCH_MAX_CHANGES];
+            bool everything;
+            int change_count = library_watch_collect(&library_watch, changes, WATCH_MAX_CHANGES, &everything);
+            bool reload = everything || options.scan_root;
+            for (int i = 0; i < change_count && !reload; i++) {
+                reload = strcmp(changes[i], watched_path) == 0;
+            }
+
+            // The loudness scan and the seek index read the library and the
+            // files under it, so they are retired while those change and new
+            // ones measure what moved. Retiring doesn't wait for the files
+            // being read.
+            bool loudness_stopped = loudness && reload;
+            if (loudness_stopped) {
+                audio_engine_set_loudness(&audio_engine, NULL);
+                loudness_retire(loudness);
+                loudness = NULL;
+            }
+            bool index_stopped = seek_index && reload;
+            if (index_stopped) {
+                seek_index_retire(seek_index);
+                seek_index = NULL;
+            }
+            if (reload && reload_library(&library, options.scan_root, &play_queue, covers_streaming ? &cover_loader : NULL, &cover_atlas, &view, &search_index, &text_cache, &current_album, &current_track)) {
+                albums = library.albums;
+                number_of_albums = library.number_of_albums;
+                if (search.active) {
+                    search_update(&search, &search_index);
+                }
+                layout_build(&layout, &library, shown_album(&search, current_album), font);
+                damage_all(&damage);
+                if (watching) {
+                    library_watch_update(&library_watch, &library);
+                }
+            }
+            bool tracks_changed = refresh_media(&library, changes, change_count, everything, &audio_engine, &damage);
+            if (loudness && tracks_changed && !loudness_stopped) {
+                audio_engine_set_loudness(&audio_engine, NULL);
+                loudness_retire(loudness);
+                loudness = NULL;
+                loudness_stopped = true;
+            }
+            if (loudness_stopped) {
+                loudness = loudness_start(&library, LOUDNESS_CACHE_PATH, audio_engine.frequency, audio_engine.channels, options.resample_quality);
+                if (loudness) {
+                    audio_engine_set_loudness(&audio_engine, loudness);
+                }
+            }
+            if (seek_index && tracks_changed && !index_stopped) {
+                seek_index_retire(seek_index);
+                seek_index = NULL;
+                index_stopped = true;
+            }
+            if (index_stopped) {
+                seek_index = seek_index_start(&library, seek_cache_path);
+                track_length.album = -1;
+            }
+            for (int i = 0; i < change_count; i++) {
+                free(changes[i]);
+            }
+            library_changed = false;
+        }
+
+        int shown = shown_album(&search, current_album);
+        int selected = shown_track(&search);
+        if (shown != previous_shown) {
+            trace_start_time = trace_begin();
+            layout_build(&layout, &library, shown, font);
+            trace_end("layout_build", trace_start_time);
+            damage_album(&damage, previous_shown);
+            damage_album(&damage, shown);
+        }
+        if (selected != previous_selected) {
+            layout_show_row(&layout, selected);
+            damage_album(&damage, shown);
+        }
+        if (current_album != previous_album || current_track != previous_track) {
+            if (layout.expanded_album == current_album && selected < 0) {
+                layout_show_row(&layout, current_track);
+            }
+            scrubbing = false;
+            damage_album(&damage, previous_album);
+            damage_album(&damage, current_album);
+        }
+
+        now = SDL_GetTicks();
+        bool scroll_frame_due = interval == 0 || now - last_frame >= interval;
+        if (scroll_frame_due && view_animate(&view)) {
+            damage_all(&damage);
+        }
+
+        // Request covers that scrolled into range and upload any the
+        // workers have finished. Covers that arrive after their album has
+        // left the resident range are dropped.
+        if (covers_streaming) {
+            update_resident_covers(&view, &library, &cover_loader, &cover_atlas);
+
+            int album_index;
+            SDL_Surface *surface;
+            while (cover_loader_collect(&cover_loader, &album_index, &surface)) {
+                Album *album = &albums[album_index];
+                if (album->cover_state != COVER_PENDING) {
+                    SDL_FreeSurface(surface);
+                } else if (surface) {
+                    trace_start_time = trace_begin();
+                    cover_atlas_release(&cover_atlas, album->cover);
+                    album->cover = cover_atlas_insert(&cover_atlas, surface, album_index);
+                    trace_end("cover_upload", trace_start_time);
+                    album->cover_state = cover_atlas_contains(&cover_atlas, album->cover) ? COVER_READY : COVER_FAILED;
+                    SDL_FreeSurface(surface);
+                    damage_album(&damage, album_index);
+                } else {
+                    printf("Error loading album cover for album %d\n", album_index + 1);
+                    cover_atlas_release(&cover_atlas, album->cover);
+                    album->cover_state = COVER_FAILED;
+                }
+            }
+            if (!visible_covers_logged && cover_loader_outstanding(&cover_loader) == 0) {
+                printf("Visible covers ready after %u ms\n", SDL_GetTicks() - start_ticks);
+                visible_covers_logged = true;
             }
         }
 
-        // Render albums and tracks
-        draw_albums(renderer, albums, number_of_albums, font, current_album, current_track);
+        if (spectrum_due && now - last_spectrum >= SPECTRUM_FRAME_MS) {
+            trace_start_time = trace_begin();
+            bool spectrum_changed = spectrum_update(&spectrum);
+            trace_end("spectrum_update", trace_start_time);
+            if (spectrum_changed) {
+                damage_album(&damage, current_album);
+            }
+            last_spectrum = now;
+        }
+
+        // Motion is coalesced to one seek per pass, so a fast drag does not
+        // flush the ring for every event
+        if (scrub_moved) {
+            scrubbing = scrubbing && scrub(&audio_engine, scrub_fraction, &scrub_ms);
+            damage_album(&damage, current_album);
+            scrub_moved = false;
+        }
+
+        if (audio_engine_is_playing(&audio_engine) && now - last_tick >= POSITION_TICK_MS) {
+            damage_album(&damage, current_album);
+            last_tick = now;
+        }
+
+        if (trace_dump_requested()) {
+            trace_dump();
+        }
+
+        if (session_enabled && now - last_session_save >= SESSION_SAVE_MS) {
+            save_session(&session_writer, &library, &layout, &view, &audio_engine, current_album, current_track, thumbnail_size, false);
+            last_session_save = now;
+        }
+        // Scans retired by a library change are freed once their workers
+        // finish the track in hand
+        loudness_reap(false);
+        seek_index_reap(false);
+
+        if (quit || !damage.any || (frame_interval > 0 && now - last_frame < frame_interval)) {
+            frames_skipped++;
+            continue;
+        }
+
+        // Render the albums and tracks that changed. While scrubbing the bar
+        // follows the pointer rather than the audio catching up with it.
+        Progress progress = track_progress(&audio_engine, seek_index, &track_length, &library, current_album, current_track);
+        if (scrubbing) {
+            progress.position_ms = scrub_ms;
+        }
+        draw_albums(renderer, canvas, &library, font, &text_cache, &cover_atlas, &layout, spectrum_running ? &spectrum : NULL, &progress, &damage, &view, &search, current_album, current_track);
+        last_frame = now;
+        if (frames_drawn++ == 0) {
+            printf("First frame after %u ms\n", SDL_GetTicks() - start_ticks);
+        }
+    }
+    printf("Frames: %lu drawn, %lu skipped\n", frames_drawn, frames_skipped);
+    if (watching) {
+        library_watch_stop(&library_watch);
     }
+    if (session_enabled) {
+        save_session(&session_writer, &library, &layout, &view, &audio_engine, current_album, current_track, thumbnail_size, true);
+        session_writer_stop(&session_writer);
+    }
+    if (covers_streaming) {
+        cover_loader_stop(&cover_loader);
+    }
+    SDL_DestroyTexture(canvas);
+    layout_free(&layout);
 
 
     // Cleanup resources
-    for (int i = 0; i < number_of_albums; i++) {
-        SDL_DestroyTexture(albums[i].cover);
-        for (int j = 0; j < albums[i].number_of_tracks; j++) {
-            Mix_FreeMusic(albums[i].tracks[j].music);
-        }
-        free(albums[i].tracks);
+    play_queue_free(&play_queue);
+    if (spectrum_running) {
+        spectrum_free(&spectrum);
+    }
+    printf("Audio underruns: %d\n", audio_engine_underruns(&audio_engine));
+    audio_engine_shutdown(&audio_engine);
+    if (loudness) {
+        loudness_stop(loudness);
+    }
+    loudness_reap(true);
+    if (seek_index) {
+        seek_index_stop(seek_index);
     }
-    free(albums);
+    seek_index_reap(true);
+    printf("Music cache: %d hits, %d misses, %d evictions\n", music_cache.hits, music_cache.misses, music_cache.evictions);
+    music_cache_clear(&music_cache);
+    printf("Text cache: %lu frames, %lu with no TTF or texture work, %lu renders, %lu textures created, %lu hits, %lu evictions\n",
+           text_cache.frames, text_cache.steady_frames, text_cache.ttf_renders, text_cache.textures_created, text_cache.hits, text_cache.evictions);
+    text_cache_invalidate(&text_cache);
+
+    printf("Cover atlas: %d pages, %d draw calls, %d evictions\n", cover_atlas.page_count, cover_atlas.draw_calls, cover_atlas.evictions);
+    cover_atlas_free(&cover_atlas);
+    search_index_free(&search_index);
+    library_free(&library);
 
     //cleanup
     SDL_DestroyRenderer(renderer);
@@ -417,7 +2102,9 @@ int main(int argc, char **argv) {
     IMG_Quit();
     Mix_CloseAudio();
     Mix_Quit();
+    trace_stop();
     SDL_Quit();
 
     return 0;
 }
+#endif
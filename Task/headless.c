@@ -0,0 +1,235 @@
+#include "headless.h"
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "search_index.h"
+
+HeadlessCommand headless_parse_command(const char *name, const char *argument) {
+    if (strcmp(name, "list") == 0) {
+        return HEADLESS_LIST;
+    } else if (strcmp(name, "validate") == 0) {
+        return HEADLESS_VALIDATE;
+    } else if (strcmp(name, "search") == 0 && argument) {
+        return HEADLESS_SEARCH;
+    } else if (strcmp(name, "export") == 0 && argument && strcmp(argument, "json") == 0) {
+        return HEADLESS_EXPORT_JSON;
+    } else if (strcmp(name, "export") == 0 && argument && strcmp(argument, "csv") == 0) {
+        return HEADLESS_EXPORT_CSV;
+    }
+    return HEADLESS_NONE;
+}
+
+bool headless_takes_argument(HeadlessCommand command) {
+    return command == HEADLESS_SEARCH || command == HEADLESS_EXPORT_JSON || command == HEADLESS_EXPORT_CSV;
+}
+
+static const char *genre_name(Genre genre) {
+    switch (genre) {
+    case POP:
+        return "Pop";
+    case CLASSIC:
+        return "Classic";
+    case JAZZ:
+        return "Jazz";
+    case ROCK:
+        return "Rock";
+    }
+    return "";
+}
+
+// Tabs, line breaks and backslashes in the text are written as \t, \n, \r
+// and \\, so every field stays on its line and between its tabs.
+static void write_tsv_field(const char *str, char separator) {
+    const char *run = str;
+    const char *c = str;
+    for (;; c++) {
+        if (*c && *c != '\t' && *c != '\n' && *c != '\r' && *c != '\\') {
+            continue;
+        }
+        fwrite(run, 1, (size_t)(c - run), stdout);
+        if (!*c) {
+            break;
+        }
+        putchar('\\');
+        putchar(*c == '\t' ? 't' : *c == '\n' ? 'n' : *c == '\r' ? 'r' : '\\');
+        run = c + 1;
+    }
+    putchar(separator);
+}
+
+static int list_albums(const Library *library) {
+    for (int a = 0; a < library->number_of_albums; a++) {
+        const Album *album = &library->albums[a];
+        printf("%d\t", a);
+        write_tsv_field(library_string(library, album->title), '\t');
+        write_tsv_field(library_string(library, album->artist), '\t');
+        printf("%s\t%d\n", genre_name(album->genre), album->number_of_tracks);
+    }
+    return 0;
+}
+
+static int search_library(const Library *library, const char *query) {
+    SearchResult results[HEADLESS_SEARCH_RESULTS];
+    int count = search_index_scan(library, query, results, HEADLESS_SEARCH_RESULTS);
+    for (int i = 0; i < count; i++) {
+        const Album *album = &library->albums[results[i].album];
+        const char *track = results[i].track >= 0 ? library_track_title(library, results[i].album, results[i].track) : "";
+        printf("%d\t%d\t", results[i].album, results[i].track);
+        write_tsv_field(library_string(library, album->title), '\t');
+        write_tsv_field(library_string(library, album->artist), '\t');
+        write_tsv_field(track, '\n');
+    }
+    return 0;
+}
+
+static bool file_exists(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && !S_ISDIR(st.st_mode);
+}
+
+static int validate_library(const Library *library) {
+    int checked = 0;
+    int missing = 0;
+    for (int a = 0; a < library->number_of_albums; a++) {
+        const Album *album = &library->albums[a];
+        const char *cover = library_string(library, album->photo_location);
+        if (*cover) {
+            checked++;
+            if (!file_exists(cover)) {
+                printf("cover\t%d\t-1\t", a);
+                write_tsv_field(cover, '\n');
+                missing++;
+            }
+        }
+        for (int t = 0; t < album->number_of_tracks; t++) {
+            char path[MAX_PATH_LENGTH];
+            library_track_location(library, a, t, path, sizeof(path));
+            checked++;
+            if (!file_exists(path)) {
+                printf("track\t%d\t%d\t", a, t);
+                write_tsv_field(path, '\n');
+                missing++;
+            }
+        }
+    }
+    fprintf(stderr, "%d of %d files missing\n", missing, checked);
+    return missing > 0 ? 1 : 0;
+}
+
+// Runs that need no escaping are written in one call.
+static void write_json_string(const char *str) {
+    putchar('"');
+    const unsigned char *run = (const unsigned char *)str;
+    const unsigned char *c = run;
+    for (;; c++) {
+        if (*c >= 0x20 && *c != '"' && *c != '\\') {
+            continue;
+        }
+        fwrite(run, 1, (size_t)(c - run), stdout);
+        if (!*c) {
+            break;
+        }
+        if (*c < 0x20) {
+            printf("\\u%04x", *c);
+        } else {
+            putchar('\\');
+            putchar(*c);
+        }
+        run = c + 1;
+    }
+    putchar('"');
+}
+
+// One album per line, so the output can also be split with line tools.
+static int export_json(const Library *library) {
+    printf("[\n");
+    for (int a = 0; a < library->number_of_albums; a++) {
+        const Album *album = &library->albums[a];
+        printf("  {\"title\": ");
+        write_json_string(library_string(library, album->title));
+        printf(", \"artist\": ");
+        write_json_string(library_string(library, album->artist));
+        printf(", \"genre\": ");
+        write_json_string(genre_name(album->genre));
+        printf(", \"cover\": ");
+        write_json_string(library_string(library, album->photo_location));
+        printf(", \"tracks\": [");
+        for (int t = 0; t < album->number_of_tracks; t++) {
+            char path[MAX_PATH_LENGTH];
+            library_track_location(library, a, t, path, sizeof(path));
+            printf(t > 0 ? ", {\"title\": " : "{\"title\": ");
+            write_json_string(library_track_title(library, a, t));
+            printf(", \"location\": ");
+            write_json_string(path);
+            putchar('}');
+        }
+        printf(a + 1 < library->number_of_albums ? "]},\n" : "]}\n");
+    }
+    printf("]\n");
+    return 0;
+}
+
+// Quoted only when it holds a separator, a quote or a line break.
+static void write_csv_field(const char *str, char separator) {
+    if (strpbrk(str, ",\"\r\n")) {
+        putchar('"');
+        for (const char *c = str; *c; c++) {
+            if (*c == '"') {
+                putchar('"');
+            }
+            putchar(*c);
+        }
+        putchar('"');
+    } else {
+        fputs(str, stdout);
+    }
+    putchar(separator);
+}
+
+// One row per track, with its album's fields repeated.
+static int export_csv(const Library *library) {
+    printf("album,artist,genre,cover,track,title,location\n");
+    for (int a = 0; a < library->number_of_albums; a++) {
+        const Album *album = &library->albums[a];
+        for (int t = 0; t < album->number_of_tracks; t++) {
+            char path[MAX_PATH_LENGTH];
+            library_track_location(library, a, t, path, sizeof(path));
+            write_csv_field(library_string(library, album->title), ',');
+            write_csv_field(library_string(library, album->artist), ',');
+            write_csv_field(genre_name(album->genre), ',');
+            write_csv_field(library_string(library, album->photo_location), ',');
+            printf("%d,", t + 1);
+            write_csv_field(library_track_title(library, a, t), ',');
+            write_csv_field(path, '\n');
+        }
+    }
+    return 0;
+}
+
+int headless_run(const Library *library, HeadlessCommand command, const char *argument) {
+    int status = 1;
+    switch (command) {
+    case HEADLESS_LIST:
+        status = list_albums(library);
+        break;
+    case HEADLESS_SEARCH:
+        status = search_library(library, argument);
+        break;
+    case HEADLESS_VALIDATE:
+        status = validate_library(library);
+        break;
+    case HEADLESS_EXPORT_JSON:
+        status = export_json(library);
+        break;
+    case HEADLESS_EXPORT_CSV:
+        status = export_csv(library);
+        break;
+    case HEADLESS_NONE:
+        break;
+    }
+    if (fflush(stdout) != 0) {
+        fprintf(stderr, "Error writing output\n");
+        return 1;
+    }
+    return status;
+}
@@ -0,0 +1,33 @@
+#ifndef HEADLESS_H
+#define HEADLESS_H
+
+#include <stdbool.h>
+#include "library.h"
+
+#define HEADLESS_SEARCH_RESULTS 1000
+
+typedef enum headless_command {
+    HEADLESS_NONE = 0,
+    HEADLESS_LIST,
+    HEADLESS_SEARCH,
+    HEADLESS_VALIDATE,
+    HEADLESS_EXPORT_JSON,
+    HEADLESS_EXPORT_CSV
+} HeadlessCommand;
+
+// Queries answered from the library alone, for scripts: nothing but the
+// catalog is read, and no part of SDL is initialized. Results go to stdout
+// and diagnostics to stderr.
+//
+//   list              albums as tab-separated index, title, artist, genre
+//                     and track count
+//   search QUERY      matches as album, track (-1 for the album itself),
+//                     album title, artist and track title
+//   validate          covers and tracks whose files are missing, as kind,
+//                     album, track and path; exits with 1 if any are
+//   export json|csv   every album and track
+HeadlessCommand headless_parse_command(const char *name, const char *argument);
+bool headless_takes_argument(HeadlessCommand command);
+int headless_run(const Library *library, HeadlessCommand command, const char *argument);
+
+#endif
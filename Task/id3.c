@@ -0,0 +1,319 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "id3.h"
+
+static size_t put_utf8(char *out, size_t used, size_t out_size, unsigned long code) {
+    char bytes[4];
+    size_t length;
+    if (code < 0x80) {
+        bytes[0] = (char)code;
+        length = 1;
+    } else if (code < 0x800) {
+        bytes[0] = (char)(0xC0 | (code >> 6));
+        bytes[1] = (char)(0x80 | (code & 0x3F));
+        length = 2;
+    } else if (code < 0x10000) {
+        bytes[0] = (char)(0xE0 | (code >> 12));
+        bytes[1] = (char)(0x80 | ((code >> 6) & 0x3F));
+        bytes[2] = (char)(0x80 | (code & 0x3F));
+        length = 3;
+    } else {
+        bytes[0] = (char)(0xF0 | (code >> 18));
+        bytes[1] = (char)(0x80 | ((code >> 12) & 0x3F));
+        bytes[2] = (char)(0x80 | ((code >> 6) & 0x3F));
+        bytes[3] = (char)(0x80 | (code & 0x3F));
+        length = 4;
+    }
+    if (used + length >= out_size) {
+        return used;
+    }
+    memcpy(out + used, bytes, length);
+    return used + length;
+}
+
+// Converts one ID3v2 text value to UTF-8, stopping at its terminator.
+// Encodings: 0 ISO-8859-1, 1 UTF-16 with BOM, 2 UTF-16BE, 3 UTF-8.
+static void decode_text(int encoding, const unsigned char *data, size_t size, char *out, size_t out_size) {
+    size_t used = 0;
+    if (encoding == 1 || encoding == 2) {
+        bool big_endian = true;
+        size_t i = 0;
+        if (encoding == 1 && size >= 2) {
+            if (data[0] == 0xFF && data[1] == 0xFE) {
+                big_endian = false;
+                i = 2;
+            } else if (data[0] == 0xFE && data[1] == 0xFF) {
+                i = 2;
+            }
+        }
+        for (; i + 1 < size; i += 2) {
+            unsigned long unit = big_endian ? (unsigned long)(data[i] << 8 | data[i + 1]) : (unsigned long)(data[i + 1] << 8 | data[i]);
+            if (unit == 0) {
+                break;
+            }
+            if (unit >= 0xD800 && unit < 0xDC00 && i + 3 < size) {
+                unsigned long low = big_endian ? (unsigned long)(data[i + 2] << 8 | data[i + 3]) : (unsigned long)(data[i + 3] << 8 | data[i + 2]);
+                if (low >= 0xDC00 && low < 0xE000) {
+                    unit = 0x10000 + ((unit - 0xD800) << 10) + (low - 0xDC00);
+                    i += 2;
+                }
+            }
+            used = put_utf8(out, used, out_size, unit);
+        }
+    } else {
+        for (size_t i = 0; i < size && data[i]; i++) {
+            if (encoding == 3) {
+                if (used + 1 < out_size) {
+                    out[used++] = (char)data[i];
+                }
+            } else {
+                used = put_utf8(out, used, out_size, data[i]);
+            }
+        }
+    }
+    out[used] = '\0';
+}
+
+// Length of a terminated string in the given encoding, including the
+// terminator, or `size` if it is unterminated.
+static size_t terminated_length(int encoding, const unsigned char *data, size_t size) {
+    if (encoding == 1 || encoding == 2) {
+        for (size_t i = 0; i + 1 < size; i += 2) {
+            if (data[i] == 0 && data[i + 1] == 0) {
+                return i + 2;
+            }
+        }
+        return size;
+    }
+    for (size_t i = 0; i < size; i++) {
+        if (data[i] == 0) {
+            return i + 1;
+        }
+    }
+    return size;
+}
+
+static void trim_trailing_spaces(char *text) {
+    size_t length = strlen(text);
+    while (length > 0 && text[length - 1] == ' ') {
+        text[--length] = '\0';
+    }
+}
+
+static size_t syncsafe(const unsigned char *bytes) {
+    return (size_t)(bytes[0] & 0x7F) << 21 | (size_t)(bytes[1] & 0x7F) << 14 | (size_t)(bytes[2] & 0x7F) << 7 | (size_t)(bytes[3] & 0x7F);
+}
+
+// Undoes unsynchronisation (a 0x00 inserted after every 0xFF) in place and
+// returns the new size.
+static size_t resynchronise(unsigned char *data, size_t size) {
+    size_t out = 0;
+    for (size_t i = 0; i < size; i++) {
+        data[out++] = data[i];
+        if (data[i] == 0xFF && i + 1 < size && data[i + 1] == 0x00) {
+            i++;
+        }
+    }
+    return out;
+}
+
+static void read_picture(Id3Tags *tags, int version, const unsigned char *data, size_t size) {
+    if (size < 2) {
+        return;
+    }
+    int encoding = data[0];
+    size_t offset = 1;
+    const char *extension = "jpg";
+    if (version == 2) {
+        // PIC: three-letter image format instead of a MIME type
+        if (size < 5) {
+            return;
+        }
+        if (memcmp(data + 1, "PNG", 3) == 0) {
+            extension = "png";
+        }
+        offset = 4;
+    } else {
+        size_t mime_length = terminated_length(0, data + offset, size - offset);
+        if (mime_length >= 9 && memcmp(data + offset, "image/png", 9) == 0) {
+            extension = "png";
+        }
+        offset += mime_length;
+    }
+    if (offset >= size) {
+        return;
+    }
+    int picture_type = data[offset++];
+    offset += terminated_length(encoding, data + offset, size - offset);
+    if (offset >= size) {
+        return;
+    }
+
+    // Keep the first picture unless a front cover (type 3) turns up later
+    if (tags->cover && picture_type != 3) {
+        return;
+    }
+    unsigned char *cover = malloc(size - offset);
+    if (!cover) {
+        return;
+    }
+    memcpy(cover, data + offset, size - offset);
+    free(tags->cover);
+    tags->cover = cover;
+    tags->cover_size = size - offset;
+    snprintf(tags->cover_extension, sizeof(tags->cover_extension), "%s", extension);
+}
+
+static void read_frame(Id3Tags *tags, int version, const char *id, const unsigned char *data, size_t size) {
+    char *field = NULL;
+    if (strcmp(id, "TIT2") == 0 || strcmp(id, "TT2") == 0) {
+        field = tags->title;
+    } else if (strcmp(id, "TPE1") == 0 || strcmp(id, "TP1") == 0) {
+        field = tags->artist;
+    } else if (strcmp(id, "TPE2") == 0 || strcmp(id, "TP2") == 0) {
+        field = tags->album_artist;
+    } else if (strcmp(id, "TALB") == 0 || strcmp(id, "TAL") == 0) {
+        field = tags->album;
+    } else if (strcmp(id, "TCON") == 0 || strcmp(id, "TCO") == 0) {
+        field = tags->genre;
+    } else if (strcmp(id, "TRCK") == 0 || strcmp(id, "TRK") == 0) {
+        char number[16];
+        if (size > 1) {
+            decode_text(data[0], data + 1, size - 1, number, sizeof(number));
+            tags->track_number = atoi(number);
+        }
+        return;
+    } else if (strcmp(id, "APIC") == 0 || strcmp(id, "PIC") == 0) {
+        read_picture(tags, version, data, size);
+        return;
+    }
+    if (field && size > 1) {
+        decode_text(data[0], data + 1, size - 1, field, ID3_TEXT_LENGTH);
+    }
+}
+
+static bool read_id3v2(FILE *fptr, Id3Tags *tags) {
+    unsigned char header[10];
+    if (fread(header, 1, sizeof(header), fptr) != sizeof(header) || memcmp(header, "ID3", 3) != 0) {
+        return false;
+    }
+    int version = header[3];
+    int flags = header[5];
+    size_t size = syncsafe(header + 6);
+    if (version < 2 || version > 4 || size == 0 || size > ID3_MAX_TAG_SIZE) {
+        return false;
+    }
+
+    unsigned char *data = malloc(size);
+    if (!data) {
+        return false;
+    }
+    if (fread(data, 1, size, fptr) != size) {
+        free(data);
+        return false;
+    }
+    if ((flags & 0x80) && version < 4) {
+        size = resynchronise(data, size);
+    }
+
+    size_t offset = 0;
+    if ((flags & 0x40) && version >= 3 && size >= 4) {
+        // Extended header: v2.3 stores its size excluding the size field,
+        // v2.4 as a syncsafe size including it
+        size_t extended = version == 3 ? ((size_t)data[0] << 24 | (size_t)data[1] << 16 | (size_t)data[2] << 8 | data[3]) + 4 : syncsafe(data);
+        offset = extended < size ? extended : size;
+    }
+
+    size_t id_length = version == 2 ? 3 : 4;
+    size_t header_length = version == 2 ? 6 : 10;
+    while (offset + header_length <= size && data[offset] != 0) {
+        char id[5] = {0};
+        memcpy(id, data + offset, id_length);
+        const unsigned char *frame = data + offset + id_length;
+        size_t frame_size;
+        int frame_flags = version == 2 ? 0 : frame[5];
+        if (version == 2) {
+            frame_size = (size_t)frame[0] << 16 | (size_t)frame[1] << 8 | frame[2];
+        } else if (version == 3) {
+            frame_size = (size_t)frame[0] << 24 | (size_t)frame[1] << 16 | (size_t)frame[2] << 8 | frame[3];
+        } else {
+            frame_size = syncsafe(frame);
+        }
+        offset += header_length;
+        if (frame_size > size - offset) {
+            break;
+        }
+
+        unsigned char *body = data + offset;
+        size_t body_size = frame_size;
+        if (version == 4 && (frame_flags & 0x01) && body_size >= 4) {
+            // Data length indicator precedes the frame data
+            body += 4;
+            body_size -= 4;
+        }
+        // Compressed and encrypted frames are skipped
+        bool readable = version == 2 || (version == 3 ? !(frame_flags & 0xC0) : !(frame_flags & 0x0C));
+        if (readable) {
+            if (version == 4 && (frame_flags & 0x02)) {
+                body_size = resynchronise(body, body_size);
+            }
+            read_frame(tags, version, id, body, body_size);
+        }
+        offset += frame_size;
+    }
+    free(data);
+    return true;
+}
+
+static void read_v1_field(const unsigned char *data, size_t size, char *out) {
+    char field[31];
+    memcpy(field, data, size);
+    field[size] = '\0';
+    decode_text(0, (const unsigned char *)field, size, out, ID3_TEXT_LENGTH);
+    trim_trailing_spaces(out);
+}
+
+// ID3v1 fields fill in whatever the ID3v2 tag left empty.
+static bool read_id3v1(FILE *fptr, Id3Tags *tags) {
+    unsigned char tag[128];
+    if (fseek(fptr, -128, SEEK_END) != 0 || fread(tag, 1, sizeof(tag), fptr) != sizeof(tag) || memcmp(tag, "TAG", 3) != 0) {
+        return false;
+    }
+    if (!tags->title[0]) {
+        read_v1_field(tag + 3, 30, tags->title);
+    }
+    if (!tags->artist[0]) {
+        read_v1_field(tag + 33, 30, tags->artist);
+    }
+    if (!tags->album[0]) {
+        read_v1_field(tag + 63, 30, tags->album);
+    }
+    // ID3v1.1 keeps the track number in the last comment byte
+    if (tags->track_number == 0 && tag[125] == 0 && tag[126] != 0) {
+        tags->track_number = tag[126];
+    }
+    if (!tags->genre[0] && tag[127] != 0xFF) {
+        snprintf(tags->genre, sizeof(tags->genre), "(%d)", tag[127]);
+    }
+    return true;
+}
+
+// Returns false if the file could not be opened or has no tag at all.
+bool id3_read(const char *path, Id3Tags *tags) {
+    memset(tags, 0, sizeof(*tags));
+    FILE *fptr = fopen(path, "rb");
+    if (!fptr) {
+        return false;
+    }
+    bool found = read_id3v2(fptr, tags);
+    found = read_id3v1(fptr, tags) || found;
+    fclose(fptr);
+    return found;
+}
+
+void id3_free(Id3Tags *tags) {
+    free(tags->cover);
+    tags->cover = NULL;
+    tags->cover_size = 0;
+}
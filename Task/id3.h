@@ -0,0 +1,29 @@
+#ifndef ID3_H
+#define ID3_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#define ID3_TEXT_LENGTH 256
+#define ID3_MAX_TAG_SIZE (16 * 1024 * 1024)
+
+// The fields the library uses, converted to UTF-8. Empty strings when a
+// field is missing. `cover` holds the raw bytes of the embedded front cover
+// (any picture if there is no front cover), with `cover_extension` "jpg" or
+// "png".
+typedef struct id3_tags {
+    char title[ID3_TEXT_LENGTH];
+    char artist[ID3_TEXT_LENGTH];
+    char album_artist[ID3_TEXT_LENGTH];
+    char album[ID3_TEXT_LENGTH];
+    char genre[ID3_TEXT_LENGTH];
+    int track_number;
+    unsigned char *cover;
+    size_t cover_size;
+    char cover_extension[8];
+} Id3Tags;
+
+bool id3_read(const char *path, Id3Tags *tags);
+void id3_free(Id3Tags *tags);
+
+#endif
@@ -1,80 +1,418 @@
 #include "input_functions.h"
-#include "string.h"
+#include <float.h>
+#include <limits.h>
+#include <stdint.h>
+#include <string.h>
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
 
-void flush()
+typedef struct input_state
 {
-	while ((getchar()) != '\n')
-		;
+	char buffer[INPUT_BUFFER_SIZE];
+	size_t position;
+	size_t length;
+	bool end;
+	bool batch;
+	bool mode_chosen;
+	int line;
+} InputState;
+
+static InputState input;
+
+void input_set_batch(bool batch)
+{
+	input.batch = batch;
+	input.mode_chosen = true;
 }
 
-void read_string(const char *prompt, char *destination)
+int input_line_number(void)
 {
-	printf("%s", prompt);
-	scanf("%s", destination);
-	flush();
+	return input.line;
 }
 
-float read_float(const char *prompt)
+// Appends more of stdin after the unread part of the buffer. Interactively
+// fgets returns as soon as a line is typed, where fread would wait for the
+// whole buffer to fill.
+static void fill(void)
 {
-	float input;
-	printf("%s", prompt);
-	scanf("%f", &input);
-	flush();
-	return input;
+	memmove(input.buffer, input.buffer + input.position, input.length - input.position);
+	input.length -= input.position;
+	input.position = 0;
+
+	size_t space = INPUT_BUFFER_SIZE - input.length;
+	size_t read = 0;
+	if (input.batch)
+	{
+		read = fread(input.buffer + input.length, 1, space, stdin);
+	}
+	else if (fgets(input.buffer + input.length, (int)(space < INT_MAX ? space : INT_MAX), stdin))
+	{
+		read = strlen(input.buffer + input.length);
+	}
+	input.length += read;
+	input.end = read == 0;
+}
+
+// Finds the next line, without its line break. A line longer than the
+// buffer is skipped and returned as NULL.
+static bool next_line(const char **line, size_t *length)
+{
+	bool too_long = false;
+	for (;;)
+	{
+		char *start = input.buffer + input.position;
+		size_t available = input.length - input.position;
+		char *newline = memchr(start, '\n', available);
+		if (newline)
+		{
+			*line = start;
+			*length = (size_t)(newline - start);
+			input.position += *length + 1;
+			break;
+		}
+		if (input.end && available > 0)
+		{
+			*line = start;
+			*length = available;
+			input.position = input.length;
+			break;
+		}
+		if (input.end)
+		{
+			return false;
+		}
+		if (available >= INPUT_BUFFER_SIZE - 1)
+		{
+			too_long = true;
+			input.position = input.length;
+		}
+		fill();
+	}
+	input.line++;
+	if (*length > 0 && (*line)[*length - 1] == '\r')
+	{
+		(*length)--;
+	}
+	if (too_long)
+	{
+		*line = NULL;
+	}
+	return true;
+}
+
+// Unless input_set_batch() said otherwise, input is batch when stdin is
+// not a terminal.
+static bool prompt_line(const char *prompt, const char **line, size_t *length)
+{
+	if (!input.mode_chosen)
+	{
+		input.batch = !isatty(fileno(stdin));
+		input.mode_chosen = true;
+	}
+	if (!input.batch)
+	{
+		printf("%s", prompt);
+		fflush(stdout);
+	}
+	return next_line(line, length);
+}
+
+// Interactively asks for the line again; in batch mode fails the read.
+static bool reject(const char *expected, const char **line, size_t *length)
+{
+	if (input.batch)
+	{
+		fprintf(stderr, "Line %d: expected %s\n", input.line, expected);
+		return false;
+	}
+	printf("Please enter %s: ", expected);
+	fflush(stdout);
+	return next_line(line, length);
 }
 
-int read_integer(const char *prompt)
+static bool is_space(char c)
 {
-	int input;
-	printf("%s", prompt);
-	scanf("%d", &input);
-	flush();
-	return input;
+	return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
 }
 
-int read_integer_in_range(const char *prompt, int min, int max)
+// Narrows the line to its text without surrounding blanks.
+static bool trim(const char **text, size_t *length)
 {
-	int input;
-	bool repeat = false;
+	if (!*text)
+	{
+		return false;
+	}
+	while (*length > 0 && is_space(**text))
+	{
+		(*text)++;
+		(*length)--;
+	}
+	while (*length > 0 && is_space((*text)[*length - 1]))
+	{
+		(*length)--;
+	}
+	return *length > 0;
+}
 
-	printf("%s", prompt);
+static bool parse_integer(const char *text, size_t length, int *value)
+{
+	if (!trim(&text, &length))
+	{
+		return false;
+	}
+	const char *end = text + length;
+	bool negative = *text == '-';
+	if (*text == '-' || *text == '+')
+	{
+		text++;
+	}
+	if (text == end)
+	{
+		return false;
+	}
+	long long limit = negative ? -(long long)INT_MIN : INT_MAX;
+	long long result = 0;
+	for (; text < end; text++)
+	{
+		if (*text < '0' || *text > '9')
+		{
+			return false;
+		}
+		result = result * 10 + (*text - '0');
+		if (result > limit)
+		{
+			return false;
+		}
+	}
+	*value = (int)(negative ? -result : result);
+	return true;
+}
 
-	do
+// Decimal digits with an optional point and exponent. The first 19
+// significant digits are kept exactly, which is well beyond a float's
+// precision, and scaled by the decimal exponent in one pass over its bits.
+static bool parse_float(const char *text, size_t length, float *value)
+{
+	static const double powers[] = {1e1, 1e2, 1e4, 1e8, 1e16, 1e32, 1e64, 1e128, 1e256};
+	if (!trim(&text, &length))
+	{
+		return false;
+	}
+	const char *end = text + length;
+	bool negative = *text == '-';
+	if (*text == '-' || *text == '+')
 	{
-		scanf("%d", &input);
-		flush();
+		text++;
+	}
 
-		if (input < min && input > max)
+	uint64_t mantissa = 0;
+	int digits = 0;
+	int significant = 0;
+	int exponent = 0;
+	bool point = false;
+	for (; text < end; text++)
+	{
+		if (*text == '.' && !point)
+		{
+			point = true;
+			continue;
+		}
+		if (*text < '0' || *text > '9')
 		{
-			printf("Please enter a value between %d and %d: \n");
-			repeat = true;
+			break;
+		}
+		digits++;
+		if (significant < 19)
+		{
+			mantissa = mantissa * 10 + (uint64_t)(*text - '0');
+			significant += mantissa > 0;
+			exponent -= point;
 		}
 		else
 		{
-			repeat = false;
+			exponent += !point;
+		}
+	}
+	if (digits == 0)
+	{
+		return false;
+	}
+	if (text < end && (*text == 'e' || *text == 'E'))
+	{
+		text++;
+		bool negative_exponent = text < end && *text == '-';
+		if (text < end && (*text == '-' || *text == '+'))
+		{
+			text++;
+		}
+		if (text == end)
+		{
+			return false;
+		}
+		int written = 0;
+		for (; text < end && *text >= '0' && *text <= '9'; text++)
+		{
+			if (written < 10000)
+			{
+				written = written * 10 + (*text - '0');
+			}
+		}
+		exponent += negative_exponent ? -written : written;
+	}
+	if (text != end)
+	{
+		return false;
+	}
+
+	double result = (double)mantissa;
+	int scale = exponent < 0 ? -exponent : exponent;
+	for (int bit = 0; scale > 0 && result != 0.0; bit++, scale >>= 1)
+	{
+		if (bit >= (int)(sizeof(powers) / sizeof(powers[0])))
+		{
+			result = exponent < 0 ? 0.0 : DBL_MAX;
+			break;
+		}
+		if (scale & 1)
+		{
+			result = exponent < 0 ? result / powers[bit] : result * powers[bit];
 		}
-	} while (repeat);
+	}
+	if (result > FLT_MAX)
+	{
+		return false;
+	}
+	*value = (float)(negative ? -result : result);
+	return true;
+}
+
+bool read_string(const char *prompt, char *destination, size_t size)
+{
+	const char *line;
+	size_t length;
+	char expected[64];
+	if (size == 0)
+	{
+		return false;
+	}
+	snprintf(expected, sizeof(expected), "at most %zu characters", size - 1);
+	if (!prompt_line(prompt, &line, &length))
+	{
+		return false;
+	}
+	while (!line || length >= size)
+	{
+		if (!reject(expected, &line, &length))
+		{
+			return false;
+		}
+	}
+	memcpy(destination, line, length);
+	destination[length] = '\0';
+	return true;
+}
 
-	return input;
+bool read_float(const char *prompt, float *value)
+{
+	const char *line;
+	size_t length;
+	if (!prompt_line(prompt, &line, &length))
+	{
+		return false;
+	}
+	while (!parse_float(line, length, value))
+	{
+		if (!reject("a number", &line, &length))
+		{
+			return false;
+		}
+	}
+	return true;
 }
 
-bool read_boolean(const char *prompt)
+bool read_integer(const char *prompt, int *value)
 {
-	char input[5];
+	const char *line;
+	size_t length;
+	if (!prompt_line(prompt, &line, &length))
+	{
+		return false;
+	}
+	while (!parse_integer(line, length, value))
+	{
+		if (!reject("a whole number", &line, &length))
+		{
+			return false;
+		}
+	}
+	return true;
+}
 
-	printf("%s", prompt);
-	scanf("%s", input);
+bool read_integer_in_range(const char *prompt, int min, int max, int *value)
+{
+	const char *line;
+	size_t length;
+	char expected[64];
+	snprintf(expected, sizeof(expected), "a value between %d and %d", min, max);
+	if (!prompt_line(prompt, &line, &length))
+	{
+		return false;
+	}
+	while (!parse_integer(line, length, value) || *value < min || *value > max)
+	{
+		if (!reject(expected, &line, &length))
+		{
+			return false;
+		}
+	}
+	return true;
+}
 
-	if (strcmp(input, "y") == 0 ||
-		strcmp(input, "Y") == 0 ||
-		strcmp(input, "yes") == 0 ||
-		strcmp(input, "Yes") == 0 ||
-		strcmp(input, "YES") == 0)
+static bool equal_ignoring_case(const char *text, size_t length, const char *word)
+{
+	size_t i = 0;
+	for (; i < length && word[i]; i++)
 	{
-		return true;
+		char c = text[i] >= 'A' && text[i] <= 'Z' ? (char)(text[i] - 'A' + 'a') : text[i];
+		if (c != word[i])
+		{
+			return false;
+		}
 	}
-	else
+	return i == length && !word[i];
+}
+
+bool read_boolean(const char *prompt, bool *value)
+{
+	const char *line;
+	size_t length;
+	if (!prompt_line(prompt, &line, &length))
 	{
 		return false;
 	}
+	for (;;)
+	{
+		const char *text = line;
+		size_t trimmed = length;
+		if (trim(&text, &trimmed))
+		{
+			if (equal_ignoring_case(text, trimmed, "y") || equal_ignoring_case(text, trimmed, "yes"))
+			{
+				*value = true;
+				return true;
+			}
+			if (equal_ignoring_case(text, trimmed, "n") || equal_ignoring_case(text, trimmed, "no"))
+			{
+				*value = false;
+				return true;
+			}
+		}
+		if (!reject("yes or no", &line, &length))
+		{
+			return false;
+		}
+	}
 }
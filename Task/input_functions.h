@@ -2,12 +2,28 @@
 #define INPUT_FUNCTIONS_H
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 
-void read_string(const char * prompt, char * destination);
-float read_float(const char * prompt);
-int read_integer(const char * prompt);
-int read_integer_in_range(const char * prompt, int min, int max);
-bool read_boolean(const char * prompt);
+#define INPUT_BUFFER_SIZE 65536
 
-#endif
\ No newline at end of file
+// Console input, one line of stdin per read. Input goes through a static
+// INPUT_BUFFER_SIZE buffer, so nothing is allocated, and numbers are parsed
+// by hand rather than with scanf, so the decimal point is '.' in any locale.
+//
+// Interactively each read prints its prompt and asks again until the line
+// is valid. In batch mode, for piped input, stdin is read in whole buffers,
+// nothing is printed and an invalid line fails the read after being
+// reported on stderr with its line number. Batch mode is chosen on the
+// first read from whether stdin is a terminal; input_set_batch() overrides
+// that. Every read fails at end of input, and read_string fails when
+// `size` is 0.
+void input_set_batch(bool batch);
+int input_line_number(void);
+bool read_string(const char * prompt, char * destination, size_t size);
+bool read_float(const char * prompt, float * value);
+bool read_integer(const char * prompt, int * value);
+bool read_integer_in_range(const char * prompt, int min, int max, int * value);
+bool read_boolean(const char * prompt, bool * value);
+
+#endif
@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "layout.h"
+
+void format_track_row(char *buffer, size_t size, int track_index, const char *title) {
+    snprintf(buffer, size, "%d. %s", track_index + 1, title);
+}
+
+void layout_init(Layout *layout) {
+    memset(layout, 0, sizeof(*layout));
+    layout->expanded_album = -1;
+}
+
+static bool point_in_rect(int x, int y, const SDL_Rect *rect) {
+    return x >= rect->x && x < rect->x + rect->w && y >= rect->y && y < rect->y + rect->h;
+}
+
+// Track rows are as wide as their text, measured here rather than on every
+// click. Without a font (e.g. in benchmarks) they get TRACK_ROW_WIDTH.
+bool layout_build(Layout *layout, const Library *library, int expanded_album, TTF_Font *font) {
+    layout->number_of_albums = library->number_of_albums;
+    layout->content_height = library->number_of_albums * ALBUM_SPACE;
+
+    SDL_Rect title = {MARGIN_LEFT, 0, COVER_SIZE, FONT_SIZE};
+    SDL_Rect artist = {MARGIN_LEFT, FONT_SIZE, COVER_SIZE, FONT_SIZE};
+    SDL_Rect cover = {MARGIN_LEFT, COVER_Y_OFFSET, COVER_SIZE, COVER_SIZE};
+    SDL_Rect album_hit = {MARGIN_LEFT, 0, COVER_SIZE, COVER_Y_OFFSET + COVER_SIZE};
+    layout->title = title;
+    layout->artist = artist;
+    layout->cover = cover;
+    layout->album_hit = album_hit;
+    SDL_Rect spectrum = {MARGIN_LEFT, COVER_Y_OFFSET + COVER_SIZE + 5, COVER_SIZE, SPECTRUM_HEIGHT};
+    layout->spectrum = spectrum;
+    // The gap under each track row, from the top of the row, where the
+    // playing track shows its progress
+    SDL_Rect progress = {TRACK_LIST_X, FONT_SIZE + 5, TRACK_ROW_WIDTH, TRACK_SPACING - FONT_SIZE - 10};
+    layout->progress = progress;
+
+    // Rebuilding the same album keeps its rows scrolled where they were
+    if (expanded_album != layout->expanded_album) {
+        layout->first_row = 0;
+    }
+    layout->expanded_album = expanded_album;
+    layout->number_of_rows = 0;
+    layout->visible_rows = 0;
+    if (expanded_album < 0 || expanded_album >= library->number_of_albums) {
+        layout->expanded_album = -1;
+        return true;
+    }
+
+    const Album *album = &library->albums[expanded_album];
+    if (album->number_of_tracks > layout->rows_capacity) {
+        SDL_Rect *rows = realloc(layout->rows, album->number_of_tracks * sizeof(SDL_Rect));
+        if (!rows) {
+            printf("Memory allocation failed for layout\n");
+            layout->expanded_album = -1;
+            return false;
+        }
+        layout->rows = rows;
+        layout->rows_capacity = album->number_of_tracks;
+    }
+
+    for (int i = 0; i < album->number_of_tracks; i++) {
+        int width = TRACK_ROW_WIDTH;
+        if (font) {
+            char row_text[MAX_PATH_LENGTH + 16];
+            format_track_row(row_text, sizeof(row_text), i, library_track_title(library, expanded_album, i));
+            int height;
+            if (TTF_SizeText(font, row_text, &width, &height) != 0) {
+                width = TRACK_ROW_WIDTH;
+            }
+        }
+        SDL_Rect row = {TRACK_LIST_X, COVER_Y_OFFSET + i * TRACK_SPACING, width, FONT_SIZE};
+        layout->rows[i] = row;
+        // As many rows as fit in the panel are shown at a time
+        if (row.y + row.h <= ALBUM_SPACE) {
+            layout->visible_rows = i + 1;
+        }
+    }
+    layout->number_of_rows = album->number_of_tracks;
+    layout_scroll_rows(layout, 0);
+    return true;
+}
+
+// Moves the shown rows by `delta`, clamped so the panel stays full. Returns
+// true if they moved.
+bool layout_scroll_rows(Layout *layout, int delta) {
+    int first_row = layout->first_row + delta;
+    int last_first = layout->number_of_rows - layout->visible_rows;
+    if (first_row > last_first) {
+        first_row = last_first;
+    }
+    if (first_row < 0) {
+        first_row = 0;
+    }
+    bool moved = first_row != layout->first_row;
+    layout->first_row = first_row;
+    return moved;
+}
+
+// Scrolls the rows as little as needed to show `row`. Returns true if they
+// moved.
+bool layout_show_row(Layout *layout, int row) {
+    if (row < 0 || row >= layout->number_of_rows) {
+        return false;
+    }
+    if (row < layout->first_row) {
+        return layout_scroll_rows(layout, row - layout->first_row);
+    }
+    if (row >= layout->first_row + layout->visible_rows) {
+        return layout_scroll_rows(layout, row - (layout->first_row + layout->visible_rows - 1));
+    }
+    return false;
+}
+
+// True over the track list of an expanded album with more rows than fit,
+// where the mouse wheel scrolls the rows instead of the view.
+bool layout_in_track_list(const Layout *layout, int x, int content_y) {
+    if (layout->expanded_album < 0 || layout->number_of_rows <= layout->visible_rows || content_y < 0) {
+        return false;
+    }
+    int album = content_y / ALBUM_SPACE;
+    int local_y = content_y - album * ALBUM_SPACE;
+    return album == layout->expanded_album && x >= ROW_SCROLLBAR_X && local_y >= COVER_Y_OFFSET - 5;
+}
+
+// Resolves a point in content coordinates (window y plus scroll offset) with
+// arithmetic on the fixed panel and row pitch; no region list is scanned.
+Hit layout_hit_test(const Layout *layout, int x, int content_y) {
+    Hit hit = {HIT_NONE, -1, -1, 0.0f};
+    if (content_y < 0 || content_y >= layout->content_height) {
+        return hit;
+    }
+
+    int album = content_y / ALBUM_SPACE;
+    int local_y = content_y - album * ALBUM_SPACE;
+    if (point_in_rect(x, local_y, &layout->album_hit)) {
+        hit.kind = HIT_ALBUM;
+        hit.album = album;
+        return hit;
+    }
+
+    if (album == layout->expanded_album && local_y >= COVER_Y_OFFSET) {
+        int slot = (local_y - COVER_Y_OFFSET) / TRACK_SPACING;
+        int row_y = (local_y - COVER_Y_OFFSET) % TRACK_SPACING;
+        int track = layout->first_row + slot;
+        bool shown = slot < layout->visible_rows && track < layout->number_of_rows;
+        if (shown && point_in_rect(x, local_y + layout->first_row * TRACK_SPACING, &layout->rows[track])) {
+            hit.kind = HIT_TRACK;
+            hit.album = album;
+            hit.track = track;
+        } else if (shown && point_in_rect(x, row_y, &layout->progress)) {
+            hit.kind = HIT_PROGRESS;
+            hit.album = album;
+            hit.track = track;
+            hit.fraction = layout_progress_fraction(layout, x);
+        }
+    }
+    return hit;
+}
+
+// Where `x` falls along a progress bar, clamped to 0..1 so a drag can run
+// past either end.
+float layout_progress_fraction(const Layout *layout, int x) {
+    float fraction = (float)(x - layout->progress.x) / layout->progress.w;
+    return fraction < 0.0f ? 0.0f : fraction > 1.0f ? 1.0f : fraction;
+}
+
+void layout_free(Layout *layout) {
+    free(layout->rows);
+    layout_init(layout);
+}
@@ -0,0 +1,75 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+#include "library.h"
+
+#define FONT_SIZE 25
+
+#define MARGIN_LEFT 50
+#define ALBUM_SPACE 300
+#define TRACK_SPACING 50
+#define COVER_SIZE 200
+#define TRACK_LIST_X 300
+#define COVER_Y_OFFSET 50
+#define TRACK_ROW_WIDTH 240
+#define SPECTRUM_HEIGHT 40
+#define VU_HEIGHT 4
+#define PROGRESS_HEIGHT 4
+#define ROW_SCROLLBAR_X (TRACK_LIST_X - 15)
+#define ROW_SCROLLBAR_WIDTH 4
+
+typedef enum hit_kind {
+    HIT_NONE,
+    HIT_ALBUM,
+    HIT_TRACK,
+    HIT_PROGRESS
+} HitKind;
+
+// `fraction` is how far along a progress bar the point is, 0..1.
+typedef struct hit {
+    HitKind kind;
+    int album;
+    int track;
+    float fraction;
+} Hit;
+
+// Geometry shared by the renderer and the click handler. Every album panel
+// is ALBUM_SPACE tall and laid out the same way, so its regions are stored
+// once relative to the panel top; only the expanded album's track rows vary.
+// Rebuilt whenever the expanded album or the library changes.
+//
+// The panel shows `visible_rows` track rows from `first_row`; an album with
+// more tracks scrolls its rows inside the panel. `rows` are stored as if
+// `first_row` were 0.
+typedef struct layout {
+    int number_of_albums;
+    int content_height;
+    SDL_Rect title;
+    SDL_Rect artist;
+    SDL_Rect cover;
+    SDL_Rect album_hit;
+    SDL_Rect spectrum;
+    SDL_Rect progress;
+    int expanded_album;
+    int number_of_rows;
+    int visible_rows;
+    int first_row;
+    int rows_capacity;
+    SDL_Rect *rows;
+} Layout;
+
+void format_track_row(char *buffer, size_t size, int track_index, const char *title);
+void layout_init(Layout *layout);
+bool layout_build(Layout *layout, const Library *library, int expanded_album, TTF_Font *font);
+Hit layout_hit_test(const Layout *layout, int x, int content_y);
+float layout_progress_fraction(const Layout *layout, int x);
+bool layout_in_track_list(const Layout *layout, int x, int content_y);
+bool layout_scroll_rows(Layout *layout, int delta);
+bool layout_show_row(Layout *layout, int row);
+void layout_free(Layout *layout);
+
+#endif
@@ -0,0 +1,295 @@
+#include <stdlib.h>
+#include <string.h>
+#include "library.h"
+#include "catalog.h"
+
+#define INITIAL_TRACK_CAPACITY 256
+
+void trim_newline(char *str) {
+    char *newline = strpbrk(str, "\r\n");
+    if (newline) {
+        *newline = '\0';
+    }
+}
+
+StringId library_intern(Library *library, const char *str) {
+    return string_arena_intern(&library->strings, str);
+}
+
+// Grows the track arrays, first copying them out of a mapped catalog.
+static bool reserve_tracks(Library *library, int needed) {
+    if (needed <= library->tracks_capacity) {
+        return true;
+    }
+    int capacity = library->tracks_capacity ? library->tracks_capacity * 2 : INITIAL_TRACK_CAPACITY;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    StringId **arrays[] = {&library->track_titles, &library->track_folders, &library->track_files};
+    for (int i = 0; i < 3; i++) {
+        StringId *grown = malloc(capacity * sizeof(StringId));
+        if (!grown) {
+            fprintf(stderr, "Memory allocation failed for tracks\n");
+            return false;
+        }
+        if (library->number_of_tracks > 0) {
+            memcpy(grown, *arrays[i], library->number_of_tracks * sizeof(StringId));
+        }
+        if (library->tracks_capacity) {
+            free(*arrays[i]);
+        }
+        *arrays[i] = grown;
+    }
+    library->tracks_capacity = capacity;
+    return true;
+}
+
+// Appends a track to the end of the track arrays; the caller sets up the
+// album's first_track and number_of_tracks.
+bool library_add_track(Library *library, const char *title, const char *location) {
+    if (!reserve_tracks(library, library->number_of_tracks + 1)) {
+        return false;
+    }
+    const char *slash = strrchr(location, '/');
+    size_t folder_length = slash ? (size_t)(slash - location) + 1 : 0;
+    int index = library->number_of_tracks++;
+    library->track_titles[index] = library_intern(library, title);
+    library->track_folders[index] = string_arena_intern_length(&library->strings, location, folder_length);
+    library->track_files[index] = library_intern(library, location + folder_length);
+    return true;
+}
+
+void library_track_location(const Library *library, int album, int track, char *buffer, size_t size) {
+    int index = library->albums[album].first_track + track;
+    snprintf(buffer, size, "%s%s", library_string(library, library->track_folders[index]), library_string(library, library->track_files[index]));
+}
+
+// Heap and mapped bytes held by the library, excluding the cover atlas.
+size_t library_memory_usage(const Library *library) {
+    size_t bytes = library->number_of_albums * sizeof(Album);
+    if (library->tracks_capacity) {
+        bytes += 3 * (size_t)library->tracks_capacity * sizeof(StringId);
+    }
+    bytes += library->strings.capacity + library->strings.slot_count * sizeof(uint32_t);
+    return bytes + library->mapping_size;
+}
+
+static bool read_line(FILE *fptr, char *buffer, size_t size) {
+    if (!fgets(buffer, (int)size, fptr)) {
+        buffer[0] = '\0';
+        return false;
+    }
+    trim_newline(buffer);
+    return true;
+}
+
+static bool read_string(FILE *fptr, Library *library, StringId *destination) {
+    char buffer[MAX_PATH_LENGTH];
+    bool ok = read_line(fptr, buffer, sizeof(buffer));
+    *destination = library_intern(library, buffer);
+    return ok;
+}
+
+static bool read_track(FILE *fptr, Library *library) {
+    char title[MAX_PATH_LENGTH];
+    char location[MAX_PATH_LENGTH];
+    bool has_title = read_line(fptr, title, sizeof(title));
+    bool has_location = read_line(fptr, location, sizeof(location));
+    if (!has_title || !has_location) {
+        fprintf(stderr, "Error reading track information\n");
+    }
+    return library_add_track(library, title, location);
+}
+
+// Appends the album's tracks to the library's shared track arrays.
+static bool read_tracks(FILE *fptr, Library *library, int number_of_tracks) {
+    if (!reserve_tracks(library, library->number_of_tracks + number_of_tracks)) {
+        return false;
+    }
+    for (int i = 0; i < number_of_tracks; i++) {
+        if (!read_track(fptr, library)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static Album read_album(FILE *fptr, Library *library) {
+    Album album = {0};
+    album.first_track = library->number_of_tracks;
+
+    if (!read_string(fptr, library, &album.title) ||
+        !read_string(fptr, library, &album.artist) ||
+        !read_string(fptr, library, &album.photo_location)) {
+        fprintf(stderr, "Error reading album information\n");
+        return album;
+    }
+
+    int genre_code;
+    if (fscanf(fptr, "%d\n", &genre_code) != 1) {
+        fprintf(stderr, "Error reading genre information\n");
+        return album;
+    }
+    album.genre = (Genre)genre_code;
+
+    int number_of_tracks;
+    if (fscanf(fptr, "%d\n", &number_of_tracks) != 1 || number_of_tracks < 0) {
+        fprintf(stderr, "Error reading number of tracks\n");
+        return album;
+    }
+
+    read_tracks(fptr, library, number_of_tracks);
+    album.number_of_tracks = library->number_of_tracks - album.first_track;
+
+    return album;
+}
+
+bool read_albums(FILE *fptr, Library *library) {
+    int number_of_albums;
+    if (fscanf(fptr, "%d\n", &number_of_albums) != 1 || number_of_albums < 0) {
+        fprintf(stderr, "Error reading number of albums\n");
+        return false;
+    }
+
+    library->albums = malloc((number_of_albums > 0 ? number_of_albums : 1) * sizeof(Album));
+    if (!library->albums) {
+        fprintf(stderr, "Memory allocation failed for albums\n");
+        return false;
+    }
+
+    for (int i = 0; i < number_of_albums; i++) {
+        library->albums[i] = read_album(fptr, library);
+        library->number_of_albums++;
+    }
+
+    return true;
+}
+
+// Loads from the binary catalog when a current one exists, otherwise parses
+// the text file.
+bool library_load(Library *library, const char *text_path, const char *catalog_path) {
+    memset(library, 0, sizeof(*library));
+
+    if (catalog_path && catalog_open(library, catalog_path, text_path)) {
+        return true;
+    }
+
+    FILE *fptr = fopen(text_path, "r");
+    if (!fptr) {
+        fprintf(stderr, "Error opening %s\n", text_path);
+        return false;
+    }
+    bool loaded = read_albums(fptr, library);
+    fclose(fptr);
+
+    if (!loaded) {
+        library_free(library);
+    }
+    return loaded;
+}
+
+static uint32_t album_hash(const Library *library, int album) {
+    uint32_t hash = 2166136261u;
+    const char *strings[2] = {library_string(library, library->albums[album].title), library_string(library, library->albums[album].artist)};
+    for (int i = 0; i < 2; i++) {
+        for (const unsigned char *p = (const unsigned char *)strings[i]; *p; p++) {
+            hash = (hash ^ *p) * 16777619u;
+        }
+        hash = (hash ^ 0xFF) * 16777619u;
+    }
+    return hash;
+}
+
+static bool same_album(const Library *a, int album_a, const Library *b, int album_b) {
+    return strcmp(library_string(a, a->albums[album_a].title), library_string(b, b->albums[album_b].title)) == 0 &&
+           strcmp(library_string(a, a->albums[album_a].artist), library_string(b, b->albums[album_b].artist)) == 0;
+}
+
+// True when the two albums have the same cover and the same tracks, in the
+// same order, with the same titles and locations.
+bool library_album_equal(const Library *a, int album_a, const Library *b, int album_b) {
+    const Album *first = &a->albums[album_a];
+    const Album *second = &b->albums[album_b];
+    if (first->number_of_tracks != second->number_of_tracks || first->genre != second->genre ||
+        strcmp(library_string(a, first->photo_location), library_string(b, second->photo_location)) != 0) {
+        return false;
+    }
+    for (int t = 0; t < first->number_of_tracks; t++) {
+        int i = first->first_track + t;
+        int j = second->first_track + t;
+        if (strcmp(library_string(a, a->track_titles[i]), library_string(b, b->track_titles[j])) != 0 ||
+            strcmp(library_string(a, a->track_folders[i]), library_string(b, b->track_folders[j])) != 0 ||
+            strcmp(library_string(a, a->track_files[i]), library_string(b, b->track_files[j])) != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// Matches the albums of `new_library` to those of `old_library` through a
+// hash table of the new albums, so a reload costs one pass over each.
+bool library_diff(const Library *old_library, const Library *new_library, LibraryDiff *diff) {
+    memset(diff, 0, sizeof(*diff));
+    uint32_t slot_count = 16;
+    while (slot_count < 2 * (uint32_t)new_library->number_of_albums) {
+        slot_count *= 2;
+    }
+    int *slots = calloc(slot_count, sizeof(int));
+    bool *matched = calloc((size_t)new_library->number_of_albums + 1, sizeof(bool));
+    diff->album_map = malloc(((size_t)old_library->number_of_albums + 1) * sizeof(int));
+    if (!slots || !matched || !diff->album_map) {
+        fprintf(stderr, "Memory allocation failed for library diff\n");
+        free(slots);
+        free(matched);
+        library_diff_free(diff);
+        return false;
+    }
+
+    // Slots hold new album index + 1, with 0 for empty
+    for (int i = 0; i < new_library->number_of_albums; i++) {
+        uint32_t slot = album_hash(new_library, i) & (slot_count - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = i + 1;
+    }
+
+    for (int i = 0; i < old_library->number_of_albums; i++) {
+        diff->album_map[i] = -1;
+        uint32_t slot = album_hash(old_library, i) & (slot_count - 1);
+        for (; slots[slot]; slot = (slot + 1) & (slot_count - 1)) {
+            int candidate = slots[slot] - 1;
+            if (!matched[candidate] && same_album(old_library, i, new_library, candidate)) {
+                matched[candidate] = true;
+                diff->album_map[i] = candidate;
+                break;
+            }
+        }
+        if (diff->album_map[i] < 0) {
+            diff->removed++;
+        } else if (!library_album_equal(old_library, i, new_library, diff->album_map[i])) {
+            diff->modified++;
+        }
+    }
+    diff->added = new_library->number_of_albums - (old_library->number_of_albums - diff->removed);
+    free(slots);
+    free(matched);
+    return true;
+}
+
+void library_diff_free(LibraryDiff *diff) {
+    free(diff->album_map);
+    diff->album_map = NULL;
+}
+
+void library_free(Library *library) {
+    free(library->albums);
+    if (library->tracks_capacity) {
+        free(library->track_titles);
+        free(library->track_folders);
+        free(library->track_files);
+    }
+    string_arena_free(&library->strings);
+    catalog_close(library);
+    memset(library, 0, sizeof(*library));
+}
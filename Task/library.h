@@ -0,0 +1,91 @@
+#ifndef LIBRARY_H
+#define LIBRARY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "cover_atlas.h"
+#include "string_arena.h"
+
+#define MAX_PATH_LENGTH 256
+
+typedef enum genre {
+    POP = 1,
+    CLASSIC = 2,
+    JAZZ = 3,
+    ROCK = 4
+} Genre;
+
+typedef enum cover_state {
+    COVER_NONE = 0,
+    COVER_PENDING,
+    COVER_READY,
+    COVER_FAILED
+} CoverState;
+
+typedef struct album {
+    CoverSlot cover;
+    CoverState cover_state;
+    StringId title;
+    StringId artist;
+    StringId photo_location;
+    Genre genre;
+    int first_track;
+    int number_of_tracks;
+} Album;
+
+// Every album and track in the player. Tracks are stored as parallel arrays
+// of string ids, indexed by an album's first_track plus the track number, so
+// a track costs 12 bytes plus its share of the interned strings. A location
+// is split into its folder, interned once for all the tracks in it, and its
+// file name.
+//
+// With a memory-mapped catalog the strings and track arrays stay in
+// `mapping` and `tracks_capacity` is 0; they are copied out only if the
+// library is modified.
+typedef struct library {
+    Album *albums;
+    int number_of_albums;
+    StringId *track_titles;
+    StringId *track_folders;
+    StringId *track_files;
+    int number_of_tracks;
+    int tracks_capacity;
+    StringArena strings;
+    void *mapping;
+    size_t mapping_size;
+} Library;
+
+static inline const char *library_string(const Library *library, StringId id) {
+    return string_arena_get(&library->strings, id);
+}
+
+static inline const char *library_track_title(const Library *library, int album, int track) {
+    return library_string(library, library->track_titles[library->albums[album].first_track + track]);
+}
+
+// How a reloaded library relates to the one it replaces. Albums are matched
+// by title and artist; `album_map` gives each old album's index in the new
+// library, or -1 if it was removed. A matched album is modified when its
+// cover or any of its tracks changed.
+typedef struct library_diff {
+    int *album_map;
+    int added;
+    int removed;
+    int modified;
+} LibraryDiff;
+
+void trim_newline(char *str);
+StringId library_intern(Library *library, const char *str);
+bool library_add_track(Library *library, const char *title, const char *location);
+void library_track_location(const Library *library, int album, int track, char *buffer, size_t size);
+size_t library_memory_usage(const Library *library);
+bool read_albums(FILE *fptr, Library *library);
+bool library_load(Library *library, const char *text_path, const char *catalog_path);
+bool library_album_equal(const Library *a, int album_a, const Library *b, int album_b);
+bool library_diff(const Library *old_library, const Library *new_library, LibraryDiff *diff);
+void library_diff_free(LibraryDiff *diff);
+void library_free(Library *library);
+
+#endif
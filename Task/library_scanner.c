@@ -0,0 +1,665 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+#include <SDL2/SDL.h>
+#include "id3.h"
+#include "library_scanner.h"
+
+#define MAX_CACHED_STRING 65536
+
+// One audio file. Strings are owned by the record; `present` is false if the
+// file vanished between the walk and the stat.
+typedef struct scan_record {
+    char *path;
+    int64_t size;
+    int64_t mtime;
+    int genre;
+    int track_number;
+    char *title;
+    char *artist;
+    char *album;
+    char *cover;
+    bool present;
+    bool changed;
+} ScanRecord;
+
+typedef struct record_list {
+    ScanRecord *records;
+    int count;
+    int capacity;
+} RecordList;
+
+// Directories already walked, by device and inode, so a symbolic link back
+// up the tree or a second link to the same folder is not followed again.
+// Open addressing, kept at most half full.
+typedef struct visited_directory {
+    uint64_t device;
+    uint64_t inode;
+    bool used;
+} VisitedDirectory;
+
+typedef struct directory_set {
+    VisitedDirectory *slots;
+    Uint32 mask;
+    int count;
+} DirectorySet;
+
+// Shared by the scan workers. Each takes the next file index from `next`,
+// so no locking is needed: workers only write their own file's record, and
+// each cached record matches at most one path.
+typedef struct scan_job {
+    RecordList *files;
+    RecordList *cache;
+    int *slots;
+    Uint32 slot_mask;
+    SDL_atomic_t next;
+    SDL_atomic_t changed;
+} ScanJob;
+
+static char *copy_string(const char *str) {
+    char *copy = malloc(strlen(str) + 1);
+    if (copy) {
+        strcpy(copy, str);
+    }
+    return copy;
+}
+
+static const char *text_or_empty(const char *str) {
+    return str ? str : "";
+}
+
+static void free_record(ScanRecord *record) {
+    free(record->path);
+    free(record->title);
+    free(record->artist);
+    free(record->album);
+    free(record->cover);
+}
+
+static void free_list(RecordList *list) {
+    for (int i = 0; i < list->count; i++) {
+        free_record(&list->records[i]);
+    }
+    free(list->records);
+    memset(list, 0, sizeof(*list));
+}
+
+static ScanRecord *push_record(RecordList *list) {
+    if (list->count == list->capacity) {
+        int capacity = list->capacity ? list->capacity * 2 : 256;
+        ScanRecord *records = realloc(list->records, capacity * sizeof(ScanRecord));
+        if (!records) {
+            fprintf(stderr, "Memory allocation failed for scan records\n");
+            return NULL;
+        }
+        list->records = records;
+        list->capacity = capacity;
+    }
+    ScanRecord *record = &list->records[list->count++];
+    memset(record, 0, sizeof(*record));
+    return record;
+}
+
+static uint32_t hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+static bool is_audio_file(const char *name) {
+    static const char *extensions[] = {".mp3", ".wav", ".ogg", ".flac"};
+    const char *dot = strrchr(name, '.');
+    if (!dot) {
+        return false;
+    }
+    for (size_t i = 0; i < sizeof(extensions) / sizeof(extensions[0]); i++) {
+        if (SDL_strcasecmp(dot, extensions[i]) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void add_file(RecordList *files, const char *path) {
+    if (strlen(path) >= MAX_PATH_LENGTH) {
+        fprintf(stderr, "Skipping %s: path longer than %d characters\n", path, MAX_PATH_LENGTH - 1);
+        return;
+    }
+    ScanRecord *record = push_record(files);
+    if (record) {
+        record->path = copy_string(path);
+        if (!record->path) {
+            files->count--;
+        }
+    }
+}
+
+static Uint32 hash_directory(uint64_t device, uint64_t inode) {
+    uint64_t hash = (inode ^ (device << 32 | device >> 32)) * 0x9E3779B97F4A7C15ull;
+    return (Uint32)(hash >> 32);
+}
+
+static void insert_directory(VisitedDirectory *slots, Uint32 mask, uint64_t device, uint64_t inode) {
+    Uint32 i = hash_directory(device, inode) & mask;
+    while (slots[i].used) {
+        i = (i + 1) & mask;
+    }
+    slots[i].device = device;
+    slots[i].inode = inode;
+    slots[i].used = true;
+}
+
+// Returns false if the directory was walked before, or can't be recorded.
+static bool visit_directory(DirectorySet *set, uint64_t device, uint64_t inode) {
+    if (set->slots) {
+        for (Uint32 i = hash_directory(device, inode) & set->mask; set->slots[i].used; i = (i + 1) & set->mask) {
+            if (set->slots[i].device == device && set->slots[i].inode == inode) {
+                return false;
+            }
+        }
+    }
+    if (!set->slots || (Uint32)(set->count + 1) * 2 > set->mask + 1) {
+        Uint32 size = set->slots ? (set->mask + 1) * 2 : 64;
+        VisitedDirectory *slots = calloc(size, sizeof(VisitedDirectory));
+        if (!slots) {
+            fprintf(stderr, "Memory allocation failed for visited directories\n");
+            return false;
+        }
+        for (Uint32 i = 0; set->slots && i <= set->mask; i++) {
+            if (set->slots[i].used) {
+                insert_directory(slots, size - 1, set->slots[i].device, set->slots[i].inode);
+            }
+        }
+        free(set->slots);
+        set->slots = slots;
+        set->mask = size - 1;
+    }
+    insert_directory(set->slots, set->mask, device, inode);
+    set->count++;
+    return true;
+}
+
+// Collects audio files below `dir`, skipping hidden entries. Only names are
+// read here; the workers stat the files in parallel. Symbolic links to
+// directories are followed, each directory at most once; on Windows
+// junctions and directory links are not followed at all.
+static void walk(const char *dir, RecordList *files, DirectorySet *visited) {
+    char path[1024];
+#ifdef _WIN32
+    char pattern[1024];
+    snprintf(pattern, sizeof(pattern), "%s\\*", dir);
+    WIN32_FIND_DATAA data;
+    HANDLE find = FindFirstFileA(pattern, &data);
+    if (find == INVALID_HANDLE_VALUE) {
+        return;
+    }
+    do {
+        if (data.cFileName[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, data.cFileName);
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_REPARSE_POINT) {
+            continue;
+        }
+        if (data.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            walk(path, files, visited);
+        } else if (is_audio_file(data.cFileName)) {
+            add_file(files, path);
+        }
+    } while (FindNextFileA(find, &data));
+    FindClose(find);
+#else
+    struct stat dir_st;
+    if (stat(dir, &dir_st) != 0 || !visit_directory(visited, (uint64_t)dir_st.st_dev, (uint64_t)dir_st.st_ino)) {
+        return;
+    }
+    DIR *handle = opendir(dir);
+    if (!handle) {
+        return;
+    }
+    struct dirent *entry;
+    while ((entry = readdir(handle))) {
+        if (entry->d_name[0] == '.') {
+            continue;
+        }
+        snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+        bool is_dir;
+#ifdef _DIRENT_HAVE_D_TYPE
+        if (entry->d_type != DT_UNKNOWN && entry->d_type != DT_LNK) {
+            is_dir = entry->d_type == DT_DIR;
+        } else
+#endif
+        {
+            struct stat st;
+            is_dir = stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+        }
+        if (is_dir) {
+            walk(path, files, visited);
+        } else if (is_audio_file(entry->d_name)) {
+            add_file(files, path);
+        }
+    }
+    closedir(handle);
+#endif
+}
+
+static bool read_string(FILE *fptr, char **str) {
+    uint32_t length;
+    if (fread(&length, sizeof(length), 1, fptr) != 1 || length > MAX_CACHED_STRING) {
+        return false;
+    }
+    *str = malloc(length + 1);
+    if (!*str || fread(*str, 1, length, fptr) != length) {
+        return false;
+    }
+    (*str)[length] = '\0';
+    return true;
+}
+
+static bool write_string(FILE *fptr, const char *str) {
+    uint32_t length = (uint32_t)strlen(text_or_empty(str));
+    return fwrite(&length, sizeof(length), 1, fptr) == 1 && fwrite(text_or_empty(str), 1, length, fptr) == length;
+}
+
+// A missing or damaged cache just means every file is read again.
+static void load_cache(const char *cache_path, RecordList *cache) {
+    FILE *fptr = fopen(cache_path, "rb");
+    if (!fptr) {
+        return;
+    }
+    ScanCacheHeader header;
+    if (fread(&header, sizeof(header), 1, fptr) != 1 || header.magic != SCAN_CACHE_MAGIC || header.version != SCAN_CACHE_VERSION) {
+        fclose(fptr);
+        return;
+    }
+    for (uint32_t i = 0; i < header.count; i++) {
+        ScanRecord *record = push_record(cache);
+        if (!record) {
+            break;
+        }
+        int32_t numbers[2];
+        bool ok = fread(&record->size, sizeof(record->size), 1, fptr) == 1 &&
+                  fread(&record->mtime, sizeof(record->mtime), 1, fptr) == 1 &&
+                  fread(numbers, sizeof(numbers), 1, fptr) == 1 &&
+                  read_string(fptr, &record->path) && read_string(fptr, &record->title) &&
+                  read_string(fptr, &record->artist) && read_string(fptr, &record->album) &&
+                  read_string(fptr, &record->cover);
+        if (!ok) {
+            fprintf(stderr, "Scan cache %s is damaged, rescanning everything\n", cache_path);
+            free_list(cache);
+            break;
+        }
+        record->genre = numbers[0];
+        record->track_number = numbers[1];
+    }
+    fclose(fptr);
+}
+
+static void save_cache(const char *cache_path, const RecordList *files) {
+    char temp_path[1024];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", cache_path);
+    FILE *fptr = fopen(temp_path, "wb");
+    if (!fptr) {
+        fprintf(stderr, "Error writing scan cache: %s\n", cache_path);
+        return;
+    }
+
+    ScanCacheHeader header = {0};
+    header.magic = SCAN_CACHE_MAGIC;
+    header.version = SCAN_CACHE_VERSION;
+    for (int i = 0; i < files->count; i++) {
+        header.count += files->records[i].present;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fptr) == 1;
+    for (int i = 0; i < files->count && ok; i++) {
+        const ScanRecord *record = &files->records[i];
+        if (!record->present) {
+            continue;
+        }
+        int32_t numbers[2] = {record->genre, record->track_number};
+        ok = fwrite(&record->size, sizeof(record->size), 1, fptr) == 1 &&
+             fwrite(&record->mtime, sizeof(record->mtime), 1, fptr) == 1 &&
+             fwrite(numbers, sizeof(numbers), 1, fptr) == 1 &&
+             write_string(fptr, record->path) && write_string(fptr, record->title) &&
+             write_string(fptr, record->artist) && write_string(fptr, record->album) &&
+             write_string(fptr, record->cover);
+    }
+    ok = fclose(fptr) == 0 && ok;
+    if (ok) {
+        remove(cache_path);
+        ok = rename(temp_path, cache_path) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error writing scan cache: %s\n", cache_path);
+        remove(temp_path);
+    }
+}
+
+static ScanRecord *find_cached(const ScanJob *job, const char *path) {
+    if (!job->slots) {
+        return NULL;
+    }
+    for (Uint32 slot = hash_path(path) & job->slot_mask; job->slots[slot]; slot = (slot + 1) & job->slot_mask) {
+        ScanRecord *record = &job->cache->records[job->slots[slot] - 1];
+        if (strcmp(record->path, path) == 0) {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+static Genre genre_from_tag(const char *text) {
+    char lower[ID3_TEXT_LENGTH];
+    size_t i = 0;
+    for (; text[i] && i + 1 < sizeof(lower); i++) {
+        lower[i] = (char)tolower((unsigned char)text[i]);
+    }
+    lower[i] = '\0';
+
+    // ID3v1 genre numbers, as "(17)" or "17"
+    int code = text[0] == '(' ? atoi(text + 1) : isdigit((unsigned char)text[0]) ? atoi(text) : -1;
+    if (code == 32 || strstr(lower, "classic")) {
+        return CLASSIC;
+    } else if (code == 8 || strstr(lower, "jazz")) {
+        return JAZZ;
+    } else if (code == 17 || strstr(lower, "rock")) {
+        return ROCK;
+    }
+    return POP;
+}
+
+// Embedded covers are written once under SCAN_COVER_DIR, named after a hash
+// of the image bytes, so every track of an album shares one file.
+static char *write_cover(const Id3Tags *tags) {
+    uint64_t hash = 14695981039346656037ull;
+    for (size_t i = 0; i < tags->cover_size; i++) {
+        hash = (hash ^ tags->cover[i]) * 1099511628211ull;
+    }
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%016llx.%s", SCAN_COVER_DIR, (unsigned long long)hash, tags->cover_extension);
+
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        return copy_string(path);
+    }
+#ifdef _WIN32
+    _mkdir(SCAN_COVER_DIR);
+#else
+    mkdir(SCAN_COVER_DIR, 0755);
+#endif
+    char temp_path[96];
+    snprintf(temp_path, sizeof(temp_path), "%s.%lu.tmp", path, (unsigned long)SDL_ThreadID());
+    FILE *fptr = fopen(temp_path, "wb");
+    if (!fptr) {
+        return NULL;
+    }
+    bool ok = fwrite(tags->cover, 1, tags->cover_size, fptr) == tags->cover_size;
+    ok = fclose(fptr) == 0 && ok;
+    if (ok) {
+        remove(path);
+        ok = rename(temp_path, path) == 0;
+    }
+    if (!ok) {
+        fprintf(stderr, "Error writing cover: %s\n", path);
+        remove(temp_path);
+        return NULL;
+    }
+    return copy_string(path);
+}
+
+// Missing tags fall back to the file and directory names, so an untagged
+// "Artist Album/01-Song_Name.mp3" still lands in a sensible album.
+static void read_tags(ScanRecord *record) {
+    Id3Tags tags;
+    id3_read(record->path, &tags);
+
+    const char *name = strrchr(record->path, '/');
+    name = name ? name + 1 : record->path;
+    if (tags.title[0]) {
+        record->title = copy_string(tags.title);
+    } else {
+        char stem[MAX_PATH_LENGTH];
+        snprintf(stem, sizeof(stem), "%s", name);
+        char *dot = strrchr(stem, '.');
+        if (dot) {
+            *dot = '\0';
+        }
+        for (char *p = stem; *p; p++) {
+            if (*p == '_') {
+                *p = ' ';
+            }
+        }
+        record->title = copy_string(stem);
+    }
+
+    const char *artist = tags.album_artist[0] ? tags.album_artist : tags.artist[0] ? tags.artist : "Unknown Artist";
+    record->artist = copy_string(artist);
+    if (tags.album[0]) {
+        record->album = copy_string(tags.album);
+    } else {
+        char directory[MAX_PATH_LENGTH];
+        snprintf(directory, sizeof(directory), "%.*s", (int)(name - record->path), record->path);
+        size_t length = strlen(directory);
+        if (length > 0) {
+            directory[--length] = '\0';
+        }
+        const char *parent = strrchr(directory, '/');
+        record->album = copy_string(parent ? parent + 1 : directory);
+    }
+    record->genre = genre_from_tag(tags.genre);
+    record->track_number = tags.track_number;
+    if (tags.cover) {
+        record->cover = write_cover(&tags);
+    }
+    id3_free(&tags);
+}
+
+static int scan_worker(void *data) {
+    ScanJob *job = data;
+    for (;;) {
+        int i = SDL_AtomicAdd(&job->next, 1);
+        if (i >= job->files->count) {
+            break;
+        }
+        ScanRecord *file = &job->files->records[i];
+        struct stat st;
+        if (stat(file->path, &st) != 0) {
+            continue;
+        }
+        file->present = true;
+        file->size = (int64_t)st.st_size;
+        file->mtime = (int64_t)st.st_mtime;
+
+        ScanRecord *cached = find_cached(job, file->path);
+        if (cached && cached->size == file->size && cached->mtime == file->mtime) {
+            // Unchanged: take over the cached fields without opening the file
+            file->title = cached->title;
+            file->artist = cached->artist;
+            file->album = cached->album;
+            file->cover = cached->cover;
+            file->genre = cached->genre;
+            file->track_number = cached->track_number;
+            cached->title = cached->artist = cached->album = cached->cover = NULL;
+            continue;
+        }
+        read_tags(file);
+        file->changed = true;
+        SDL_AtomicAdd(&job->changed, 1);
+    }
+    return 0;
+}
+
+static void run_workers(ScanJob *job) {
+    // Mostly waiting on the disk, so more threads than cores still helps
+    int thread_count = SDL_GetCPUCount() * 2;
+    if (thread_count > SCANNER_MAX_THREADS) {
+        thread_count = SCANNER_MAX_THREADS;
+    }
+    SDL_Thread *threads[SCANNER_MAX_THREADS];
+    int started = 0;
+    for (int i = 0; i < thread_count; i++) {
+        threads[started] = SDL_CreateThread(scan_worker, "scan_worker", job);
+        if (threads[started]) {
+            started++;
+        }
+    }
+    if (started == 0) {
+        scan_worker(job);
+    }
+    for (int i = 0; i < started; i++) {
+        SDL_WaitThread(threads[i], NULL);
+    }
+}
+
+static int compare_records(const void *a, const void *b) {
+    const ScanRecord *x = a;
+    const ScanRecord *y = b;
+    if (x->present != y->present) {
+        return x->present ? -1 : 1;
+    }
+    int order = strcmp(text_or_empty(x->artist), text_or_empty(y->artist));
+    if (order == 0) {
+        order = strcmp(text_or_empty(x->album), text_or_empty(y->album));
+    }
+    if (order == 0) {
+        order = (x->track_number > y->track_number) - (x->track_number < y->track_number);
+    }
+    if (order == 0) {
+        order = strcmp(x->path, y->path);
+    }
+    return order;
+}
+
+static bool same_album(const ScanRecord *a, const ScanRecord *b) {
+    return strcmp(text_or_empty(a->artist), text_or_empty(b->artist)) == 0 && strcmp(text_or_empty(a->album), text_or_empty(b->album)) == 0;
+}
+
+// Albums without embedded art use an image next to their first track.
+static StringId folder_image(Library *library, const char *track_path) {
+    static const char *names[] = {"cover.jpg", "folder.jpg", "front.jpg", "cover.png", "folder.png"};
+    const char *name = strrchr(track_path, '/');
+    int directory_length = name ? (int)(name - track_path) : 0;
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        char path[MAX_PATH_LENGTH + 16];
+        snprintf(path, sizeof(path), "%.*s/%s", directory_length, track_path, names[i]);
+        struct stat st;
+        if (stat(path, &st) == 0) {
+            return library_intern(library, path);
+        }
+    }
+    return 0;
+}
+
+// Builds the library from the sorted records: one album per run of tracks
+// sharing an artist and album name.
+static bool emit_library(Library *library, const RecordList *files, int present) {
+    library->albums = malloc((present > 0 ? present : 1) * sizeof(Album));
+    if (!library->albums) {
+        fprintf(stderr, "Memory allocation failed for scanned library\n");
+        return false;
+    }
+
+    for (int start = 0; start < present;) {
+        int end = start + 1;
+        while (end < present && same_album(&files->records[start], &files->records[end])) {
+            end++;
+        }
+
+        const ScanRecord *first = &files->records[start];
+        Album album = {0};
+        album.title = library_intern(library, text_or_empty(first->album));
+        album.artist = library_intern(library, text_or_empty(first->artist));
+        album.genre = (Genre)first->genre;
+        album.first_track = library->number_of_tracks;
+        album.number_of_tracks = end - start;
+        for (int i = start; i < end; i++) {
+            const ScanRecord *record = &files->records[i];
+            if (!album.photo_location && record->cover && record->cover[0]) {
+                album.photo_location = library_intern(library, record->cover);
+            }
+            if (!library_add_track(library, text_or_empty(record->title), record->path)) {
+                return false;
+            }
+        }
+        if (!album.photo_location) {
+            album.photo_location = folder_image(library, first->path);
+        }
+        library->albums[library->number_of_albums++] = album;
+        start = end;
+    }
+    return true;
+}
+
+// Builds the library from the audio files below `root` instead of
+// albums.txt. Files are stat'ed and their tags read on a pool of threads;
+// files whose size and mtime match the scan cache are not opened at all.
+bool library_scan(Library *library, const char *root, const char *cache_path) {
+    memset(library, 0, sizeof(*library));
+    Uint32 start_ticks = SDL_GetTicks();
+
+    RecordList files = {0};
+    RecordList cache = {0};
+    DirectorySet visited = {0};
+    walk(root, &files, &visited);
+    free(visited.slots);
+    if (files.count == 0) {
+        fprintf(stderr, "No audio files found under %s\n", root);
+        free(files.records);
+        return false;
+    }
+    load_cache(cache_path, &cache);
+
+    ScanJob job;
+    memset(&job, 0, sizeof(job));
+    job.files = &files;
+    job.cache = &cache;
+    if (cache.count > 0) {
+        Uint32 slot_count = 16;
+        while (slot_count < (Uint32)cache.count * 2) {
+            slot_count <<= 1;
+        }
+        job.slots = calloc(slot_count, sizeof(int));
+        job.slot_mask = slot_count - 1;
+        for (int i = 0; job.slots && i < cache.count; i++) {
+            Uint32 slot = hash_path(cache.records[i].path) & job.slot_mask;
+            while (job.slots[slot]) {
+                slot = (slot + 1) & job.slot_mask;
+            }
+            job.slots[slot] = i + 1;
+        }
+    }
+    run_workers(&job);
+
+    int changed = SDL_AtomicGet(&job.changed);
+    qsort(files.records, files.count, sizeof(ScanRecord), compare_records);
+    int present = 0;
+    while (present < files.count && files.records[present].present) {
+        present++;
+    }
+    bool loaded = emit_library(library, &files, present);
+
+    // Rewrite the cache only if a file was added, changed or removed
+    if (loaded && (changed > 0 || present != cache.count)) {
+        save_cache(cache_path, &files);
+    }
+    fprintf(stderr, "Scanned %d files under %s in %u ms: %d read, %d unchanged, %d albums\n",
+            present, root, SDL_GetTicks() - start_ticks, changed, present - changed, library->number_of_albums);
+
+    free(job.slots);
+    free_list(&cache);
+    free_list(&files);
+    if (!loaded) {
+        library_free(library);
+    }
+    return loaded;
+}
@@ -0,0 +1,28 @@
+#ifndef LIBRARY_SCANNER_H
+#define LIBRARY_SCANNER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "library.h"
+
+#define SCAN_CACHE_PATH "scan.cache"
+#define SCAN_COVER_DIR "covers"
+#define SCAN_CACHE_MAGIC 0x4E414353u // "SCAN"
+#define SCAN_CACHE_VERSION 1
+#define SCANNER_MAX_THREADS 16
+
+// The scan cache is this header followed by `count` records, each holding
+// the file's size, mtime, genre and track number as int64/int64/int32/int32
+// and then its path, title, artist, album and cover path as a uint32 length
+// plus bytes. A file whose size and mtime still match its record is not
+// opened again.
+typedef struct scan_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t count;
+    uint32_t reserved;
+} ScanCacheHeader;
+
+bool library_scan(Library *library, const char *root, const char *cache_path);
+
+#endif
@@ -0,0 +1,525 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+#endif
+#include "library_watch.h"
+#include "trace.h"
+
+#define WATCH_WAIT_MS 100
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE)
+
+static void path_stamp(const char *path, int64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (stat(path, &st) == 0) {
+        *size = (int64_t)st.st_size;
+        *mtime = (int64_t)st.st_mtime;
+    } else {
+        *size = -1;
+        *mtime = -1;
+    }
+}
+
+static bool is_directory(const char *path) {
+    struct stat st;
+    return stat(path, &st) == 0 && S_ISDIR(st.st_mode);
+}
+
+static uint32_t hash_path(const char *path, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)path[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Slots hold the folder's index + 1, so that 0 marks an empty slot.
+static void insert_slot(LibraryWatch *watch, int directory) {
+    const char *path = watch->directories[directory];
+    Uint32 mask = watch->slot_count - 1;
+    Uint32 slot = hash_path(path, strlen(path)) & mask;
+    while (watch->slots[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    watch->slots[slot] = directory + 1;
+}
+
+static bool grow_slots(LibraryWatch *watch) {
+    Uint32 slot_count = watch->slot_count ? watch->slot_count * 2 : 64;
+    int *slots = calloc(slot_count, sizeof(int));
+    if (!slots) {
+        return false;
+    }
+    free(watch->slots);
+    watch->slots = slots;
+    watch->slot_count = slot_count;
+    for (int i = 0; i < watch->directory_count; i++) {
+        insert_slot(watch, i);
+    }
+    return true;
+}
+
+static int find_directory(const LibraryWatch *watch, const char *path, size_t length) {
+    if (watch->slot_count == 0) {
+        return -1;
+    }
+    Uint32 mask = watch->slot_count - 1;
+    for (Uint32 slot = hash_path(path, length) & mask; watch->slots[slot]; slot = (slot + 1) & mask) {
+        const char *candidate = watch->directories[watch->slots[slot] - 1];
+        if (strncmp(candidate, path, length) == 0 && candidate[length] == '\0') {
+            return watch->slots[slot] - 1;
+        }
+    }
+    return -1;
+}
+
+// Adds the folder part of `path` (up to its last slash, or `path` itself
+// when `whole` is set) unless it is already watched. "" stands for ".".
+// Returns the folder's index, or -1 if it could not be added.
+static int add_directory(LibraryWatch *watch, const char *path, bool whole) {
+    size_t length = strlen(path);
+    if (!whole) {
+        const char *slash = strrchr(path, '/');
+        length = slash ? (size_t)(slash - path) : 0;
+    }
+    while (length > 1 && path[length - 1] == '/') {
+        length--;
+    }
+    if (length == 0) {
+        path = ".";
+        length = 1;
+    }
+    int known = find_directory(watch, path, length);
+    if (known >= 0) {
+        return known;
+    }
+    if ((Uint32)(watch->directory_count + 1) * 2 > watch->slot_count && !grow_slots(watch)) {
+        printf("Memory allocation failed for watched folders, not watching %.*s\n", (int)length, path);
+        return -1;
+    }
+    if (watch->directory_count == watch->directory_capacity) {
+        int capacity = watch->directory_capacity ? watch->directory_capacity * 2 : 64;
+        char **directories = realloc(watch->directories, capacity * sizeof(char *));
+        if (directories) {
+            watch->directories = directories;
+        }
+        int *descriptors = directories ? realloc(watch->descriptors, capacity * sizeof(int)) : NULL;
+        if (descriptors) {
+            watch->descriptors = descriptors;
+        }
+        int64_t *mtimes = descriptors ? realloc(watch->mtimes, capacity * sizeof(int64_t)) : NULL;
+        if (!mtimes) {
+            printf("Memory allocation failed for watched folders, not watching %.*s\n", (int)length, path);
+            return -1;
+        }
+        watch->mtimes = mtimes;
+        watch->directory_capacity = capacity;
+    }
+    char *directory = malloc(length + 1);
+    if (!directory) {
+        printf("Memory allocation failed for watched folders, not watching %.*s\n", (int)length, path);
+        return -1;
+    }
+    memcpy(directory, path, length);
+    directory[length] = '\0';
+    int index = watch->directory_count++;
+    watch->directories[index] = directory;
+    watch->descriptors[index] = -1;
+    watch->mtimes[index] = -1;
+    insert_slot(watch, index);
+    return index;
+}
+
+// Adds the library file's folder and the folders of every cover and track,
+// marking in `wanted` those among the first `wanted_count` that were
+// already watched.
+static void add_library_directories(LibraryWatch *watch, const Library *library, bool *wanted, int wanted_count) {
+    int index = add_directory(watch, watch->library_path, is_directory(watch->library_path));
+    if (index >= 0 && index < wanted_count) {
+        wanted[index] = true;
+    }
+    StringId last_folder = 0;
+    for (int a = 0; a < library->number_of_albums; a++) {
+        const Album *album = &library->albums[a];
+        index = add_directory(watch, library_string(library, album->photo_location), false);
+        if (index >= 0 && index < wanted_count) {
+            wanted[index] = true;
+        }
+        for (int t = album->first_track; t < album->first_track + album->number_of_tracks; t++) {
+            // Tracks of an album usually share a folder, interned once
+            if (library->track_folders[t] != last_folder) {
+                last_folder = library->track_folders[t];
+                index = add_directory(watch, library_string(library, last_folder), true);
+                if (index >= 0 && index < wanted_count) {
+                    wanted[index] = true;
+                }
+            }
+        }
+    }
+}
+
+// Watches folder `index` with inotify, or stamps it when polling. A folder
+// inotify refuses switches the watch to polling.
+static void watch_directory(LibraryWatch *watch, int index) {
+#ifdef __linux__
+    if (!watch->polling) {
+        watch->descriptors[index] = inotify_add_watch(watch->fd, watch->directories[index], WATCH_EVENTS);
+        if (watch->descriptors[index] >= 0 || !is_directory(watch->directories[index])) {
+            return;
+        }
+        printf("inotify watch failed for %s, polling instead\n", watch->directories[index]);
+        watch->polling = true;
+        for (int i = 0; i < watch->directory_count; i++) {
+            int64_t size;
+            path_stamp(watch->directories[i], &size, &watch->mtimes[i]);
+        }
+        return;
+    }
+#endif
+    int64_t size;
+    path_stamp(watch->directories[index], &size, &watch->mtimes[index]);
+}
+
+static bool is_ignored(const LibraryWatch *watch, const char *path) {
+    for (int i = 0; i < watch->ignored_count; i++) {
+        size_t length = strlen(watch->ignored[i]);
+        if (strncmp(path, watch->ignored[i], length) == 0 && (path[length] == '\0' || strcmp(path + length, ".tmp") == 0)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void add_change(LibraryWatch *watch, const char *path) {
+    SDL_LockMutex(watch->lock);
+    bool known = false;
+    for (int i = 0; i < watch->change_count && !known; i++) {
+        known = strcmp(watch->changes[i], path) == 0;
+    }
+    if (!known && watch->change_count == WATCH_MAX_CHANGES) {
+        watch->overflowed = true;
+    } else if (!known) {
+        char *copy = malloc(strlen(path) + 1);
+        if (copy) {
+            strcpy(copy, path);
+            watch->changes[watch->change_count++] = copy;
+        } else {
+            watch->overflowed = true;
+        }
+    }
+    SDL_UnlockMutex(watch->lock);
+}
+
+#ifdef __linux__
+// Reads whatever inotify has queued, waiting up to WATCH_WAIT_MS for it.
+static bool read_events(LibraryWatch *watch) {
+    struct pollfd descriptor = {watch->fd, POLLIN, 0};
+    if (poll(&descriptor, 1, WATCH_WAIT_MS) <= 0) {
+        return false;
+    }
+    char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    ssize_t length = read(watch->fd, buffer, sizeof(buffer));
+    bool changed = false;
+    SDL_LockMutex(watch->directory_lock);
+    for (ssize_t offset = 0; offset < length;) {
+        const struct inotify_event *event = (const struct inotify_event *)(buffer + offset);
+        offset += (ssize_t)(sizeof(struct inotify_event) + event->len);
+        if (event->mask & IN_Q_OVERFLOW) {
+            SDL_LockMutex(watch->lock);
+            watch->overflowed = true;
+            SDL_UnlockMutex(watch->lock);
+            changed = true;
+            continue;
+        }
+        for (int i = 0; i < watch->directory_count && event->len > 0; i++) {
+            if (watch->descriptors[i] != event->wd) {
+                continue;
+            }
+            char path[MAX_PATH_LENGTH * 2];
+            if (strcmp(watch->directories[i], ".") == 0) {
+                snprintf(path, sizeof(path), "%s", event->name);
+            } else {
+                snprintf(path, sizeof(path), "%s/%s", watch->directories[i], event->name);
+            }
+            if (!is_ignored(watch, path)) {
+                add_change(watch, path);
+                changed = true;
+            }
+            break;
+        }
+    }
+    SDL_UnlockMutex(watch->directory_lock);
+    return changed;
+}
+#endif
+
+// Stats the library file and every folder, reporting those that moved.
+static bool poll_stamps(LibraryWatch *watch) {
+    bool changed = false;
+    int64_t size, mtime;
+    path_stamp(watch->library_path, &size, &mtime);
+    if (size != watch->library_size || mtime != watch->library_mtime) {
+        watch->library_size = size;
+        watch->library_mtime = mtime;
+        add_change(watch, watch->library_path);
+        changed = true;
+    }
+    SDL_LockMutex(watch->directory_lock);
+    for (int i = 0; i < watch->directory_count; i++) {
+        path_stamp(watch->directories[i], &size, &mtime);
+        if (mtime != watch->mtimes[i]) {
+            watch->mtimes[i] = mtime;
+            add_change(watch, watch->directories[i]);
+            changed = true;
+        }
+    }
+    SDL_UnlockMutex(watch->directory_lock);
+    return changed;
+}
+
+static void post_changes(LibraryWatch *watch) {
+    SDL_Event event;
+    SDL_zero(event);
+    event.type = watch->event_type;
+    SDL_PushEvent(&event);
+}
+
+// Editors and copies touch a file several times in a row, so changes are
+// announced only once none have arrived for WATCH_SETTLE_MS.
+static int watch_thread(void *data) {
+    LibraryWatch *watch = data;
+    trace_name_thread("library_watch");
+    Uint32 last_poll = SDL_GetTicks();
+    Uint32 last_change = 0;
+    bool unannounced = false;
+
+    while (!SDL_AtomicGet(&watch->quit)) {
+        bool changed = false;
+        SDL_LockMutex(watch->directory_lock);
+        bool polling = watch->polling;
+        SDL_UnlockMutex(watch->directory_lock);
+#ifdef __linux__
+        if (!polling) {
+            changed = read_events(watch);
+        } else
+#endif
+        {
+            SDL_Delay(WATCH_WAIT_MS);
+            if (SDL_GetTicks() - last_poll >= WATCH_POLL_MS) {
+                changed = poll_stamps(watch);
+                last_poll = SDL_GetTicks();
+            }
+        }
+
+        Uint32 now = SDL_GetTicks();
+        if (changed) {
+            last_change = now;
+            unannounced = true;
+        } else if (unannounced && now - last_change >= WATCH_SETTLE_MS) {
+            post_changes(watch);
+            unannounced = false;
+        }
+    }
+    return 0;
+}
+
+// Starts watching `library_path` and the folders of every cover and track
+// in `library`, ignoring the paths in `ignored`, which must outlive the
+// watch. Falls back to polling when inotify is missing or refuses a watch,
+// and fails only if the thread cannot start.
+bool library_watch_start(LibraryWatch *watch, const Library *library, const char *library_path, const char *const *ignored, int ignored_count, Uint32 event_type) {
+    memset(watch, 0, sizeof(*watch));
+    watch->fd = -1;
+    watch->event_type = event_type;
+    snprintf(watch->library_path, sizeof(watch->library_path), "%s", library_path);
+    watch->ignored_count = ignored_count < WATCH_MAX_IGNORED ? ignored_count : WATCH_MAX_IGNORED;
+    memcpy(watch->ignored, ignored, (size_t)watch->ignored_count * sizeof(const char *));
+    add_library_directories(watch, library, NULL, 0);
+
+#ifdef __linux__
+    watch->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    watch->polling = watch->fd < 0;
+    path_stamp(watch->library_path, &watch->library_size, &watch->library_mtime);
+    for (int i = 0; i < watch->directory_count; i++) {
+        watch_directory(watch, i);
+    }
+
+    watch->lock = SDL_CreateMutex();
+    watch->directory_lock = SDL_CreateMutex();
+    watch->thread = watch->lock && watch->directory_lock ? SDL_CreateThread(watch_thread, "library_watch", watch) : NULL;
+    if (!watch->thread) {
+        printf("Library watch disabled: %s\n", SDL_GetError());
+        library_watch_stop(watch);
+        return false;
+    }
+    printf("Watching %d folders for library changes (%s)\n", watch->directory_count, watch->polling ? "polling" : "inotify");
+    return true;
+}
+
+// Follows a library reload: folders of the new `library` that were not
+// watched yet are added and those it no longer uses are dropped. One hash
+// lookup per folder, and the folders kept are not touched.
+void library_watch_update(LibraryWatch *watch, const Library *library) {
+    if (!watch->thread) {
+        return;
+    }
+    int old_count = watch->directory_count;
+    bool *wanted = calloc((size_t)(old_count > 0 ? old_count : 1), sizeof(bool));
+    if (!wanted) {
+        printf("Memory allocation failed for watched folders\n");
+        return;
+    }
+    SDL_LockMutex(watch->directory_lock);
+    add_library_directories(watch, library, wanted, old_count);
+    int added = watch->directory_count - old_count;
+    for (int i = old_count; i < watch->directory_count; i++) {
+        watch_directory(watch, i);
+    }
+    int kept = 0;
+    for (int i = 0; i < watch->directory_count; i++) {
+        if (i >= old_count || wanted[i]) {
+            watch->directories[kept] = watch->directories[i];
+            watch->descriptors[kept] = watch->descriptors[i];
+            watch->mtimes[kept] = watch->mtimes[i];
+            kept++;
+            continue;
+        }
+#ifdef __linux__
+        if (watch->descriptors[i] >= 0) {
+            inotify_rm_watch(watch->fd, watch->descriptors[i]);
+        }
+#endif
+        free(watch->directories[i]);
+    }
+    int removed = watch->directory_count - kept;
+    watch->directory_count = kept;
+    if (removed > 0) {
+        // The folders kept moved down, so they are hashed again
+        memset(watch->slots, 0, watch->slot_count * sizeof(int));
+        for (int i = 0; i < watch->directory_count; i++) {
+            insert_slot(watch, i);
+        }
+    }
+    SDL_UnlockMutex(watch->directory_lock);
+    free(wanted);
+    if (added > 0 || removed > 0) {
+        printf("Watching %d folders for library changes: %d added, %d dropped\n", watch->directory_count, added, removed);
+    }
+}
+
+// Hands over up to `capacity` changed paths, which the caller frees.
+// `overflowed` is set when changes were lost and everything should be
+// treated as changed.
+int library_watch_collect(LibraryWatch *watch, char **changes, int capacity, bool *overflowed) {
+    SDL_LockMutex(watch->lock);
+    int count = watch->change_count < capacity ? watch->change_count : capacity;
+    memcpy(changes, watch->changes, count * sizeof(char *));
+    memmove(watch->changes, watch->changes + count, (watch->change_count - count) * sizeof(char *));
+    watch->change_count -= count;
+    *overflowed = watch->overflowed;
+    watch->overflowed = false;
+    SDL_UnlockMutex(watch->lock);
+    return count;
+}
+
+// True if `path` is the changed file or sits directly in the changed
+// folder.
+bool library_watch_affects(const char *change, const char *path) {
+    if (strcmp(change, path) == 0) {
+        return true;
+    }
+    const char *slash = strrchr(path, '/');
+    size_t folder = slash ? (size_t)(slash - path) : 0;
+    if (strcmp(change, ".") == 0) {
+        return folder == 0;
+    }
+    return folder == strlen(change) && strncmp(change, path, folder) == 0;
+}
+
+static int compare_changes(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Sorts changes for library_watch_affects_sorted().
+void library_watch_sort(char **changes, int count) {
+    qsort(changes, (size_t)count, sizeof(char *), compare_changes);
+}
+
+// strcmp() of `change` against the first `length` bytes of `head` followed
+// by `tail`, without joining them.
+static int compare_joined(const char *change, const char *head, size_t length, const char *tail) {
+    int order = strncmp(change, head, length);
+    return order != 0 ? order : strcmp(change + length, tail);
+}
+
+static bool listed(char **changes, int count, const char *head, size_t length, const char *tail) {
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        int middle = low + (high - low) / 2;
+        int order = compare_joined(changes[middle], head, length, tail);
+        if (order == 0) {
+            return true;
+        }
+        if (order < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return false;
+}
+
+// library_watch_affects() for the file `name` in `folder` (its first
+// `folder_length` bytes, empty or ending in '/'), against every change at
+// once: `changes` must be sorted by library_watch_sort(). Two binary
+// searches, and the path is never put together.
+bool library_watch_affects_sorted(char **changes, int count, const char *folder, size_t folder_length, const char *name) {
+    if (listed(changes, count, folder, folder_length, name)) {
+        return true;
+    }
+    return folder_length > 0 ? listed(changes, count, folder, folder_length - 1, "") : listed(changes, count, ".", 1, "");
+}
+
+void library_watch_stop(LibraryWatch *watch) {
+    SDL_AtomicSet(&watch->quit, 1);
+    SDL_WaitThread(watch->thread, NULL);
+    watch->thread = NULL;
+#ifdef __linux__
+    if (watch->fd >= 0) {
+        close(watch->fd);
+    }
+#endif
+    watch->fd = -1;
+    for (int i = 0; i < watch->directory_count; i++) {
+        free(watch->directories[i]);
+    }
+    free(watch->directories);
+    free(watch->descriptors);
+    free(watch->mtimes);
+    free(watch->slots);
+    watch->directories = NULL;
+    watch->descriptors = NULL;
+    watch->mtimes = NULL;
+    watch->slots = NULL;
+    watch->directory_count = 0;
+    watch->directory_capacity = 0;
+    watch->slot_count = 0;
+    for (int i = 0; i < watch->change_count; i++) {
+        free(watch->changes[i]);
+    }
+    watch->change_count = 0;
+    if (watch->lock) {
+        SDL_DestroyMutex(watch->lock);
+        watch->lock = NULL;
+    }
+    if (watch->directory_lock) {
+        SDL_DestroyMutex(watch->directory_lock);
+        watch->directory_lock = NULL;
+    }
+}
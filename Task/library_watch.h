@@ -0,0 +1,67 @@
+#ifndef LIBRARY_WATCH_H
+#define LIBRARY_WATCH_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "library.h"
+
+#define WATCH_MAX_CHANGES 256
+#define WATCH_MAX_IGNORED 16
+#define WATCH_SETTLE_MS 250
+#define WATCH_POLL_MS 1000
+
+// Watches the library file (albums.txt, or the --scan root) and every folder
+// holding a cover or a track. A background thread waits on inotify, or
+// where there is none stats the watched paths every WATCH_POLL_MS, and posts
+// an SDL event of type `event_type` once changes have settled for
+// WATCH_SETTLE_MS. With inotify a change is the path of the file that was
+// written, created, moved or deleted; when polling it is the library file
+// or a folder whose mtime moved, which covers files added or removed but
+// not ones rewritten in place.
+//
+// The player's own files (`ignored`, and each with ".tmp" appended) are
+// not reported, so writing a cache or snapshot next to albums.txt doesn't
+// come back as a library change.
+//
+// When the library is reloaded, library_watch_update() watches the folders
+// that appeared and drops those that vanished, keeping the rest.
+//
+// `changes` is shared under `lock`. The folders, which `slots` hashes by
+// path, their stamps and `polling` are shared under `directory_lock`. The
+// library stamps belong to the thread; the rest is fixed after start.
+typedef struct library_watch {
+    char library_path[MAX_PATH_LENGTH];
+    const char *ignored[WATCH_MAX_IGNORED];
+    int ignored_count;
+    SDL_mutex *directory_lock;
+    char **directories;
+    int *descriptors;
+    int64_t *mtimes;
+    int directory_count;
+    int directory_capacity;
+    int *slots;
+    Uint32 slot_count;
+    bool polling;
+    int64_t library_size;
+    int64_t library_mtime;
+    int fd;
+    Uint32 event_type;
+    SDL_Thread *thread;
+    SDL_atomic_t quit;
+
+    SDL_mutex *lock;
+    char *changes[WATCH_MAX_CHANGES];
+    int change_count;
+    bool overflowed;
+} LibraryWatch;
+
+bool library_watch_start(LibraryWatch *watch, const Library *library, const char *library_path, const char *const *ignored, int ignored_count, Uint32 event_type);
+void library_watch_update(LibraryWatch *watch, const Library *library);
+int library_watch_collect(LibraryWatch *watch, char **changes, int capacity, bool *overflowed);
+bool library_watch_affects(const char *change, const char *path);
+void library_watch_sort(char **changes, int count);
+bool library_watch_affects_sorted(char **changes, int count, const char *folder, size_t folder_length, const char *name);
+void library_watch_stop(LibraryWatch *watch);
+
+#endif
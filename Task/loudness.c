@@ -0,0 +1,583 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <SDL2/SDL_mixer.h>
+#include "loudness.h"
+#include "trace.h"
+#include "track_decoder.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+#define MAX_CACHED_PATH 65536
+
+// Second-order IIR section in direct form I.
+typedef struct biquad {
+    double b0, b1, b2, a1, a2;
+    double x1, x2, y1, y2;
+} Biquad;
+
+static uint32_t hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+static char *copy_string(const char *str) {
+    char *copy = malloc(strlen(str) + 1);
+    if (copy) {
+        strcpy(copy, str);
+    }
+    return copy;
+}
+
+static bool file_identity(const char *path, int64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+    *size = (int64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    return true;
+}
+
+// Called with the lock held, or on a table no other thread can see yet.
+static LoudnessRecord *find_record(const Loudness *loudness, const char *path) {
+    if (!loudness->slots) {
+        return NULL;
+    }
+    for (Uint32 slot = hash_path(path) & loudness->slot_mask; loudness->slots[slot]; slot = (slot + 1) & loudness->slot_mask) {
+        LoudnessRecord *record = &loudness->records[loudness->slots[slot] - 1];
+        if (strcmp(record->path, path) == 0) {
+            return record;
+        }
+    }
+    return NULL;
+}
+
+static bool grow_slots(Loudness *loudness) {
+    Uint32 slot_count = loudness->slots ? (loudness->slot_mask + 1) * 2 : 1024;
+    int *slots = calloc(slot_count, sizeof(int));
+    if (!slots) {
+        printf("Memory allocation failed for loudness table\n");
+        return false;
+    }
+    for (int i = 0; i < loudness->count; i++) {
+        Uint32 slot = hash_path(loudness->records[i].path) & (slot_count - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = i + 1;
+    }
+    free(loudness->slots);
+    loudness->slots = slots;
+    loudness->slot_mask = slot_count - 1;
+    return true;
+}
+
+// Returns the record for `path`, adding an empty one if there is none.
+// Called with the lock held, or on a table no other thread can see yet.
+static LoudnessRecord *upsert_record(Loudness *loudness, const char *path) {
+    LoudnessRecord *record = find_record(loudness, path);
+    if (record) {
+        return record;
+    }
+    if (loudness->count == loudness->capacity) {
+        int capacity = loudness->capacity ? loudness->capacity * 2 : 256;
+        LoudnessRecord *records = realloc(loudness->records, capacity * sizeof(LoudnessRecord));
+        if (!records) {
+            printf("Memory allocation failed for loudness records\n");
+            return NULL;
+        }
+        loudness->records = records;
+        loudness->capacity = capacity;
+    }
+    if ((Uint32)(loudness->count + 1) * 2 > (loudness->slots ? loudness->slot_mask + 1 : 0) && !grow_slots(loudness)) {
+        return NULL;
+    }
+    record = &loudness->records[loudness->count];
+    memset(record, 0, sizeof(*record));
+    record->path = copy_string(path);
+    if (!record->path) {
+        return NULL;
+    }
+    Uint32 slot = hash_path(path) & loudness->slot_mask;
+    while (loudness->slots[slot]) {
+        slot = (slot + 1) & loudness->slot_mask;
+    }
+    loudness->slots[slot] = ++loudness->count;
+    return record;
+}
+
+static bool write_record(FILE *fptr, const LoudnessRecord *record) {
+    uint32_t length = (uint32_t)strlen(record->path);
+    return fwrite(&record->size, sizeof(record->size), 1, fptr) == 1 &&
+           fwrite(&record->mtime, sizeof(record->mtime), 1, fptr) == 1 &&
+           fwrite(&record->loudness, sizeof(record->loudness), 1, fptr) == 1 &&
+           fwrite(&record->peak, sizeof(record->peak), 1, fptr) == 1 &&
+           fwrite(&length, sizeof(length), 1, fptr) == 1 &&
+           fwrite(record->path, 1, length, fptr) == length;
+}
+
+static bool write_header(FILE *fptr) {
+    LoudnessCacheHeader header = {0};
+    header.magic = LOUDNESS_CACHE_MAGIC;
+    header.version = LOUDNESS_CACHE_VERSION;
+    return fwrite(&header, sizeof(header), 1, fptr) == 1;
+}
+
+// Reads every complete record; returns how many were read, including ones
+// later replaced, or -1 if there is no usable cache. `damaged` is set when
+// the file ends in a partial record.
+static int load_cache(Loudness *loudness, bool *damaged) {
+    *damaged = false;
+    FILE *fptr = fopen(loudness->cache_path, "rb");
+    if (!fptr) {
+        return -1;
+    }
+    LoudnessCacheHeader header;
+    if (fread(&header, sizeof(header), 1, fptr) != 1 || header.magic != LOUDNESS_CACHE_MAGIC || header.version != LOUDNESS_CACHE_VERSION) {
+        fclose(fptr);
+        return -1;
+    }
+
+    int read = 0;
+    long end = ftell(fptr);
+    char *path = malloc(MAX_CACHED_PATH + 1);
+    while (path) {
+        LoudnessRecord loaded;
+        uint32_t length;
+        bool ok = fread(&loaded.size, sizeof(loaded.size), 1, fptr) == 1 &&
+                  fread(&loaded.mtime, sizeof(loaded.mtime), 1, fptr) == 1 &&
+                  fread(&loaded.loudness, sizeof(loaded.loudness), 1, fptr) == 1 &&
+                  fread(&loaded.peak, sizeof(loaded.peak), 1, fptr) == 1 &&
+                  fread(&length, sizeof(length), 1, fptr) == 1 &&
+                  length <= MAX_CACHED_PATH && fread(path, 1, length, fptr) == length;
+        if (!ok) {
+            break;
+        }
+        path[length] = '\0';
+        LoudnessRecord *record = upsert_record(loudness, path);
+        if (!record) {
+            break;
+        }
+        record->size = loaded.size;
+        record->mtime = loaded.mtime;
+        record->loudness = loaded.loudness;
+        record->peak = loaded.peak;
+        record->analyzed = true;
+        read++;
+        end = ftell(fptr);
+    }
+    free(path);
+    fseek(fptr, 0, SEEK_END);
+    *damaged = ftell(fptr) != end;
+    fclose(fptr);
+    return read;
+}
+
+// Opens the cache for appending, first rewriting it with one record per
+// path if `rewrite` is set.
+static bool open_journal(Loudness *loudness, bool rewrite) {
+    if (!rewrite) {
+        loudness->journal = fopen(loudness->cache_path, "ab");
+        return loudness->journal != NULL;
+    }
+
+    char temp_path[MAX_PATH_LENGTH + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", loudness->cache_path);
+    FILE *fptr = fopen(temp_path, "wb");
+    bool ok = fptr && write_header(fptr);
+    for (int i = 0; ok && i < loudness->count; i++) {
+        ok = write_record(fptr, &loudness->records[i]);
+    }
+    ok = fptr && fclose(fptr) == 0 && ok;
+    if (ok) {
+        remove(loudness->cache_path);
+        ok = rename(temp_path, loudness->cache_path) == 0;
+    }
+    if (!ok) {
+        remove(temp_path);
+        return false;
+    }
+    loudness->journal = fopen(loudness->cache_path, "ab");
+    return loudness->journal != NULL;
+}
+
+static void set_biquad(Biquad *filter, double b0, double b1, double b2, double a0, double a1, double a2) {
+    memset(filter, 0, sizeof(*filter));
+    filter->b0 = b0 / a0;
+    filter->b1 = b1 / a0;
+    filter->b2 = b2 / a0;
+    filter->a1 = a1 / a0;
+    filter->a2 = a2 / a0;
+}
+
+static double run_biquad(Biquad *filter, double x) {
+    double y = filter->b0 * x + filter->b1 * filter->x1 + filter->b2 * filter->x2 - filter->a1 * filter->y1 - filter->a2 * filter->y2;
+    filter->x2 = filter->x1;
+    filter->x1 = x;
+    filter->y2 = filter->y1;
+    filter->y1 = y;
+    return y;
+}
+
+// The two stages of the BS.1770 K-weighting filter, a high shelf for the
+// head and a high-pass, designed for `frequency`.
+static void k_weighting(Biquad *shelf, Biquad *high_pass, int frequency) {
+    double k = tan(M_PI * 1681.974450955533 / frequency);
+    double q = 0.7071752369554196;
+    double vh = pow(10.0, 3.999843853973347 / 20.0);
+    double vb = pow(vh, 0.4996667741545416);
+    set_biquad(shelf, vh + vb * k / q + k * k, 2.0 * (k * k - vh), vh - vb * k / q + k * k,
+               1.0 + k / q + k * k, 2.0 * (k * k - 1.0), 1.0 - k / q + k * k);
+
+    k = tan(M_PI * 38.13547087602444 / frequency);
+    q = 0.5003270373238773;
+    set_biquad(high_pass, 1.0, -2.0, 1.0, 1.0 + k / q + k * k, 2.0 * (k * k - 1.0), 1.0 - k / q + k * k);
+}
+
+static double to_lufs(double mean_square) {
+    return -0.691 + 10.0 * log10(mean_square);
+}
+
+// EBU R128 integrated loudness of interleaved Sint16 PCM: K-weighted mean
+// square over 400 ms blocks with 75% overlap, gated at -70 LUFS and then
+// at 10 LU below the ungated mean. Returns false for audio with no block
+// above the gates, such as silence or anything shorter than one block.
+static bool measure(const Sint16 *samples, Uint32 frames, int channels, int frequency, float *loudness, float *peak) {
+    int step = frequency / 10;
+    Uint32 steps = frames / (Uint32)step;
+    double *energy = calloc(steps + 1, sizeof(double));
+    if (!energy) {
+        printf("Memory allocation failed for loudness analysis\n");
+        return false;
+    }
+
+    Biquad shelf[2];
+    Biquad high_pass[2];
+    int weighted = channels < 2 ? channels : 2;
+    for (int c = 0; c < weighted; c++) {
+        k_weighting(&shelf[c], &high_pass[c], frequency);
+    }
+
+    // Mean square of each 100 ms step, summed over the front channels
+    int max_sample = 0;
+    for (Uint32 s = 0; s < steps; s++) {
+        double sum = 0.0;
+        for (int i = 0; i < step; i++) {
+            const Sint16 *frame = samples + ((size_t)s * step + i) * channels;
+            for (int c = 0; c < weighted; c++) {
+                int magnitude = frame[c] < 0 ? -frame[c] : frame[c];
+                max_sample = magnitude > max_sample ? magnitude : max_sample;
+                double y = run_biquad(&high_pass[c], run_biquad(&shelf[c], frame[c] / 32768.0));
+                sum += y * y;
+            }
+        }
+        energy[s] = sum / step;
+    }
+    *peak = max_sample / 32768.0f;
+
+    // Each 400 ms block is four consecutive steps
+    const double absolute_gate = pow(10.0, (-70.0 + 0.691) / 10.0);
+    double gated_sum = 0.0;
+    int gated_blocks = 0;
+    for (Uint32 s = 0; s + 4 <= steps; s++) {
+        double block = (energy[s] + energy[s + 1] + energy[s + 2] + energy[s + 3]) / 4.0;
+        if (block > absolute_gate) {
+            gated_sum += block;
+            gated_blocks++;
+        }
+    }
+    bool ok = gated_blocks > 0;
+    if (ok) {
+        double relative_gate = gated_sum / gated_blocks * pow(10.0, -10.0 / 10.0);
+        double sum = 0.0;
+        int blocks = 0;
+        for (Uint32 s = 0; s + 4 <= steps; s++) {
+            double block = (energy[s] + energy[s + 1] + energy[s + 2] + energy[s + 3]) / 4.0;
+            if (block > absolute_gate && block > relative_gate) {
+                sum += block;
+                blocks++;
+            }
+        }
+        *loudness = (float)to_lufs(sum / blocks);
+    }
+    free(energy);
+    return ok;
+}
+
+static int loudness_worker(void *data) {
+    Loudness *loudness = data;
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    trace_name_thread("loudness_worker");
+    while (!SDL_AtomicGet(&loudness->quit)) {
+        int i = SDL_AtomicAdd(&loudness->next, 1);
+        if (i >= loudness->task_count) {
+            break;
+        }
+        LoudnessTask *task = &loudness->tasks[i];
+        Uint64 trace_start_time = trace_begin();
+        Mix_Chunk *chunk = decode_track(task->path, loudness->frequency, loudness->channels, loudness->quality);
+        trace_end("decode_track", trace_start_time);
+        if (!chunk) {
+            SDL_AtomicAdd(&loudness->failed, 1);
+            continue;
+        }
+        float lufs = 0.0f;
+        float peak = 0.0f;
+        Uint32 frames = chunk->alen / (Uint32)(loudness->channels * sizeof(Sint16));
+        trace_start_time = trace_begin();
+        bool measured = measure((const Sint16 *)chunk->abuf, frames, loudness->channels, loudness->frequency, &lufs, &peak);
+        trace_end("loudness_measure", trace_start_time);
+        if (!measured) {
+            // Silent or too short to gate: play it as it is
+            lufs = (float)LOUDNESS_TARGET_LUFS;
+        }
+        Mix_FreeChunk(chunk);
+
+        SDL_LockMutex(loudness->lock);
+        LoudnessRecord *record = upsert_record(loudness, task->path);
+        if (record) {
+            record->size = task->size;
+            record->mtime = task->mtime;
+            record->loudness = lufs;
+            record->peak = peak;
+            record->analyzed = true;
+            if (loudness->journal && (!write_record(loudness->journal, record) || fflush(loudness->journal) != 0)) {
+                printf("Error writing loudness cache: %s\n", loudness->cache_path);
+                fclose(loudness->journal);
+                loudness->journal = NULL;
+            }
+        }
+        SDL_UnlockMutex(loudness->lock);
+        SDL_AtomicAdd(&loudness->analyzed, 1);
+    }
+    return 0;
+}
+
+// Queues each library file that has no current record, once. Returns how
+// many tracks were already analysed. Called with the library lock held; the
+// library is gone once the scan has been retired.
+static int queue_tasks(Loudness *loudness) {
+    const Library *library = loudness->library;
+    int capacity = 0;
+    int up_to_date = 0;
+    if (!library) {
+        return 0;
+    }
+    for (int a = 0; a < library->number_of_albums; a++) {
+        for (int t = 0; t < library->albums[a].number_of_tracks; t++) {
+            if (SDL_AtomicGet(&loudness->quit)) {
+                return up_to_date;
+            }
+            char path[MAX_PATH_LENGTH];
+            int64_t size;
+            int64_t mtime;
+            library_track_location(library, a, t, path, sizeof(path));
+            if (!file_identity(path, &size, &mtime)) {
+                continue;
+            }
+
+            SDL_LockMutex(loudness->lock);
+            LoudnessRecord *record = upsert_record(loudness, path);
+            bool current = !record || (record->size == size && record->mtime == mtime);
+            up_to_date += record && current && record->analyzed;
+            if (!current) {
+                record->size = size;
+                record->mtime = mtime;
+                record->analyzed = false;
+            }
+            SDL_UnlockMutex(loudness->lock);
+            if (current) {
+                continue;
+            }
+
+            if (loudness->task_count == capacity) {
+                capacity = capacity ? capacity * 2 : 256;
+                LoudnessTask *tasks = realloc(loudness->tasks, capacity * sizeof(LoudnessTask));
+                if (!tasks) {
+                    printf("Memory allocation failed for loudness tasks\n");
+                    return up_to_date;
+                }
+                loudness->tasks = tasks;
+            }
+            LoudnessTask *task = &loudness->tasks[loudness->task_count];
+            task->path = copy_string(path);
+            task->size = size;
+            task->mtime = mtime;
+            if (task->path) {
+                loudness->task_count++;
+            }
+        }
+    }
+    return up_to_date;
+}
+
+static int loudness_coordinator(void *data) {
+    Loudness *loudness = data;
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    Uint32 started = SDL_GetTicks();
+
+    // Read into a table of our own and swapped in after, so loudness_gain()
+    // doesn't wait on the disk
+    Loudness loaded;
+    memset(&loaded, 0, sizeof(loaded));
+    memcpy(loaded.cache_path, loudness->cache_path, sizeof(loaded.cache_path));
+    bool damaged;
+    int read = load_cache(&loaded, &damaged);
+    // Compact when records have been replaced or cut short; start afresh
+    // without a cache
+    if (!open_journal(&loaded, read < 0 || damaged || read > loaded.count)) {
+        printf("Error opening loudness cache: %s\n", loudness->cache_path);
+    }
+    SDL_LockMutex(loudness->lock);
+    loudness->records = loaded.records;
+    loudness->count = loaded.count;
+    loudness->capacity = loaded.capacity;
+    loudness->slots = loaded.slots;
+    loudness->slot_mask = loaded.slot_mask;
+    loudness->journal = loaded.journal;
+    SDL_UnlockMutex(loudness->lock);
+
+    SDL_LockMutex(loudness->library_lock);
+    int up_to_date = queue_tasks(loudness);
+    SDL_UnlockMutex(loudness->library_lock);
+    if (loudness->task_count > 0) {
+        int thread_count = SDL_GetCPUCount() - 1;
+        thread_count = thread_count < 1 ? 1 : thread_count > LOUDNESS_MAX_THREADS ? LOUDNESS_MAX_THREADS : thread_count;
+        SDL_Thread *threads[LOUDNESS_MAX_THREADS];
+        int running = 0;
+        for (int i = 0; i < thread_count; i++) {
+            threads[running] = SDL_CreateThread(loudness_worker, "loudness_worker", loudness);
+            if (threads[running]) {
+                running++;
+            }
+        }
+        if (running == 0) {
+            loudness_worker(loudness);
+        }
+        for (int i = 0; i < running; i++) {
+            SDL_WaitThread(threads[i], NULL);
+        }
+    }
+
+    printf("Loudness scan %s after %u ms: %d of %d tracks analysed, %d failed, %d already cached\n",
+           SDL_AtomicGet(&loudness->quit) ? "stopped" : "finished", SDL_GetTicks() - started,
+           SDL_AtomicGet(&loudness->analyzed), loudness->task_count, SDL_AtomicGet(&loudness->failed), up_to_date);
+    SDL_AtomicSet(&loudness->finished, 1);
+    return 0;
+}
+
+// Returns at once; the cache is read and the scan runs on background
+// threads. `frequency`, `channels` and `quality` must be the audio engine's,
+// so tracks are measured as they will be played. NULL if the threads could
+// not be started.
+Loudness *loudness_start(const Library *library, const char *cache_path, int frequency, int channels, ResampleQuality quality) {
+    Loudness *loudness = calloc(1, sizeof(Loudness));
+    if (!loudness) {
+        printf("Memory allocation failed for loudness scan\n");
+        return NULL;
+    }
+    loudness->library = library;
+    loudness->frequency = frequency;
+    loudness->channels = channels;
+    loudness->quality = quality;
+    snprintf(loudness->cache_path, sizeof(loudness->cache_path), "%s", cache_path);
+    loudness->lock = SDL_CreateMutex();
+    loudness->library_lock = SDL_CreateMutex();
+    loudness->coordinator = loudness->lock && loudness->library_lock ? SDL_CreateThread(loudness_coordinator, "loudness", loudness) : NULL;
+    if (!loudness->coordinator) {
+        printf("Loudness scan disabled: %s\n", SDL_GetError());
+        loudness_stop(loudness);
+        return NULL;
+    }
+    return loudness;
+}
+
+// Q12 gain that brings `path` to LOUDNESS_TARGET_LUFS without clipping its
+// peak, or unity if it has not been analysed. Stats the file, so call it
+// off the audio thread.
+int loudness_gain(Loudness *loudness, const char *path) {
+    int64_t size;
+    int64_t mtime;
+    if (!loudness->lock || !file_identity(path, &size, &mtime)) {
+        return LOUDNESS_UNITY_GAIN;
+    }
+    double gain = 1.0;
+    SDL_LockMutex(loudness->lock);
+    const LoudnessRecord *record = find_record(loudness, path);
+    if (record && record->analyzed && record->size == size && record->mtime == mtime) {
+        gain = pow(10.0, (LOUDNESS_TARGET_LUFS - record->loudness) / 20.0);
+        if (record->peak > 0.0f && gain * record->peak * 32768.0 > 32767.0) {
+            gain = 32767.0 / (record->peak * 32768.0);
+        }
+    }
+    SDL_UnlockMutex(loudness->lock);
+    gain = gain > LOUDNESS_MAX_GAIN ? LOUDNESS_MAX_GAIN : gain;
+    return (int)(gain * LOUDNESS_UNITY_GAIN);
+}
+
+// Scans retired but still finishing a track. Only the main thread touches
+// the list.
+static Loudness *retired_scans;
+
+// Stops the scan without waiting for the tracks being decoded: returns once
+// the scan no longer reads the library, which is at most one stat() away,
+// so the library can be reloaded. The scan is freed by loudness_reap()
+// after its workers are done; until then it may still append to the cache.
+void loudness_retire(Loudness *loudness) {
+    SDL_AtomicSet(&loudness->quit, 1);
+    SDL_LockMutex(loudness->library_lock);
+    loudness->library = NULL;
+    SDL_UnlockMutex(loudness->library_lock);
+    loudness->next_retired = retired_scans;
+    retired_scans = loudness;
+}
+
+// Frees the retired scans that have finished, or with `wait` all of them.
+void loudness_reap(bool wait) {
+    Loudness **link = &retired_scans;
+    while (*link) {
+        Loudness *loudness = *link;
+        if (wait || SDL_AtomicGet(&loudness->finished)) {
+            *link = loudness->next_retired;
+            loudness_stop(loudness);
+        } else {
+            link = &loudness->next_retired;
+        }
+    }
+}
+
+// Waits for each worker to finish the track it is decoding, then frees the
+// scan.
+void loudness_stop(Loudness *loudness) {
+    if (loudness->coordinator) {
+        SDL_AtomicSet(&loudness->quit, 1);
+        SDL_WaitThread(loudness->coordinator, NULL);
+    }
+    if (loudness->journal) {
+        fclose(loudness->journal);
+    }
+    for (int i = 0; i < loudness->count; i++) {
+        free(loudness->records[i].path);
+    }
+    for (int i = 0; i < loudness->task_count; i++) {
+        free(loudness->tasks[i].path);
+    }
+    free(loudness->records);
+    free(loudness->slots);
+    free(loudness->tasks);
+    if (loudness->lock) {
+        SDL_DestroyMutex(loudness->lock);
+    }
+    if (loudness->library_lock) {
+        SDL_DestroyMutex(loudness->library_lock);
+    }
+    free(loudness);
+}
@@ -0,0 +1,94 @@
+#ifndef LOUDNESS_H
+#define LOUDNESS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "library.h"
+#include "resampler.h"
+
+#define LOUDNESS_CACHE_PATH "loudness.cache"
+#define LOUDNESS_CACHE_MAGIC 0x44554F4Cu // "LOUD"
+#define LOUDNESS_CACHE_VERSION 1
+#define LOUDNESS_TARGET_LUFS -18.0
+#define LOUDNESS_MAX_GAIN 4.0
+#define LOUDNESS_MAX_THREADS 16
+
+// Gains are Q12 fixed point so the feeder applies them with one integer
+// multiply and a shift per sample.
+#define LOUDNESS_GAIN_SHIFT 12
+#define LOUDNESS_UNITY_GAIN (1 << LOUDNESS_GAIN_SHIFT)
+
+// The loudness cache is this header followed by records appended as tracks
+// are analysed, each the file's size and mtime as int64, its integrated
+// loudness in LUFS and sample peak (0..1) as float, then its path as a
+// uint32 length plus bytes. Later records replace earlier ones for the same
+// path; a record cut short by a crash is ignored.
+typedef struct loudness_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t reserved[2];
+} LoudnessCacheHeader;
+
+// `analyzed` is false while the track is still queued.
+typedef struct loudness_record {
+    char *path;
+    int64_t size;
+    int64_t mtime;
+    float loudness;
+    float peak;
+    bool analyzed;
+} LoudnessRecord;
+
+// A file waiting for analysis.
+typedef struct loudness_task {
+    char *path;
+    int64_t size;
+    int64_t mtime;
+} LoudnessTask;
+
+// Background EBU R128 scan of every track in the library. A coordinator
+// thread loads the cache, queues the tracks whose size or mtime changed and
+// runs low-priority workers over them; none of it happens on the caller's
+// thread. Results are appended to the cache as they come in, so a scan
+// that is stopped picks up where it left off next time.
+//
+// The coordinator reads the library only while queueing, under
+// `library_lock`; loudness_retire() waits for that and no more. `records`
+// and `journal` are shared under `lock`; the workers take tasks by index
+// from `next`.
+typedef struct loudness {
+    const Library *library;
+    SDL_mutex *library_lock;
+    char cache_path[MAX_PATH_LENGTH];
+    int frequency;
+    int channels;
+    ResampleQuality quality;
+    SDL_Thread *coordinator;
+
+    SDL_mutex *lock;
+    LoudnessRecord *records;
+    int count;
+    int capacity;
+    int *slots;
+    Uint32 slot_mask;
+    FILE *journal;
+
+    LoudnessTask *tasks;
+    int task_count;
+    SDL_atomic_t next;
+    SDL_atomic_t analyzed;
+    SDL_atomic_t failed;
+    SDL_atomic_t quit;
+    SDL_atomic_t finished;
+    struct loudness *next_retired;
+} Loudness;
+
+Loudness *loudness_start(const Library *library, const char *cache_path, int frequency, int channels, ResampleQuality quality);
+int loudness_gain(Loudness *loudness, const char *path);
+void loudness_retire(Loudness *loudness);
+void loudness_reap(bool wait);
+void loudness_stop(Loudness *loudness);
+
+#endif
@@ -0,0 +1,198 @@
+#include <math.h>
+#include "mix.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MIX_X86
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#define MIX_X86
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+typedef struct mix_kernels {
+    void (*s16)(Sint16 *out, const Sint16 *a, const Sint16 *b, int frames, int channels, MixGain gain_a, MixGain gain_b);
+    void (*f32)(float *out, const float *a, const float *b, int frames, int channels, MixGain gain_a, MixGain gain_b);
+} MixKernels;
+
+// Samples `first` to `count`, one at a time. The vector kernels finish their
+// blocks with these and compute the gains the same way, so all kernels agree
+// to within rounding.
+static void mix_s16_samples(Sint16 *out, const Sint16 *a, const Sint16 *b, int first, int count, int channels, MixGain gain_a, MixGain gain_b) {
+    for (int i = first; i < count; i++) {
+        float frame = (float)(i / channels);
+        float mixed = (float)a[i] * (gain_a.start + gain_a.step * frame) + (float)b[i] * (gain_b.start + gain_b.step * frame);
+        mixed = mixed > 32767.0f ? 32767.0f : mixed < -32768.0f ? -32768.0f : mixed;
+        out[i] = (Sint16)lrintf(mixed);
+    }
+}
+
+static void mix_f32_samples(float *out, const float *a, const float *b, int first, int count, int channels, MixGain gain_a, MixGain gain_b) {
+    for (int i = first; i < count; i++) {
+        float frame = (float)(i / channels);
+        out[i] = a[i] * (gain_a.start + gain_a.step * frame) + b[i] * (gain_b.start + gain_b.step * frame);
+    }
+}
+
+static void mix_s16_scalar(Sint16 *out, const Sint16 *a, const Sint16 *b, int frames, int channels, MixGain gain_a, MixGain gain_b) {
+    mix_s16_samples(out, a, b, 0, frames * channels, channels, gain_a, gain_b);
+}
+
+static void mix_f32_scalar(float *out, const float *a, const float *b, int frames, int channels, MixGain gain_a, MixGain gain_b) {
+    mix_f32_samples(out, a, b, 0, frames * channels, channels, gain_a, gain_b);
+}
+
+// The vector kernels handle channel counts that divide the vector width, so
+// each lane stays on the same frame offset from one iteration to the next.
+// Anything else (5.1, say) goes through the scalar loop.
+#ifdef MIX_X86
+TARGET_SSE2 static __m128 lane_frames_sse2(int channels, int lane) {
+    return _mm_setr_ps((float)(lane / channels), (float)((lane + 1) / channels), (float)((lane + 2) / channels), (float)((lane + 3) / channels));
+}
+
+TARGET_SSE2 static __m128 gain_sse2(MixGain gain, __m128 frames) {
+    return _mm_add_ps(_mm_set1_ps(gain.start), _mm_mul_ps(_mm_set1_ps(gain.step), frames));
+}
+
+TARGET_SSE2 static void mix_s16_sse2(Sint16 *out, const Sint16 *a, const Sint16 *b, int frames, int channels, MixGain gain_a, MixGain gain_b) {
+    int count = frames * channels;
+    int i = 0;
+    if (4 % channels == 0) {
+        __m128 lanes_low = lane_frames_sse2(channels, 0);
+        __m128 lanes_high = lane_frames_sse2(channels, 4);
+        for (; i + 8 <= count; i += 8) {
+            __m128 frame = _mm_set1_ps((float)(i / channels));
+            __m128 frames_low = _mm_add_ps(frame, lanes_low);
+            __m128 frames_high = _mm_add_ps(frame, lanes_high);
+
+            // Sign-extend eight samples of each stream to two vectors of four floats
+            __m128i raw_a = _mm_loadu_si128((const __m128i *)(a + i));
+            __m128i raw_b = _mm_loadu_si128((const __m128i *)(b + i));
+            __m128 a_low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(raw_a, raw_a), 16));
+            __m128 a_high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(raw_a, raw_a), 16));
+            __m128 b_low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(raw_b, raw_b), 16));
+            __m128 b_high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(raw_b, raw_b), 16));
+
+            __m128 low = _mm_add_ps(_mm_mul_ps(a_low, gain_sse2(gain_a, frames_low)), _mm_mul_ps(b_low, gain_sse2(gain_b, frames_low)));
+            __m128 high = _mm_add_ps(_mm_mul_ps(a_high, gain_sse2(gain_a, frames_high)), _mm_mul_ps(b_high, gain_sse2(gain_b, frames_high)));
+            _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(_mm_cvtps_epi32(low), _mm_cvtps_epi32(high)));
+        }
+    }
+    mix_s16_samples(out, a, b, i, count, channels, gain_a, gain_b);
+}
+
+TARGET_SSE2 static void mix_f32_sse2(float *out, const float *a, const float *b, int frames, int channels, MixGain gain_a, MixGain gain_b) {
+    int count = frames * channels;
+    int i = 0;
+    if (4 % channels == 0) {
+        __m128 lanes = lane_frames_sse2(channels, 0);
+        for (; i + 4 <= count; i += 4) {
+            __m128 frame = _mm_add_ps(_mm_set1_ps((float)(i / channels)), lanes);
+            __m128 mixed = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(a + i), gain_sse2(gain_a, frame)), _mm_mul_ps(_mm_loadu_ps(b + i), gain_sse2(gain_b, frame)));
+            _mm_storeu_ps(out + i, mixed);
+        }
+    }
+    mix_f32_samples(out, a, b, i, count, channels, gain_a, gain_b);
+}
+
+TARGET_AVX2 static __m256 lane_frames_avx2(int channels) {
+    return _mm256_setr_ps((float)(0 / channels), (float)(1 / channels), (float)(2 / channels), (float)(3 / channels),
+                          (float)(4 / channels), (float)(5 / channels), (float)(6 / channels), (float)(7 / channels));
+}
+
+TARGET_AVX2 static __m256 gain_avx2(MixGain gain, __m256 frames) {
+    return _mm256_add_ps(_mm256_set1_ps(gain.start), _mm256_mul_ps(_mm256_set1_ps(gain.step), frames));
+}
+
+TARGET_AVX2 static void mix_s16_avx2(Sint16 *out, const Sint16 *a, const Sint16 *b, int frames, int channels, MixGain gain_a, MixGain gain_b) {
+    int count = frames * channels;
+    int i = 0;
+    if (8 % channels == 0) {
+        __m256 lanes = lane_frames_avx2(channels);
+        for (; i + 8 <= count; i += 8) {
+            __m256 frame = _mm256_add_ps(_mm256_set1_ps((float)(i / channels)), lanes);
+            __m256 sample_a = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(a + i))));
+            __m256 sample_b = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(b + i))));
+            __m256i mixed = _mm256_cvtps_epi32(_mm256_add_ps(_mm256_mul_ps(sample_a, gain_avx2(gain_a, frame)), _mm256_mul_ps(sample_b, gain_avx2(gain_b, frame))));
+            _mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(_mm256_castsi256_si128(mixed), _mm256_extracti128_si256(mixed, 1)));
+        }
+    }
+    mix_s16_samples(out, a, b, i, count, channels, gain_a, gain_b);
+}
+
+TARGET_AVX2 static void mix_f32_avx2(float *out, const float *a, const float *b, int frames, int channels, MixGain gain_a, MixGain gain_b) {
+    int count = frames * channels;
+    int i = 0;
+    if (8 % channels == 0) {
+        __m256 lanes = lane_frames_avx2(channels);
+        for (; i + 8 <= count; i += 8) {
+            __m256 frame = _mm256_add_ps(_mm256_set1_ps((float)(i / channels)), lanes);
+            __m256 mixed = _mm256_add_ps(_mm256_mul_ps(_mm256_loadu_ps(a + i), gain_avx2(gain_a, frame)), _mm256_mul_ps(_mm256_loadu_ps(b + i), gain_avx2(gain_b, frame)));
+            _mm256_storeu_ps(out + i, mixed);
+        }
+    }
+    mix_f32_samples(out, a, b, i, count, channels, gain_a, gain_b);
+}
+#endif
+
+static const MixKernels KERNELS[] = {
+    {mix_s16_scalar, mix_f32_scalar},
+#ifdef MIX_X86
+    {mix_s16_sse2, mix_f32_sse2},
+    {mix_s16_avx2, mix_f32_avx2},
+#endif
+};
+
+// False when the kernel was not compiled in or the CPU lacks it.
+bool mix_kernel_supported(MixKernel kernel) {
+    return (size_t)kernel < sizeof(KERNELS) / sizeof(KERNELS[0]) &&
+           (kernel != MIX_SSE2 || SDL_HasSSE2()) &&
+           (kernel != MIX_AVX2 || SDL_HasAVX2());
+}
+
+MixKernel mix_best_kernel(void) {
+    if (mix_kernel_supported(MIX_AVX2)) {
+        return MIX_AVX2;
+    }
+    return mix_kernel_supported(MIX_SSE2) ? MIX_SSE2 : MIX_SCALAR;
+}
+
+const char *mix_kernel_name(MixKernel kernel) {
+    switch (kernel) {
+        case MIX_SSE2:
+            return "SSE2";
+        case MIX_AVX2:
+            return "AVX2";
+        default:
+            return "scalar";
+    }
+}
+
+// Gains for frames `position` to `position + frames` of an equal-power fade
+// `length` frames long: the outgoing stream follows a quarter cosine and the
+// incoming one a quarter sine, so their power sums to one throughout. Both
+// are interpolated linearly across the block; over MIX_BLOCK_FRAMES that is
+// within 0.1% of the curve for fades of half a second or longer.
+void mix_equal_power(Uint32 position, Uint32 length, Uint32 frames, MixGain *fade_out, MixGain *fade_in) {
+    double first = M_PI / 2.0 * position / length;
+    double last = M_PI / 2.0 * (position + frames) / length;
+    fade_out->start = (float)cos(first);
+    fade_out->step = (float)((cos(last) - cos(first)) / frames);
+    fade_in->start = (float)sin(first);
+    fade_in->step = (float)((sin(last) - sin(first)) / frames);
+}
+
+void mix_s16(MixKernel kernel, Sint16 *out, const Sint16 *a, const Sint16 *b, int frames, int channels, MixGain gain_a, MixGain gain_b) {
+    KERNELS[kernel].s16(out, a, b, frames, channels, gain_a, gain_b);
+}
+
+void mix_f32(MixKernel kernel, float *out, const float *a, const float *b, int frames, int channels, MixGain gain_a, MixGain gain_b) {
+    KERNELS[kernel].f32(out, a, b, frames, channels, gain_a, gain_b);
+}
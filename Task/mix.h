@@ -0,0 +1,32 @@
+#ifndef MIX_H
+#define MIX_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#define MIX_BLOCK_FRAMES 1024
+
+typedef enum mix_kernel {
+    MIX_SCALAR,
+    MIX_SSE2,
+    MIX_AVX2
+} MixKernel;
+
+// A gain that changes linearly across a block: frame i is scaled by
+// start + i * step.
+typedef struct mix_gain {
+    float start;
+    float step;
+} MixGain;
+
+// Mixing kernels for crossfades: out = a * gain_a + b * gain_b, sample by
+// sample over `frames` interleaved frames. The int16 version rounds and
+// saturates. `out` may alias `a` or `b`.
+bool mix_kernel_supported(MixKernel kernel);
+MixKernel mix_best_kernel(void);
+const char *mix_kernel_name(MixKernel kernel);
+void mix_equal_power(Uint32 position, Uint32 length, Uint32 frames, MixGain *fade_out, MixGain *fade_in);
+void mix_s16(MixKernel kernel, Sint16 *out, const Sint16 *a, const Sint16 *b, int frames, int channels, MixGain gain_a, MixGain gain_b);
+void mix_f32(MixKernel kernel, float *out, const float *a, const float *b, int frames, int channels, MixGain gain_a, MixGain gain_b);
+
+#endif
@@ -0,0 +1,150 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "music_cache.h"
+
+void music_cache_init(MusicCache *cache, int max_handles, size_t max_bytes) {
+    memset(cache, 0, sizeof(*cache));
+    cache->max_handles = max_handles;
+    cache->max_bytes = max_bytes;
+}
+
+static void unlink_handle(MusicCache *cache, MusicHandle *handle) {
+    if (handle->prev) {
+        handle->prev->next = handle->next;
+    } else {
+        cache->head = handle->next;
+    }
+    if (handle->next) {
+        handle->next->prev = handle->prev;
+    } else {
+        cache->tail = handle->prev;
+    }
+    handle->prev = NULL;
+    handle->next = NULL;
+}
+
+static void push_front(MusicCache *cache, MusicHandle *handle) {
+    handle->prev = NULL;
+    handle->next = cache->head;
+    if (cache->head) {
+        cache->head->prev = handle;
+    }
+    cache->head = handle;
+    if (!cache->tail) {
+        cache->tail = handle;
+    }
+}
+
+static void free_handle(MusicCache *cache, MusicHandle *handle) {
+    unlink_handle(cache, handle);
+    cache->count--;
+    cache->bytes -= handle->bytes;
+    Mix_FreeChunk(handle->chunk);
+    free(handle->location);
+    free(handle);
+}
+
+static bool over_budget(const MusicCache *cache) {
+    return (cache->max_handles > 0 && cache->count > cache->max_handles) ||
+           (cache->max_bytes > 0 && cache->bytes > cache->max_bytes);
+}
+
+// Evict unused handles from the cold end until the cache fits its budget.
+// Handles that are still referenced are skipped, so the cache can run over
+// budget while everything in it is in use.
+static void trim(MusicCache *cache) {
+    MusicHandle *handle = cache->tail;
+    while (handle && over_budget(cache)) {
+        MusicHandle *prev = handle->prev;
+        if (handle->refs == 0) {
+            printf("Evicting music: %s\n", handle->location);
+            free_handle(cache, handle);
+            cache->evictions++;
+        }
+        handle = prev;
+    }
+}
+
+// Returns the cached handle for `location` with a new reference, or NULL on
+// a miss.
+MusicHandle *music_cache_lookup(MusicCache *cache, const char *location) {
+    for (MusicHandle *handle = cache->head; handle; handle = handle->next) {
+        if (!handle->stale && strcmp(handle->location, location) == 0) {
+            unlink_handle(cache, handle);
+            push_front(cache, handle);
+            handle->refs++;
+            cache->hits++;
+            return handle;
+        }
+    }
+    cache->misses++;
+    return NULL;
+}
+
+// Takes ownership of a freshly decoded `chunk` and returns its handle with
+// one reference.
+MusicHandle *music_cache_insert(MusicCache *cache, const char *location, Mix_Chunk *chunk) {
+    MusicHandle *handle = calloc(1, sizeof(MusicHandle));
+    char *location_copy = malloc(strlen(location) + 1);
+    if (!handle || !location_copy) {
+        printf("Memory allocation failed for music cache\n");
+        Mix_FreeChunk(chunk);
+        free(handle);
+        free(location_copy);
+        return NULL;
+    }
+    strcpy(location_copy, location);
+
+    handle->bytes = chunk->alen;
+    handle->location = location_copy;
+    handle->chunk = chunk;
+    handle->refs = 1;
+    push_front(cache, handle);
+    cache->count++;
+    cache->bytes += handle->bytes;
+
+    trim(cache);
+    return handle;
+}
+
+void music_cache_release(MusicCache *cache, MusicHandle *handle) {
+    if (!handle) {
+        return;
+    }
+    if (handle->refs > 0) {
+        handle->refs--;
+    }
+    if (handle->stale && handle->refs == 0) {
+        free_handle(cache, handle);
+        cache->evictions++;
+    }
+    trim(cache);
+}
+
+// Drops the handle for `location` because its file changed. One still in
+// use is marked stale instead, so playback of it carries on. Returns true
+// if there was a handle.
+bool music_cache_evict(MusicCache *cache, const char *location) {
+    for (MusicHandle *handle = cache->head; handle; handle = handle->next) {
+        if (handle->stale || strcmp(handle->location, location) != 0) {
+            continue;
+        }
+        printf("Evicting changed music: %s\n", location);
+        if (handle->refs > 0) {
+            handle->stale = true;
+        } else {
+            free_handle(cache, handle);
+            cache->evictions++;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Frees every handle. Music must be halted first.
+void music_cache_clear(MusicCache *cache) {
+    while (cache->head) {
+        free_handle(cache, cache->head);
+    }
+}
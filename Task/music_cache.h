@@ -0,0 +1,45 @@
+#ifndef MUSIC_CACHE_H
+#define MUSIC_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <SDL2/SDL_mixer.h>
+
+// One fully decoded track, in the mixer's output format, owned by the cache.
+// `refs` counts the users (e.g. the playing track); a handle is only freed
+// once it has no users and has fallen out of the cache budget. A `stale`
+// handle, whose file has changed, is never looked up again and is freed as
+// soon as its last user lets go.
+typedef struct music_handle {
+    char *location;
+    Mix_Chunk *chunk;
+    size_t bytes;
+    int refs;
+    bool stale;
+    struct music_handle *prev;
+    struct music_handle *next;
+} MusicHandle;
+
+// LRU list of handles, most recently used at `head`. Either budget may be 0
+// to disable it. The cache does no locking and never decodes; callers that
+// share it across threads lock around it and decode outside the lock.
+typedef struct music_cache {
+    MusicHandle *head;
+    MusicHandle *tail;
+    int count;
+    size_t bytes;
+    int max_handles;
+    size_t max_bytes;
+    int hits;
+    int misses;
+    int evictions;
+} MusicCache;
+
+void music_cache_init(MusicCache *cache, int max_handles, size_t max_bytes);
+MusicHandle *music_cache_lookup(MusicCache *cache, const char *location);
+MusicHandle *music_cache_insert(MusicCache *cache, const char *location, Mix_Chunk *chunk);
+void music_cache_release(MusicCache *cache, MusicHandle *handle);
+bool music_cache_evict(MusicCache *cache, const char *location);
+void music_cache_clear(MusicCache *cache);
+
+#endif
@@ -0,0 +1,188 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "play_queue.h"
+
+bool play_queue_init(PlayQueue *queue, AudioEngine *engine, int prefetch_depth) {
+    memset(queue, 0, sizeof(*queue));
+    queue->position = -1;
+    queue->engine = engine;
+    queue->prefetch_depth = prefetch_depth < 0 ? 0 : prefetch_depth > MAX_PREFETCH_DEPTH ? MAX_PREFETCH_DEPTH : prefetch_depth;
+    return true;
+}
+
+// Collects the locations of `first` and up to `limit` - 1 following queue
+// entries into `buffers`, skipping entries whose track has been removed.
+static int window(const PlayQueue *queue, const Library *library, int first, int limit, char buffers[][MAX_PATH_LENGTH], const char **locations, int *positions) {
+    int n = 0;
+    for (int position = first; position < queue->count && n < limit; position++) {
+        QueueEntry entry = queue->entries[position];
+        if (entry.album < 0) {
+            continue;
+        }
+        library_track_location(library, entry.album, entry.track, buffers[n], MAX_PATH_LENGTH);
+        locations[n] = buffers[n];
+        positions[n] = position;
+        n++;
+    }
+    return n;
+}
+
+// Tells the engine which tracks follow the current one.
+static void prefetch(PlayQueue *queue, const Library *library) {
+    char buffers[MAX_PREFETCH_DEPTH][MAX_PATH_LENGTH];
+    const char *locations[MAX_PREFETCH_DEPTH];
+    int positions[MAX_PREFETCH_DEPTH];
+    int n = window(queue, library, queue->position + 1, queue->prefetch_depth, buffers, locations, positions);
+    audio_engine_set_upcoming(queue->engine, locations, positions, n);
+}
+
+static bool start_position(PlayQueue *queue, const Library *library, int position, Uint32 start_ms) {
+    while (position >= 0 && position < queue->count && queue->entries[position].album < 0) {
+        position++;
+    }
+    if (position < 0 || position >= queue->count) {
+        play_queue_stop(queue);
+        return false;
+    }
+    queue->position = position;
+
+    char buffers[1 + MAX_PREFETCH_DEPTH][MAX_PATH_LENGTH];
+    const char *locations[1 + MAX_PREFETCH_DEPTH];
+    int positions[1 + MAX_PREFETCH_DEPTH];
+    int n = window(queue, library, position, 1 + queue->prefetch_depth, buffers, locations, positions);
+    queue->generation = audio_engine_play(queue->engine, locations, positions, n, start_ms);
+    return true;
+}
+
+static bool grow(PlayQueue *queue, int needed) {
+    if (needed <= queue->capacity) {
+        return true;
+    }
+    int capacity = queue->capacity ? queue->capacity * 2 : 16;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    QueueEntry *entries = realloc(queue->entries, capacity * sizeof(QueueEntry));
+    if (!entries) {
+        printf("Memory allocation failed for play queue\n");
+        return false;
+    }
+    queue->entries = entries;
+    queue->capacity = capacity;
+    return true;
+}
+
+// Replaces the queue with `album` from `first_track` onwards and starts it.
+bool play_queue_play_album(PlayQueue *queue, const Library *library, int album, int first_track) {
+    return play_queue_resume(queue, library, album, first_track, 0);
+}
+
+// Like play_queue_play_album(), starting `start_ms` into the first track.
+bool play_queue_resume(PlayQueue *queue, const Library *library, int album, int first_track, Uint32 start_ms) {
+    const Album *source = &library->albums[album];
+    if (first_track < 0 || first_track >= source->number_of_tracks || !grow(queue, source->number_of_tracks - first_track)) {
+        return false;
+    }
+    queue->count = 0;
+    for (int t = first_track; t < source->number_of_tracks; t++) {
+        queue->entries[queue->count].album = album;
+        queue->entries[queue->count].track = t;
+        queue->count++;
+    }
+    return start_position(queue, library, 0, start_ms);
+}
+
+// Adds a track to the end of the queue. Starts it if nothing is playing.
+bool play_queue_append(PlayQueue *queue, const Library *library, int album, int track) {
+    if (!grow(queue, queue->count + 1)) {
+        return false;
+    }
+    queue->entries[queue->count].album = album;
+    queue->entries[queue->count].track = track;
+    queue->count++;
+    printf("Queued track %d of album %d\n", track + 1, album + 1);
+
+    if (queue->position < 0) {
+        // Nothing playing: drop what already played and start the new track
+        queue->entries[0] = queue->entries[queue->count - 1];
+        queue->count = 1;
+        return start_position(queue, library, 0, 0);
+    }
+    prefetch(queue, library);
+    return true;
+}
+
+bool play_queue_advance(PlayQueue *queue, const Library *library) {
+    return start_position(queue, library, queue->position + 1, 0);
+}
+
+// Follows the engine: a started event means it moved on to the next queued
+// track by itself; running out of tracks means nothing was prefetched (or
+// the track failed to load), so start the next one directly.
+void play_queue_handle_event(PlayQueue *queue, const Library *library, const SDL_Event *event) {
+    if ((int)(intptr_t)event->user.data1 != queue->generation || queue->position < 0) {
+        return;
+    }
+    if (event->user.code == ENGINE_TRACK_STARTED) {
+        int position = (int)(intptr_t)event->user.data2;
+        if (position != queue->position && position < queue->count) {
+            queue->position = position;
+            prefetch(queue, library);
+        }
+    } else if (event->user.code == ENGINE_OUT_OF_TRACKS) {
+        play_queue_advance(queue, library);
+    }
+}
+
+bool play_queue_current(const PlayQueue *queue, int *album, int *track) {
+    if (queue->position < 0 || queue->entries[queue->position].album < 0) {
+        return false;
+    }
+    *album = queue->entries[queue->position].album;
+    *track = queue->entries[queue->position].track;
+    return true;
+}
+
+// Points the entries at the same tracks in a reloaded library, given each
+// old album's new index (-1 if removed). Entries whose track is gone are
+// kept as gaps so positions, which the engine echoes back, stay valid; the
+// track playing carries on even if it was removed.
+void play_queue_remap(PlayQueue *queue, const Library *old_library, const Library *new_library, const int *album_map) {
+    for (int i = 0; i < queue->count; i++) {
+        QueueEntry *entry = &queue->entries[i];
+        if (entry->album < 0) {
+            continue;
+        }
+        char location[MAX_PATH_LENGTH];
+        library_track_location(old_library, entry->album, entry->track, location, sizeof(location));
+        int album = album_map[entry->album];
+        entry->album = -1;
+        entry->track = -1;
+        for (int t = 0; album >= 0 && t < new_library->albums[album].number_of_tracks; t++) {
+            char candidate[MAX_PATH_LENGTH];
+            library_track_location(new_library, album, t, candidate, sizeof(candidate));
+            if (strcmp(candidate, location) == 0) {
+                entry->album = album;
+                entry->track = t;
+                break;
+            }
+        }
+    }
+    if (queue->position >= 0) {
+        prefetch(queue, new_library);
+    }
+}
+
+void play_queue_stop(PlayQueue *queue) {
+    audio_engine_stop(queue->engine);
+    queue->position = -1;
+}
+
+void play_queue_free(PlayQueue *queue) {
+    play_queue_stop(queue);
+    free(queue->entries);
+    queue->entries = NULL;
+    queue->count = 0;
+    queue->capacity = 0;
+}
@@ -0,0 +1,44 @@
+#ifndef PLAY_QUEUE_H
+#define PLAY_QUEUE_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "library.h"
+#include "audio_engine.h"
+
+#define MAX_PREFETCH_DEPTH ENGINE_MAX_UPCOMING
+
+// `album` and `track` are -1 once the track has left the library.
+typedef struct queue_entry {
+    int album;
+    int track;
+} QueueEntry;
+
+// Tracks to play in order. Clicking a track queues the rest of its album;
+// more tracks can be appended as a playlist. The next `prefetch_depth`
+// tracks are handed to the audio engine, which decodes them ahead and plays
+// them back to back; its events move `position` along. `generation`
+// identifies the engine queue we last started, so events from an older one
+// are ignored.
+typedef struct play_queue {
+    QueueEntry *entries;
+    int count;
+    int capacity;
+    int position;
+    AudioEngine *engine;
+    int prefetch_depth;
+    int generation;
+} PlayQueue;
+
+bool play_queue_init(PlayQueue *queue, AudioEngine *engine, int prefetch_depth);
+bool play_queue_play_album(PlayQueue *queue, const Library *library, int album, int first_track);
+bool play_queue_resume(PlayQueue *queue, const Library *library, int album, int first_track, Uint32 start_ms);
+bool play_queue_append(PlayQueue *queue, const Library *library, int album, int track);
+bool play_queue_advance(PlayQueue *queue, const Library *library);
+void play_queue_handle_event(PlayQueue *queue, const Library *library, const SDL_Event *event);
+bool play_queue_current(const PlayQueue *queue, int *album, int *track);
+void play_queue_remap(PlayQueue *queue, const Library *old_library, const Library *new_library, const int *album_map);
+void play_queue_stop(PlayQueue *queue);
+void play_queue_free(PlayQueue *queue);
+
+#endif
@@ -0,0 +1,232 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resampler.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define RESAMPLER_X86
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#define RESAMPLER_X86
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// Taps per phase when not downsampling, and stopband attenuation in dB. The
+// cutoff is set so the transition band ends at the Nyquist frequency, which
+// leaves a passband of about 12, 17 and 19 kHz at 44.1 kHz.
+typedef struct resample_tier {
+    int taps;
+    double attenuation;
+} ResampleTier;
+
+static const ResampleTier TIERS[] = {
+    {16, 60.0},
+    {48, 90.0},
+    {128, 120.0},
+};
+
+// Dot product of `taps` floats, a multiple of eight.
+typedef float (*DotKernel)(const float *x, const float *h, int taps);
+
+static float dot_scalar(const float *x, const float *h, int taps) {
+    float sum = 0.0f;
+    for (int i = 0; i < taps; i++) {
+        sum += x[i] * h[i];
+    }
+    return sum;
+}
+
+#ifdef RESAMPLER_X86
+TARGET_SSE2 static float dot_sse2(const float *x, const float *h, int taps) {
+    __m128 low = _mm_setzero_ps();
+    __m128 high = _mm_setzero_ps();
+    for (int i = 0; i < taps; i += 8) {
+        low = _mm_add_ps(low, _mm_mul_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(h + i)));
+        high = _mm_add_ps(high, _mm_mul_ps(_mm_loadu_ps(x + i + 4), _mm_loadu_ps(h + i + 4)));
+    }
+    float sums[4];
+    _mm_storeu_ps(sums, _mm_add_ps(low, high));
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+TARGET_AVX2 static float dot_avx2(const float *x, const float *h, int taps) {
+    __m256 sum = _mm256_setzero_ps();
+    for (int i = 0; i < taps; i += 8) {
+        sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(h + i)));
+    }
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+    float sums[4];
+    _mm_storeu_ps(sums, half);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+#endif
+
+static const DotKernel KERNELS[] = {
+    dot_scalar,
+#ifdef RESAMPLER_X86
+    dot_sse2,
+    dot_avx2,
+#endif
+};
+
+const char *resample_quality_name(ResampleQuality quality) {
+    switch (quality) {
+        case RESAMPLE_LOW:
+            return "low";
+        case RESAMPLE_HIGH:
+            return "high";
+        default:
+            return "medium";
+    }
+}
+
+// Fails when the kernel was not compiled in or the CPU lacks it.
+bool resampler_set_kernel(Resampler *resampler, MixKernel kernel) {
+    if ((size_t)kernel >= sizeof(KERNELS) / sizeof(KERNELS[0]) || !mix_kernel_supported(kernel)) {
+        return false;
+    }
+    resampler->kernel = kernel;
+    return true;
+}
+
+static Uint32 gcd(Uint32 a, Uint32 b) {
+    while (b) {
+        Uint32 t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+static double bessel_i0(double x) {
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50 && term > sum * 1e-12; k++) {
+        term *= (x / (2.0 * k)) * (x / (2.0 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// Fails when the rates are not positive or their ratio needs more than
+// RESAMPLE_MAX_PHASES filter phases.
+bool resampler_init(Resampler *resampler, int input_rate, int output_rate, int channels, ResampleQuality quality) {
+    memset(resampler, 0, sizeof(*resampler));
+    if (input_rate <= 0 || output_rate <= 0 || channels <= 0) {
+        return false;
+    }
+    Uint32 divisor = gcd((Uint32)input_rate, (Uint32)output_rate);
+    Uint32 up = (Uint32)output_rate / divisor;
+    Uint32 down = (Uint32)input_rate / divisor;
+    if (up > RESAMPLE_MAX_PHASES) {
+        printf("Resampler: %d to %d Hz needs %u filter phases\n", input_rate, output_rate, up);
+        return false;
+    }
+
+    // Downsampling narrows the passband, so the filter is stretched by the
+    // same factor to keep its transition band in proportion
+    ResampleTier tier = TIERS[quality];
+    double scale = up < down ? (double)up / down : 1.0;
+    int taps = (int)ceil(tier.taps / scale / 8.0) * 8;
+    double transition = (tier.attenuation - 8.0) / (2.285 * M_PI * tier.taps);
+    double cutoff = scale * (1.0 - transition / 2.0);
+    double beta = 0.1102 * (tier.attenuation - 8.7);
+
+    resampler->filter = malloc((size_t)up * taps * sizeof(float));
+    if (!resampler->filter) {
+        printf("Memory allocation failed for resampler\n");
+        return false;
+    }
+    double half = taps / 2.0;
+    double window_scale = 1.0 / bessel_i0(beta);
+    for (Uint32 phase = 0; phase < up; phase++) {
+        float *coefficients = resampler->filter + (size_t)phase * taps;
+        double offset = (double)phase / up;
+        double sum = 0.0;
+        for (int k = 0; k < taps; k++) {
+            double x = k - (taps / 2 - 1) - offset;
+            double u = x / half;
+            double window = u > -1.0 && u < 1.0 ? bessel_i0(beta * sqrt(1.0 - u * u)) * window_scale : 0.0;
+            double sinc = x == 0.0 ? 1.0 : sin(M_PI * cutoff * x) / (M_PI * cutoff * x);
+            coefficients[k] = (float)(cutoff * sinc * window);
+            sum += coefficients[k];
+        }
+        // Unity gain at DC for every phase
+        for (int k = 0; k < taps; k++) {
+            coefficients[k] = (float)(coefficients[k] / sum);
+        }
+    }
+
+    resampler->input_rate = input_rate;
+    resampler->output_rate = output_rate;
+    resampler->channels = channels;
+    resampler->up = up;
+    resampler->down = down;
+    resampler->taps = taps;
+    resampler->kernel = MIX_SCALAR;
+    if (!resampler_set_kernel(resampler, MIX_AVX2)) {
+        resampler_set_kernel(resampler, MIX_SSE2);
+    }
+    return true;
+}
+
+Uint32 resampler_output_frames(const Resampler *resampler, Uint32 input_frames) {
+    return (Uint32)((Uint64)input_frames * resampler->up / resampler->down);
+}
+
+// Converts interleaved `input` into `output_frames` frames of `output`
+// (resampler_output_frames() covers the whole input). Works through
+// RESAMPLE_BLOCK_FRAMES output frames at a time, deinterleaving the input
+// they read into one float row per channel so the filter runs over
+// contiguous samples.
+bool resampler_process(const Resampler *resampler, const Sint16 *input, Uint32 input_frames, Sint16 *output, Uint32 output_frames) {
+    int channels = resampler->channels;
+    int taps = resampler->taps;
+    int before = taps / 2 - 1;
+    size_t stride = (size_t)((Uint64)RESAMPLE_BLOCK_FRAMES * resampler->down / resampler->up) + taps + 2;
+    float *rows = malloc(stride * channels * sizeof(float));
+    if (!rows) {
+        printf("Memory allocation failed for resampler\n");
+        return false;
+    }
+    DotKernel dot = KERNELS[resampler->kernel];
+
+    for (Uint32 first = 0; first < output_frames; first += RESAMPLE_BLOCK_FRAMES) {
+        Uint32 count = output_frames - first < RESAMPLE_BLOCK_FRAMES ? output_frames - first : RESAMPLE_BLOCK_FRAMES;
+        Sint64 start = (Sint64)((Uint64)first * resampler->down / resampler->up) - before;
+        Sint64 end = (Sint64)((Uint64)(first + count - 1) * resampler->down / resampler->up) - before + taps;
+        for (Sint64 i = start; i < end; i++) {
+            bool inside = i >= 0 && i < (Sint64)input_frames;
+            for (int c = 0; c < channels; c++) {
+                rows[c * stride + (size_t)(i - start)] = inside ? (float)input[(size_t)i * channels + c] : 0.0f;
+            }
+        }
+
+        for (Uint32 n = first; n < first + count; n++) {
+            Uint64 position = (Uint64)n * resampler->down;
+            const float *coefficients = resampler->filter + (size_t)(position % resampler->up) * taps;
+            size_t offset = (size_t)((Sint64)(position / resampler->up) - before - start);
+            for (int c = 0; c < channels; c++) {
+                float sample = dot(rows + c * stride + offset, coefficients, taps);
+                sample = sample > 32767.0f ? 32767.0f : sample < -32768.0f ? -32768.0f : sample;
+                output[(size_t)n * channels + c] = (Sint16)lrintf(sample);
+            }
+        }
+    }
+    free(rows);
+    return true;
+}
+
+void resampler_free(Resampler *resampler) {
+    free(resampler->filter);
+    resampler->filter = NULL;
+}
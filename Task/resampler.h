@@ -0,0 +1,43 @@
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "mix.h"
+
+#define RESAMPLE_MAX_PHASES 4096
+#define RESAMPLE_BLOCK_FRAMES 4096
+
+typedef enum resample_quality {
+    RESAMPLE_LOW,
+    RESAMPLE_MEDIUM,
+    RESAMPLE_HIGH
+} ResampleQuality;
+
+// Polyphase windowed-sinc converter from `input_rate` to `output_rate`. The
+// ratio is reduced to `up` / `down`, and output frame n is read from input
+// position n * down / up with the filter phase for its fractional part, so
+// every phase is exact. Each phase has `taps` Kaiser-windowed sinc
+// coefficients, more for higher quality and for downsampling, where the
+// cutoff drops below the input's Nyquist frequency.
+//
+// Fixed after resampler_init(), so one resampler can be shared by threads.
+typedef struct resampler {
+    int input_rate;
+    int output_rate;
+    int channels;
+    Uint32 up;
+    Uint32 down;
+    int taps;
+    float *filter;
+    MixKernel kernel;
+} Resampler;
+
+bool resampler_init(Resampler *resampler, int input_rate, int output_rate, int channels, ResampleQuality quality);
+bool resampler_set_kernel(Resampler *resampler, MixKernel kernel);
+const char *resample_quality_name(ResampleQuality quality);
+Uint32 resampler_output_frames(const Resampler *resampler, Uint32 input_frames);
+bool resampler_process(const Resampler *resampler, const Sint16 *input, Uint32 input_frames, Sint16 *output, Uint32 output_frames);
+void resampler_free(Resampler *resampler);
+
+#endif
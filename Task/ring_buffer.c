@@ -0,0 +1,109 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ring_buffer.h"
+
+// Rounds `frames` up to a power of two.
+bool ring_buffer_init(RingBuffer *ring, Uint32 frames, int channels) {
+    memset(ring, 0, sizeof(*ring));
+    Uint32 capacity = 1;
+    while (capacity < frames) {
+        capacity <<= 1;
+    }
+    ring->samples = calloc((size_t)capacity * channels, sizeof(Sint16));
+    if (!ring->samples) {
+        printf("Memory allocation failed for ring buffer\n");
+        return false;
+    }
+    ring->capacity = capacity;
+    ring->mask = capacity - 1;
+    ring->channels = channels;
+    return true;
+}
+
+Uint32 ring_buffer_readable(RingBuffer *ring) {
+    return (Uint32)SDL_AtomicGet(&ring->write_index) - (Uint32)SDL_AtomicGet(&ring->read_index);
+}
+
+Uint32 ring_buffer_writable(RingBuffer *ring) {
+    return ring->capacity - ring_buffer_readable(ring);
+}
+
+// Producer side. Copies as many of `count` frames as fit and returns how many
+// were written.
+Uint32 ring_buffer_write(RingBuffer *ring, const Sint16 *frames, Uint32 count) {
+    Uint32 write = (Uint32)SDL_AtomicGet(&ring->write_index);
+    Uint32 read = (Uint32)SDL_AtomicGet(&ring->read_index);
+    Uint32 space = ring->capacity - (write - read);
+    if (count > space) {
+        count = space;
+    }
+
+    Uint32 start = write & ring->mask;
+    Uint32 first = ring->capacity - start < count ? ring->capacity - start : count;
+    memcpy(ring->samples + (size_t)start * ring->channels, frames, (size_t)first * ring->channels * sizeof(Sint16));
+    memcpy(ring->samples, frames + (size_t)first * ring->channels, (size_t)(count - first) * ring->channels * sizeof(Sint16));
+
+    // SDL_AtomicSet is a full barrier, so the samples are visible before the
+    // new index is
+    SDL_AtomicSet(&ring->write_index, (int)(write + count));
+    return count;
+}
+
+static void copy_scaled(Sint16 *out, const Sint16 *in, size_t count, int gain, int shift) {
+    for (size_t i = 0; i < count; i++) {
+        out[i] = (Sint16)((in[i] * gain) >> shift);
+    }
+}
+
+// Producer side. Like ring_buffer_write(), but multiplies each sample by the
+// fixed-point `gain` (one is 1 << shift) on the way in. The caller keeps the
+// gain low enough that no sample overflows.
+Uint32 ring_buffer_write_scaled(RingBuffer *ring, const Sint16 *frames, Uint32 count, int gain, int shift) {
+    Uint32 write = (Uint32)SDL_AtomicGet(&ring->write_index);
+    Uint32 read = (Uint32)SDL_AtomicGet(&ring->read_index);
+    Uint32 space = ring->capacity - (write - read);
+    if (count > space) {
+        count = space;
+    }
+
+    Uint32 start = write & ring->mask;
+    Uint32 first = ring->capacity - start < count ? ring->capacity - start : count;
+    copy_scaled(ring->samples + (size_t)start * ring->channels, frames, (size_t)first * ring->channels, gain, shift);
+    copy_scaled(ring->samples, frames + (size_t)first * ring->channels, (size_t)(count - first) * ring->channels, gain, shift);
+
+    SDL_AtomicSet(&ring->write_index, (int)(write + count));
+    return count;
+}
+
+// Consumer side. Copies up to `count` frames out and returns how many were
+// available.
+Uint32 ring_buffer_read(RingBuffer *ring, Sint16 *frames, Uint32 count) {
+    Uint32 read = (Uint32)SDL_AtomicGet(&ring->read_index);
+    Uint32 write = (Uint32)SDL_AtomicGet(&ring->write_index);
+    if (count > write - read) {
+        count = write - read;
+    }
+
+    Uint32 start = read & ring->mask;
+    Uint32 first = ring->capacity - start < count ? ring->capacity - start : count;
+    memcpy(frames, ring->samples + (size_t)start * ring->channels, (size_t)first * ring->channels * sizeof(Sint16));
+    memcpy(frames + (size_t)first * ring->channels, ring->samples, (size_t)(count - first) * ring->channels * sizeof(Sint16));
+
+    SDL_AtomicSet(&ring->read_index, (int)(read + count));
+    return count;
+}
+
+// Consumer side. Discards frames up to `index` (a write index the producer
+// published earlier); never moves backwards.
+void ring_buffer_skip_to(RingBuffer *ring, Uint32 index) {
+    Uint32 read = (Uint32)SDL_AtomicGet(&ring->read_index);
+    if ((Sint32)(index - read) > 0) {
+        SDL_AtomicSet(&ring->read_index, (int)index);
+    }
+}
+
+void ring_buffer_free(RingBuffer *ring) {
+    free(ring->samples);
+    ring->samples = NULL;
+}
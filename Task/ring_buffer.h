@@ -0,0 +1,29 @@
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+// Lock-free single-producer/single-consumer ring of interleaved Sint16
+// frames. The indices run freely and are masked on access, so the capacity
+// must be a power of two. Only the producer moves `write_index` and only the
+// consumer moves `read_index`.
+typedef struct ring_buffer {
+    Sint16 *samples;
+    Uint32 capacity;
+    Uint32 mask;
+    int channels;
+    SDL_atomic_t write_index;
+    SDL_atomic_t read_index;
+} RingBuffer;
+
+bool ring_buffer_init(RingBuffer *ring, Uint32 frames, int channels);
+Uint32 ring_buffer_readable(RingBuffer *ring);
+Uint32 ring_buffer_writable(RingBuffer *ring);
+Uint32 ring_buffer_write(RingBuffer *ring, const Sint16 *frames, Uint32 count);
+Uint32 ring_buffer_write_scaled(RingBuffer *ring, const Sint16 *frames, Uint32 count, int gain, int shift);
+Uint32 ring_buffer_read(RingBuffer *ring, Sint16 *frames, Uint32 count);
+void ring_buffer_skip_to(RingBuffer *ring, Uint32 index);
+void ring_buffer_free(RingBuffer *ring);
+
+#endif
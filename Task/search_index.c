@@ -0,0 +1,383 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "search_index.h"
+
+// ASCII letters and digits start words; bytes of multi-byte UTF-8 sequences
+// count as word characters so they are never split.
+static bool is_word_char(unsigned char c) {
+    return c >= 0x80 || (c >= '0' && c <= '9') || (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+}
+
+static unsigned char fold(unsigned char c) {
+    return c >= 'A' && c <= 'Z' ? (unsigned char)(c - 'A' + 'a') : c;
+}
+
+static int compare_text(const char *a, const char *b) {
+    const unsigned char *x = (const unsigned char *)a;
+    const unsigned char *y = (const unsigned char *)b;
+    while (*x && fold(*x) == fold(*y)) {
+        x++;
+        y++;
+    }
+    return (int)fold(*x) - (int)fold(*y);
+}
+
+static int compare_entries(const char *base, const SearchEntry *x, const SearchEntry *y) {
+    int order = compare_text(base + x->text, base + y->text);
+    if (order == 0) {
+        order = x->album != y->album ? (x->album < y->album ? -1 : 1) : (x->track > y->track) - (x->track < y->track);
+    }
+    return order;
+}
+
+// qsort has no context argument, so the arena being sorted is passed here.
+// Only search_index_build() sorts, on the main thread.
+static const char *sort_base;
+
+static int compare_sorted(const void *a, const void *b) {
+    return compare_entries(sort_base, a, b);
+}
+
+// Compares the first `length` characters of `text` with the already folded
+// query, so entries that start with the query compare equal.
+static int compare_prefix(const char *text, const char *query, size_t length) {
+    for (size_t i = 0; i < length; i++) {
+        unsigned char c = fold((unsigned char)text[i]);
+        unsigned char q = (unsigned char)query[i];
+        if (c != q) {
+            return (int)c - (int)q;
+        }
+    }
+    return 0;
+}
+
+static int lower_bound(const char *base, const SearchEntry *entries, int count, const char *query, size_t length) {
+    int low = 0;
+    int high = count;
+    while (low < high) {
+        int mid = low + (high - low) / 2;
+        if (compare_prefix(base + entries[mid].text, query, length) < 0) {
+            low = mid + 1;
+        } else {
+            high = mid;
+        }
+    }
+    return low;
+}
+
+static bool reserve(SearchEntry **entries, int *capacity, int needed) {
+    if (needed <= *capacity) {
+        return true;
+    }
+    int grown = *capacity ? *capacity * 2 : 1024;
+    while (grown < needed) {
+        grown *= 2;
+    }
+    SearchEntry *resized = realloc(*entries, (size_t)grown * sizeof(SearchEntry));
+    if (!resized) {
+        printf("Memory allocation failed for search index\n");
+        return false;
+    }
+    *entries = resized;
+    *capacity = grown;
+    return true;
+}
+
+static bool add_words(SearchEntry **entries, int *count, int *capacity, const Library *library, StringId id, int album, int track) {
+    const char *text = library_string(library, id);
+    for (const char *p = text; *p; p++) {
+        if (!is_word_char((unsigned char)*p) || (p > text && is_word_char((unsigned char)p[-1]))) {
+            continue;
+        }
+        if (!reserve(entries, capacity, *count + 1)) {
+            return false;
+        }
+        SearchEntry *entry = &(*entries)[(*count)++];
+        entry->text = id + (StringId)(p - text);
+        entry->album = album;
+        entry->track = track;
+    }
+    return true;
+}
+
+static bool add_album_words(SearchEntry **entries, int *count, int *capacity, const Library *library, int album_index) {
+    const Album *album = &library->albums[album_index];
+    if (!add_words(entries, count, capacity, library, album->title, album_index, -1) ||
+        !add_words(entries, count, capacity, library, album->artist, album_index, -1)) {
+        return false;
+    }
+    for (int t = 0; t < album->number_of_tracks; t++) {
+        if (!add_words(entries, count, capacity, library, library->track_titles[album->first_track + t], album_index, t)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool track_albums(SearchIndex *index, int number_of_albums) {
+    if (number_of_albums <= index->number_of_albums) {
+        return true;
+    }
+    bool *removed = realloc(index->removed, (size_t)number_of_albums * sizeof(bool));
+    if (!removed) {
+        printf("Memory allocation failed for search index\n");
+        return false;
+    }
+    memset(removed + index->number_of_albums, 0, (size_t)(number_of_albums - index->number_of_albums) * sizeof(bool));
+    index->removed = removed;
+    index->number_of_albums = number_of_albums;
+    return true;
+}
+
+static int drop_removed(const SearchIndex *index, SearchEntry *entries, int count) {
+    int kept = 0;
+    for (int i = 0; i < count; i++) {
+        if (!index->removed[entries[i].album]) {
+            entries[kept++] = entries[i];
+        }
+    }
+    return kept;
+}
+
+// Folds `pending` into `entries` and forgets removed albums. Linear in the
+// index size, so it only runs once the pending array is large, or when a
+// removed album comes back.
+bool search_index_compact(SearchIndex *index) {
+    if (index->removed_count > 0) {
+        index->count = drop_removed(index, index->entries, index->count);
+        index->pending_count = drop_removed(index, index->pending, index->pending_count);
+        memset(index->removed, 0, (size_t)index->number_of_albums * sizeof(bool));
+        index->removed_count = 0;
+    }
+    if (index->pending_count == 0) {
+        return true;
+    }
+    if (!reserve(&index->entries, &index->capacity, index->count + index->pending_count)) {
+        return false;
+    }
+
+    // Merge from the back so it can happen in place
+    int i = index->count - 1;
+    int j = index->pending_count - 1;
+    int out = index->count + index->pending_count - 1;
+    while (j >= 0) {
+        if (i >= 0 && compare_entries(index->strings->data, &index->entries[i], &index->pending[j]) > 0) {
+            index->entries[out--] = index->entries[i--];
+        } else {
+            index->entries[out--] = index->pending[j--];
+        }
+    }
+    index->count += index->pending_count;
+    index->pending_count = 0;
+    return true;
+}
+
+// The same word in `library`: `text` points into the title, the artist or
+// the title of track `track` of `old_album`, which is the same string in
+// `album`.
+static StringId same_word(const Library *old_library, const Album *old_album, const Library *library, const Album *album, StringId text, int track) {
+    if (track >= 0) {
+        return library->track_titles[album->first_track + track] + (text - old_library->track_titles[old_album->first_track + track]);
+    }
+    size_t title_length = strlen(library_string(old_library, old_album->title));
+    if (text >= old_album->title && text < old_album->title + title_length) {
+        return album->title + (text - old_album->title);
+    }
+    return album->artist + (text - old_album->artist);
+}
+
+// Moves the index over to `library`, which replaces `old_library`. Entries
+// of album i go to album album_map[i] and point at the same words in the
+// new arena; those of albums mapped to -1 or removed are dropped. Linear in
+// the index size and compares no strings. The words keep their order; only
+// entries for one word may end up out of album order, which queries don't
+// depend on.
+bool search_index_remap(SearchIndex *index, const Library *old_library, const Library *library, const int *album_map) {
+    index->strings = &old_library->strings;
+    if (!search_index_compact(index)) {
+        return false;
+    }
+    int kept = 0;
+    for (int i = 0; i < index->count; i++) {
+        SearchEntry entry = index->entries[i];
+        int album = album_map[entry.album];
+        if (album < 0) {
+            continue;
+        }
+        entry.text = same_word(old_library, &old_library->albums[entry.album], library, &library->albums[album], entry.text, entry.track);
+        entry.album = album;
+        index->entries[kept++] = entry;
+    }
+    index->count = kept;
+    index->strings = &library->strings;
+    free(index->removed);
+    index->removed = NULL;
+    index->number_of_albums = 0;
+    return track_albums(index, library->number_of_albums);
+}
+
+bool search_index_build(SearchIndex *index, const Library *library) {
+    memset(index, 0, sizeof(*index));
+    index->strings = &library->strings;
+    Uint64 started = SDL_GetPerformanceCounter();
+    if (!track_albums(index, library->number_of_albums)) {
+        return false;
+    }
+    for (int a = 0; a < library->number_of_albums; a++) {
+        if (!add_album_words(&index->entries, &index->count, &index->capacity, library, a)) {
+            search_index_free(index);
+            return false;
+        }
+    }
+    sort_base = library->strings.data;
+    qsort(index->entries, (size_t)index->count, sizeof(SearchEntry), compare_sorted);
+    double ms = (double)(SDL_GetPerformanceCounter() - started) * 1000.0 / (double)SDL_GetPerformanceFrequency();
+    printf("Search index: %d words from %d tracks in %.1f ms\n", index->count, library->number_of_tracks, ms);
+    return true;
+}
+
+// Indexes an album that was added to (or replaced in) the library after the
+// build. Its old entries, if any, are dropped first so a replaced album is
+// not found under its old titles.
+bool search_index_add_album(SearchIndex *index, const Library *library, int album) {
+    if (!track_albums(index, library->number_of_albums)) {
+        return false;
+    }
+    if (index->removed[album] && !search_index_compact(index)) {
+        return false;
+    }
+
+    int start = index->pending_count;
+    if (!add_album_words(&index->pending, &index->pending_count, &index->pending_capacity, library, album)) {
+        index->pending_count = start;
+        return false;
+    }
+    // Insertion sort of the new words into the already sorted pending array
+    for (int i = start; i < index->pending_count; i++) {
+        SearchEntry entry = index->pending[i];
+        int j = i;
+        while (j > 0 && compare_entries(library->strings.data, &index->pending[j - 1], &entry) > 0) {
+            index->pending[j] = index->pending[j - 1];
+            j--;
+        }
+        index->pending[j] = entry;
+    }
+    if (index->pending_count >= SEARCH_MERGE_THRESHOLD) {
+        return search_index_compact(index);
+    }
+    return true;
+}
+
+// The album's entries stay in place, skipped by queries, until the next
+// compaction.
+void search_index_remove_album(SearchIndex *index, int album) {
+    if (album < 0 || album >= index->number_of_albums || index->removed[album]) {
+        return;
+    }
+    index->removed[album] = true;
+    index->removed_count++;
+}
+
+static bool is_duplicate(const SearchResult *results, int count, const SearchEntry *entry) {
+    for (int i = 0; i < count; i++) {
+        if (results[i].album == entry->album && results[i].track == entry->track) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static size_t fold_query(const char *query, char *folded) {
+    size_t length = 0;
+    while (query[length] && length + 1 < SEARCH_MAX_QUERY) {
+        folded[length] = (char)fold((unsigned char)query[length]);
+        length++;
+    }
+    folded[length] = '\0';
+    return length;
+}
+
+// Fills `results` with up to `max_results` albums and tracks that have a
+// word starting with `query`, in alphabetical order of the matched text.
+// Costs two binary searches plus a walk over roughly `max_results` entries,
+// whatever the library size.
+int search_index_query(const SearchIndex *index, const char *query, SearchResult *results, int max_results) {
+    char folded[SEARCH_MAX_QUERY];
+    size_t length = fold_query(query, folded);
+    if (length == 0) {
+        return 0;
+    }
+
+    const char *base = index->strings ? index->strings->data : NULL;
+    if (!base) {
+        return 0;
+    }
+    int i = lower_bound(base, index->entries, index->count, folded, length);
+    int j = lower_bound(base, index->pending, index->pending_count, folded, length);
+    int found = 0;
+    while (found < max_results) {
+        bool main_match = i < index->count && compare_prefix(base + index->entries[i].text, folded, length) == 0;
+        bool pending_match = j < index->pending_count && compare_prefix(base + index->pending[j].text, folded, length) == 0;
+        const SearchEntry *entry;
+        if (main_match && (!pending_match || compare_entries(base, &index->entries[i], &index->pending[j]) <= 0)) {
+            entry = &index->entries[i++];
+        } else if (pending_match) {
+            entry = &index->pending[j++];
+        } else {
+            break;
+        }
+        if (index->removed[entry->album] || is_duplicate(results, found, entry)) {
+            continue;
+        }
+        results[found].album = entry->album;
+        results[found].track = entry->track;
+        found++;
+    }
+    return found;
+}
+
+static bool has_word_starting(const char *text, const char *query, size_t length) {
+    for (const char *p = text; *p; p++) {
+        if (is_word_char((unsigned char)*p) && (p == text || !is_word_char((unsigned char)p[-1])) && compare_prefix(p, query, length) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// The same matches as search_index_query() but found without an index, in
+// library order, by one pass over every title. For a single query this is
+// cheaper than building and sorting the index.
+int search_index_scan(const Library *library, const char *query, SearchResult *results, int max_results) {
+    char folded[SEARCH_MAX_QUERY];
+    size_t length = fold_query(query, folded);
+    if (length == 0) {
+        return 0;
+    }
+    int found = 0;
+    for (int a = 0; a < library->number_of_albums && found < max_results; a++) {
+        const Album *album = &library->albums[a];
+        if (has_word_starting(library_string(library, album->title), folded, length) ||
+            has_word_starting(library_string(library, album->artist), folded, length)) {
+            results[found].album = a;
+            results[found].track = -1;
+            found++;
+        }
+        for (int t = 0; t < album->number_of_tracks && found < max_results; t++) {
+            if (has_word_starting(library_track_title(library, a, t), folded, length)) {
+                results[found].album = a;
+                results[found].track = t;
+                found++;
+            }
+        }
+    }
+    return found;
+}
+
+void search_index_free(SearchIndex *index) {
+    free(index->entries);
+    free(index->pending);
+    free(index->removed);
+    memset(index, 0, sizeof(*index));
+}
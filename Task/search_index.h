@@ -0,0 +1,55 @@
+#ifndef SEARCH_INDEX_H
+#define SEARCH_INDEX_H
+
+#include <stdbool.h>
+#include "library.h"
+
+#define SEARCH_MAX_QUERY 64
+#define SEARCH_MERGE_THRESHOLD 4096
+
+// One word of an album title, artist or track title. `text` is the arena
+// offset of the start of the word inside the library's string, so matching
+// a prefix of it also matches the words that follow. `track` is -1 for
+// album title and artist words.
+typedef struct search_entry {
+    StringId text;
+    int album;
+    int track;
+} SearchEntry;
+
+typedef struct search_result {
+    int album;
+    int track;
+} SearchResult;
+
+// Word-start suffix array, sorted case-insensitively, so every entry
+// starting with a query is one contiguous range found by binary search.
+// Albums added later go into the small sorted `pending` array, which is
+// merged in once it reaches SEARCH_MERGE_THRESHOLD entries. Removed albums
+// are only flagged in `removed` and dropped at the next merge. When the
+// library is reloaded, search_index_remap() carries the entries of the
+// albums that are kept over to the new library, so only the albums that
+// were added or changed are indexed again.
+typedef struct search_index {
+    SearchEntry *entries;
+    int count;
+    int capacity;
+    SearchEntry *pending;
+    int pending_count;
+    int pending_capacity;
+    bool *removed;
+    int number_of_albums;
+    int removed_count;
+    const StringArena *strings;
+} SearchIndex;
+
+bool search_index_build(SearchIndex *index, const Library *library);
+bool search_index_add_album(SearchIndex *index, const Library *library, int album);
+void search_index_remove_album(SearchIndex *index, int album);
+bool search_index_compact(SearchIndex *index);
+bool search_index_remap(SearchIndex *index, const Library *old_library, const Library *library, const int *album_map);
+int search_index_query(const SearchIndex *index, const char *query, SearchResult *results, int max_results);
+int search_index_scan(const Library *library, const char *query, SearchResult *results, int max_results);
+void search_index_free(SearchIndex *index);
+
+#endif
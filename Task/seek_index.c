@@ -0,0 +1,541 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "seek_index.h"
+#include "trace.h"
+
+#define MAX_CACHED_PATH 65536
+
+// Kilobits per second by bitrate index, for MPEG-1 and for MPEG-2 and 2.5,
+// layers I to III.
+static const uint16_t BITRATES[2][3][15] = {
+    {{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448},
+     {0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384},
+     {0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320}},
+    {{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256},
+     {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160},
+     {0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160}},
+};
+
+// MPEG-1 rates; MPEG-2 halves them and MPEG-2.5 quarters them.
+static const uint32_t SAMPLE_RATES[3] = {44100, 48000, 32000};
+
+typedef struct frame_header {
+    bool mpeg1;
+    bool mono;
+    uint32_t sample_rate;
+    uint32_t samples;
+    uint32_t size;
+} FrameHeader;
+
+static bool parse_header(const Uint8 *bytes, FrameHeader *header) {
+    if (bytes[0] != 0xFF || (bytes[1] & 0xE0) != 0xE0) {
+        return false;
+    }
+    int version = (bytes[1] >> 3) & 3;
+    int layer = 4 - ((bytes[1] >> 1) & 3);
+    int bitrate_index = bytes[2] >> 4;
+    int rate_index = (bytes[2] >> 2) & 3;
+    // Free-format streams give no frame size in the header and are not
+    // indexed
+    if (version == 1 || layer == 4 || bitrate_index == 0 || bitrate_index == 15 || rate_index == 3) {
+        return false;
+    }
+    header->mpeg1 = version == 3;
+    header->mono = (bytes[3] >> 6) == 3;
+    header->sample_rate = SAMPLE_RATES[rate_index] >> (header->mpeg1 ? 0 : version == 2 ? 1 : 2);
+    uint32_t bitrate = BITRATES[header->mpeg1 ? 0 : 1][layer - 1][bitrate_index] * 1000u;
+    uint32_t padding = (bytes[2] >> 1) & 1;
+    if (layer == 1) {
+        header->samples = 384;
+        header->size = (12 * bitrate / header->sample_rate + padding) * 4;
+    } else if (layer == 2 || header->mpeg1) {
+        header->samples = 1152;
+        header->size = 144 * bitrate / header->sample_rate + padding;
+    } else {
+        header->samples = 576;
+        header->size = 72 * bitrate / header->sample_rate + padding;
+    }
+    return true;
+}
+
+// Same version, layer and sample rate as the first frame.
+static bool same_stream(const Uint8 *first, const Uint8 *bytes) {
+    return (first[1] & 0xFE) == (bytes[1] & 0xFE) && (first[2] & 0x0C) == (bytes[2] & 0x0C);
+}
+
+// A Xing, Info or VBRI frame at the start holds the encoder's own summary
+// of the stream rather than audio.
+static bool is_info_frame(const Uint8 *bytes, const FrameHeader *header) {
+    size_t side_info = header->mpeg1 ? (header->mono ? 17 : 32) : (header->mono ? 9 : 17);
+    const Uint8 *tag = bytes + 4 + side_info;
+    if (4 + side_info + 4 <= header->size && (memcmp(tag, "Xing", 4) == 0 || memcmp(tag, "Info", 4) == 0)) {
+        return true;
+    }
+    return 4 + 32 + 4 <= header->size && memcmp(bytes + 4 + 32, "VBRI", 4) == 0;
+}
+
+// Counts the frames of an MP3 held in memory, skipping junk between them.
+// Fails, leaving no frames, if `data` is not an MP3 stream.
+bool seek_table_scan(SeekTable *table, const Uint8 *data, size_t size) {
+    table->frame_count = 0;
+
+    size_t position = 0;
+    if (size >= 10 && memcmp(data, "ID3", 3) == 0) {
+        size_t tag_size = (size_t)(data[6] & 0x7F) << 21 | (size_t)(data[7] & 0x7F) << 14 | (size_t)(data[8] & 0x7F) << 7 | (data[9] & 0x7F);
+        position = 10 + tag_size + ((data[5] & 0x10) ? 10 : 0);
+    }
+
+    // Sync on a header followed by another of the same stream, so a stray
+    // 0xFF before the audio is not taken for a frame
+    FrameHeader first;
+    bool synced = false;
+    while (position + 4 <= size && !synced) {
+        FrameHeader next;
+        synced = parse_header(data + position, &first) && position + first.size + 4 <= size &&
+                 parse_header(data + position + first.size, &next) && same_stream(data + position, data + position + first.size);
+        position += synced ? 0 : 1;
+    }
+    if (!synced) {
+        return false;
+    }
+    const Uint8 *stream = data + position;
+    if (is_info_frame(stream, &first)) {
+        position += first.size;
+    }
+    table->sample_rate = first.sample_rate;
+    table->samples_per_frame = first.samples;
+
+    while (position + 4 <= size && table->frame_count < UINT32_MAX) {
+        FrameHeader header;
+        if (!parse_header(data + position, &header) || !same_stream(stream, data + position)) {
+            position++;
+            continue;
+        }
+        if (position + header.size > size) {
+            break;
+        }
+        table->frame_count++;
+        position += header.size;
+    }
+    return table->frame_count > 0;
+}
+
+Uint32 seek_table_duration_ms(const SeekTable *table) {
+    if (table->sample_rate == 0) {
+        return 0;
+    }
+    return (Uint32)((uint64_t)table->frame_count * table->samples_per_frame * 1000 / table->sample_rate);
+}
+
+static uint32_t hash_path(const char *path) {
+    uint32_t hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)path; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    return hash;
+}
+
+static char *copy_string(const char *str) {
+    char *copy = malloc(strlen(str) + 1);
+    if (copy) {
+        strcpy(copy, str);
+    }
+    return copy;
+}
+
+static bool file_identity(const char *path, int64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (stat(path, &st) != 0) {
+        return false;
+    }
+    *size = (int64_t)st.st_size;
+    *mtime = (int64_t)st.st_mtime;
+    return true;
+}
+
+static bool is_mp3(const char *path) {
+    const char *dot = strrchr(path, '.');
+    return dot && SDL_strcasecmp(dot, ".mp3") == 0;
+}
+
+// Called with the lock held, or before the thread is started.
+static SeekTable *find_table(const SeekIndex *index, const char *path) {
+    if (!index->slots) {
+        return NULL;
+    }
+    for (Uint32 slot = hash_path(path) & index->slot_mask; index->slots[slot]; slot = (slot + 1) & index->slot_mask) {
+        SeekTable *table = &index->tables[index->slots[slot] - 1];
+        if (strcmp(table->path, path) == 0) {
+            return table;
+        }
+    }
+    return NULL;
+}
+
+static bool grow_slots(SeekIndex *index) {
+    Uint32 slot_count = index->slots ? (index->slot_mask + 1) * 2 : 1024;
+    int *slots = calloc(slot_count, sizeof(int));
+    if (!slots) {
+        printf("Memory allocation failed for seek index\n");
+        return false;
+    }
+    for (int i = 0; i < index->count; i++) {
+        Uint32 slot = hash_path(index->tables[i].path) & (slot_count - 1);
+        while (slots[slot]) {
+            slot = (slot + 1) & (slot_count - 1);
+        }
+        slots[slot] = i + 1;
+    }
+    free(index->slots);
+    index->slots = slots;
+    index->slot_mask = slot_count - 1;
+    return true;
+}
+
+// Returns the table for `path`, adding an empty one if there is none.
+// Called with the lock held.
+static SeekTable *upsert_table(SeekIndex *index, const char *path) {
+    SeekTable *table = find_table(index, path);
+    if (table) {
+        return table;
+    }
+    if (index->count == index->capacity) {
+        int capacity = index->capacity ? index->capacity * 2 : 256;
+        SeekTable *tables = realloc(index->tables, capacity * sizeof(SeekTable));
+        if (!tables) {
+            printf("Memory allocation failed for seek tables\n");
+            return NULL;
+        }
+        index->tables = tables;
+        index->capacity = capacity;
+    }
+    if ((Uint32)(index->count + 1) * 2 > (index->slots ? index->slot_mask + 1 : 0) && !grow_slots(index)) {
+        return NULL;
+    }
+    table = &index->tables[index->count];
+    memset(table, 0, sizeof(*table));
+    table->path = copy_string(path);
+    if (!table->path) {
+        return NULL;
+    }
+    Uint32 slot = hash_path(path) & index->slot_mask;
+    while (index->slots[slot]) {
+        slot = (slot + 1) & index->slot_mask;
+    }
+    index->slots[slot] = ++index->count;
+    return table;
+}
+
+static bool write_table(FILE *fptr, const SeekTable *table) {
+    uint32_t length = (uint32_t)strlen(table->path);
+    return fwrite(&table->size, sizeof(table->size), 1, fptr) == 1 &&
+           fwrite(&table->mtime, sizeof(table->mtime), 1, fptr) == 1 &&
+           fwrite(&table->sample_rate, sizeof(table->sample_rate), 1, fptr) == 1 &&
+           fwrite(&table->samples_per_frame, sizeof(table->samples_per_frame), 1, fptr) == 1 &&
+           fwrite(&table->frame_count, sizeof(table->frame_count), 1, fptr) == 1 &&
+           fwrite(&length, sizeof(length), 1, fptr) == 1 &&
+           fwrite(table->path, 1, length, fptr) == length;
+}
+
+static bool write_header(FILE *fptr) {
+    SeekCacheHeader header = {0};
+    header.magic = SEEK_CACHE_MAGIC;
+    header.version = SEEK_CACHE_VERSION;
+    return fwrite(&header, sizeof(header), 1, fptr) == 1;
+}
+
+// Reads every complete record; returns how many were read, including ones
+// later replaced, or -1 if there is no usable cache. `damaged` is set when
+// the file ends in a partial record.
+static int load_cache(SeekIndex *index, bool *damaged) {
+    *damaged = false;
+    FILE *fptr = fopen(index->cache_path, "rb");
+    if (!fptr) {
+        return -1;
+    }
+    SeekCacheHeader header;
+    if (fread(&header, sizeof(header), 1, fptr) != 1 || header.magic != SEEK_CACHE_MAGIC || header.version != SEEK_CACHE_VERSION) {
+        fclose(fptr);
+        return -1;
+    }
+
+    int read = 0;
+    long end = ftell(fptr);
+    char *path = malloc(MAX_CACHED_PATH + 1);
+    while (path) {
+        SeekTable loaded;
+        memset(&loaded, 0, sizeof(loaded));
+        uint32_t length;
+        bool ok = fread(&loaded.size, sizeof(loaded.size), 1, fptr) == 1 &&
+                  fread(&loaded.mtime, sizeof(loaded.mtime), 1, fptr) == 1 &&
+                  fread(&loaded.sample_rate, sizeof(loaded.sample_rate), 1, fptr) == 1 &&
+                  fread(&loaded.samples_per_frame, sizeof(loaded.samples_per_frame), 1, fptr) == 1 &&
+                  fread(&loaded.frame_count, sizeof(loaded.frame_count), 1, fptr) == 1 &&
+                  fread(&length, sizeof(length), 1, fptr) == 1 &&
+                  length <= MAX_CACHED_PATH && fread(path, 1, length, fptr) == length;
+        SeekTable *table = NULL;
+        if (ok) {
+            path[length] = '\0';
+            table = upsert_table(index, path);
+        }
+        if (!table) {
+            break;
+        }
+        loaded.path = table->path;
+        loaded.indexed = true;
+        *table = loaded;
+        read++;
+        end = ftell(fptr);
+    }
+    free(path);
+    fseek(fptr, 0, SEEK_END);
+    *damaged = ftell(fptr) != end;
+    fclose(fptr);
+    return read;
+}
+
+// Opens the cache for appending, first rewriting it with one record per
+// path if `rewrite` is set.
+static bool open_journal(SeekIndex *index, bool rewrite) {
+    if (!rewrite) {
+        index->journal = fopen(index->cache_path, "ab");
+        return index->journal != NULL;
+    }
+
+    char temp_path[MAX_PATH_LENGTH + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", index->cache_path);
+    FILE *fptr = fopen(temp_path, "wb");
+    bool ok = fptr && write_header(fptr);
+    for (int i = 0; ok && i < index->count; i++) {
+        ok = write_table(fptr, &index->tables[i]);
+    }
+    ok = fptr && fclose(fptr) == 0 && ok;
+    if (ok) {
+        remove(index->cache_path);
+        ok = rename(temp_path, index->cache_path) == 0;
+    }
+    if (!ok) {
+        remove(temp_path);
+        return false;
+    }
+    index->journal = fopen(index->cache_path, "ab");
+    return index->journal != NULL;
+}
+
+static Uint8 *read_file(const char *path, size_t *size) {
+    FILE *fptr = fopen(path, "rb");
+    if (!fptr) {
+        return NULL;
+    }
+    Uint8 *data = NULL;
+    long length = fseek(fptr, 0, SEEK_END) == 0 ? ftell(fptr) : -1;
+    if (length > 0 && length <= UINT32_MAX && fseek(fptr, 0, SEEK_SET) == 0) {
+        data = malloc((size_t)length);
+        if (data && fread(data, 1, (size_t)length, fptr) != (size_t)length) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(fptr);
+    *size = data ? (size_t)length : 0;
+    return data;
+}
+
+// Indexes one file and journals the result. A file that is not an MP3
+// stream is recorded with no frames, so it is not read again until it
+// changes.
+static void index_file(SeekIndex *index, const char *path, int64_t size, int64_t mtime) {
+    SeekTable built;
+    memset(&built, 0, sizeof(built));
+    size_t length;
+    Uint8 *data = read_file(path, &length);
+    if (!data) {
+        return;
+    }
+    Uint64 trace_start_time = trace_begin();
+    if (!seek_table_scan(&built, data, length)) {
+        printf("No MP3 frames to index in %s\n", path);
+    }
+    trace_end("seek_table_scan", trace_start_time);
+    free(data);
+    built.size = size;
+    built.mtime = mtime;
+    built.indexed = true;
+    built.checked = true;
+
+    SDL_LockMutex(index->lock);
+    SeekTable *table = upsert_table(index, path);
+    if (table) {
+        built.path = table->path;
+        *table = built;
+        if (index->journal && (!write_table(index->journal, table) || fflush(index->journal) != 0)) {
+            printf("Error writing seek cache: %s\n", index->cache_path);
+            fclose(index->journal);
+            index->journal = NULL;
+        }
+    }
+    SDL_UnlockMutex(index->lock);
+    SDL_AtomicAdd(&index->indexed, 1);
+}
+
+// Location of the track after (*album, *track), stepping past empty albums.
+// False at the end of the library, or once the index has been retired and
+// the library is gone.
+static bool next_track(SeekIndex *index, int *album, int *track, char *path, size_t size) {
+    bool found = false;
+    SDL_LockMutex(index->library_lock);
+    const Library *library = index->library;
+    while (library && *album < library->number_of_albums && !found) {
+        if (*track < library->albums[*album].number_of_tracks) {
+            library_track_location(library, *album, *track, path, size);
+            (*track)++;
+            found = true;
+        } else {
+            (*album)++;
+            *track = 0;
+        }
+    }
+    SDL_UnlockMutex(index->library_lock);
+    return found;
+}
+
+static int seek_index_thread(void *data) {
+    SeekIndex *index = data;
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    trace_name_thread("seek_index");
+    Uint32 started = SDL_GetTicks();
+
+    SDL_LockMutex(index->lock);
+    bool damaged;
+    int read = load_cache(index, &damaged);
+    // Compact when records have been replaced or cut short; start afresh
+    // without a cache
+    if (!open_journal(index, read < 0 || damaged || read > index->count)) {
+        printf("Error opening seek cache: %s\n", index->cache_path);
+    }
+    SDL_UnlockMutex(index->lock);
+
+    int up_to_date = 0;
+    int album = 0;
+    int track = 0;
+    char path[MAX_PATH_LENGTH];
+    while (!SDL_AtomicGet(&index->quit) && next_track(index, &album, &track, path, sizeof(path))) {
+        int64_t size;
+        int64_t mtime;
+        if (!is_mp3(path) || !file_identity(path, &size, &mtime)) {
+            continue;
+        }
+        SDL_LockMutex(index->lock);
+        SeekTable *table = find_table(index, path);
+        bool current = table && table->indexed && table->size == size && table->mtime == mtime;
+        if (current) {
+            table->checked = true;
+        }
+        SDL_UnlockMutex(index->lock);
+        if (current) {
+            up_to_date++;
+        } else {
+            index_file(index, path, size, mtime);
+        }
+        SDL_AtomicAdd(&index->checked, 1);
+    }
+
+    printf("Seek index %s after %u ms: %d files indexed, %d already cached\n",
+           SDL_AtomicGet(&index->quit) ? "stopped" : "finished", SDL_GetTicks() - started,
+           SDL_AtomicGet(&index->indexed), up_to_date);
+    SDL_AtomicSet(&index->finished, 1);
+    return 0;
+}
+
+// Returns at once; the cache is read and the files are indexed on a
+// background thread. NULL if the thread could not be started.
+SeekIndex *seek_index_start(const Library *library, const char *cache_path) {
+    SeekIndex *index = calloc(1, sizeof(SeekIndex));
+    if (!index) {
+        printf("Memory allocation failed for seek index\n");
+        return NULL;
+    }
+    index->library = library;
+    snprintf(index->cache_path, sizeof(index->cache_path), "%s", cache_path);
+    index->lock = SDL_CreateMutex();
+    index->library_lock = SDL_CreateMutex();
+    index->thread = index->lock && index->library_lock ? SDL_CreateThread(seek_index_thread, "seek_index", index) : NULL;
+    if (!index->thread) {
+        printf("Seek index disabled: %s\n", SDL_GetError());
+        seek_index_stop(index);
+        return NULL;
+    }
+    return index;
+}
+
+// Length of `path` once the index thread has checked its table against the
+// file, so the caller never touches the disk.
+bool seek_index_duration_ms(SeekIndex *index, const char *path, Uint32 *duration_ms) {
+    if (!index->lock) {
+        return false;
+    }
+    SDL_LockMutex(index->lock);
+    const SeekTable *table = find_table(index, path);
+    bool found = table && table->checked && table->frame_count > 0;
+    if (found) {
+        *duration_ms = seek_table_duration_ms(table);
+    }
+    SDL_UnlockMutex(index->lock);
+    return found;
+}
+
+// Indexes retired but still reading a file. Only the main thread touches
+// the list.
+static SeekIndex *retired_indexes;
+
+// Stops the index without waiting for the file being read: returns once the
+// thread no longer reads the library, so the library can be reloaded. The
+// index is freed by seek_index_reap() after its thread is done; until then
+// it may still append to the cache.
+void seek_index_retire(SeekIndex *index) {
+    SDL_AtomicSet(&index->quit, 1);
+    SDL_LockMutex(index->library_lock);
+    index->library = NULL;
+    SDL_UnlockMutex(index->library_lock);
+    index->next_retired = retired_indexes;
+    retired_indexes = index;
+}
+
+// Frees the retired indexes that have finished, or with `wait` all of them.
+void seek_index_reap(bool wait) {
+    SeekIndex **link = &retired_indexes;
+    while (*link) {
+        SeekIndex *index = *link;
+        if (wait || SDL_AtomicGet(&index->finished)) {
+            *link = index->next_retired;
+            seek_index_stop(index);
+        } else {
+            link = &index->next_retired;
+        }
+    }
+}
+
+// Waits for the file being indexed to finish, then frees the index.
+void seek_index_stop(SeekIndex *index) {
+    if (index->thread) {
+        SDL_AtomicSet(&index->quit, 1);
+        SDL_WaitThread(index->thread, NULL);
+    }
+    if (index->journal) {
+        fclose(index->journal);
+    }
+    for (int i = 0; i < index->count; i++) {
+        free(index->tables[i].path);
+    }
+    free(index->tables);
+    free(index->slots);
+    if (index->lock) {
+        SDL_DestroyMutex(index->lock);
+    }
+    if (index->library_lock) {
+        SDL_DestroyMutex(index->library_lock);
+    }
+    free(index);
+}
@@ -0,0 +1,82 @@
+#ifndef SEEK_INDEX_H
+#define SEEK_INDEX_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <SDL2/SDL.h>
+#include "library.h"
+
+#define SEEK_CACHE_PATH "seek.cache"
+#define SEEK_CACHE_MAGIC 0x4B454553u // "SEEK"
+#define SEEK_CACHE_VERSION 2
+
+// The seek cache is this header followed by records appended as files are
+// indexed, each the file's size and mtime as int64, then its sample rate,
+// samples per frame and frame count as uint32, and its path as a uint32
+// length plus bytes. Later records replace earlier ones for the same path;
+// a record cut short by a crash is ignored.
+typedef struct seek_cache_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t reserved[2];
+} SeekCacheHeader;
+
+// Frame count of one MP3, which gives its length before it is decoded.
+// Seeking itself happens in the decoded PCM, so no byte offsets are kept.
+// A file that is not a usable MP3 has no frames. `indexed` is false while
+// the file is still queued; `checked` is set once the index thread has
+// seen that the file still has the size and mtime the table was built
+// from.
+typedef struct seek_table {
+    char *path;
+    int64_t size;
+    int64_t mtime;
+    uint32_t sample_rate;
+    uint32_t samples_per_frame;
+    uint32_t frame_count;
+    bool indexed;
+    bool checked;
+} SeekTable;
+
+// Background frame index of every MP3 in the library. One low-priority
+// thread loads the cache, then reads the frame headers of each file whose
+// size or mtime changed; no audio is decoded. Tables are appended to the
+// cache as they are built, so an index that is stopped picks up where it
+// left off next time. `checked` counts the files the thread has been
+// through, so callers know when a length they asked for may have arrived.
+//
+// The thread reads the library one track at a time under `library_lock`;
+// seek_index_retire() waits for that and no more. `tables` and `journal`
+// are shared under `lock`.
+typedef struct seek_index {
+    const Library *library;
+    SDL_mutex *library_lock;
+    char cache_path[MAX_PATH_LENGTH];
+    SDL_Thread *thread;
+
+    SDL_mutex *lock;
+    SeekTable *tables;
+    int count;
+    int capacity;
+    int *slots;
+    Uint32 slot_mask;
+    FILE *journal;
+
+    SDL_atomic_t indexed;
+    SDL_atomic_t checked;
+    SDL_atomic_t quit;
+    SDL_atomic_t finished;
+    struct seek_index *next_retired;
+} SeekIndex;
+
+bool seek_table_scan(SeekTable *table, const Uint8 *data, size_t size);
+Uint32 seek_table_duration_ms(const SeekTable *table);
+
+SeekIndex *seek_index_start(const Library *library, const char *cache_path);
+bool seek_index_duration_ms(SeekIndex *index, const char *path, Uint32 *duration_ms);
+void seek_index_retire(SeekIndex *index);
+void seek_index_reap(bool wait);
+void seek_index_stop(SeekIndex *index);
+
+#endif
@@ -0,0 +1,358 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include "catalog.h"
+#include "session.h"
+#include "thumbnail_cache.h"
+#include "trace.h"
+
+static uint64_t align8(uint64_t offset) {
+    return (offset + 7) & ~(uint64_t)7;
+}
+
+static void source_stamp(const char *source_path, int64_t *size, int64_t *mtime) {
+    struct stat st;
+    if (stat(source_path, &st) == 0) {
+        *size = (int64_t)st.st_size;
+        *mtime = (int64_t)st.st_mtime;
+    } else {
+        *size = -1;
+        *mtime = -1;
+    }
+}
+
+// Maps the snapshot and checks it against the library just loaded. Fails,
+// with the session empty, when there is no snapshot or it is stale or
+// damaged.
+bool session_open(Session *session, const Library *library, const char *path, const char *source_path) {
+    memset(session, 0, sizeof(*session));
+    size_t size;
+    void *data = catalog_map_file(path, &size);
+    if (!data) {
+        return false;
+    }
+
+    const Uint8 *base = data;
+    const SessionHeader *header = data;
+    int64_t source_size;
+    int64_t source_mtime;
+    source_stamp(source_path, &source_size, &source_mtime);
+    bool valid = size >= sizeof(SessionHeader) &&
+                 header->magic == SESSION_MAGIC &&
+                 header->version == SESSION_VERSION;
+    if (valid && (header->source_size != source_size || header->source_mtime != source_mtime ||
+                  header->album_count != (uint32_t)library->number_of_albums || header->track_count != (uint32_t)library->number_of_tracks)) {
+        // Taken of another library; not worth a message
+        catalog_unmap_file(data, size);
+        return false;
+    }
+    valid = valid &&
+            header->current_album >= 0 && header->current_album < library->number_of_albums &&
+            header->current_track >= -1 && header->current_track < library->albums[header->current_album].number_of_tracks &&
+            header->cover_size <= 4096;
+    uint64_t rows_offset = sizeof(SessionHeader);
+    uint64_t covers_offset = valid ? rows_offset + align8((uint64_t)header->row_count * sizeof(int32_t)) : 0;
+    valid = valid && covers_offset + (uint64_t)header->cover_count * sizeof(SessionCover) <= size;
+
+    const SessionCover *covers = valid ? (const SessionCover *)(base + covers_offset) : NULL;
+    uint64_t cover_bytes = valid ? (uint64_t)header->cover_size * header->cover_size * 4 : 0;
+    for (uint32_t i = 0; valid && i < header->cover_count; i++) {
+        valid = covers[i].album >= 0 && covers[i].album < library->number_of_albums &&
+                covers[i].offset % 8 == 0 && covers[i].offset + cover_bytes <= size;
+    }
+    if (!valid) {
+        printf("Ignoring invalid session: %s\n", path);
+        catalog_unmap_file(data, size);
+        return false;
+    }
+
+    session->current_album = header->current_album;
+    session->current_track = header->current_track;
+    session->scroll_y = header->scroll_y;
+    session->playing = header->playing && header->current_track >= 0;
+    session->position_ms = header->position_ms;
+    session->cover_size = (int)header->cover_size;
+    session->row_widths = (const int32_t *)(base + rows_offset);
+    session->row_count = (int)header->row_count;
+    session->covers = covers;
+    session->cover_count = (int)header->cover_count;
+    session->mapping = data;
+    session->mapping_size = size;
+    return true;
+}
+
+// Packs the snapshot's covers into the atlas straight from the mapping.
+// Their state is left at COVER_NONE, so the cover loader still fetches each
+// one from its source and replaces it if the image has changed.
+int session_restore_covers(const Session *session, Library *library, CoverAtlas *atlas) {
+    int restored = 0;
+    for (int i = 0; i < session->cover_count; i++) {
+        Album *album = &library->albums[session->covers[i].album];
+        if (cover_atlas_contains(atlas, album->cover)) {
+            continue;
+        }
+        void *pixels = (Uint8 *)session->mapping + session->covers[i].offset;
+        SDL_Surface *surface = SDL_CreateRGBSurfaceWithFormatFrom(pixels, session->cover_size, session->cover_size, 32,
+                                                                  session->cover_size * 4, SDL_PIXELFORMAT_ARGB8888);
+        if (!surface) {
+            continue;
+        }
+        album->cover = cover_atlas_insert(atlas, surface, session->covers[i].album);
+        SDL_FreeSurface(surface);
+        restored += cover_atlas_contains(atlas, album->cover);
+    }
+    return restored;
+}
+
+// Replaces the measured track row widths of the expanded album, so the
+// first layout needs no font metrics. Call after layout_build() without a
+// font.
+void session_restore_layout(const Session *session, Layout *layout) {
+    if (session->row_count != layout->number_of_rows) {
+        return;
+    }
+    for (int i = 0; i < session->row_count; i++) {
+        layout->rows[i].w = session->row_widths[i];
+    }
+}
+
+void session_close(Session *session) {
+    if (session->mapping) {
+        catalog_unmap_file(session->mapping, session->mapping_size);
+    }
+    memset(session, 0, sizeof(*session));
+}
+
+// Copies what the writer needs: the layout's row widths when it shows
+// `current_album`, and the cover paths of the albums [first_cover,
+// last_cover) whose covers are on screen. The caller fills in the playback
+// state.
+SessionSnapshot *session_snapshot_take(const Library *library, const Layout *layout, int current_album, int first_cover, int last_cover, int cover_size) {
+    SessionSnapshot *snapshot = calloc(1, sizeof(SessionSnapshot));
+    if (!snapshot) {
+        printf("Memory allocation failed for session snapshot\n");
+        return NULL;
+    }
+    snapshot->current_album = current_album;
+    snapshot->album_count = library->number_of_albums;
+    snapshot->track_count = library->number_of_tracks;
+    snapshot->cover_size = cover_size;
+    if (layout->expanded_album == current_album && layout->number_of_rows > 0) {
+        snapshot->row_widths = malloc((size_t)layout->number_of_rows * sizeof(int32_t));
+        if (!snapshot->row_widths) {
+            printf("Memory allocation failed for session snapshot\n");
+            free(snapshot);
+            return NULL;
+        }
+        for (int i = 0; i < layout->number_of_rows; i++) {
+            snapshot->row_widths[i] = layout->rows[i].w;
+        }
+        snapshot->row_count = layout->number_of_rows;
+    }
+    for (int i = first_cover; cover_size > 0 && i < last_cover && snapshot->cover_count < SESSION_MAX_COVERS; i++) {
+        if (library->albums[i].cover_state != COVER_READY) {
+            continue;
+        }
+        const char *path = library_string(library, library->albums[i].photo_location);
+        char *copy = malloc(strlen(path) + 1);
+        if (!copy) {
+            break;
+        }
+        strcpy(copy, path);
+        snapshot->cover_albums[snapshot->cover_count] = i;
+        snapshot->cover_paths[snapshot->cover_count] = copy;
+        snapshot->cover_count++;
+    }
+    return snapshot;
+}
+
+void session_snapshot_free(SessionSnapshot *snapshot) {
+    if (!snapshot) {
+        return;
+    }
+    for (int i = 0; i < snapshot->cover_count; i++) {
+        free(snapshot->cover_paths[i]);
+    }
+    free(snapshot->row_widths);
+    free(snapshot);
+}
+
+// Everything the screen would show differently; the playback position is
+// left out, as it changes on every tick.
+static bool same_screen(const SessionSnapshot *a, const SessionSnapshot *b) {
+    if (a->current_album != b->current_album || a->current_track != b->current_track || a->scroll_y != b->scroll_y ||
+        a->playing != b->playing || a->album_count != b->album_count || a->track_count != b->track_count ||
+        a->row_count != b->row_count || a->cover_count != b->cover_count) {
+        return false;
+    }
+    return memcmp(a->cover_albums, b->cover_albums, (size_t)a->cover_count * sizeof(int)) == 0;
+}
+
+static bool write_padding(FILE *fptr) {
+    static const char zeros[8] = {0};
+    long position = ftell(fptr);
+    size_t padding = position < 0 ? 0 : (size_t)(align8((uint64_t)position) - (uint64_t)position);
+    return position >= 0 && fwrite(zeros, 1, padding, fptr) == padding;
+}
+
+// Writes the state, row widths and pre-scaled pixels of the snapshot's
+// covers, which come from the thumbnail cache already at cover_size. Goes
+// through a temporary file so a crash never leaves half a snapshot.
+static bool write_snapshot(const SessionSnapshot *snapshot, const char *path, const char *source_path) {
+    char temp_path[MAX_PATH_LENGTH + 8];
+    snprintf(temp_path, sizeof(temp_path), "%s.tmp", path);
+
+    int size = snapshot->cover_size;
+    int count = 0;
+    SDL_Surface *surfaces[SESSION_MAX_COVERS];
+    SessionCover covers[SESSION_MAX_COVERS];
+    for (int i = 0; i < snapshot->cover_count; i++) {
+        SDL_Surface *surface = thumbnail_load(snapshot->cover_paths[i], size);
+        if (surface && surface->w == size && surface->h == size && surface->format->format == SDL_PIXELFORMAT_ARGB8888) {
+            surfaces[count] = surface;
+            covers[count].album = snapshot->cover_albums[i];
+            covers[count].reserved = 0;
+            count++;
+        } else {
+            SDL_FreeSurface(surface);
+        }
+    }
+
+    SessionHeader header = {0};
+    header.magic = SESSION_MAGIC;
+    header.version = SESSION_VERSION;
+    source_stamp(source_path, &header.source_size, &header.source_mtime);
+    header.album_count = (uint32_t)snapshot->album_count;
+    header.track_count = (uint32_t)snapshot->track_count;
+    header.current_album = snapshot->current_album;
+    header.current_track = snapshot->current_track;
+    header.scroll_y = snapshot->scroll_y;
+    header.playing = snapshot->playing;
+    header.position_ms = snapshot->position_ms;
+    header.cover_size = (uint32_t)size;
+    header.cover_count = (uint32_t)count;
+    header.row_count = (uint32_t)snapshot->row_count;
+
+    uint64_t pixels_offset = sizeof(SessionHeader) + align8((uint64_t)header.row_count * sizeof(int32_t)) + (uint64_t)count * sizeof(SessionCover);
+    for (int i = 0; i < count; i++) {
+        covers[i].offset = pixels_offset + (uint64_t)i * size * size * 4;
+    }
+
+    FILE *fptr = fopen(temp_path, "wb");
+    bool ok = fptr != NULL;
+    if (fptr) {
+        ok = fwrite(&header, sizeof(header), 1, fptr) == 1 &&
+             fwrite(snapshot->row_widths, sizeof(int32_t), header.row_count, fptr) == header.row_count &&
+             write_padding(fptr) && fwrite(covers, sizeof(SessionCover), (size_t)count, fptr) == (size_t)count;
+        for (int i = 0; ok && i < count; i++) {
+            for (int y = 0; ok && y < size; y++) {
+                ok = fwrite((Uint8 *)surfaces[i]->pixels + y * surfaces[i]->pitch, 4, (size_t)size, fptr) == (size_t)size;
+            }
+        }
+        ok = fclose(fptr) == 0 && ok;
+    }
+    for (int i = 0; i < count; i++) {
+        SDL_FreeSurface(surfaces[i]);
+    }
+
+#ifdef _WIN32
+    // rename() does not replace an existing file on Windows
+    if (ok) {
+        remove(path);
+    }
+#endif
+    if (!ok || rename(temp_path, path) != 0) {
+        printf("Error writing session: %s\n", path);
+        remove(temp_path);
+        return false;
+    }
+    return true;
+}
+
+static int writer_thread(void *data) {
+    SessionWriter *writer = data;
+    SDL_SetThreadPriority(SDL_THREAD_PRIORITY_LOW);
+    trace_name_thread("session_writer");
+
+    SDL_LockMutex(writer->lock);
+    while (true) {
+        while (!writer->quit && !writer->pending) {
+            SDL_CondWait(writer->wake, writer->lock);
+        }
+        SessionSnapshot *snapshot = writer->pending;
+        writer->pending = NULL;
+        if (!snapshot) {
+            break;
+        }
+        SDL_UnlockMutex(writer->lock);
+
+        Uint64 trace_start_time = trace_begin();
+        write_snapshot(snapshot, writer->path, writer->source_path);
+        trace_end("session_write", trace_start_time);
+        session_snapshot_free(snapshot);
+
+        SDL_LockMutex(writer->lock);
+    }
+    SDL_UnlockMutex(writer->lock);
+    return 0;
+}
+
+bool session_writer_start(SessionWriter *writer, const char *path, const char *source_path) {
+    memset(writer, 0, sizeof(*writer));
+    snprintf(writer->path, sizeof(writer->path), "%s", path);
+    snprintf(writer->source_path, sizeof(writer->source_path), "%s", source_path);
+    writer->lock = SDL_CreateMutex();
+    writer->wake = SDL_CreateCond();
+    writer->thread = writer->lock && writer->wake ? SDL_CreateThread(writer_thread, "session_writer", writer) : NULL;
+    if (!writer->thread) {
+        printf("Session writer disabled: %s\n", SDL_GetError());
+        session_writer_stop(writer);
+        return false;
+    }
+    return true;
+}
+
+// Hands the snapshot to the writer thread, which owns it from here on.
+// Returns false, having freed it, when it shows the same screen as the
+// last one submitted and `force` is not set.
+bool session_writer_submit(SessionWriter *writer, SessionSnapshot *snapshot, bool force) {
+    if (!snapshot) {
+        return false;
+    }
+    if (!force && writer->has_last && same_screen(snapshot, &writer->last)) {
+        session_snapshot_free(snapshot);
+        return false;
+    }
+    // Only the fields same_screen() reads are kept
+    writer->last = *snapshot;
+    writer->last.row_widths = NULL;
+    memset(writer->last.cover_paths, 0, sizeof(writer->last.cover_paths));
+    writer->has_last = true;
+
+    SDL_LockMutex(writer->lock);
+    session_snapshot_free(writer->pending);
+    writer->pending = snapshot;
+    SDL_CondSignal(writer->wake);
+    SDL_UnlockMutex(writer->lock);
+    return true;
+}
+
+// Writes the snapshot still pending, if any, and joins the thread.
+void session_writer_stop(SessionWriter *writer) {
+    if (writer->thread) {
+        SDL_LockMutex(writer->lock);
+        writer->quit = true;
+        SDL_CondSignal(writer->wake);
+        SDL_UnlockMutex(writer->lock);
+        SDL_WaitThread(writer->thread, NULL);
+    }
+    session_snapshot_free(writer->pending);
+    if (writer->wake) {
+        SDL_DestroyCond(writer->wake);
+    }
+    if (writer->lock) {
+        SDL_DestroyMutex(writer->lock);
+    }
+    memset(writer, 0, sizeof(*writer));
+}
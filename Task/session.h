@@ -0,0 +1,115 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+#include "cover_atlas.h"
+#include "library.h"
+#include "layout.h"
+
+#define SESSION_PATH "session.snap"
+#define SESSION_MAGIC 0x53534553u // "SESS"
+#define SESSION_VERSION 2
+#define SESSION_MAX_COVERS 64
+
+// Snapshot of the player at exit, so the next launch can show the same
+// screen without decoding a cover. The library itself still comes from
+// albums.cat (or albums.txt); the snapshot holds only the player's state,
+// memory-mapped as
+//
+//   SessionHeader
+//   int32_t row widths[row_count], padded to 8 bytes
+//   SessionCover[cover_count]
+//   cover_size x cover_size ARGB8888 pixels for each cover
+//
+// Cover offsets are from the start of the file. The albums.txt stamp and
+// the album and track counts tie the snapshot to the library it was taken
+// of; it is ignored when they don't match the library loaded.
+typedef struct session_header {
+    uint32_t magic;
+    uint32_t version;
+    int64_t source_size;
+    int64_t source_mtime;
+    uint32_t album_count;
+    uint32_t track_count;
+    int32_t current_album;
+    int32_t current_track;
+    int32_t scroll_y;
+    int32_t playing;
+    uint32_t position_ms;
+    uint32_t cover_size;
+    uint32_t cover_count;
+    uint32_t row_count;
+} SessionHeader;
+
+typedef struct session_cover {
+    int32_t album;
+    uint32_t reserved;
+    uint64_t offset;
+} SessionCover;
+
+// What a snapshot restores. `row_widths` and `covers` point into the
+// mapping, and are only valid until session_close().
+typedef struct session {
+    int current_album;
+    int current_track;
+    int scroll_y;
+    bool playing;
+    Uint32 position_ms;
+    int cover_size;
+    const int32_t *row_widths;
+    int row_count;
+    const SessionCover *covers;
+    int cover_count;
+    void *mapping;
+    size_t mapping_size;
+} Session;
+
+// The state to write, copied out of the library and layout so the writer
+// thread never touches them. Cover pixels are read on the writer thread
+// from the thumbnail cache.
+typedef struct session_snapshot {
+    int current_album;
+    int current_track;
+    int scroll_y;
+    bool playing;
+    Uint32 position_ms;
+    int album_count;
+    int track_count;
+    int cover_size;
+    int32_t *row_widths;
+    int row_count;
+    int cover_albums[SESSION_MAX_COVERS];
+    char *cover_paths[SESSION_MAX_COVERS];
+    int cover_count;
+} SessionSnapshot;
+
+// Writes snapshots on a thread of its own. Only the latest snapshot
+// submitted is kept; one equal to the last written, playback position
+// aside, is dropped unless forced.
+typedef struct session_writer {
+    SDL_Thread *thread;
+    SDL_mutex *lock;
+    SDL_cond *wake;
+    SessionSnapshot *pending;
+    SessionSnapshot last;
+    bool has_last;
+    bool quit;
+    char path[MAX_PATH_LENGTH];
+    char source_path[MAX_PATH_LENGTH];
+} SessionWriter;
+
+bool session_open(Session *session, const Library *library, const char *path, const char *source_path);
+int session_restore_covers(const Session *session, Library *library, CoverAtlas *atlas);
+void session_restore_layout(const Session *session, Layout *layout);
+void session_close(Session *session);
+
+SessionSnapshot *session_snapshot_take(const Library *library, const Layout *layout, int current_album, int first_cover, int last_cover, int cover_size);
+void session_snapshot_free(SessionSnapshot *snapshot);
+
+bool session_writer_start(SessionWriter *writer, const char *path, const char *source_path);
+bool session_writer_submit(SessionWriter *writer, SessionSnapshot *snapshot, bool force);
+void session_writer_stop(SessionWriter *writer);
+
+#endif
@@ -0,0 +1,379 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL2/SDL_mixer.h>
+#include "spectrum.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define SPECTRUM_X86
+#define TARGET_SSE2 __attribute__((target("sse2")))
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <immintrin.h>
+#define SPECTRUM_X86
+#define TARGET_SSE2
+#define TARGET_AVX2
+#endif
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+// The three stages of an analysis pass, in scalar, SSE2 and AVX2 versions.
+// `window` converts and windows the samples and returns their energy.
+// `butterflies` runs one decimation-in-frequency stage over `n` points.
+// `power` writes the squared magnitude of each point.
+typedef struct spectrum_kernels {
+    float (*window)(const Sint16 *samples, const float *window, float *out, int n);
+    void (*butterflies)(float *re, float *im, const float *wr, const float *wi, int half, int n);
+    void (*power)(const float *re, const float *im, float *out, int n);
+} SpectrumKernels;
+
+static float window_scalar(const Sint16 *samples, const float *window, float *out, int n) {
+    float energy = 0.0f;
+    for (int i = 0; i < n; i++) {
+        float sample = (float)samples[i];
+        energy += sample * sample;
+        out[i] = sample * window[i];
+    }
+    return energy;
+}
+
+static void butterflies_scalar(float *re, float *im, const float *wr, const float *wi, int half, int n) {
+    for (int start = 0; start < n; start += 2 * half) {
+        for (int j = 0; j < half; j++) {
+            int a = start + j;
+            int b = a + half;
+            float ur = re[a] - re[b];
+            float ui = im[a] - im[b];
+            re[a] += re[b];
+            im[a] += im[b];
+            re[b] = ur * wr[j] - ui * wi[j];
+            im[b] = ur * wi[j] + ui * wr[j];
+        }
+    }
+}
+
+static void power_scalar(const float *re, const float *im, float *out, int n) {
+    for (int i = 0; i < n; i++) {
+        out[i] = re[i] * re[i] + im[i] * im[i];
+    }
+}
+
+#ifdef SPECTRUM_X86
+TARGET_SSE2 static float window_sse2(const Sint16 *samples, const float *window, float *out, int n) {
+    __m128 energy = _mm_setzero_ps();
+    for (int i = 0; i < n; i += 8) {
+        // Sign-extend eight samples to two vectors of four floats
+        __m128i raw = _mm_loadu_si128((const __m128i *)(samples + i));
+        __m128 low = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(raw, raw), 16));
+        __m128 high = _mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(raw, raw), 16));
+        energy = _mm_add_ps(energy, _mm_add_ps(_mm_mul_ps(low, low), _mm_mul_ps(high, high)));
+        _mm_storeu_ps(out + i, _mm_mul_ps(low, _mm_loadu_ps(window + i)));
+        _mm_storeu_ps(out + i + 4, _mm_mul_ps(high, _mm_loadu_ps(window + i + 4)));
+    }
+    float sums[4];
+    _mm_storeu_ps(sums, energy);
+    return sums[0] + sums[1] + sums[2] + sums[3];
+}
+
+TARGET_SSE2 static void butterflies_sse2(float *re, float *im, const float *wr, const float *wi, int half, int n) {
+    if (half < 4) {
+        butterflies_scalar(re, im, wr, wi, half, n);
+        return;
+    }
+    for (int start = 0; start < n; start += 2 * half) {
+        for (int j = 0; j < half; j += 4) {
+            int a = start + j;
+            int b = a + half;
+            __m128 ar = _mm_loadu_ps(re + a);
+            __m128 ai = _mm_loadu_ps(im + a);
+            __m128 br = _mm_loadu_ps(re + b);
+            __m128 bi = _mm_loadu_ps(im + b);
+            __m128 cr = _mm_loadu_ps(wr + j);
+            __m128 ci = _mm_loadu_ps(wi + j);
+            __m128 ur = _mm_sub_ps(ar, br);
+            __m128 ui = _mm_sub_ps(ai, bi);
+            _mm_storeu_ps(re + a, _mm_add_ps(ar, br));
+            _mm_storeu_ps(im + a, _mm_add_ps(ai, bi));
+            _mm_storeu_ps(re + b, _mm_sub_ps(_mm_mul_ps(ur, cr), _mm_mul_ps(ui, ci)));
+            _mm_storeu_ps(im + b, _mm_add_ps(_mm_mul_ps(ur, ci), _mm_mul_ps(ui, cr)));
+        }
+    }
+}
+
+TARGET_SSE2 static void power_sse2(const float *re, const float *im, float *out, int n) {
+    for (int i = 0; i < n; i += 4) {
+        __m128 r = _mm_loadu_ps(re + i);
+        __m128 m = _mm_loadu_ps(im + i);
+        _mm_storeu_ps(out + i, _mm_add_ps(_mm_mul_ps(r, r), _mm_mul_ps(m, m)));
+    }
+}
+
+TARGET_AVX2 static float window_avx2(const Sint16 *samples, const float *window, float *out, int n) {
+    __m256 energy = _mm256_setzero_ps();
+    for (int i = 0; i < n; i += 8) {
+        __m256 sample = _mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)(samples + i))));
+        energy = _mm256_add_ps(energy, _mm256_mul_ps(sample, sample));
+        _mm256_storeu_ps(out + i, _mm256_mul_ps(sample, _mm256_loadu_ps(window + i)));
+    }
+    float sums[8];
+    _mm256_storeu_ps(sums, energy);
+    return sums[0] + sums[1] + sums[2] + sums[3] + sums[4] + sums[5] + sums[6] + sums[7];
+}
+
+TARGET_AVX2 static void butterflies_avx2(float *re, float *im, const float *wr, const float *wi, int half, int n) {
+    if (half < 8) {
+        butterflies_sse2(re, im, wr, wi, half, n);
+        return;
+    }
+    for (int start = 0; start < n; start += 2 * half) {
+        for (int j = 0; j < half; j += 8) {
+            int a = start + j;
+            int b = a + half;
+            __m256 ar = _mm256_loadu_ps(re + a);
+            __m256 ai = _mm256_loadu_ps(im + a);
+            __m256 br = _mm256_loadu_ps(re + b);
+            __m256 bi = _mm256_loadu_ps(im + b);
+            __m256 cr = _mm256_loadu_ps(wr + j);
+            __m256 ci = _mm256_loadu_ps(wi + j);
+            __m256 ur = _mm256_sub_ps(ar, br);
+            __m256 ui = _mm256_sub_ps(ai, bi);
+            _mm256_storeu_ps(re + a, _mm256_add_ps(ar, br));
+            _mm256_storeu_ps(im + a, _mm256_add_ps(ai, bi));
+            _mm256_storeu_ps(re + b, _mm256_sub_ps(_mm256_mul_ps(ur, cr), _mm256_mul_ps(ui, ci)));
+            _mm256_storeu_ps(im + b, _mm256_add_ps(_mm256_mul_ps(ur, ci), _mm256_mul_ps(ui, cr)));
+        }
+    }
+}
+
+TARGET_AVX2 static void power_avx2(const float *re, const float *im, float *out, int n) {
+    for (int i = 0; i < n; i += 8) {
+        __m256 r = _mm256_loadu_ps(re + i);
+        __m256 m = _mm256_loadu_ps(im + i);
+        _mm256_storeu_ps(out + i, _mm256_add_ps(_mm256_mul_ps(r, r), _mm256_mul_ps(m, m)));
+    }
+}
+#endif
+
+static const SpectrumKernels KERNELS[] = {
+    {window_scalar, butterflies_scalar, power_scalar},
+#ifdef SPECTRUM_X86
+    {window_sse2, butterflies_sse2, power_sse2},
+    {window_avx2, butterflies_avx2, power_avx2},
+#endif
+};
+
+const char *spectrum_kernel_name(SpectrumKernel kernel) {
+    switch (kernel) {
+        case SPECTRUM_SSE2:
+            return "SSE2";
+        case SPECTRUM_AVX2:
+            return "AVX2";
+        default:
+            return "scalar";
+    }
+}
+
+// Fails when the kernel was not compiled in or the CPU lacks it.
+bool spectrum_set_kernel(Spectrum *spectrum, SpectrumKernel kernel) {
+    if ((size_t)kernel >= sizeof(KERNELS) / sizeof(KERNELS[0]) ||
+        (kernel == SPECTRUM_SSE2 && !SDL_HasSSE2()) ||
+        (kernel == SPECTRUM_AVX2 && !SDL_HasAVX2())) {
+        return false;
+    }
+    spectrum->kernel = kernel;
+    return true;
+}
+
+static int reverse_bits(int value, int bits) {
+    int reversed = 0;
+    for (int i = 0; i < bits; i++) {
+        reversed = (reversed << 1) | ((value >> i) & 1);
+    }
+    return reversed;
+}
+
+bool spectrum_init(Spectrum *spectrum, int frequency, int channels) {
+    memset(spectrum, 0, sizeof(*spectrum));
+    spectrum->frequency = frequency;
+    spectrum->channels = channels;
+    if (!ring_buffer_init(&spectrum->ring, SPECTRUM_RING_FRAMES, 1)) {
+        return false;
+    }
+    spectrum->history = calloc(SPECTRUM_SIZE, sizeof(Sint16));
+    spectrum->window = malloc(SPECTRUM_SIZE * sizeof(float));
+    spectrum->twiddle_re = malloc(SPECTRUM_SIZE * sizeof(float));
+    spectrum->twiddle_im = malloc(SPECTRUM_SIZE * sizeof(float));
+    spectrum->re = malloc(SPECTRUM_SIZE * sizeof(float));
+    spectrum->im = malloc(SPECTRUM_SIZE * sizeof(float));
+    spectrum->power = malloc(SPECTRUM_SIZE * sizeof(float));
+    spectrum->bin_position = malloc(SPECTRUM_SIZE / 2 * sizeof(Uint16));
+    if (!spectrum->history || !spectrum->window || !spectrum->twiddle_re || !spectrum->twiddle_im ||
+        !spectrum->re || !spectrum->im || !spectrum->power || !spectrum->bin_position) {
+        printf("Memory allocation failed for spectrum analyzer\n");
+        spectrum_free(spectrum);
+        return false;
+    }
+
+    for (int i = 0; i < SPECTRUM_SIZE; i++) {
+        spectrum->window[i] = (float)(0.5 - 0.5 * cos(2.0 * M_PI * i / SPECTRUM_SIZE));
+    }
+
+    // Each stage's twiddles are stored contiguously so the butterflies can
+    // load them as vectors: the stage with span `half` starts at half - 1
+    for (int half = 1; half < SPECTRUM_SIZE; half *= 2) {
+        for (int j = 0; j < half; j++) {
+            spectrum->twiddle_re[half - 1 + j] = (float)cos(M_PI * j / half);
+            spectrum->twiddle_im[half - 1 + j] = (float)-sin(M_PI * j / half);
+        }
+    }
+
+    // Decimation in frequency leaves the output in bit-reversed order;
+    // rather than permuting it, bins are looked up where they landed
+    int bits = 0;
+    while ((1 << bits) < SPECTRUM_SIZE) {
+        bits++;
+    }
+    for (int k = 0; k < SPECTRUM_SIZE / 2; k++) {
+        spectrum->bin_position[k] = (Uint16)reverse_bits(k, bits);
+    }
+
+    // Log-spaced band edges, each band at least one bin wide
+    float high = SPECTRUM_HIGH_HZ < frequency / 2.0f ? SPECTRUM_HIGH_HZ : frequency / 2.0f;
+    for (int b = 0; b <= SPECTRUM_BANDS; b++) {
+        float hz = SPECTRUM_LOW_HZ * powf(high / SPECTRUM_LOW_HZ, (float)b / SPECTRUM_BANDS);
+        int bin = (int)(hz * SPECTRUM_SIZE / frequency);
+        if (b > 0 && bin <= spectrum->band_start[b - 1]) {
+            bin = spectrum->band_start[b - 1] + 1;
+        }
+        spectrum->band_start[b] = bin < SPECTRUM_SIZE / 2 ? bin : SPECTRUM_SIZE / 2;
+    }
+
+    spectrum->kernel = SPECTRUM_SCALAR;
+    if (!spectrum_set_kernel(spectrum, SPECTRUM_AVX2)) {
+        spectrum_set_kernel(spectrum, SPECTRUM_SSE2);
+    }
+    printf("Spectrum analyzer: %d-point FFT, %s kernels\n", SPECTRUM_SIZE, spectrum_kernel_name(spectrum->kernel));
+    return true;
+}
+
+// Runs on the audio thread after every mix. Only downmixes into the ring;
+// if the main thread has fallen behind, the excess is dropped.
+static void post_mix(void *data, Uint8 *stream, int length) {
+    Spectrum *spectrum = data;
+    const Sint16 *samples = (const Sint16 *)stream;
+    int channels = spectrum->channels;
+    int frames = length / (int)(channels * sizeof(Sint16));
+    Sint16 mono[256];
+    while (frames > 0) {
+        int count = frames < 256 ? frames : 256;
+        for (int i = 0; i < count; i++) {
+            int sum = 0;
+            for (int c = 0; c < channels; c++) {
+                sum += samples[c];
+            }
+            mono[i] = (Sint16)(sum / channels);
+            samples += channels;
+        }
+        ring_buffer_write(&spectrum->ring, mono, (Uint32)count);
+        frames -= count;
+    }
+}
+
+void spectrum_attach(Spectrum *spectrum) {
+    Mix_SetPostMix(post_mix, spectrum);
+    spectrum->attached = true;
+}
+
+void spectrum_detach(Spectrum *spectrum) {
+    if (spectrum->attached) {
+        Mix_SetPostMix(NULL, NULL);
+        spectrum->attached = false;
+    }
+}
+
+static float to_display(float decibels) {
+    float value = (decibels + SPECTRUM_RANGE_DB) / SPECTRUM_RANGE_DB;
+    return value < 0.0f ? 0.0f : value > 1.0f ? 1.0f : value;
+}
+
+// Analyses one window of SPECTRUM_SIZE mono samples into band levels and
+// an RMS level, without smoothing.
+void spectrum_analyze(Spectrum *spectrum, const Sint16 *samples, float *bands, float *level) {
+    const SpectrumKernels *kernels = &KERNELS[spectrum->kernel];
+    float energy = kernels->window(samples, spectrum->window, spectrum->re, SPECTRUM_SIZE);
+    memset(spectrum->im, 0, SPECTRUM_SIZE * sizeof(float));
+    for (int half = SPECTRUM_SIZE / 2; half >= 1; half /= 2) {
+        kernels->butterflies(spectrum->re, spectrum->im, spectrum->twiddle_re + half - 1, spectrum->twiddle_im + half - 1, half, SPECTRUM_SIZE);
+    }
+    kernels->power(spectrum->re, spectrum->im, spectrum->power, SPECTRUM_SIZE);
+
+    // A full-scale sine peaks at 32768 * N / 4 through the Hann window
+    const float full_scale = 32768.0f * SPECTRUM_SIZE / 4.0f;
+    const float reference = full_scale * full_scale;
+    for (int b = 0; b < SPECTRUM_BANDS; b++) {
+        float peak = 0.0f;
+        for (int k = spectrum->band_start[b]; k < spectrum->band_start[b + 1]; k++) {
+            float power = spectrum->power[spectrum->bin_position[k]];
+            peak = power > peak ? power : peak;
+        }
+        bands[b] = to_display(10.0f * log10f(peak / reference + 1e-12f));
+    }
+    float rms = sqrtf(energy / SPECTRUM_SIZE) / 32768.0f;
+    *level = to_display(20.0f * log10f(rms + 1e-6f));
+}
+
+// Takes whatever the post-mix hook has delivered since the last call and,
+// if anything arrived, re-analyses the newest window. Returns true when the
+// bands or level changed, so the caller knows to redraw.
+bool spectrum_update(Spectrum *spectrum) {
+    Uint32 available = ring_buffer_readable(&spectrum->ring);
+    if (available > SPECTRUM_SIZE) {
+        Uint32 write = (Uint32)SDL_AtomicGet(&spectrum->ring.write_index);
+        ring_buffer_skip_to(&spectrum->ring, write - SPECTRUM_SIZE);
+        available = SPECTRUM_SIZE;
+    }
+
+    float bands[SPECTRUM_BANDS];
+    float level = 0.0f;
+    if (available > 0) {
+        memmove(spectrum->history, spectrum->history + available, (SPECTRUM_SIZE - available) * sizeof(Sint16));
+        ring_buffer_read(&spectrum->ring, spectrum->history + SPECTRUM_SIZE - available, available);
+        spectrum_analyze(spectrum, spectrum->history, bands, &level);
+    } else {
+        memset(bands, 0, sizeof(bands));
+    }
+
+    bool changed = false;
+    bool active = false;
+    for (int b = 0; b < SPECTRUM_BANDS; b++) {
+        float fallen = spectrum->bands[b] - SPECTRUM_FALLOFF;
+        float value = bands[b] > fallen ? bands[b] : (fallen > 0.0f ? fallen : 0.0f);
+        changed = changed || value != spectrum->bands[b];
+        active = active || value > 0.0f;
+        spectrum->bands[b] = value;
+    }
+    float fallen = spectrum->level - SPECTRUM_FALLOFF;
+    float value = level > fallen ? level : (fallen > 0.0f ? fallen : 0.0f);
+    changed = changed || value != spectrum->level;
+    spectrum->level = value;
+    spectrum->active = active || value > 0.0f;
+    return changed;
+}
+
+void spectrum_free(Spectrum *spectrum) {
+    spectrum_detach(spectrum);
+    ring_buffer_free(&spectrum->ring);
+    free(spectrum->history);
+    free(spectrum->window);
+    free(spectrum->twiddle_re);
+    free(spectrum->twiddle_im);
+    free(spectrum->re);
+    free(spectrum->im);
+    free(spectrum->power);
+    free(spectrum->bin_position);
+    memset(spectrum, 0, sizeof(*spectrum));
+}
@@ -0,0 +1,58 @@
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include "ring_buffer.h"
+
+#define SPECTRUM_SIZE 2048
+#define SPECTRUM_BANDS 32
+#define SPECTRUM_RING_FRAMES 8192
+#define SPECTRUM_RANGE_DB 60.0f
+#define SPECTRUM_FALLOFF 0.04f
+#define SPECTRUM_LOW_HZ 40.0f
+#define SPECTRUM_HIGH_HZ 16000.0f
+
+typedef enum spectrum_kernel {
+    SPECTRUM_SCALAR,
+    SPECTRUM_SSE2,
+    SPECTRUM_AVX2
+} SpectrumKernel;
+
+// Spectrum and VU meter of what is being played. The mixer's post-mix hook
+// downmixes each output buffer to mono and pushes it into `ring`; nothing
+// else happens on the audio thread. spectrum_update(), on the main thread,
+// takes the newest SPECTRUM_SIZE samples, runs a Hann-windowed FFT and
+// reduces it to SPECTRUM_BANDS log-spaced bands. Bands and level are 0..1
+// over the top SPECTRUM_RANGE_DB and fall by at most SPECTRUM_FALLOFF per
+// update, so the bars decay smoothly after the music stops.
+typedef struct spectrum {
+    RingBuffer ring;
+    int channels;
+    int frequency;
+    SpectrumKernel kernel;
+    Sint16 *history;
+    float *window;
+    float *twiddle_re;
+    float *twiddle_im;
+    float *re;
+    float *im;
+    float *power;
+    Uint16 *bin_position;
+    int band_start[SPECTRUM_BANDS + 1];
+    float bands[SPECTRUM_BANDS];
+    float level;
+    bool active;
+    bool attached;
+} Spectrum;
+
+bool spectrum_init(Spectrum *spectrum, int frequency, int channels);
+bool spectrum_set_kernel(Spectrum *spectrum, SpectrumKernel kernel);
+const char *spectrum_kernel_name(SpectrumKernel kernel);
+void spectrum_attach(Spectrum *spectrum);
+void spectrum_detach(Spectrum *spectrum);
+void spectrum_analyze(Spectrum *spectrum, const Sint16 *samples, float *bands, float *level);
+bool spectrum_update(Spectrum *spectrum);
+void spectrum_free(Spectrum *spectrum);
+
+#endif
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "string_arena.h"
+
+#define ARENA_INITIAL_SIZE 65536
+#define ARENA_INITIAL_SLOTS 1024
+
+static uint32_t hash_string(const char *str, size_t length) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char)str[i]) * 16777619u;
+    }
+    return hash;
+}
+
+// Slots hold id + 1 so that 0 marks an empty slot.
+static void insert_slot(StringArena *arena, StringId id) {
+    const char *str = arena->data + id;
+    uint32_t mask = arena->slot_count - 1;
+    uint32_t slot = hash_string(str, strlen(str)) & mask;
+    while (arena->slots[slot]) {
+        slot = (slot + 1) & mask;
+    }
+    arena->slots[slot] = id + 1;
+}
+
+static bool grow_slots(StringArena *arena) {
+    uint32_t slot_count = arena->slot_count ? arena->slot_count * 2 : ARENA_INITIAL_SLOTS;
+    uint32_t *slots = calloc(slot_count, sizeof(uint32_t));
+    if (!slots) {
+        return false;
+    }
+    uint32_t *old_slots = arena->slots;
+    uint32_t old_count = arena->slot_count;
+    arena->slots = slots;
+    arena->slot_count = slot_count;
+    for (uint32_t i = 0; i < old_count; i++) {
+        if (old_slots[i]) {
+            insert_slot(arena, old_slots[i] - 1);
+        }
+    }
+    free(old_slots);
+    return true;
+}
+
+static bool reserve(StringArena *arena, size_t needed) {
+    if (needed > UINT32_MAX) {
+        return false;
+    }
+    if (needed <= arena->capacity) {
+        return true;
+    }
+    size_t capacity = arena->capacity ? arena->capacity : ARENA_INITIAL_SIZE;
+    while (capacity < needed) {
+        capacity *= 2;
+    }
+    if (capacity > UINT32_MAX) {
+        capacity = UINT32_MAX;
+    }
+    char *data;
+    if (arena->capacity == 0 && arena->data) {
+        // Borrowed memory: copy it before the first write
+        data = malloc(capacity);
+        if (data) {
+            memcpy(data, arena->data, arena->size);
+        }
+    } else {
+        data = realloc(arena->data, capacity);
+    }
+    if (!data) {
+        return false;
+    }
+    arena->data = data;
+    arena->capacity = (uint32_t)capacity;
+    return true;
+}
+
+// Indexes every string of an attached buffer, so interning into it finds
+// the strings it already holds.
+static bool index_existing(StringArena *arena) {
+    for (uint32_t id = 0; id < arena->size; id += (uint32_t)strlen(arena->data + id) + 1) {
+        if ((arena->count + 1) * 2 > arena->slot_count && !grow_slots(arena)) {
+            return false;
+        }
+        insert_slot(arena, id);
+        arena->count++;
+    }
+    return true;
+}
+
+static StringId add(StringArena *arena, const char *str, size_t length) {
+    if (arena->data && !arena->slots && !index_existing(arena)) {
+        fprintf(stderr, "Memory allocation failed for strings\n");
+        return 0;
+    }
+
+    uint32_t hash = hash_string(str, length);
+    if (arena->slot_count) {
+        uint32_t mask = arena->slot_count - 1;
+        for (uint32_t slot = hash & mask; arena->slots[slot]; slot = (slot + 1) & mask) {
+            const char *candidate = arena->data + arena->slots[slot] - 1;
+            if (strncmp(candidate, str, length) == 0 && candidate[length] == '\0') {
+                return arena->slots[slot] - 1;
+            }
+        }
+    }
+
+    if (((arena->count + 1) * 2 > arena->slot_count && !grow_slots(arena)) ||
+        !reserve(arena, (size_t)arena->size + length + 1)) {
+        fprintf(stderr, "Memory allocation failed for strings\n");
+        return 0;
+    }
+    StringId id = arena->size;
+    memcpy(arena->data + id, str, length);
+    arena->data[id + length] = '\0';
+    arena->size += (uint32_t)length + 1;
+    arena->count++;
+    insert_slot(arena, id);
+    return id;
+}
+
+// Interns the first `length` bytes of `str`, which need not be terminated.
+StringId string_arena_intern_length(StringArena *arena, const char *str, size_t length) {
+    if (arena->size == 0) {
+        // Reserve id 0 for the empty string
+        add(arena, "", 0);
+    }
+    return length == 0 ? 0 : add(arena, str, length);
+}
+
+StringId string_arena_intern(StringArena *arena, const char *str) {
+    return string_arena_intern_length(arena, str, strlen(str));
+}
+
+// Uses `size` bytes of NUL-terminated strings at `data` in place, e.g. the
+// string table of a mapped catalog. `data` must start with "" and outlive
+// the arena, or at least the arena's first intern.
+void string_arena_attach(StringArena *arena, const char *data, uint32_t size) {
+    string_arena_free(arena);
+    arena->data = (char *)data;
+    arena->size = size;
+}
+
+void string_arena_free(StringArena *arena) {
+    if (arena->capacity) {
+        free(arena->data);
+    }
+    free(arena->slots);
+    memset(arena, 0, sizeof(*arena));
+}
@@ -0,0 +1,33 @@
+#ifndef STRING_ARENA_H
+#define STRING_ARENA_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+typedef uint32_t StringId;
+
+// Interned strings, each stored once, NUL-terminated, in one contiguous
+// buffer. A string's id is its byte offset, so ids stay valid when the
+// buffer grows; id 0 is always "". A zeroed arena is empty and ready to use.
+//
+// `capacity` is 0 while `data` points at memory the arena does not own (a
+// mapped catalog); the first intern then copies it into an owned buffer.
+typedef struct string_arena {
+    char *data;
+    uint32_t size;
+    uint32_t capacity;
+    uint32_t *slots;
+    uint32_t slot_count;
+    uint32_t count;
+} StringArena;
+
+static inline const char *string_arena_get(const StringArena *arena, StringId id) {
+    return arena->data ? arena->data + id : "";
+}
+
+StringId string_arena_intern(StringArena *arena, const char *str);
+StringId string_arena_intern_length(StringArena *arena, const char *str, size_t length);
+void string_arena_attach(StringArena *arena, const char *data, uint32_t size);
+void string_arena_free(StringArena *arena);
+
+#endif
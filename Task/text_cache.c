@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "text_cache.h"
+#include "trace.h"
+
+void text_cache_init(TextCache *cache) {
+    memset(cache, 0, sizeof(*cache));
+}
+
+static unsigned int hash_key(TTF_Font *font, const char *text, SDL_Color color) {
+    // FNV-1a over the text, then fold in the font and color
+    unsigned int hash = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *)text; *p; p++) {
+        hash = (hash ^ *p) * 16777619u;
+    }
+    hash ^= (unsigned int)(size_t)font;
+    hash = (hash ^ (((unsigned int)color.r << 24) | ((unsigned int)color.g << 16) | ((unsigned int)color.b << 8) | color.a)) * 16777619u;
+    return hash % TEXT_CACHE_BUCKETS;
+}
+
+static bool same_color(SDL_Color a, SDL_Color b) {
+    return a.r == b.r && a.g == b.g && a.b == b.b && a.a == b.a;
+}
+
+static void free_entry(TextCache *cache, TextEntry *entry) {
+    if (entry->texture) {
+        SDL_DestroyTexture(entry->texture);
+        cache->textures_destroyed++;
+    }
+    free(entry->text);
+    free(entry);
+    cache->count--;
+}
+
+// Frees the entries `drop` picks, given the retained album range and the
+// current frame.
+static void sweep(TextCache *cache, bool (*drop)(const TextCache *cache, const TextEntry *entry)) {
+    for (int i = 0; i < TEXT_CACHE_BUCKETS; i++) {
+        TextEntry **link = &cache->buckets[i];
+        while (*link) {
+            TextEntry *entry = *link;
+            if (drop(cache, entry)) {
+                *link = entry->next;
+                free_entry(cache, entry);
+                cache->evictions++;
+            } else {
+                link = &entry->next;
+            }
+        }
+    }
+}
+
+static bool outside_albums(const TextCache *cache, const TextEntry *entry) {
+    return entry->album >= 0 && (entry->album < cache->first_album || entry->album >= cache->last_album);
+}
+
+static bool stale(const TextCache *cache, const TextEntry *entry) {
+    return entry->album < 0 && entry->last_used + TEXT_CACHE_MAX_AGE < cache->frames;
+}
+
+void text_cache_begin_frame(TextCache *cache) {
+    cache->frame_renders = 0;
+    cache->frame_textures = 0;
+}
+
+void text_cache_end_frame(TextCache *cache) {
+    cache->frames++;
+    if (cache->frame_renders == 0 && cache->frame_textures == 0) {
+        cache->steady_frames++;
+    }
+    if (cache->frames % TEXT_CACHE_MAX_AGE == 0) {
+        sweep(cache, stale);
+    }
+}
+
+// Keeps only the text of albums [first_album, last_album), the resident
+// range, plus text of no album. Sweeps only when the range moved.
+void text_cache_retain(TextCache *cache, int first_album, int last_album) {
+    if (first_album == cache->first_album && last_album == cache->last_album) {
+        return;
+    }
+    cache->first_album = first_album;
+    cache->last_album = last_album;
+    sweep(cache, outside_albums);
+}
+
+// Returns the texture for `text`, rasterizing it only on the first request,
+// or NULL if that failed. The cache owns the texture. `album` is the album
+// whose panel shows the text, or -1.
+SDL_Texture *text_cache_get(TextCache *cache, SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Color color, int album, int *w, int *h) {
+    unsigned int bucket = hash_key(font, text, color);
+    for (TextEntry *entry = cache->buckets[bucket]; entry; entry = entry->next) {
+        if (entry->font == font && same_color(entry->color, color) && strcmp(entry->text, text) == 0) {
+            cache->hits++;
+            entry->last_used = cache->frames;
+            *w = entry->w;
+            *h = entry->h;
+            return entry->texture;
+        }
+    }
+
+    TextEntry *entry = malloc(sizeof(TextEntry));
+    char *text_copy = malloc(strlen(text) + 1);
+    if (!entry || !text_copy) {
+        printf("Error caching text: %s\n", text);
+        free(entry);
+        free(text_copy);
+        return NULL;
+    }
+    strcpy(text_copy, text);
+    entry->text = text_copy;
+    entry->font = font;
+    entry->color = color;
+    entry->texture = NULL;
+    entry->w = 0;
+    entry->h = 0;
+    entry->album = album;
+    entry->last_used = cache->frames;
+
+    Uint64 trace_start_time = trace_begin();
+    SDL_Surface *surface = TTF_RenderText_Blended(font, text, color);
+    trace_end("TTF_RenderText", trace_start_time);
+    cache->ttf_renders++;
+    cache->frame_renders++;
+    if (surface) {
+        trace_start_time = trace_begin();
+        entry->texture = SDL_CreateTextureFromSurface(renderer, surface);
+        trace_end("text_upload", trace_start_time);
+        cache->textures_created += entry->texture != NULL;
+        cache->frame_textures++;
+        entry->w = surface->w;
+        entry->h = surface->h;
+        SDL_FreeSurface(surface);
+    }
+    if (!entry->texture) {
+        printf("Error rendering text: %s\n", text);
+    }
+    entry->next = cache->buckets[bucket];
+    cache->buckets[bucket] = entry;
+    cache->count++;
+
+    *w = entry->w;
+    *h = entry->h;
+    return entry->texture;
+}
+
+// Follows a library reload: the text of album i now belongs to album
+// album_map[i], and the text of albums mapped to -1 is dropped. The next
+// text_cache_retain() sweeps again whatever the range.
+void text_cache_remap(TextCache *cache, const int *album_map, int album_count) {
+    for (int i = 0; i < TEXT_CACHE_BUCKETS; i++) {
+        TextEntry **link = &cache->buckets[i];
+        while (*link) {
+            TextEntry *entry = *link;
+            int album = entry->album >= 0 && entry->album < album_count ? album_map[entry->album] : entry->album;
+            if (entry->album >= 0 && album < 0) {
+                *link = entry->next;
+                free_entry(cache, entry);
+                cache->evictions++;
+            } else {
+                entry->album = album;
+                link = &entry->next;
+            }
+        }
+    }
+    cache->first_album = -1;
+    cache->last_album = -1;
+}
+
+// Drops every cached string.
+void text_cache_invalidate(TextCache *cache) {
+    for (int i = 0; i < TEXT_CACHE_BUCKETS; i++) {
+        TextEntry *entry = cache->buckets[i];
+        while (entry) {
+            TextEntry *next = entry->next;
+            free_entry(cache, entry);
+            entry = next;
+        }
+        cache->buckets[i] = NULL;
+    }
+}
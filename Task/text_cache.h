@@ -0,0 +1,54 @@
+#ifndef TEXT_CACHE_H
+#define TEXT_CACHE_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+#include <SDL2/SDL_ttf.h>
+
+#define TEXT_CACHE_BUCKETS 256
+#define TEXT_CACHE_MAX_AGE 600
+
+// A rendered string, keyed by (text, font, color). `texture` is NULL when
+// rendering failed, so the failure is not retried every frame. `album` is
+// the album panel the text belongs to, or -1.
+typedef struct text_entry {
+    char *text;
+    TTF_Font *font;
+    SDL_Color color;
+    SDL_Texture *texture;
+    int w;
+    int h;
+    int album;
+    unsigned long last_used;
+    struct text_entry *next;
+} TextEntry;
+
+// Entries of albums outside [first_album, last_album) are dropped by
+// text_cache_retain(), like their covers; text of no album is dropped once
+// unused for TEXT_CACHE_MAX_AGE frames. Counters are cumulative; `frame_*`
+// fields are reset by text_cache_begin_frame.
+typedef struct text_cache {
+    TextEntry *buckets[TEXT_CACHE_BUCKETS];
+    int count;
+    int first_album;
+    int last_album;
+    unsigned long evictions;
+    unsigned long hits;
+    unsigned long ttf_renders;
+    unsigned long textures_created;
+    unsigned long textures_destroyed;
+    unsigned long frames;
+    unsigned long steady_frames;
+    int frame_renders;
+    int frame_textures;
+} TextCache;
+
+void text_cache_init(TextCache *cache);
+void text_cache_begin_frame(TextCache *cache);
+void text_cache_end_frame(TextCache *cache);
+SDL_Texture *text_cache_get(TextCache *cache, SDL_Renderer *renderer, TTF_Font *font, const char *text, SDL_Color color, int album, int *w, int *h);
+void text_cache_retain(TextCache *cache, int first_album, int last_album);
+void text_cache_remap(TextCache *cache, const int *album_map, int album_count);
+void text_cache_invalidate(TextCache *cache);
+
+#endif
@@ -0,0 +1,182 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#ifdef _WIN32
+#include <direct.h>
+#endif
+#include <SDL2/SDL_image.h>
+#include "thumbnail_cache.h"
+#include "trace.h"
+
+static void thumbnail_path(const char *source_path, char *path, size_t path_size) {
+    uint64_t hash = 14695981039346656037ull;
+    for (const unsigned char *p = (const unsigned char *)source_path; *p; p++) {
+        hash = (hash ^ *p) * 1099511628211ull;
+    }
+    snprintf(path, path_size, "%s/%016llx.thumb", THUMBNAIL_DIR, (unsigned long long)hash);
+}
+
+// Box-filters `source` down to width x height. Each output pixel averages the
+// source pixels it covers, which keeps high-resolution scans from aliasing
+// the way a nearest-neighbour SDL_BlitScaled would.
+SDL_Surface *scale_surface(SDL_Surface *source, int width, int height) {
+    SDL_Surface *input = source;
+    if (source->format->format != SDL_PIXELFORMAT_ARGB8888) {
+        input = SDL_ConvertSurfaceFormat(source, SDL_PIXELFORMAT_ARGB8888, 0);
+        if (!input) {
+            return NULL;
+        }
+    }
+    SDL_Surface *output = SDL_CreateRGBSurfaceWithFormat(0, width, height, 32, SDL_PIXELFORMAT_ARGB8888);
+    if (!output) {
+        if (input != source) {
+            SDL_FreeSurface(input);
+        }
+        return NULL;
+    }
+
+    for (int y = 0; y < height; y++) {
+        int y0 = y * input->h / height;
+        int y1 = (y + 1) * input->h / height;
+        if (y1 <= y0) {
+            y1 = y0 + 1;
+        }
+        Uint32 *out_row = (Uint32 *)((Uint8 *)output->pixels + y * output->pitch);
+        for (int x = 0; x < width; x++) {
+            int x0 = x * input->w / width;
+            int x1 = (x + 1) * input->w / width;
+            if (x1 <= x0) {
+                x1 = x0 + 1;
+            }
+            Uint32 a = 0, r = 0, g = 0, b = 0;
+            for (int sy = y0; sy < y1; sy++) {
+                const Uint32 *in_row = (const Uint32 *)((const Uint8 *)input->pixels + sy * input->pitch);
+                for (int sx = x0; sx < x1; sx++) {
+                    Uint32 pixel = in_row[sx];
+                    a += pixel >> 24;
+                    r += (pixel >> 16) & 0xFF;
+                    g += (pixel >> 8) & 0xFF;
+                    b += pixel & 0xFF;
+                }
+            }
+            Uint32 count = (Uint32)((y1 - y0) * (x1 - x0));
+            out_row[x] = ((a / count) << 24) | ((r / count) << 16) | ((g / count) << 8) | (b / count);
+        }
+    }
+
+    if (input != source) {
+        SDL_FreeSurface(input);
+    }
+    return output;
+}
+
+static SDL_Surface *read_thumbnail(const char *path, const char *source_path, const struct stat *source_stat, int size) {
+    FILE *fptr = fopen(path, "rb");
+    if (!fptr) {
+        return NULL;
+    }
+
+    ThumbnailHeader header;
+    char stored_path[1024];
+    SDL_Surface *surface = NULL;
+    if (fread(&header, sizeof(header), 1, fptr) == 1 &&
+        header.magic == THUMBNAIL_MAGIC &&
+        header.version == THUMBNAIL_VERSION &&
+        header.width == (uint32_t)size && header.height == (uint32_t)size &&
+        header.source_size == (int64_t)source_stat->st_size &&
+        header.source_mtime == (int64_t)source_stat->st_mtime &&
+        header.path_length < sizeof(stored_path) &&
+        fread(stored_path, 1, header.path_length, fptr) == header.path_length) {
+        stored_path[header.path_length] = '\0';
+        if (strcmp(stored_path, source_path) == 0) {
+            surface = SDL_CreateRGBSurfaceWithFormat(0, size, size, 32, SDL_PIXELFORMAT_ARGB8888);
+        }
+    }
+
+    if (surface) {
+        bool ok = true;
+        for (int y = 0; y < size && ok; y++) {
+            ok = fread((Uint8 *)surface->pixels + y * surface->pitch, 4, size, fptr) == (size_t)size;
+        }
+        if (!ok) {
+            SDL_FreeSurface(surface);
+            surface = NULL;
+        }
+    }
+    fclose(fptr);
+    return surface;
+}
+
+// Written to a temporary file first so a crash never leaves a torn thumbnail.
+static void write_thumbnail(const char *path, const char *source_path, const struct stat *source_stat, SDL_Surface *surface) {
+#ifdef _WIN32
+    _mkdir(THUMBNAIL_DIR);
+#else
+    mkdir(THUMBNAIL_DIR, 0755);
+#endif
+    char temp_path[544];
+    snprintf(temp_path, sizeof(temp_path), "%s.%lu.tmp", path, (unsigned long)SDL_ThreadID());
+    FILE *fptr = fopen(temp_path, "wb");
+    if (!fptr) {
+        return;
+    }
+
+    ThumbnailHeader header = {0};
+    header.magic = THUMBNAIL_MAGIC;
+    header.version = THUMBNAIL_VERSION;
+    header.width = (uint32_t)surface->w;
+    header.height = (uint32_t)surface->h;
+    header.source_size = (int64_t)source_stat->st_size;
+    header.source_mtime = (int64_t)source_stat->st_mtime;
+    header.path_length = (uint32_t)strlen(source_path);
+
+    bool ok = fwrite(&header, sizeof(header), 1, fptr) == 1 &&
+              fwrite(source_path, 1, header.path_length, fptr) == header.path_length;
+    for (int y = 0; y < surface->h && ok; y++) {
+        ok = fwrite((Uint8 *)surface->pixels + y * surface->pitch, 4, surface->w, fptr) == (size_t)surface->w;
+    }
+    ok = fclose(fptr) == 0 && ok;
+
+    if (ok) {
+        remove(path);
+        ok = rename(temp_path, path) == 0;
+    }
+    if (!ok) {
+        printf("Error writing thumbnail: %s\n", path);
+        remove(temp_path);
+    }
+}
+
+// Returns a size x size ARGB8888 copy of the image at `source_path`, decoding
+// and scaling the source only when no current thumbnail is on disk.
+SDL_Surface *thumbnail_load(const char *source_path, int size) {
+    struct stat source_stat;
+    if (stat(source_path, &source_stat) != 0) {
+        printf("Error loading image: %s - file not found\n", source_path);
+        return NULL;
+    }
+
+    char path[512];
+    thumbnail_path(source_path, path, sizeof(path));
+    SDL_Surface *surface = read_thumbnail(path, source_path, &source_stat, size);
+    if (surface) {
+        return surface;
+    }
+
+    Uint64 trace_start_time = trace_begin();
+    SDL_Surface *source = IMG_Load(source_path);
+    trace_end("IMG_Load", trace_start_time);
+    if (!source) {
+        printf("Error loading image: %s - %s\n", source_path, IMG_GetError());
+        return NULL;
+    }
+    trace_start_time = trace_begin();
+    surface = scale_surface(source, size, size);
+    trace_end("thumbnail_scale", trace_start_time);
+    SDL_FreeSurface(source);
+    if (surface) {
+        write_thumbnail(path, source_path, &source_stat, surface);
+    }
+    return surface;
+}
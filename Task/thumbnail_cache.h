@@ -0,0 +1,29 @@
+#ifndef THUMBNAIL_CACHE_H
+#define THUMBNAIL_CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <SDL2/SDL.h>
+
+#define THUMBNAIL_DIR "thumbs"
+#define THUMBNAIL_MAGIC 0x424D4854u // "THMB"
+#define THUMBNAIL_VERSION 1
+
+// On-disk thumbnail: this header, the source path, then width * height raw
+// ARGB8888 pixels. Files are named after a hash of the source path, and the
+// stored path, size and mtime must all match for a thumbnail to be reused.
+typedef struct thumbnail_header {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t width;
+    uint32_t height;
+    int64_t source_size;
+    int64_t source_mtime;
+    uint32_t path_length;
+    uint32_t reserved;
+} ThumbnailHeader;
+
+SDL_Surface *scale_surface(SDL_Surface *source, int width, int height);
+SDL_Surface *thumbnail_load(const char *source_path, int size);
+
+#endif
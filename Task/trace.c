@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "trace.h"
+
+#if defined(_MSC_VER)
+#define TRACE_THREAD_LOCAL __declspec(thread)
+#else
+#define TRACE_THREAD_LOCAL _Thread_local
+#endif
+
+bool trace_enabled = false;
+
+static char trace_path[512];
+static Uint64 trace_origin;
+static void *trace_buffers;
+static TraceBuffer *spare_buffers[TRACE_SPARE_BUFFERS];
+static SDL_atomic_t spares_taken;
+static TRACE_THREAD_LOCAL TraceBuffer *local_buffer;
+static TRACE_THREAD_LOCAL bool local_unbuffered;
+static volatile sig_atomic_t dump_requested;
+
+// Pushes onto the lock-free list the dumper walks.
+static void publish_buffer(TraceBuffer *buffer) {
+    do {
+        buffer->next = SDL_AtomicGetPtr(&trace_buffers);
+    } while (!SDL_AtomicCASPtr(&trace_buffers, buffer->next, buffer));
+}
+
+// The calling thread's buffer; a thread that never named itself takes a
+// spare, with one atomic add and no allocation.
+static TraceBuffer *thread_buffer(void) {
+    if (!local_buffer && !local_unbuffered) {
+        int spare = SDL_AtomicAdd(&spares_taken, 1);
+        if (spare < TRACE_SPARE_BUFFERS && spare_buffers[spare]) {
+            spare_buffers[spare]->thread = SDL_ThreadID();
+            publish_buffer(spare_buffers[spare]);
+            local_buffer = spare_buffers[spare];
+        } else {
+            local_unbuffered = true;
+        }
+    }
+    return local_buffer;
+}
+
+void trace_record(const char *name, Uint64 start, Uint64 end) {
+    TraceBuffer *buffer = thread_buffer();
+    if (!buffer) {
+        return;
+    }
+    int written = SDL_AtomicGet(&buffer->written);
+    TraceEvent *event = &buffer->events[(Uint32)written % TRACE_THREAD_EVENTS];
+    event->name = name;
+    event->start = start;
+    event->end = end;
+    SDL_AtomicSet(&buffer->written, written + 1);
+}
+
+// Labels the calling thread in the trace and allocates its buffer. Call it
+// at the top of each thread, before anything is recorded.
+void trace_name_thread(const char *name) {
+    if (!trace_enabled) {
+        return;
+    }
+    if (!local_buffer) {
+        TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+        if (!buffer) {
+            printf("Memory allocation failed for trace buffer: %s\n", name);
+            return;
+        }
+        buffer->thread = SDL_ThreadID();
+        publish_buffer(buffer);
+        local_buffer = buffer;
+        local_unbuffered = false;
+    }
+    local_buffer->thread_name = name;
+}
+
+#ifndef _WIN32
+static void request_dump(int signal_number) {
+    (void)signal_number;
+    dump_requested = 1;
+}
+#endif
+
+// Enables tracing; trace_dump() writes to `path`. On POSIX systems SIGUSR1
+// asks for a dump, which the main loop performs.
+bool trace_start(const char *path) {
+    if (strlen(path) >= sizeof(trace_path)) {
+        printf("Trace path too long: %s\n", path);
+        return false;
+    }
+    strcpy(trace_path, path);
+    for (int i = 0; i < TRACE_SPARE_BUFFERS; i++) {
+        spare_buffers[i] = calloc(1, sizeof(TraceBuffer));
+    }
+    SDL_AtomicSet(&spares_taken, 0);
+    trace_origin = SDL_GetPerformanceCounter();
+    trace_enabled = true;
+#ifndef _WIN32
+    signal(SIGUSR1, request_dump);
+    printf("Tracing to %s (kill -USR1 %d to dump)\n", trace_path, (int)getpid());
+#else
+    printf("Tracing to %s\n", trace_path);
+#endif
+    trace_name_thread("main");
+    return true;
+}
+
+bool trace_dump_requested(void) {
+    if (!dump_requested) {
+        return false;
+    }
+    dump_requested = 0;
+    return true;
+}
+
+static double to_microseconds(Uint64 counter, double frequency) {
+    return counter > trace_origin ? (double)(counter - trace_origin) * 1e6 / frequency : 0.0;
+}
+
+// Writes every buffered event as Chrome Trace Event JSON, replacing any
+// earlier dump. Other threads keep recording meanwhile, so the oldest
+// TRACE_DUMP_MARGIN slots of a full ring are skipped rather than read while
+// they may be overwritten.
+bool trace_dump(void) {
+    if (!trace_enabled) {
+        return false;
+    }
+    FILE *fptr = fopen(trace_path, "w");
+    if (!fptr) {
+        printf("Error writing trace: %s\n", trace_path);
+        return false;
+    }
+
+    double frequency = (double)SDL_GetPerformanceFrequency();
+    int events = 0;
+    const char *separator = "";
+    fprintf(fptr, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+    for (TraceBuffer *buffer = SDL_AtomicGetPtr(&trace_buffers); buffer; buffer = buffer->next) {
+        unsigned long tid = (unsigned long)buffer->thread;
+        if (buffer->thread_name) {
+            fprintf(fptr, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %lu, \"args\": {\"name\": \"%s\"}}",
+                    separator, tid, buffer->thread_name);
+            separator = ",\n";
+        }
+        Uint32 written = (Uint32)SDL_AtomicGet(&buffer->written);
+        Uint32 first = written > TRACE_THREAD_EVENTS - TRACE_DUMP_MARGIN ? written - (TRACE_THREAD_EVENTS - TRACE_DUMP_MARGIN) : 0;
+        for (Uint32 i = first; i < written; i++) {
+            const TraceEvent *event = &buffer->events[i % TRACE_THREAD_EVENTS];
+            double ts = to_microseconds(event->start, frequency);
+            if (event->end) {
+                fprintf(fptr, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %lu, \"ts\": %.3f, \"dur\": %.3f}",
+                        separator, event->name, tid, ts, to_microseconds(event->end, frequency) - ts);
+            } else {
+                fprintf(fptr, "%s{\"name\": \"%s\", \"ph\": \"i\", \"s\": \"t\", \"pid\": 1, \"tid\": %lu, \"ts\": %.3f}",
+                        separator, event->name, tid, ts);
+            }
+            separator = ",\n";
+            events++;
+        }
+    }
+    fprintf(fptr, "\n]}\n");
+    bool ok = fclose(fptr) == 0;
+    if (ok) {
+        printf("Wrote %d trace events to %s\n", events, trace_path);
+    } else {
+        printf("Error writing trace: %s\n", trace_path);
+    }
+    return ok;
+}
+
+// Dumps and frees the buffers, spares included. Call once no other thread
+// can record, after the audio device is closed and the worker threads are
+// joined.
+void trace_stop(void) {
+    if (!trace_enabled) {
+        return;
+    }
+    trace_dump();
+    trace_enabled = false;
+    TraceBuffer *buffer = SDL_AtomicGetPtr(&trace_buffers);
+    while (buffer) {
+        TraceBuffer *next = buffer->next;
+        free(buffer);
+        buffer = next;
+    }
+    SDL_AtomicSetPtr(&trace_buffers, NULL);
+    // Spares that were taken were freed with the list
+    for (int i = 0; i < TRACE_SPARE_BUFFERS; i++) {
+        if (i >= SDL_AtomicGet(&spares_taken)) {
+            free(spare_buffers[i]);
+        }
+        spare_buffers[i] = NULL;
+    }
+    local_buffer = NULL;
+}
@@ -0,0 +1,73 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdbool.h>
+#include <SDL2/SDL.h>
+
+#define TRACE_ENV "MUSIC_TRACE"
+#define TRACE_THREAD_EVENTS 32768
+#define TRACE_DUMP_MARGIN 256
+#define TRACE_SPARE_BUFFERS 2
+
+// A span (`end` non-zero) or an instant. `name` must outlive the trace, in
+// practice a string literal.
+typedef struct trace_event {
+    const char *name;
+    Uint64 start;
+    Uint64 end;
+} TraceEvent;
+
+// Events of one thread, kept as a ring so the newest TRACE_THREAD_EVENTS
+// survive. Only the owning thread writes; `written` publishes the events
+// to the dumper. Buffers live until trace_stop(), so a thread that exits
+// keeps its events in the trace.
+typedef struct trace_buffer {
+    TraceEvent events[TRACE_THREAD_EVENTS];
+    SDL_atomic_t written;
+    SDL_threadID thread;
+    const char *thread_name;
+    struct trace_buffer *next;
+} TraceBuffer;
+
+// Instrumentation for Chrome's trace viewer (chrome://tracing, Perfetto).
+// Wrap a region as
+//
+//     Uint64 start = trace_begin();
+//     ...
+//     trace_end("IMG_Load", start);
+//
+// When tracing is off, trace_begin() returns 0 after testing one flag and
+// trace_end() does nothing.
+//
+// Recording never allocates. A thread gets its buffer from
+// trace_name_thread(), which each thread calls before its first event; the
+// few threads we don't start, such as the audio callback's, take one of
+// TRACE_SPARE_BUFFERS set aside by trace_start(). Events from any further
+// unnamed thread are dropped.
+extern bool trace_enabled;
+
+void trace_record(const char *name, Uint64 start, Uint64 end);
+
+static inline Uint64 trace_begin(void) {
+    return trace_enabled ? SDL_GetPerformanceCounter() : 0;
+}
+
+static inline void trace_end(const char *name, Uint64 start) {
+    if (start) {
+        trace_record(name, start, SDL_GetPerformanceCounter());
+    }
+}
+
+static inline void trace_instant(const char *name) {
+    if (trace_enabled) {
+        trace_record(name, SDL_GetPerformanceCounter(), 0);
+    }
+}
+
+bool trace_start(const char *path);
+void trace_name_thread(const char *name);
+bool trace_dump_requested(void);
+bool trace_dump(void);
+void trace_stop(void);
+
+#endif
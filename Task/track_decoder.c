@@ -0,0 +1,93 @@
+#include <stdio.h>
+#include <string.h>
+#include "track_decoder.h"
+#include "trace.h"
+
+// Wraps PCM allocated with SDL_malloc so Mix_FreeChunk() frees both.
+static Mix_Chunk *wrap_chunk(Uint8 *pcm, Uint32 length) {
+    Mix_Chunk *chunk = SDL_malloc(sizeof(Mix_Chunk));
+    if (!chunk) {
+        printf("Memory allocation failed for decoded track\n");
+        SDL_free(pcm);
+        return NULL;
+    }
+    chunk->allocated = 1;
+    chunk->abuf = pcm;
+    chunk->alen = length;
+    chunk->volume = MIX_MAX_VOLUME;
+    return chunk;
+}
+
+// Whether decode_track() resamples `location` with our Resampler, judged
+// by its extension: only WAV is decoded at its own rate.
+bool decode_track_resamples(const char *location) {
+    const char *dot = strrchr(location, '.');
+    return dot && SDL_strcasecmp(dot, ".wav") == 0;
+}
+
+// Decodes a track to interleaved S16 frames at `frequency` with `channels`
+// channels. WAV files are converted to S16 at their own rate and then
+// resampled once with our Resampler at `quality`. Other formats, and rates
+// the Resampler cannot take, go through Mix_LoadWAV(), which converts with
+// SDL's own resampler. Safe to call from any thread.
+Mix_Chunk *decode_track(const char *location, int frequency, int channels, ResampleQuality quality) {
+    SDL_AudioSpec spec;
+    Uint8 *wav;
+    Uint32 wav_length;
+    if (!SDL_LoadWAV(location, &spec, &wav, &wav_length)) {
+        return Mix_LoadWAV(location);
+    }
+
+    Resampler resampler;
+    bool resample = spec.freq != frequency;
+    if (resample && !resampler_init(&resampler, spec.freq, frequency, channels, quality)) {
+        SDL_FreeWAV(wav);
+        return Mix_LoadWAV(location);
+    }
+
+    // Sample format and channel count first, keeping the source rate
+    SDL_AudioCVT cvt;
+    if (SDL_BuildAudioCVT(&cvt, spec.format, spec.channels, spec.freq, AUDIO_S16SYS, (Uint8)channels, spec.freq) < 0 ||
+        !(cvt.buf = SDL_malloc((size_t)wav_length * cvt.len_mult))) {
+        printf("Error converting music: %s - %s\n", location, SDL_GetError());
+        SDL_FreeWAV(wav);
+        if (resample) {
+            resampler_free(&resampler);
+        }
+        return NULL;
+    }
+    memcpy(cvt.buf, wav, wav_length);
+    cvt.len = (int)wav_length;
+    SDL_FreeWAV(wav);
+    Uint32 length = wav_length;
+    if (cvt.needed) {
+        if (SDL_ConvertAudio(&cvt) < 0) {
+            printf("Error converting music: %s - %s\n", location, SDL_GetError());
+            SDL_free(cvt.buf);
+            if (resample) {
+                resampler_free(&resampler);
+            }
+            return NULL;
+        }
+        length = (Uint32)cvt.len_cvt;
+    }
+    if (!resample) {
+        return wrap_chunk(cvt.buf, length);
+    }
+
+    Uint32 frame_bytes = (Uint32)channels * sizeof(Sint16);
+    Uint32 input_frames = length / frame_bytes;
+    Uint32 output_frames = resampler_output_frames(&resampler, input_frames);
+    Sint16 *output = SDL_malloc((size_t)output_frames * frame_bytes);
+    Uint64 trace_start_time = trace_begin();
+    bool resampled = output && resampler_process(&resampler, (const Sint16 *)cvt.buf, input_frames, output, output_frames);
+    trace_end("resample", trace_start_time);
+    resampler_free(&resampler);
+    SDL_free(cvt.buf);
+    if (!resampled) {
+        printf("Error resampling music: %s\n", location);
+        SDL_free(output);
+        return NULL;
+    }
+    return wrap_chunk((Uint8 *)output, output_frames * frame_bytes);
+}
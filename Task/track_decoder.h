@@ -0,0 +1,10 @@
+#ifndef TRACK_DECODER_H
+#define TRACK_DECODER_H
+
+#include <SDL2/SDL_mixer.h>
+#include "resampler.h"
+
+bool decode_track_resamples(const char *location);
+Mix_Chunk *decode_track(const char *location, int frequency, int channels, ResampleQuality quality);
+
+#endif